@@ -0,0 +1,161 @@
+#include <vector>
+#include <map>
+#include <set>
+
+#ifndef COMM_STATS_HPP
+#define COMM_STATS_HPP
+
+/*!
+ * \defgroup comm Communication accounting
+ * \brief
+ * Counters of the messages, the bytes, the partner ranks and the time spent
+ * waiting for the communication, in the phases of the program which
+ * communicate. The counters are filled by the code which calls MPI (or
+ * PETSc) directly; so, they show what we ask for, not what the MPI library
+ * does internally.
+ */
+
+/*!
+ * \ingroup comm
+ * \brief The phases which are counted.
+ */
+enum Comm_Phase
+{
+  Comm_Count_Globals = 0,
+  Comm_PETSc_Assembly = 1,
+  Comm_Scatter = 2,
+  N_Comm_Phases = 3
+};
+
+/*!
+ * \ingroup comm
+ * \brief The counters of one phase in one rank.
+ */
+struct Comm_Phase_Stats
+{
+  Comm_Phase_Stats()
+    : n_sends(0),
+      send_bytes(0),
+      n_recvs(0),
+      recv_bytes(0),
+      n_probes(0),
+      n_collectives(0),
+      collective_bytes(0),
+      wait_time(0),
+      stash_entries(0),
+      stash_reallocs(0)
+  {
+  }
+
+  double n_sends;
+  double send_bytes;
+  double n_recvs;
+  double recv_bytes;
+  double n_probes;
+  double n_collectives;
+  double collective_bytes;
+  double wait_time;
+  /* The entries and the reallocations of the PETSc stashes, as reported by
+   * MatStashGetInfo and VecStashGetInfo. */
+  double stash_entries;
+  double stash_reallocs;
+  /* The number of messages and the bytes which are sent to, or received
+   * from, each rank. */
+  std::map<unsigned, double> msgs_to_rank, bytes_to_rank;
+  std::map<unsigned, double> msgs_from_rank, bytes_from_rank;
+  /* The bytes which are added by aggregate(), before they are counted as
+   * messages. */
+  std::map<unsigned, double> pending_to_rank, pending_from_rank;
+};
+
+/*!
+ * \ingroup comm
+ * \brief Keeps the Comm_Phase_Stats of all phases of this rank. All of the
+ * functions do nothing if the ledger is not enabled.
+ */
+struct Comm_Ledger
+{
+  Comm_Ledger() : enabled(false), phases(N_Comm_Phases)
+  {
+  }
+
+  void clear()
+  {
+    phases.assign(N_Comm_Phases, Comm_Phase_Stats());
+  }
+
+  void send(const unsigned &phase, const unsigned &dest, const double &bytes)
+  {
+    if (!enabled)
+      return;
+    phases[phase].n_sends += 1;
+    phases[phase].send_bytes += bytes;
+    phases[phase].msgs_to_rank[dest] += 1;
+    phases[phase].bytes_to_rank[dest] += bytes;
+  }
+
+  void recv(const unsigned &phase, const unsigned &source, const double &bytes)
+  {
+    if (!enabled)
+      return;
+    phases[phase].n_recvs += 1;
+    phases[phase].recv_bytes += bytes;
+    phases[phase].msgs_from_rank[source] += 1;
+    phases[phase].bytes_from_rank[source] += bytes;
+  }
+
+  /*!
+   * \details Adds some bytes which go to (or come from) \c rank, in a
+   * message which is sent later; e.g. the values which PETSc stashes until
+   * the assembly. finish_aggregates() counts one message for each rank.
+   */
+  void aggregate(const unsigned &phase,
+                 const unsigned &rank,
+                 const double &bytes,
+                 const bool &outgoing)
+  {
+    if (!enabled)
+      return;
+    if (outgoing)
+      phases[phase].pending_to_rank[rank] += bytes;
+    else
+      phases[phase].pending_from_rank[rank] += bytes;
+  }
+
+  void finish_aggregates(const unsigned &phase)
+  {
+    if (!enabled)
+      return;
+    for (auto &&rank_and_bytes : phases[phase].pending_to_rank)
+      send(phase, rank_and_bytes.first, rank_and_bytes.second);
+    for (auto &&rank_and_bytes : phases[phase].pending_from_rank)
+      recv(phase, rank_and_bytes.first, rank_and_bytes.second);
+    phases[phase].pending_to_rank.clear();
+    phases[phase].pending_from_rank.clear();
+  }
+
+  void probe(const unsigned &phase)
+  {
+    if (enabled)
+      phases[phase].n_probes += 1;
+  }
+
+  void collective(const unsigned &phase, const double &bytes)
+  {
+    if (!enabled)
+      return;
+    phases[phase].n_collectives += 1;
+    phases[phase].collective_bytes += bytes;
+  }
+
+  void wait(const unsigned &phase, const double &seconds)
+  {
+    if (enabled)
+      phases[phase].wait_time += seconds;
+  }
+
+  bool enabled;
+  std::vector<Comm_Phase_Stats> phases;
+};
+
+#endif
@@ -1,4 +1,8 @@
 //#define EIGEN_USE_MKL_ALL
+/* In the nodal collocation mode, the bases are Lagrange polynomials on the
+ * Gauss-Lobatto points, and the same points are used for integration. It can
+ * also be turned on by -DNODAL_COLLOCATION=ON in cmake. */
+//#define NODAL_COLLOCATION
 
 #include <fstream>
 #include <iostream>
@@ -7,6 +11,8 @@
 #include <functional>
 #include <memory>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <unistd.h>
 #include <getopt.h>
 #include <memory>
@@ -39,6 +45,7 @@ using namespace ::LinearAlgebraTrilinos;
 #include <deal.II/grid/grid_out.h>
 #include <deal.II/grid/tria_boundary_lib.h>
 #include <deal.II/grid/grid_tools.h>
+#include <deal.II/grid/grid_in.h>
 
 #include <deal.II/distributed/tria.h>
 #include <deal.II/distributed/grid_refinement.h>
@@ -68,6 +75,8 @@ using namespace ::LinearAlgebraTrilinos;
 #include <deal.II/numerics/error_estimator.h>
 #include <deal.II/numerics/data_component_interpretation.h>
 
+#include <deal.II/distributed/solution_transfer.h>
+
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -80,19 +89,79 @@ using namespace ::LinearAlgebraTrilinos;
 #include "jacobi_polynomial.hpp"
 #include "input_data.hpp"
 #include "support_classes.hpp"
+#include "renumbering.hpp"
+#include "numa_tools.hpp"
+#include "perf_counters.hpp"
+#include "event_tracer.hpp"
+#include "comm_stats.hpp"
+#include "solver_telemetry.hpp"
+#include "mesh_import.hpp"
+#include "vtk_lagrange.hpp"
+#include "in_situ.hpp"
+#include "point_query.hpp"
+#include "interior_condensation.hpp"
+#include "direct_solver.hpp"
 
 #ifndef O_N_DIFFUSION
 #define O_N_DIFFUSION
 
+/*!
+ * \details The rule for choosing the number of Gauss points in each cell.
+ * \c Fixed_Quadrature uses (2p+6)/2 points in each direction everywhere.
+ * \c Exact_Quadrature uses the smallest rule which integrates the local
+ * matrices and right hand side exactly on affine cells, where the data which
+ * are not polynomials are counted as polynomials of order p.
+ * \c Adaptive_Quadrature starts from the exact rule, and adds points in each
+ * cell, until the projection of \f$\kappa^{-1}\f$ and \f$f\f$ onto the
+ * element basis does not change more than a tolerance.
+ */
+enum Quadrature_Policy
+{
+  Fixed_Quadrature = 0,
+  Exact_Quadrature = 1,
+  Adaptive_Quadrature = 2
+};
+
+/*!
+ * \details The order of the trace space on a face whose two sides have
+ * different orders. \c Max_Face_Order takes the larger order, which keeps
+ * the coupling of the higher order side; \c Min_Face_Order takes the
+ * smaller one, which gives fewer trace DOFs.
+ */
+enum Face_Order_Rule
+{
+  Max_Face_Order = 0,
+  Min_Face_Order = 1
+};
+
+/*!
+ * \details The format of the global matrix of the traces. \c AIJ_Assembly
+ * adds the condensed matrices of the cells into a MATMPIAIJ, and solves it
+ * with GAMG. \c IS_Assembly keeps the matrix of each rank unassembled in a
+ * MATIS, numbered by the local faces of the rank (face_DOF_in_this_rank),
+ * and solves it with BDDC, where the owned cells of each rank form one
+ * subdomain.
+ */
+enum Assembly_Type
+{
+  AIJ_Assembly = 0,
+  IS_Assembly = 1
+};
+
 template <int dim>
 struct Diffusion
 {
   static const unsigned n_faces_per_cell = dealii::GeometryInfo<dim>::faces_per_cell;
   typedef typename Cell_Class<dim>::dealii_Cell_Type Cell_Type;
+#ifdef NODAL_COLLOCATION
+  typedef Lagrange_Polys<dim> elem_basis_type;
+  typedef Lagrange_Polys<dim - 1> face_basis_type;
+  typedef dealii::FE_DGQArbitraryNodes<dim> DG_Elem_Type;
+#else
   typedef Jacobi_Poly_Basis<dim> elem_basis_type;
   typedef Jacobi_Poly_Basis<dim - 1> face_basis_type;
-  //  typedef Lagrange_Polys<dim> elem_basis_type;
-  //  typedef Lagrange_Polys<dim - 1> face_basis_type;
+  typedef dealii::FE_DGQ<dim> DG_Elem_Type;
+#endif
 
   /*!
    * @brief The constructor of the main class of the program. This constructor
@@ -119,9 +188,18 @@ struct Diffusion
   void Setup_System(unsigned);
   void Set_Boundary_Indicator();
   PetscErrorCode Solve_Linear_Systam();
+  void Report_Matrix_Locality();
+  void Report_Perf_Counters();
+  void Write_Trace();
+  void Report_Memory();
+  void Report_Communication();
+  void Write_Solver_Record(const Solver_Record &);
   void vtk_visualizer();
 
-  std::vector<Cell_Class<dim>> All_Owned_Cells;
+  /* False in the cycles which only write the in-situ summaries; see
+   * Decide_Full_Output. */
+  bool full_output_this_cycle;
+  typename Cell_Class<dim>::vector_type All_Owned_Cells;
   MPI_Comm comm;
   unsigned comm_size, comm_rank;
   const unsigned poly_order;
@@ -130,11 +208,11 @@ struct Diffusion
   const unsigned n_trace_unknowns;
   dealii::parallel::distributed::Triangulation<dim> Grid1;
   dealii::MappingQ1<dim> Elem_Mapping;
-  const dealii::QGauss<dim> elem_integration_capsul;
-  const dealii::QGauss<dim - 1> face_integration_capsul;
+  const dealii::Quadrature<dim> elem_integration_capsul;
+  const dealii::Quadrature<dim - 1> face_integration_capsul;
   const dealii::QGaussLobatto<1> LGL_quad_1D;
   const std::vector<dealii::Point<1>> support_points_1D;
-  dealii::FE_DGQ<dim> DG_Elem;
+  DG_Elem_Type DG_Elem;
   dealii::FESystem<dim> DG_System;
   dealii::DoFHandler<dim> DoF_H_Refine;
   dealii::DoFHandler<dim> DoF_H_System;
@@ -143,7 +221,7 @@ struct Diffusion
   poly_space_basis<face_basis_type, dim - 1> the_face_basis;
   unsigned refn_cycle;
 
-  kappa_inv_class<dim, Eigen::MatrixXd> kappa_inv;
+  kappa_inv_class<dim, Eigen::Matrix<double, dim, dim>> kappa_inv;
   u_func_class<dim, double> u_func;
   q_func_class<dim, dealii::Tensor<1, dim>> q_func;
   divq_func_class<dim, double> divq_func;
@@ -156,29 +234,105 @@ struct Diffusion
   const int Neumann_BC_Index = 2;
   const bool Adaptive_ON = true;
   void Init_Mesh_Containers();
+  bool Import_Coarse_Mesh(const std::string &file_name);
+  void Write_Coarse_Mesh_Of_Grid(const std::string &file_name);
+  void Map_Boundary_Tags();
+  int BC_Index_of_Tag(const unsigned &tag) const;
   void Count_Globals();
+  void Reorder_Owned_Cells(const std::vector<unsigned> &new_position);
+  void Renumber_Owned_Faces(typename Cell_Class<dim>::vector_type &All_Ghost_Cells,
+                            const unsigned &n_owned_faces);
+  void Distribute_Cells_To_Threads();
+  std::vector<unsigned> Cells_of_Thread(const unsigned &thread_id,
+                                        const unsigned &n_team) const;
+  void Report_NUMA_Placement();
+  void Count_Mesh_Memory();
   void Assemble_Globals();
+  void Count_Stashed_Rows(const PetscInt *ownership_ranges,
+                          const std::vector<PetscInt> &row_nums,
+                          const double &bytes_per_row);
+  void Count_Local_Connections(std::vector<PetscInt> &n_DOFs_connected_to_local_DOF) const;
+  void Condense_Interior_Faces();
+  void Recover_Interior_Faces();
+  bool Use_Direct_Solver(Mat the_mat);
+  KSP Direct_Solver_KSP(Mat the_mat);
   void Calculate_Internal_Unknowns(double *const &local_uhat_vec);
+  unsigned Lagrange_Output_Order(const unsigned &p) const;
+  std::vector<dealii::Point<dim>> Lagrange_Output_Nodes(const unsigned &p) const;
+  uint64_t Write_Lagrange_VTU(const std::string &file_name);
+  void Report_Output(const double &output_time, const double &n_bytes);
+  void Setup_In_Situ();
+  void Decide_Full_Output();
+  void In_Situ_Cell(Cell_Class<dim> &cell,
+                    const unsigned &i_cell,
+                    const unsigned &error_order,
+                    const Eigen::MatrixXd &solved_uhat_vec,
+                    const Eigen::MatrixXd &solved_u_vec,
+                    const Eigen::MatrixXd &solved_q_vec,
+                    In_Situ_Sums &sums);
+  void Finish_In_Situ();
+  void Write_Downsampled_Field();
+  void Build_Cell_Tree();
+  std::vector<double> Evaluate_Points(const std::vector<double> &points);
+  void Write_Point_Values(std::ofstream &out_file,
+                          const std::vector<double> &points,
+                          const std::vector<double> &point_values);
+  void Run_Point_Queries();
+  double Face_Numerical_Flux(Cell_Class<dim> &cell,
+                             const unsigned &i_face,
+                             const unsigned &n_points_1D,
+                             const Eigen::MatrixXd &solved_uhat_vec,
+                             const Eigen::MatrixXd &solved_u_vec,
+                             const Eigen::MatrixXd &solved_q_vec);
+  bool Recovery_Needed() const;
+  unsigned Face_Tag(const Cell_Class<dim> &cell, const unsigned &i_face) const;
+  bool Is_QoI_Face(const Cell_Class<dim> &cell, const unsigned &i_face) const;
+  double Interior_QoI_Sign(const Cell_Class<dim> &cell, const unsigned &i_face) const;
+  void Compute_Flux_QoI(double *const &local_uhat_vec);
 
-  template <typename T1, typename T2>
+  template <typename T1>
   void Internal_Vars_Errors(const Cell_Class<dim> &cell,
+                            const Quadrature_Table<dim> &elem_table,
                             const T1 &solved_u_vec,
                             const T1 &solved_q_vec,
-                            const T2 &Mode_to_Node_Matrix,
                             double &Error_u,
                             double &Error_q,
                             double &Error_div_q);
 
+  /* The kinds of faces that a cell has. Classify_Cells puts the owned cells
+   * in buckets by this signature, and the kernels are instantiated for each
+   * signature, so the checks of the boundary conditions and of the half
+   * ranges are decided at compile time; Any_Cell gives the general kernel.
+   * The loops over the quadrature points and the faces are the same in all
+   * instantiations, and each cell is still computed on its own. */
+  enum Cell_Signature
+  {
+    Interior_Cell = 0,
+    Has_Dirichlet_Face = 1 << 0,
+    Has_Neumann_Face = 1 << 1,
+    Has_Hanging_Face = 1 << 2,
+    Any_Cell = (1 << 3) - 1
+  };
+  static const unsigned n_cell_signatures = Any_Cell + 1;
+  unsigned Signature_of_Cell(const Cell_Class<dim> &cell) const;
+  void Classify_Cells();
+  std::vector<unsigned> Cells_of_Thread(const unsigned &thread_id,
+                                        const unsigned &n_team,
+                                        const unsigned &signature) const;
+
+  template <unsigned signature = Any_Cell>
   void CalculateMatrices(Cell_Class<dim> &cell);
 
   template <typename T>
   void Calculate_Postprocess_Matrices(Cell_Class<dim> &cell,
+                                      const Quadrature_Table<dim> &elem_table,
                                       const poly_space_basis<elem_basis_type, dim> &PostProcess_Elem_Basis,
                                       T &DM_star,
                                       T &DB2);
 
   template <typename T1>
   void PostProcess(Cell_Class<dim> &cell,
+                   const Quadrature_Table<dim> &elem_table,
                    const poly_space_basis<elem_basis_type, dim> &PostProcess_Elem_Basis,
                    const T1 &u,
                    const T1 &q,
@@ -227,13 +381,49 @@ struct Diffusion
                      const Eigen::MatrixXd &mode_to_Qpoint_matrix,
                      double &error);
 
-  void initiate_mat_calc_fe_vals(
-   std::unique_ptr<dealii::FEValues<dim>> &fe_vals_cell_1,
-   std::unique_ptr<dealii::FEFaceValues<dim>> &fe_vals_face_1,
-   std::unique_ptr<dealii::FEValues<dim>> &fe_vals_cell_2,
-   std::unique_ptr<dealii::FEFaceValues<dim>> &fe_vals_face_2);
+  /*!
+   * \details The FEValues and FEFaceValues which are attached to a cell, for
+   * one of the Gauss rules. Each thread keeps one set for each rule that it
+   * has used.
+   */
+  struct Cell_FEValues
+  {
+    std::unique_ptr<dealii::FEValues<dim>> quad_elem, supp_elem;
+    std::unique_ptr<dealii::FEFaceValues<dim>> quad_face, supp_face;
+  };
+
+  Cell_FEValues &FEValues_of_Order(std::map<unsigned, Cell_FEValues> &fe_vals_of_order,
+                                   const unsigned &n_points_1D);
+  void Local_Solve(Cell_Class<dim> &cell,
+                   std::map<unsigned, Cell_FEValues> &fe_vals_of_order,
+                   double *const &local_uhat_vec,
+                   Eigen::MatrixXd &solved_uhat_vec,
+                   Eigen::MatrixXd &solved_u_vec,
+                   Eigen::MatrixXd &solved_q_vec);
+  template <unsigned signature>
+  void Assemble_Cell(Cell_Class<dim> &cell,
+                     std::map<unsigned, Cell_FEValues> &fe_vals_of_order,
+                     Perf_Thread_Counters &thread_counters,
+                     const unsigned &thread_id,
+                     const PetscInt *ownership_ranges);
+  unsigned Fixed_Quadrature_Order(const unsigned &p) const;
+  unsigned Error_Quadrature_Order(const unsigned &p) const;
+  unsigned Exact_Quadrature_Order(const unsigned &p) const;
+  void Select_Quadrature_Orders();
+
+  bool hp_adaptive() const;
+  poly_space_basis<elem_basis_type, dim> &elem_basis(const unsigned &p);
+  poly_space_basis<face_basis_type, dim - 1> &face_basis(const unsigned &p);
+  unsigned Order_DOF_of_Cell(const Cell_Type &cell) const;
+  unsigned Order_of_Cell(const Cell_Type &cell) const;
+  void Set_Face_Orders(Cell_Class<dim> &cell) const;
+  void Apply_hp_Decisions();
+  void Transfer_Cell_Orders(
+   dealii::parallel::distributed::SolutionTransfer<dim, LA::MPI::Vector> &order_transfer);
+  double Legendre_Decay_Rate(const Eigen::MatrixXd &modal_u, const unsigned &p) const;
 
-  void initiate_internal_calc_fe_vals(
+  void initiate_mat_calc_fe_vals(
+   const unsigned &n_points_1D,
    std::unique_ptr<dealii::FEValues<dim>> &fe_vals_cell_1,
    std::unique_ptr<dealii::FEFaceValues<dim>> &fe_vals_face_1,
    std::unique_ptr<dealii::FEValues<dim>> &fe_vals_cell_2,
@@ -243,18 +433,102 @@ struct Diffusion
   unsigned n_active_cell;
   unsigned num_global_DOFs_on_this_rank;
   unsigned num_local_DOFs_on_this_rank;
-  unsigned num_global_DOFs_on_all_ranks;
+  Global_Index num_global_DOFs_on_all_ranks;
   unsigned n_threads;
+  Renumbering_Type renumbering;
+  Assembly_Type assembly_type;
+  Interior_Condensation condensation;
+  Direct_Solver_Options direct_solver;
+  bool report_matrix_locality;
+  bool numa_pinning;
+  bool numa_report;
+  Perf_Recorder perf_recorder;
+  Event_Tracer tracer;
+  unsigned trace_batch_size;
+  /* The peak RSS of the phases of the current cycle, the bytes of the large
+   * containers, and the largest bytes of the local matrices which each
+   * thread has held during the assembly. */
+  Memory_Ledger memory_ledger;
+  /* The wall times of the last Refine_Grid and Count_Globals. */
+  double refine_time, count_time;
+  std::vector<double> thread_matrix_bytes;
+  Comm_Ledger comm_ledger;
+  bool solver_report;
+  Adaptive_Tolerance adaptive_tolerance;
+  /* True if the coarse mesh is read by -mesh; then, the boundary ids are
+   * mapped from the tags of the file once, and are inherited by the
+   * children. */
+  bool mesh_imported;
+  /* By -vtk_lagrange, Calculate_Internal_Unknowns keeps the head and the
+   * flow of each owned cell at the equidistant nodes of its order (in the
+   * VTK order); the values of the cell i_cell start at
+   * lagrange_value_start[i_cell]. */
+  bool vtk_lagrange;
+  bool vtk_compress;
+  First_Touch_Vector<double> lagrange_values;
+  std::vector<unsigned> lagrange_value_start;
+  In_Situ_Analysis in_situ;
+  /* The point queries: the tree of the owned cells (valid until the next
+   * Refine_Grid), the points of -query_points, and the modes of the head and
+   * the flow of each owned cell, which are kept by Calculate_Internal_Unknowns
+   * if there are any points to evaluate. */
+  BBox_Tree cell_tree;
+  double query_tolerance;
+  std::vector<double> query_points;
+  bool keep_cell_modes;
+  First_Touch_Vector<double> cell_modes;
+  std::vector<unsigned> cell_mode_start;
+  /* The face tags of -qoi_boundaries. */
+  std::vector<unsigned> qoi_boundary_ids;
+  /* The boundary condition of each tag of an imported mesh; see
+   * Map_Boundary_Tags. */
+  std::map<unsigned, int> BC_of_tag;
+  Quadrature_Policy quad_policy;
+  double quad_tolerance;
+  unsigned max_quad_order;
+  unsigned max_poly_order;
+  double hp_smoothness_limit;
+  Face_Order_Rule face_order_rule;
+
+  /* The bases of the orders other than poly_order, which are used by the
+   * hp-adaptive cells. The bases of poly_order are the_elem_basis and
+   * the_face_basis. */
+  std::map<unsigned, poly_space_basis<elem_basis_type, dim>> elem_bases_of_order;
+  std::map<unsigned, poly_space_basis<face_basis_type, dim - 1>> face_bases_of_order;
+
+  /* The order of each cell is stored as a DG(0) field, so that it can be
+   * transferred to the children (or parents) of the cell, when the mesh is
+   * refined. cell_smoothness is the Legendre decay rate of u in each active
+   * cell, which is computed after the solve and used in the next refinement.
+   */
+  dealii::FE_DGQ<dim> DG_Order_Elem;
+  dealii::DoFHandler<dim> DoF_H_Order;
+  LA::MPI::Vector cell_orders;
+  dealii::Vector<float> cell_smoothness;
+
+  /* The owned cells are divided into n_threads contiguous blocks; the cells
+   * of the ith block are in [thread_cell_bounds[i], thread_cell_bounds[i+1]).
+   * The same partition is used in every loop over the cells.
+   */
+  std::vector<unsigned> thread_cell_bounds;
+  /* The cells of the ith block with the signature s are in
+   * cell_work_lists[i * n_cell_signatures + s]; see Classify_Cells. */
+  std::vector<std::vector<unsigned>> cell_work_lists;
 
   /* The next two variables contain num faces from rank zero to the
    * current rank, including and excluding current rank
    */
-  std::vector<unsigned> face_count_before_rank;
-  std::vector<unsigned> face_count_up_to_rank;
-  std::vector<int> n_local_DOFs_connected_to_DOF;
-  std::vector<int> n_nonlocal_DOFs_connected_to_DOF;
-  std::vector<int> scatter_from, scatter_to;
+  std::vector<Global_Index> face_count_before_rank;
+  std::vector<Global_Index> face_count_up_to_rank;
+  /* The first DOF of each local face in the local vector of uhat, and the
+   * total number of local DOFs at the end. */
+  std::vector<unsigned> face_DOF_in_this_rank;
+  std::vector<PetscInt> n_local_DOFs_connected_to_DOF;
+  std::vector<PetscInt> n_nonlocal_DOFs_connected_to_DOF;
+  std::vector<PetscInt> scatter_from, scatter_to;
   std::vector<double> taus;
+  /* The stabilization parameter of all faces, from -tau. */
+  double tau_penalty;
   std::map<std::string, int> cell_ID_to_num;
   std::map<unsigned, std::vector<std::string>> face_to_rank_sender;
   std::map<unsigned, unsigned> face_to_rank_recver;
@@ -273,5 +547,7 @@ void Tokenize(const std::string &str_in,
 
 #include "grid_operations.tpp"
 #include "diffusion.tpp"
+#include "in_situ.tpp"
+#include "interior_condensation.tpp"
 
 #endif // O_N_DIFFUSION
@@ -11,19 +11,23 @@ Diffusion<dim>::Diffusion(const unsigned &order,
     comm_size(comm_size_),
     comm_rank(comm_rank_),
     poly_order(order),
-    quad_order((order * 2 + 6) / 2),
+    quad_order(Fixed_Quadrature_Order(order)),
     n_internal_unknowns(pow(poly_order + 1, dim)),
-    n_trace_unknowns((poly_order + 1) * n_faces_per_cell),
+    n_trace_unknowns(pow(poly_order + 1, dim - 1) * n_faces_per_cell),
     Grid1(comm,
           typename dealii::Triangulation<dim>::MeshSmoothing(
            dealii::Triangulation<dim>::smoothing_on_refinement |
            dealii::Triangulation<dim>::smoothing_on_coarsening)),
     Elem_Mapping(),
-    elem_integration_capsul(quad_order),
-    face_integration_capsul(quad_order),
+    elem_integration_capsul(Cell_Quadrature<dim>(quad_order)),
+    face_integration_capsul(Cell_Quadrature<dim - 1>(quad_order)),
     LGL_quad_1D(poly_order + 1),
     support_points_1D(LGL_quad_1D.get_points()),
+#ifdef NODAL_COLLOCATION
+    DG_Elem(LGL_quad_1D),
+#else
     DG_Elem(poly_order),
+#endif
     DG_System(DG_Elem, 1 + dim),
     DoF_H_Refine(Grid1),
     DoF_H_System(Grid1),
@@ -35,22 +39,362 @@ Diffusion<dim>::Diffusion(const unsigned &order,
                    Domain::From_0_to_1),
     refn_cycle(0),
     Adaptive_ON(Adaptive_ON_),
-    n_threads(n_threads)
+    n_threads(n_threads),
+    DG_Order_Elem(0),
+    DoF_H_Order(Grid1)
 {
+  the_face_basis.Compute_Half_Range_Bases(face_integration_capsul.get_points());
+
   if (comm_rank == 0)
   {
     Convergence_Result.open("Convergence_Result.txt",
                             std::ofstream::out | std::fstream::app);
     Execution_Time.open("Execution_Time.txt", std::ofstream::out | std::fstream::app);
   }
-  std::vector<unsigned> repeats(dim, 1);
-  dealii::Point<dim> point_1, point_2;
-  for (int i_dim = 0; i_dim < dim; ++i_dim)
+
+  /* The renumbering of cells and trace DOFs on each rank can be chosen by
+   * -renumber <none|sfc|rcm>. By -renumber_report we measure the bandwidth
+   * of the global matrix and the speed of SpMV after each assembly. */
+  renumbering = No_Renumbering;
+  char renumbering_type[100];
+  PetscBool renumbering_option_flag;
+  PetscOptionsGetString(NULL, "-renumber", renumbering_type, 100, &renumbering_option_flag);
+  if (renumbering_option_flag == PETSC_TRUE)
+  {
+    if (strcmp(renumbering_type, "sfc") == 0)
+      renumbering = SFC_Renumbering;
+    else if (strcmp(renumbering_type, "rcm") == 0)
+      renumbering = RCM_Renumbering;
+    else if (strcmp(renumbering_type, "none") != 0)
+      OutLogger(std::cout,
+                " HEY! : The renumbering should either be <none> (default), "
+                "<sfc> or <rcm>. \n");
+  }
+  PetscBool locality_report_flag = PETSC_FALSE;
+  PetscOptionsGetBool(NULL, "-renumber_report", &locality_report_flag, NULL);
+  report_matrix_locality = (locality_report_flag == PETSC_TRUE);
+
+  /* By -assembly is, the global matrix is kept unassembled in a MATIS, and
+   * it is preconditioned by BDDC; the options of BDDC (-pc_bddc_*) are
+   * applied to it. The default is -assembly aij, with GAMG. */
+  assembly_type = AIJ_Assembly;
+  char assembly_type_name[100];
+  PetscBool assembly_option_flag;
+  PetscOptionsGetString(NULL, "-assembly", assembly_type_name, 100, &assembly_option_flag);
+  if (assembly_option_flag == PETSC_TRUE)
+  {
+    if (strcmp(assembly_type_name, "is") == 0)
+      assembly_type = IS_Assembly;
+    else if (strcmp(assembly_type_name, "aij") != 0)
+      OutLogger(std::cout, " HEY! : The assembly should either be <aij> (default) or <is>. \n");
+  }
+
+  /* By -condense_interior, the faces which are only in one rank are
+   * eliminated on that rank before the Krylov solve; see
+   * Condense_Interior_Faces. This needs -assembly is, which is then set.
+   * -condense_block <n> is the number of columns of the Schur complement
+   * which are computed at once. */
+  PetscBool condense_flag = PETSC_FALSE;
+  PetscOptionsGetBool(NULL, "-condense_interior", &condense_flag, NULL);
+  PetscInt condense_block = 64;
+  PetscOptionsGetInt(NULL, "-condense_block", &condense_block, NULL);
+  condensation.enabled = (condense_flag == PETSC_TRUE);
+  condensation.column_block = std::max((int)condense_block, 1);
+  if (condensation.enabled && comm_size == 1)
+  {
+    OutLogger(std::cout, " HEY! : -condense_interior needs more than one rank; it is ignored. \n");
+    condensation.enabled = false;
+  }
+  if (condensation.enabled)
+    assembly_type = IS_Assembly;
+
+  /* By -direct_solve, the global system is factorized by the package of
+   * -direct_package (by default MUMPS or SuperLU_DIST, if PETSc has them,
+   * and PETSc itself on one rank), unless the estimated factors of a rank
+   * need more than -direct_max_mb megabytes. The estimate is -direct_fill
+   * times the bytes of the local rows of global_mat. */
+  PetscBool direct_flag = PETSC_FALSE;
+  PetscOptionsGetBool(NULL, "-direct_solve", &direct_flag, NULL);
+  direct_solver.enabled = (direct_flag == PETSC_TRUE);
+  PetscReal direct_max_mb = 4096, direct_fill = 10;
+  PetscOptionsGetReal(NULL, "-direct_max_mb", &direct_max_mb, NULL);
+  PetscOptionsGetReal(NULL, "-direct_fill", &direct_fill, NULL);
+  direct_solver.max_bytes = direct_max_mb * 1048576.0;
+  direct_solver.fill = direct_fill;
+#if defined(PETSC_HAVE_MUMPS)
+  direct_solver.package = MATSOLVERMUMPS;
+#elif defined(PETSC_HAVE_SUPERLU_DIST)
+  direct_solver.package = MATSOLVERSUPERLU_DIST;
+#else
+  if (comm_size == 1)
+    direct_solver.package = MATSOLVERPETSC;
+#endif
+  char direct_package[100];
+  PetscBool direct_package_flag;
+  PetscOptionsGetString(NULL, "-direct_package", direct_package, 100, &direct_package_flag);
+  if (direct_package_flag == PETSC_TRUE)
+    direct_solver.package = direct_package;
+  /* SuperLU_DIST has no Cholesky factorization. */
+  direct_solver.use_LU = (direct_solver.package == MATSOLVERSUPERLU_DIST);
+  if (direct_solver.enabled && direct_solver.package.empty())
+  {
+    OutLogger(std::cout,
+              " HEY! : -direct_solve needs MUMPS or SuperLU_DIST on more than one "
+              "rank; CG is used. \n");
+    direct_solver.enabled = false;
+  }
+  if (direct_solver.enabled && assembly_type == IS_Assembly)
+  {
+    OutLogger(std::cout, " HEY! : -direct_solve needs -assembly aij; CG is used. \n");
+    direct_solver.enabled = false;
+  }
+  if (assembly_type == IS_Assembly && report_matrix_locality)
+  {
+    OutLogger(std::cout, " HEY! : -renumber_report needs -assembly aij; it is ignored. \n");
+    report_matrix_locality = false;
+  }
+
+  /* By -numa_pin, each OpenMP thread is pinned to one core, and it first
+   * touches the data of the cells that it processes. -numa_report writes, after
+   * the recovery, the ratio of the memory pages of the cell objects and of the
+   * recovered value arrays which are on a remote NUMA node. */
+  PetscBool numa_pin_flag = PETSC_FALSE, numa_report_flag = PETSC_FALSE;
+  PetscOptionsGetBool(NULL, "-numa_pin", &numa_pin_flag, NULL);
+  PetscOptionsGetBool(NULL, "-numa_report", &numa_report_flag, NULL);
+  numa_pinning = (numa_pin_flag == PETSC_TRUE);
+  numa_report = (numa_report_flag == PETSC_TRUE);
+
+  /* By -perf_counters, the cycles, instructions and cache misses of the main
+   * phases are counted in each thread and written after each solve. The FP
+   * operations are counted only if their raw event code for this CPU is
+   * given by -perf_fp_event (e.g. 0x01c7 on Intel cores). */
+  PetscBool perf_flag = PETSC_FALSE;
+  PetscOptionsGetBool(NULL, "-perf_counters", &perf_flag, NULL);
+  char perf_fp_event[100];
+  PetscBool perf_fp_event_flag;
+  PetscOptionsGetString(NULL, "-perf_fp_event", perf_fp_event, 100, &perf_fp_event_flag);
+  uint64_t fp_raw_event = 0;
+  if (perf_fp_event_flag == PETSC_TRUE)
+    fp_raw_event = strtoull(perf_fp_event, NULL, 0);
+  perf_recorder.setup(perf_flag == PETSC_TRUE, fp_raw_event, n_threads);
+
+  /* By -trace, the spans of the main phases are recorded in each thread and
+   * written by Write_Trace in the Chrome trace format. Each thread keeps the
+   * last -trace_capacity spans, and the cells are traced in batches of
+   * -trace_batch cells. */
+  PetscBool trace_flag = PETSC_FALSE;
+  PetscOptionsGetBool(NULL, "-trace", &trace_flag, NULL);
+  PetscInt trace_capacity = 65536, trace_batch = 64;
+  PetscOptionsGetInt(NULL, "-trace_capacity", &trace_capacity, NULL);
+  PetscOptionsGetInt(NULL, "-trace_batch", &trace_batch, NULL);
+  trace_batch_size = std::max((int)trace_batch, 1);
+  tracer.setup(trace_flag == PETSC_TRUE, n_threads, std::max((int)trace_capacity, 1));
+
+  /* By -memory_report, the peak RSS of each phase and the bytes of the large
+   * containers are written after each cycle (minimum and maximum over the
+   * ranks). */
+  PetscBool memory_report_flag = PETSC_FALSE;
+  PetscOptionsGetBool(NULL, "-memory_report", &memory_report_flag, NULL);
+  memory_ledger.enabled = (memory_report_flag == PETSC_TRUE);
+
+  /* By -comm_report, the messages, bytes, partners and waiting times of
+   * Count_Globals, the PETSc assembly and the solution scatter are counted,
+   * and the messages between each pair of ranks are written to
+   * Comm_Neighbors_p<order>_c<cycle>.txt. */
+  PetscBool comm_report_flag = PETSC_FALSE;
+  PetscOptionsGetBool(NULL, "-comm_report", &comm_report_flag, NULL);
+  comm_ledger.enabled = (comm_report_flag == PETSC_TRUE);
+
+  /* By -solver_report, the residual history, the setup and solve times, the
+   * multigrid complexities and the extreme singular values of each solve are
+   * written to Solver_p<order>_c<cycle>.json and Solver_p<order>.csv. The
+   * stabilization parameter of the faces is given by -tau. */
+  PetscBool solver_report_flag = PETSC_FALSE;
+  PetscOptionsGetBool(NULL, "-solver_report", &solver_report_flag, NULL);
+  solver_report = (solver_report_flag == PETSC_TRUE);
+  /* By -adaptive_rtol, the relative tolerance of each cycle is
+   * -adaptive_rtol_fraction (0.1) times the predicted relative error of the
+   * trace, divided by the condition estimate of the last solve, between 1E-8
+   * and -adaptive_rtol_max (1E-2); see Adaptive_Tolerance. */
+  PetscBool adaptive_rtol_flag = PETSC_FALSE;
+  PetscOptionsGetBool(NULL, "-adaptive_rtol", &adaptive_rtol_flag, NULL);
+  adaptive_tolerance.enabled = (adaptive_rtol_flag == PETSC_TRUE);
+  PetscReal rtol_fraction = 0.1, rtol_max = 1E-2;
+  PetscOptionsGetReal(NULL, "-adaptive_rtol_fraction", &rtol_fraction, NULL);
+  PetscOptionsGetReal(NULL, "-adaptive_rtol_max", &rtol_max, NULL);
+  adaptive_tolerance.fraction = rtol_fraction;
+  adaptive_tolerance.max_rtol = std::max((double)rtol_max, adaptive_tolerance.min_rtol);
+  PetscReal tau_option = 8.5;
+  PetscOptionsGetReal(NULL, "-tau", &tau_option, NULL);
+  tau_penalty = tau_option;
+
+  /* By -vtk_lagrange, the solution is written with the high order Lagrange
+   * cells of VTK, at the equidistant nodes of the order of each cell, instead
+   * of the patches of DataOut. The appended data are compressed, unless
+   * -vtk_compress 0 is given. */
+  PetscBool vtk_lagrange_flag = PETSC_FALSE, vtk_compress_flag = PETSC_TRUE;
+  PetscOptionsGetBool(NULL, "-vtk_lagrange", &vtk_lagrange_flag, NULL);
+  PetscOptionsGetBool(NULL, "-vtk_compress", &vtk_compress_flag, NULL);
+  vtk_lagrange = (vtk_lagrange_flag == PETSC_TRUE);
+  vtk_compress = (vtk_compress_flag == PETSC_TRUE);
+  Setup_In_Situ();
+  thread_matrix_bytes.assign(n_threads, 0);
+  refine_time = count_time = 0;
+  MPI_Barrier(comm);
+  tracer.start();
+  if (perf_recorder.enabled && !perf_recorder.master_counters.available(Perf_Cycles))
+    OutLogger(std::cout,
+              " HEY! : The hardware counters are not available (check "
+              "/proc/sys/kernel/perf_event_paranoid); only the wall times are "
+              "reported. \n");
+
+  /* The hp-adaptivity is turned on by -hp_max, which is the largest order
+   * that a cell can get (the default is poly_order, i.e. no p-refinement).
+   * The cells which are flagged for refinement and whose solution decays
+   * faster than -hp_smooth are enriched instead of being split. The order of
+   * the faces between cells of different orders is chosen by
+   * -hp_face <max|min>. */
+  PetscInt hp_max = poly_order;
+  PetscOptionsGetInt(NULL, "-hp_max", &hp_max, NULL);
+  max_poly_order = std::max((unsigned)hp_max, poly_order);
+  if (!Adaptive_ON && max_poly_order > poly_order)
+  {
+    OutLogger(std::cout, " HEY! : -hp_max is only used with adaptive refinement. \n");
+    max_poly_order = poly_order;
+  }
+#ifdef NODAL_COLLOCATION
+  if (max_poly_order > poly_order)
+  {
+    OutLogger(std::cout,
+              " HEY! : -hp_max is not used in the nodal collocation mode, "
+              "where all cells have the same nodes. \n");
+    max_poly_order = poly_order;
+  }
+#endif
+  PetscReal hp_smooth = 1.0;
+  PetscOptionsGetReal(NULL, "-hp_smooth", &hp_smooth, NULL);
+  hp_smoothness_limit = hp_smooth;
+  face_order_rule = Max_Face_Order;
+  char face_order_type[100];
+  PetscBool face_order_flag;
+  PetscOptionsGetString(NULL, "-hp_face", face_order_type, 100, &face_order_flag);
+  if (face_order_flag == PETSC_TRUE)
+  {
+    if (strcmp(face_order_type, "min") == 0)
+      face_order_rule = Min_Face_Order;
+    else if (strcmp(face_order_type, "max") != 0)
+      OutLogger(std::cout,
+                " HEY! : The face order in hp-adaptivity should either be "
+                "<max> (default) or <min>. \n");
+  }
+
+  /* The quadrature rule of the cells is chosen by
+   * -quad_policy <fixed|exact|adaptive>. In the adaptive policy, -quad_tol is
+   * the relative change in the projected data that we accept, and -quad_max
+   * is the largest number of points in each direction. */
+  quad_policy = Fixed_Quadrature;
+  char quad_policy_type[100];
+  PetscBool quad_policy_flag;
+  PetscOptionsGetString(NULL, "-quad_policy", quad_policy_type, 100, &quad_policy_flag);
+  if (quad_policy_flag == PETSC_TRUE)
+  {
+    if (strcmp(quad_policy_type, "exact") == 0)
+      quad_policy = Exact_Quadrature;
+    else if (strcmp(quad_policy_type, "adaptive") == 0)
+      quad_policy = Adaptive_Quadrature;
+    else if (strcmp(quad_policy_type, "fixed") != 0)
+      OutLogger(std::cout,
+                " HEY! : The quadrature policy should either be <fixed> "
+                "(default), <exact> or <adaptive>. \n");
+  }
+#ifdef NODAL_COLLOCATION
+  if (quad_policy != Fixed_Quadrature)
+  {
+    OutLogger(std::cout,
+              " HEY! : In the nodal collocation mode, the cells are integrated "
+              "on their nodes, and -quad_policy is ignored. \n");
+    quad_policy = Fixed_Quadrature;
+  }
+#endif
+  PetscReal quad_tol = 1.0E-8;
+  PetscOptionsGetReal(NULL, "-quad_tol", &quad_tol, NULL);
+  quad_tolerance = quad_tol;
+  PetscInt quad_max = Fixed_Quadrature_Order(max_poly_order) + 2;
+  PetscOptionsGetInt(NULL, "-quad_max", &quad_max, NULL);
+  max_quad_order = std::max((unsigned)quad_max, Exact_Quadrature_Order(max_poly_order));
+
+  /* The bases of the higher orders are built on the fixed rule of their
+   * order. */
+  for (unsigned p = poly_order + 1; p <= max_poly_order; ++p)
+  {
+    dealii::Quadrature<dim> elem_rule = Cell_Quadrature<dim>(Fixed_Quadrature_Order(p));
+    dealii::Quadrature<dim - 1> face_rule = Cell_Quadrature<dim - 1>(Fixed_Quadrature_Order(p));
+    dealii::QGaussLobatto<1> support_rule(p + 1);
+    elem_bases_of_order.emplace(
+     std::piecewise_construct,
+     std::forward_as_tuple(p),
+     std::forward_as_tuple(elem_rule.get_points(), support_rule.get_points(), Domain::From_0_to_1));
+    face_bases_of_order.emplace(
+     std::piecewise_construct,
+     std::forward_as_tuple(p),
+     std::forward_as_tuple(face_rule.get_points(), support_rule.get_points(), Domain::From_0_to_1));
+    face_bases_of_order.at(p).Compute_Half_Range_Bases(face_rule.get_points());
+  }
+
+  /* All of the rules that the policy might choose are cached here, before
+   * the cells are visited by several threads. A face basis is used with the
+   * rules of the cells on both of its sides, so every basis gets every rule
+   * in the range. The exact and adaptive rules of a cell are chosen for the
+   * largest order of the cell and its faces, which is at most
+   * max_poly_order. */
+  unsigned min_cached_order = (quad_policy == Fixed_Quadrature)
+                               ? quad_order
+                               : std::min(quad_order, Exact_Quadrature_Order(poly_order));
+  unsigned max_cached_order =
+   std::max(Fixed_Quadrature_Order(max_poly_order), Error_Quadrature_Order(max_poly_order));
+  if (quad_policy == Adaptive_Quadrature)
+    max_cached_order = std::max(max_cached_order, max_quad_order);
+  else if (quad_policy == Exact_Quadrature)
+    max_cached_order = std::max(max_cached_order, Exact_Quadrature_Order(max_poly_order));
+  for (unsigned n_points_1D = min_cached_order; n_points_1D <= max_cached_order; ++n_points_1D)
+    for (unsigned p = poly_order; p <= max_poly_order; ++p)
+    {
+      elem_basis(p).Cache_Quadrature(n_points_1D);
+      face_basis(p).Cache_Quadrature(n_points_1D);
+    }
+
+  /* By -mesh <file>, the coarse mesh is read from a Gmsh file (*.msh), or
+   * from the binary format of mesh_import.hpp, instead of [-1,1]^dim. The
+   * boundary tags of the file are mapped to the boundary conditions by
+   * -mesh_dirichlet <tags> and -mesh_neumann <tags>. By -mesh_convert
+   * <file>, the imported mesh is also written in the binary format, which is
+   * read in parallel by all ranks. */
+  mesh_imported = false;
+  char mesh_file_name[1000];
+  PetscBool mesh_flag;
+  PetscOptionsGetString(NULL, "-mesh", mesh_file_name, 1000, &mesh_flag);
+  if (mesh_flag == PETSC_TRUE)
+    mesh_imported = Import_Coarse_Mesh(mesh_file_name);
+  if (mesh_imported)
+  {
+    char convert_file_name[1000];
+    PetscBool convert_flag;
+    PetscOptionsGetString(NULL, "-mesh_convert", convert_file_name, 1000, &convert_flag);
+    if (convert_flag == PETSC_TRUE)
+      Write_Coarse_Mesh_Of_Grid(convert_file_name);
+    Map_Boundary_Tags();
+  }
+  else
   {
-    point_1[i_dim] = -1.0;
-    point_2[i_dim] = 1.0;
+    std::vector<unsigned> repeats(dim, 1);
+    dealii::Point<dim> point_1, point_2;
+    for (int i_dim = 0; i_dim < dim; ++i_dim)
+    {
+      point_1[i_dim] = -1.0;
+      point_2[i_dim] = 1.0;
+    }
+    dealii::GridGenerator::subdivided_hyper_rectangle(Grid1, repeats, point_1, point_2);
   }
-  dealii::GridGenerator::subdivided_hyper_rectangle(Grid1, repeats, point_1, point_2);
 
   //  Set_Boundary_Indicator(Grid1);
   Set_Boundary_Indicator();
@@ -63,6 +407,7 @@ Diffusion<dim>::~Diffusion()
 {
   DoF_H_System.clear();
   DoF_H_Refine.clear();
+  DoF_H_Order.clear();
   if (comm_rank == 0)
   {
     Convergence_Result.close();
@@ -126,13 +471,15 @@ void Diffusion<dim>::Compute_Error(const Function<dim, dealii::Tensor<1, dim>> &
 /**
  * In this function we calculate the matrices used in all other methods.
  * In this calculation we choose to use the nodal or modal basis for the faces
- * and elements.
+ * and elements. Unless the signature has Has_Hanging_Face, all faces are
+ * taken as whole faces.
  */
 template <int dim>
+template <unsigned signature>
 void Diffusion<dim>::CalculateMatrices(Cell_Class<dim> &cell)
 {
-  const unsigned n_polys = pow(poly_order + 1, dim);
-  const unsigned n_polyfaces = pow(poly_order + 1, dim - 1);
+  const unsigned n_polys = pow(cell.poly_order + 1, dim);
+  const unsigned n_trace_DOFs = cell.n_trace_DOFs();
   typedef Eigen::MatrixXd T;
 
   std::vector<dealii::DerivativeForm<1, dim, dim>> D_Forms =
@@ -140,51 +487,66 @@ void Diffusion<dim>::CalculateMatrices(Cell_Class<dim> &cell)
   std::vector<dealii::Point<dim>> QPoints_Locs =
    cell.cell_quad_fe_vals->get_quadrature_points();
   std::vector<double> cell_JxW = cell.cell_quad_fe_vals->get_JxW_values();
+  poly_space_basis<elem_basis_type, dim> &cell_basis = elem_basis(cell.poly_order);
+  const Quadrature_Table<dim> &elem_table = cell_basis.quadrature_table(cell.quad_order);
+  const Quadrature_Table<dim - 1> &face_table =
+   the_face_basis.quadrature_table(cell.quad_order);
 
   T A = T::Zero(dim * n_polys, dim * n_polys);
   T B = T::Zero(dim * n_polys, n_polys);
-  T C = T::Zero(dim * n_polys, n_faces_per_cell * n_polyfaces);
+  T C = T::Zero(dim * n_polys, n_trace_DOFs);
   T D = T::Zero(n_polys, n_polys);
-  T E = T::Zero(n_polys, n_faces_per_cell * n_polyfaces);
-  T H = T::Zero(n_faces_per_cell * n_polyfaces, n_faces_per_cell * n_polyfaces);
-  T H2 = T::Zero(n_faces_per_cell * n_polyfaces, n_faces_per_cell * n_polyfaces);
+  T E = T::Zero(n_polys, n_trace_DOFs);
+  T H = T::Zero(n_trace_DOFs, n_trace_DOFs);
+  T H2 = T::Zero(n_trace_DOFs, n_trace_DOFs);
   T M = T::Zero(n_polys, n_polys);
 
   Eigen::MatrixXd Ni_grad, NjT, Ni_vec;
-  for (unsigned i1 = 0; i1 < elem_integration_capsul.size(); ++i1)
+  for (unsigned i1 = 0; i1 < elem_table.quadrature.size(); ++i1)
   {
     Ni_grad = Eigen::MatrixXd::Zero(dim * n_polys, 1);
-    NjT = the_elem_basis.the_bases.block(i1, 0, 1, n_polys);
+    NjT = elem_table.the_bases.block(i1, 0, 1, n_polys);
     Ni_vec = Eigen::MatrixXd::Zero(dim * n_polys, dim);
     for (unsigned i_poly = 0; i_poly < n_polys; ++i_poly)
     {
       dealii::Tensor<2, dim> d_form = D_Forms[i1];
-      dealii::Tensor<1, dim> N_grads_X = the_elem_basis.bases_grads[i1][i_poly] * d_form;
+      dealii::Tensor<1, dim> N_grads_X = elem_table.bases_grads[i1][i_poly] * d_form;
       for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
       {
         Ni_vec(n_polys * i_dim + i_poly, i_dim) = NjT(0, i_poly);
         Ni_grad(n_polys * i_dim + i_poly, 0) = N_grads_X[i_dim];
       }
     }
-    Eigen::MatrixXd kappa_inv_ = kappa_inv.value(QPoints_Locs[i1], QPoints_Locs[i1]);
+    const Eigen::Matrix<double, dim, dim> kappa_inv_ =
+     kappa_inv.value(QPoints_Locs[i1], QPoints_Locs[i1]);
+#ifdef NODAL_COLLOCATION
+    /* The quadrature points are the nodes of the basis, so N_j(x_i1) is
+     * delta_{i1 j}, and the mass-type matrices only get their diagonal. */
+    for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+      for (unsigned j_dim = 0; j_dim < dim; ++j_dim)
+        A(i_dim * n_polys + i1, j_dim * n_polys + i1) +=
+         cell_JxW[i1] * kappa_inv_(i_dim, j_dim);
+    M(i1, i1) += cell_JxW[i1];
+    B.col(i1) += cell_JxW[i1] * Ni_grad;
+#else
     A += cell_JxW[i1] * Ni_vec * kappa_inv_ * Ni_vec.transpose();
     M += cell_JxW[i1] * NjT.transpose() * NjT;
     B += cell_JxW[i1] * Ni_grad * NjT;
+#endif
   }
 
   Eigen::MatrixXd normal(dim, 1);
-  std::vector<dealii::Point<dim - 1>> Face_Q_Points =
-   face_integration_capsul.get_points();
   for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
   {
+    const unsigned n_polyfaces = cell.n_face_DOFs(i_face);
+    const unsigned face_start = cell.face_DOF_start(i_face);
     cell.reinit_Face_FEValues(i_face);
     Eigen::MatrixXd C_On_Face = Eigen::MatrixXd::Zero(dim * n_polys, n_polyfaces);
     Eigen::MatrixXd E_On_Face = Eigen::MatrixXd::Zero(n_polys, n_polyfaces);
     Eigen::MatrixXd H_On_Face = Eigen::MatrixXd::Zero(n_polyfaces, n_polyfaces);
     Eigen::MatrixXd H2_On_Face = Eigen::MatrixXd::Zero(n_polyfaces, n_polyfaces);
-    std::vector<dealii::Point<dim>> Projected_Face_Q_Points(
-     face_integration_capsul.size());
-    dealii::QProjector<dim>::project_to_face(face_integration_capsul,
+    std::vector<dealii::Point<dim>> Projected_Face_Q_Points(face_table.quadrature.size());
+    dealii::QProjector<dim>::project_to_face(face_table.quadrature,
                                              i_face,
                                              Projected_Face_Q_Points);
     std::vector<dealii::Point<dim>> Normals =
@@ -193,24 +555,15 @@ void Diffusion<dim>::CalculateMatrices(Cell_Class<dim> &cell)
     Eigen::MatrixXd NjT_Face = Eigen::MatrixXd::Zero(1, n_polyfaces);
     Eigen::MatrixXd Nj_vec;
     Eigen::MatrixXd Nj = Eigen::MatrixXd::Zero(n_polys, 1);
-    for (unsigned i_Q_face = 0; i_Q_face < face_integration_capsul.size(); ++i_Q_face)
+    const unsigned half_range =
+     (signature & Has_Hanging_Face) ? cell.half_range_flag[i_face] : 0;
+    const Eigen::MatrixXd &face_bases =
+     face_basis(cell.face_poly_order[i_face]).half_range_table(half_range, cell.quad_order);
+    for (unsigned i_Q_face = 0; i_Q_face < face_table.quadrature.size(); ++i_Q_face)
     {
       Nj_vec = Eigen::MatrixXd::Zero(dim * n_polys, dim);
-      std::vector<double> N_valus =
-       the_elem_basis.value(Projected_Face_Q_Points[i_Q_face]);
-      std::vector<double> half_range_face_basis, face_basis;
-
-      face_basis = the_face_basis.bases[i_Q_face];
-      half_range_face_basis =
-       the_face_basis.value(Face_Q_Points[i_Q_face], cell.half_range_flag[i_face]);
-
-      for (unsigned i_polyface = 0; i_polyface < n_polyfaces; ++i_polyface)
-      {
-        if (cell.half_range_flag[i_face] == 0)
-          NjT_Face(0, i_polyface) = face_basis[i_polyface];
-        else
-          NjT_Face(0, i_polyface) = half_range_face_basis[i_polyface];
-      }
+      std::vector<double> N_valus = cell_basis.value(Projected_Face_Q_Points[i_Q_face]);
+      NjT_Face = face_bases.row(i_Q_face);
       for (unsigned i_poly = 0; i_poly < n_polys; ++i_poly)
       {
         Nj(i_poly, 0) = N_valus[i_poly];
@@ -222,15 +575,22 @@ void Diffusion<dim>::CalculateMatrices(Cell_Class<dim> &cell)
       C_On_Face += Face_JxW[i_Q_face] * Nj_vec * normal * NjT_Face;
       D += Face_JxW[i_Q_face] * taus[i_face] * Nj * Nj.transpose();
       E_On_Face += Face_JxW[i_Q_face] * taus[i_face] * Nj * NjT_Face;
+#ifdef NODAL_COLLOCATION
+      /* On a conforming face, the trace nodes are the face quadrature points. */
+      if (half_range == 0)
+      {
+        H_On_Face(i_Q_face, i_Q_face) += Face_JxW[i_Q_face] * taus[i_face];
+        H2_On_Face(i_Q_face, i_Q_face) += Face_JxW[i_Q_face];
+        continue;
+      }
+#endif
       H_On_Face += Face_JxW[i_Q_face] * taus[i_face] * NjT_Face.transpose() * NjT_Face;
       H2_On_Face += Face_JxW[i_Q_face] * NjT_Face.transpose() * NjT_Face;
     }
-    H.block(i_face * n_polyfaces, i_face * n_polyfaces, n_polyfaces, n_polyfaces) =
-     H_On_Face;
-    H2.block(i_face * n_polyfaces, i_face * n_polyfaces, n_polyfaces, n_polyfaces) =
-     H2_On_Face;
-    C.block(0, i_face * n_polyfaces, dim * n_polys, n_polyfaces) = C_On_Face;
-    E.block(0, i_face * n_polyfaces, n_polys, n_polyfaces) = E_On_Face;
+    H.block(face_start, face_start, n_polyfaces, n_polyfaces) = H_On_Face;
+    H2.block(face_start, face_start, n_polyfaces, n_polyfaces) = H2_On_Face;
+    C.block(0, face_start, dim * n_polys, n_polyfaces) = C_On_Face;
+    E.block(0, face_start, n_polys, n_polyfaces) = E_On_Face;
   }
   cell.assign_matrices(A, B, C, D, E, H, H2, M);
 }
@@ -242,6 +602,7 @@ void Diffusion<dim>::CalculateMatrices(Cell_Class<dim> &cell)
  */
 template <int dim>
 void Diffusion<dim>::initiate_mat_calc_fe_vals(
+ const unsigned &n_points_1D,
  std::unique_ptr<dealii::FEValues<dim>> &fe_vals_cell_1,
  std::unique_ptr<dealii::FEFaceValues<dim>> &fe_vals_face_1,
  std::unique_ptr<dealii::FEValues<dim>> &fe_vals_cell_2,
@@ -253,7 +614,7 @@ void Diffusion<dim>::initiate_mat_calc_fe_vals(
   std::unique_ptr<dealii::FEValues<dim>> p1(new dealii::FEValues<dim>(
    Elem_Mapping,
    DG_Elem,
-   elem_integration_capsul,
+   the_elem_basis.quadrature_table(n_points_1D).quadrature,
    dealii::update_JxW_values | dealii::update_quadrature_points |
     dealii::update_inverse_jacobians | dealii::update_jacobians));
   fe_vals_cell_1 = std::move(p1);
@@ -261,7 +622,7 @@ void Diffusion<dim>::initiate_mat_calc_fe_vals(
   std::unique_ptr<dealii::FEFaceValues<dim>> p2(new dealii::FEFaceValues<dim>(
    Elem_Mapping,
    DG_Elem,
-   face_integration_capsul,
+   the_face_basis.quadrature_table(n_points_1D).quadrature,
    dealii::update_values | dealii::update_JxW_values | dealii::update_quadrature_points |
     dealii::update_face_normal_vectors | dealii::update_inverse_jacobians));
   fe_vals_face_1 = std::move(p2);
@@ -279,211 +640,562 @@ void Diffusion<dim>::initiate_mat_calc_fe_vals(
   fe_vals_face_2 = std::move(p4);
 }
 
+/*!
+ * Returns the FEValues of the Gauss rule with \c n_points_1D points in each
+ * direction, from the sets of the calling thread. The set is created the first
+ * time that it is needed.
+ */
 template <int dim>
-void Diffusion<dim>::Assemble_Globals()
+typename Diffusion<dim>::Cell_FEValues &
+ Diffusion<dim>::FEValues_of_Order(std::map<unsigned, Cell_FEValues> &fe_vals_of_order,
+                                   const unsigned &n_points_1D)
 {
-  unsigned n_polys = pow(poly_order + 1, dim);
-  unsigned n_polyfaces = pow(poly_order + 1, dim - 1);
-  std::vector<double> Q_Weights = elem_integration_capsul.get_weights();
-  std::vector<double> Face_Q_Weights = face_integration_capsul.get_weights();
-  dealii::QGaussLobatto<dim> LGL_elem_support_points(poly_order + 1);
-  dealii::QGaussLobatto<dim - 1> LGL_face_support_points(poly_order + 1);
-#ifdef _OPENMP
-#pragma omp parallel
-  {
-    unsigned thread_id = omp_get_thread_num();
+  Cell_FEValues &fe_vals = fe_vals_of_order[n_points_1D];
+  if (!fe_vals.quad_elem)
+    initiate_mat_calc_fe_vals(
+     n_points_1D, fe_vals.quad_elem, fe_vals.quad_face, fe_vals.supp_elem, fe_vals.supp_face);
+  return fe_vals;
+}
+
+/*!
+ * The number of points of the fixed policy for the cells of order p. In the
+ * nodal collocation mode, these are the p+1 Gauss-Lobatto points, which are
+ * the nodes of the basis.
+ */
+template <int dim>
+unsigned Diffusion<dim>::Fixed_Quadrature_Order(const unsigned &p) const
+{
+#ifdef NODAL_COLLOCATION
+  return p + 1;
 #else
-  unsigned thread_id = 0;
-  {
+  return (2 * p + 6) / 2;
 #endif
-    std::unique_ptr<dealii::FEValues<dim>> fe_val_quad_elem, fe_val_supp_elem;
-    std::unique_ptr<dealii::FEFaceValues<dim>> fe_val_quad_face, fe_val_supp_face;
-    initiate_mat_calc_fe_vals(
-     fe_val_quad_elem, fe_val_quad_face, fe_val_supp_elem, fe_val_supp_face);
+}
+
+/*!
+ * The number of points for computing the errors and the postprocessed
+ * solution of the cells of order p. In the modal mode, this is the fixed
+ * rule. The collocation rule is not enough for the postprocessing (which is
+ * of order p+1), so in the nodal mode we use p+4 Gauss-Lobatto points, which
+ * are exact for the same order as the fixed Gauss rule.
+ */
+template <int dim>
+unsigned Diffusion<dim>::Error_Quadrature_Order(const unsigned &p) const
+{
+#ifdef NODAL_COLLOCATION
+  return p + 4;
+#else
+  return Fixed_Quadrature_Order(p);
+#endif
+}
 
-    for (unsigned i_cell = thread_id; i_cell < All_Owned_Cells.size();
-         i_cell = i_cell + n_threads)
+/*!
+ * The smallest number of Gauss points, which integrates the local matrices
+ * and the right hand side of a cell of order p exactly on affine cells.
+ * Gauss rule with n points is exact up to order 2n-1. The mass type
+ * integrands have the order \f$2p\f$ plus the order of \f$\kappa^{-1}\f$, and
+ * the right hand side has the order \f$p\f$ plus the order of \f$f\f$. The data
+ * which are not polynomials are counted as polynomials of order p.
+ */
+template <int dim>
+unsigned Diffusion<dim>::Exact_Quadrature_Order(const unsigned &p) const
+{
+  int kappa_degree = kappa_inv.polynomial_degree();
+  int f_degree = f_func.polynomial_degree();
+  if (kappa_degree < 0)
+    kappa_degree = p;
+  if (f_degree < 0)
+    f_degree = p;
+  unsigned n_points_for_matrices = (2 * p + kappa_degree + 2) / 2;
+  unsigned n_points_for_rhs = (p + f_degree + 2) / 2;
+  return std::max(std::max(n_points_for_matrices, n_points_for_rhs), 1U);
+}
+
+/*!
+ * Sets Cell_Class::quad_order of all owned cells according to quad_policy.
+ * The exact and adaptive policies start from the exact rule of the largest
+ * order of the cell and its faces, because with -hp_face max, the faces of
+ * a cell can have a higher order than the cell. In the adaptive policy, we
+ * project the entries of \f$\kappa^{-1}\f$ and \f$f\f$ onto the element
+ * basis with n and n+1 points, and increase n until the relative change of
+ * all of these projections is below quad_tolerance, or n reaches
+ * max_quad_order. So, only the cells where the data are not resolved get the
+ * more expensive rules.
+ */
+template <int dim>
+void Diffusion<dim>::Select_Quadrature_Orders()
+{
+  std::map<unsigned, std::unique_ptr<dealii::FEValues<dim>>> fe_vals_of_order;
+  auto projected_data = [&](const Cell_Class<dim> &cell, const unsigned &n_points_1D)
+  {
+    const Quadrature_Table<dim> &table =
+     elem_basis(cell.poly_order).quadrature_table(n_points_1D);
+    std::unique_ptr<dealii::FEValues<dim>> &fe_vals = fe_vals_of_order[n_points_1D];
+    if (!fe_vals)
+      fe_vals.reset(new dealii::FEValues<dim>(
+       Elem_Mapping, DG_Elem, table.quadrature, dealii::update_quadrature_points));
+    fe_vals->reinit(cell.dealii_Cell);
+    const std::vector<double> &weights = table.quadrature.get_weights();
+    Eigen::MatrixXd data_at_points(weights.size(), dim * dim + 1);
+    for (unsigned i_point = 0; i_point < weights.size(); ++i_point)
     {
-      Cell_Class<dim> &cell = All_Owned_Cells[i_cell];
-      char buffer[100];
-      std::snprintf(buffer,
-                    100,
-                    "I am thread num. %d on rank %d on element: %d from %zu",
-                    thread_id,
-                    comm_rank,
-                    i_cell,
-                    All_Owned_Cells.size());
-
-      cell.attach_FEValues(fe_val_quad_elem, fe_val_quad_face, fe_val_supp_elem, fe_val_supp_face);
-      cell.reinit_Cell_FEValues();
-
-      Eigen::MatrixXd A, B, C, D, E, H, H2, M;
-      CalculateMatrices(cell);
-      cell.get_matrices(A, B, C, D, E, H, H2, M);
-
-      Eigen::MatrixXd Ainv = A.inverse();
-      Eigen::MatrixXd BT_Ainv = B.transpose() * Ainv;
-      Eigen::LDLT<Eigen::MatrixXd, Eigen::Lower> LDLT_of_A = A.ldlt();
-      Eigen::LDLT<Eigen::MatrixXd, Eigen::Lower> LDLT_of_BT_Ainv_B_plus_D =
-       (BT_Ainv * B + D).ldlt();
-
-      std::vector<dealii::Point<dim>> Q_Points_Loc =
-       cell.cell_quad_fe_vals->get_quadrature_points();
-
-      std::vector<double> cell_mat;
-      std::vector<int> row_nums, col_nums;
-
-      Eigen::MatrixXd f_vec = Eigen::MatrixXd::Zero(n_polys, 1);
-      for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+      const dealii::Point<dim> &x = fe_vals->quadrature_point(i_point);
+      const Eigen::Matrix<double, dim, dim> kappa_inv_ = kappa_inv.value(x, x);
+      for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+        for (unsigned j_dim = 0; j_dim < dim; ++j_dim)
+          data_at_points(i_point, i_dim * dim + j_dim) =
+           weights[i_point] * kappa_inv_(i_dim, j_dim);
+      data_at_points(i_point, dim * dim) = weights[i_point] * f_func.value(x, x);
+    }
+    return Eigen::MatrixXd(table.the_bases.transpose() * data_at_points);
+  };
+
+  unsigned local_min_order = max_quad_order, local_max_order = 0;
+  unsigned long local_n_points = 0, local_n_fixed_points = 0;
+  for (Cell_Class<dim> &cell : All_Owned_Cells)
+  {
+    unsigned integrand_order = cell.poly_order;
+    for (const unsigned &face_order : cell.face_poly_order)
+      integrand_order = std::max(integrand_order, face_order);
+    cell.quad_order = (quad_policy == Fixed_Quadrature)
+                       ? Fixed_Quadrature_Order(cell.poly_order)
+                       : Exact_Quadrature_Order(integrand_order);
+    if (quad_policy == Adaptive_Quadrature)
+    {
+      Eigen::MatrixXd projection = projected_data(cell, cell.quad_order);
+      while (cell.quad_order < max_quad_order)
       {
-        for (unsigned i_polyface = 0; i_polyface < n_polyfaces; ++i_polyface)
+        Eigen::MatrixXd finer_projection = projected_data(cell, cell.quad_order + 1);
+        bool converged = true;
+        for (unsigned i_col = 0; i_col < finer_projection.cols(); ++i_col)
         {
-          int global_face_number = cell.Face_ID_in_all_ranks[i_face];
-          int global_dof_number = -1;
-          if (global_face_number >= 0)
-            global_dof_number = global_face_number * n_polyfaces + i_polyface;
-
-          if (global_face_number < -1)
-            std::cout << global_face_number << std::endl;
-
-          assert(global_face_number >= -1);
-          assert(global_dof_number < INT_MAX);
-
-          row_nums.push_back(global_dof_number);
-          col_nums.push_back(global_dof_number);
-
-          Eigen::MatrixXd uhat_vec =
-           Eigen::MatrixXd::Zero(n_faces_per_cell * n_polyfaces, 1);
-          Eigen::MatrixXd gN_vec =
-           Eigen::MatrixXd::Zero(n_faces_per_cell * n_polyfaces, 1);
-          uhat_vec(i_face * n_polyfaces + i_polyface, 0) = 1.0;
-          Eigen::MatrixXd u_vec, q_vec;
-          std::vector<double> jth_col;
-          u_from_uhat_f(
-           LDLT_of_BT_Ainv_B_plus_D, BT_Ainv, C, E, M, uhat_vec, uhat_vec, f_vec, u_vec);
-          q_from_u_uhat(LDLT_of_A, B, C, uhat_vec, u_vec, q_vec);
-          uhat_u_q_to_jth_col(C, E, H, H2, uhat_vec, u_vec, q_vec, gN_vec, -1, jth_col);
-          cell_mat.insert(cell_mat.end(),
-                          std::make_move_iterator(jth_col.begin()),
-                          std::make_move_iterator(jth_col.end()));
+          double change = (finer_projection.col(i_col) - projection.col(i_col)).norm();
+          if (change > quad_tolerance * finer_projection.col(i_col).norm())
+            converged = false;
         }
+        if (converged)
+          break;
+        ++cell.quad_order;
+        projection = std::move(finer_projection);
+      }
+    }
+    local_min_order = std::min(local_min_order, cell.quad_order);
+    local_max_order = std::max(local_max_order, cell.quad_order);
+    local_n_points += pow(cell.quad_order, dim);
+    local_n_fixed_points += pow(Fixed_Quadrature_Order(cell.poly_order), dim);
+  }
+
+  unsigned min_order, max_order;
+  unsigned long n_points, n_fixed_points;
+  MPI_Reduce(&local_min_order, &min_order, 1, MPI_UNSIGNED, MPI_MIN, 0, comm);
+  MPI_Reduce(&local_max_order, &max_order, 1, MPI_UNSIGNED, MPI_MAX, 0, comm);
+  MPI_Reduce(&local_n_points, &n_points, 1, MPI_UNSIGNED_LONG, MPI_SUM, 0, comm);
+  MPI_Reduce(&local_n_fixed_points, &n_fixed_points, 1, MPI_UNSIGNED_LONG, MPI_SUM, 0, comm);
+  char buffer[200];
+  std::snprintf(buffer,
+                200,
+                "Gauss points per direction are between %d and %d; total cell "
+                "quadrature points: %lu, with the fixed rule: %lu",
+                min_order,
+                max_order,
+                n_points,
+                n_fixed_points);
+  OutLogger(Execution_Time, buffer, true);
+}
+
+/*!
+ * The p-refinement is used only when the mesh is adaptively refined, and
+ * some cells are allowed to have orders above poly_order.
+ */
+template <int dim>
+bool Diffusion<dim>::hp_adaptive() const
+{
+  return Adaptive_ON && max_poly_order > poly_order;
+}
+
+template <int dim>
+poly_space_basis<typename Diffusion<dim>::elem_basis_type, dim> &
+ Diffusion<dim>::elem_basis(const unsigned &p)
+{
+  if (p == poly_order)
+    return the_elem_basis;
+  assert(elem_bases_of_order.find(p) != elem_bases_of_order.end());
+  return elem_bases_of_order.find(p)->second;
+}
+
+template <int dim>
+poly_space_basis<typename Diffusion<dim>::face_basis_type, dim - 1> &
+ Diffusion<dim>::face_basis(const unsigned &p)
+{
+  if (p == poly_order)
+    return the_face_basis;
+  assert(face_bases_of_order.find(p) != face_bases_of_order.end());
+  return face_bases_of_order.find(p)->second;
+}
+
+/*!
+ * The smoothness indicator of the hp-adaptivity. The modes of u with the
+ * largest one dimensional index equal to k are grouped together, and
+ * \f$E_k\f$ is the norm of their coefficients. For an analytic solution,
+ * \f$E_k \sim e^{-\sigma k}\f$, and we return \f$\sigma\f$, which is found by
+ * a least squares fit of \f$\log E_k\f$. The mean value (k = 0) is not used,
+ * unless p = 1.
+ */
+template <int dim>
+double Diffusion<dim>::Legendre_Decay_Rate(const Eigen::MatrixXd &modal_u,
+                                           const unsigned &p) const
+{
+  if (p == 0)
+    return 0;
+  const unsigned n_polys_1D = p + 1;
+  std::vector<double> energy_of_order(n_polys_1D, 0.0);
+  for (unsigned i_poly = 0; i_poly < modal_u.rows(); ++i_poly)
+  {
+    unsigned largest_index = 0;
+    for (unsigned i_dim = 0, remainder = i_poly; i_dim < dim; ++i_dim)
+    {
+      largest_index = std::max(largest_index, remainder % n_polys_1D);
+      remainder /= n_polys_1D;
+    }
+    energy_of_order[largest_index] += modal_u(i_poly, 0) * modal_u(i_poly, 0);
+  }
+
+  const unsigned first_order = (p > 1) ? 1 : 0;
+  double sum_k = 0, sum_log = 0, sum_k2 = 0, sum_k_log = 0;
+  const double n_points = p + 1 - first_order;
+  for (unsigned k = first_order; k <= p; ++k)
+  {
+    double log_E_k = 0.5 * log(std::max(energy_of_order[k], 1.E-30));
+    sum_k += k;
+    sum_k2 += k * k;
+    sum_log += log_E_k;
+    sum_k_log += k * log_E_k;
+  }
+  double slope = (n_points * sum_k_log - sum_k * sum_log) / (n_points * sum_k2 - sum_k * sum_k);
+  return -slope;
+}
+
+/*!
+ * Counts the rows in \c row_nums which are owned by other ranks. PETSc keeps
+ * them in its stash, and sends them to their owners at the assembly. It is
+ * called in the critical sections of the assembly.
+ */
+template <int dim>
+void Diffusion<dim>::Count_Stashed_Rows(const PetscInt *ownership_ranges,
+                                        const std::vector<PetscInt> &row_nums,
+                                        const double &bytes_per_row)
+{
+  for (const PetscInt &row : row_nums)
+  {
+    if (row < 0 || (row >= ownership_ranges[comm_rank] && row < ownership_ranges[comm_rank + 1]))
+      continue;
+    unsigned owner =
+     std::upper_bound(ownership_ranges, ownership_ranges + comm_size + 1, row) -
+     ownership_ranges - 1;
+    comm_ledger.aggregate(Comm_PETSc_Assembly, owner, bytes_per_row, true);
+  }
+}
+
+/*!
+ * \brief Assembles the condensed matrix and the right hand side of one cell
+ * of the given signature. For the interior cells, the loop over the boundary
+ * faces and the checks of the Dirichlet faces are skipped at compile time;
+ * the rest of the work, including the loops over the faces and their DOFs,
+ * is the same as in the general kernel.
+ */
+template <int dim>
+template <unsigned signature>
+void Diffusion<dim>::Assemble_Cell(Cell_Class<dim> &cell,
+                                   std::map<unsigned, Cell_FEValues> &fe_vals_of_order,
+                                   Perf_Thread_Counters &thread_counters,
+                                   const unsigned &thread_id,
+                                   const PetscInt *ownership_ranges)
+{
+  const unsigned n_polys = pow(cell.poly_order + 1, dim);
+  const unsigned n_trace_DOFs = cell.n_trace_DOFs();
+  Cell_FEValues &fe_vals = FEValues_of_Order(fe_vals_of_order, cell.quad_order);
+  const std::vector<double> &Q_Weights =
+   the_elem_basis.quadrature_table(cell.quad_order).quadrature.get_weights();
+  const std::vector<double> &Face_Q_Weights =
+   the_face_basis.quadrature_table(cell.quad_order).quadrature.get_weights();
+  cell.attach_FEValues(fe_vals.quad_elem, fe_vals.quad_face, fe_vals.supp_elem, fe_vals.supp_face);
+  cell.reinit_Cell_FEValues();
+
+  Eigen::MatrixXd A, B, C, D, E, H, H2, M;
+  Perf_Scope matrices_scope(perf_recorder, thread_counters, Perf_Local_Matrices, thread_id);
+  CalculateMatrices<signature>(cell);
+  cell.get_matrices(A, B, C, D, E, H, H2, M);
+  matrices_scope.stop();
+
+  /* We never form the inverse of A, which is the largest local matrix
+   * (specially in 3D). Since A is symmetric, B^T A^-1 = (A^-1 B)^T. */
+  Perf_Scope solves_scope(perf_recorder, thread_counters, Perf_Local_Solves, thread_id);
+  Eigen::LDLT<Eigen::MatrixXd, Eigen::Lower> LDLT_of_A = A.ldlt();
+  Eigen::MatrixXd BT_Ainv = LDLT_of_A.solve(B).transpose();
+  Eigen::LDLT<Eigen::MatrixXd, Eigen::Lower> LDLT_of_BT_Ainv_B_plus_D =
+   (BT_Ainv * B + D).ldlt();
+  solves_scope.stop();
+
+  std::vector<dealii::Point<dim>> Q_Points_Loc =
+   cell.cell_quad_fe_vals->get_quadrature_points();
+
+  std::vector<double> cell_mat;
+  std::vector<PetscInt> row_nums, col_nums;
+  /* The rows of the cell in the local numbering of the rank, for MATIS. */
+  std::vector<PetscInt> local_row_nums;
+
+  Eigen::MatrixXd f_vec = Eigen::MatrixXd::Zero(n_polys, 1);
+  for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+  {
+    for (unsigned i_polyface = 0; i_polyface < cell.n_face_DOFs(i_face); ++i_polyface)
+    {
+      Global_Index global_face_number = cell.Face_ID_in_all_ranks[i_face];
+      Global_Index global_dof_number = -1;
+      if (!(signature & Has_Dirichlet_Face) || global_face_number >= 0)
+        global_dof_number = cell.Face_DOF_in_all_ranks[i_face] + i_polyface;
+
+      if (global_face_number < -1)
+        std::cout << global_face_number << std::endl;
+
+      assert(global_face_number >= -1);
+
+      row_nums.push_back(global_dof_number);
+      col_nums.push_back(global_dof_number);
+      if (assembly_type == IS_Assembly)
+      {
+        PetscInt local_dof_number = -1;
+        if (cell.Face_ID_in_this_rank[i_face] >= 0)
+          local_dof_number =
+           face_DOF_in_this_rank[cell.Face_ID_in_this_rank[i_face]] + i_polyface;
+        local_row_nums.push_back(local_dof_number);
       }
+    }
+  }
+
+  /* The jth column of the condensed matrix is what we get from
+   * uhat_u_q_to_jth_col, when uhat is the jth unit vector, f = 0 and
+   * gN = 0. Instead of solving for one column at a time, we solve for all
+   * of them at once. The result is stored column-major, which is what
+   * MatSetValues expects with MAT_ROW_ORIENTED = false. */
+  Perf_Scope condense_scope(perf_recorder, thread_counters, Perf_Local_Solves, thread_id);
+  Eigen::MatrixXd u_of_uhat = LDLT_of_BT_Ainv_B_plus_D.solve(BT_Ainv * C + E);
+  Eigen::MatrixXd q_of_uhat = LDLT_of_A.solve(B * u_of_uhat - C);
+  Eigen::MatrixXd condensed_mat =
+   H - C.transpose() * q_of_uhat - E.transpose() * u_of_uhat;
+  condense_scope.stop();
+  if (memory_ledger.enabled)
+  {
+    /* The LDLT objects hold a copy of the matrix that they factorize. */
+    double matrix_bytes =
+     (2 * A.size() + B.size() + C.size() + 2 * D.size() + E.size() + H.size() +
+      H2.size() + M.size() + BT_Ainv.size() + u_of_uhat.size() + q_of_uhat.size() +
+      condensed_mat.size()) *
+     sizeof(double);
+    thread_matrix_bytes[thread_id % n_threads] =
+     std::max(thread_matrix_bytes[thread_id % n_threads], matrix_bytes);
+  }
+  cell_mat.assign(condensed_mat.data(), condensed_mat.data() + condensed_mat.size());
 
 #ifdef _OPENMP
 #pragma omp critical
 #endif
-      {
-        MatSetValues(global_mat,
-                     row_nums.size(),
-                     row_nums.data(),
-                     col_nums.size(),
-                     col_nums.data(),
-                     cell_mat.data(),
-                     ADD_VALUES);
-      }
+  {
+    /* The local matrix of MATIS ignores the negative (Dirichlet) rows and
+     * columns, and it never sends anything to the other ranks. */
+    if (assembly_type == IS_Assembly)
+      MatSetValuesLocal(global_mat,
+                        local_row_nums.size(),
+                        local_row_nums.data(),
+                        local_row_nums.size(),
+                        local_row_nums.data(),
+                        cell_mat.data(),
+                        ADD_VALUES);
+    else
+    {
+      MatSetValues(global_mat,
+                   row_nums.size(),
+                   row_nums.data(),
+                   col_nums.size(),
+                   col_nums.data(),
+                   cell_mat.data(),
+                   ADD_VALUES);
+      if (comm_ledger.enabled)
+        Count_Stashed_Rows(ownership_ranges,
+                           row_nums,
+                           col_nums.size() * (sizeof(PetscScalar) + 2 * sizeof(PetscInt)));
+    }
+  }
 
+  {
+    Eigen::MatrixXd gD_vec;
+    Eigen::MatrixXd gN_vec = Eigen::MatrixXd::Zero(n_trace_DOFs, 1);
+    Eigen::MatrixXd uhat_vec = Eigen::MatrixXd::Zero(n_trace_DOFs, 1);
+    for (unsigned i_face = 0;
+         (signature & (Has_Dirichlet_Face | Has_Neumann_Face)) && i_face < n_faces_per_cell;
+         ++i_face)
+    {
+      const unsigned n_polyfaces = cell.n_face_DOFs(i_face);
+      const unsigned face_start = cell.face_DOF_start(i_face);
+      poly_space_basis<face_basis_type, dim - 1> &i_face_basis =
+       face_basis(cell.face_poly_order[i_face]);
+      if ((signature & Has_Dirichlet_Face) && cell.BCs[i_face] == Cell_Class<dim>::Dirichlet)
       {
-        Eigen::MatrixXd gD_vec;
-        Eigen::MatrixXd gN_vec =
-         Eigen::MatrixXd::Zero(n_polyfaces * n_faces_per_cell, 1);
-        Eigen::MatrixXd uhat_vec =
-         Eigen::MatrixXd::Zero(n_polyfaces * n_faces_per_cell, 1);
-        for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+        cell.reinit_Face_FEValues(i_face);
+        std::vector<dealii::Point<dim>> FaceQ_Points_Loc =
+         cell.face_quad_fe_vals->get_quadrature_points();
+        std::vector<dealii::Point<dim>> face_supp_points_loc =
+         cell.face_supp_fe_vals->get_quadrature_points();
+        if (cell.half_range_flag[i_face] == 0)
         {
-          if (cell.BCs[i_face] == Cell_Class<dim>::Dirichlet)
-          {
-            cell.reinit_Face_FEValues(i_face);
-            std::vector<dealii::Point<dim>> FaceQ_Points_Loc =
-             cell.face_quad_fe_vals->get_quadrature_points();
-            std::vector<dealii::Point<dim>> face_supp_points_loc =
-             cell.face_supp_fe_vals->get_quadrature_points();
-            if (cell.half_range_flag[i_face] == 0)
-            {
-              the_face_basis.Project_to_Basis(Dirichlet_BC_func,
-                                              FaceQ_Points_Loc,
-                                              face_supp_points_loc,
-                                              Face_Q_Weights,
-                                              gD_vec);
-            }
-            else
-              std::cout << "There is something wrong dude!\n";
-            uhat_vec.block(i_face * n_polyfaces, 0, n_polyfaces, 1) = gD_vec;
-          }
-          if (cell.BCs[i_face] == Cell_Class<dim>::Neumann)
-          {
-            cell.reinit_Face_FEValues(i_face);
-            Eigen::MatrixXd gN_vec_face;
-            std::vector<dealii::Point<dim>> FaceQ_Points_Loc =
-             cell.face_quad_fe_vals->get_quadrature_points();
-            std::vector<dealii::Point<dim>> face_supp_points_loc =
-             cell.face_supp_fe_vals->get_quadrature_points();
-            std::vector<dealii::Point<dim>> face_normals_at_support =
-             cell.face_supp_fe_vals->get_normal_vectors();
-            std::vector<dealii::Point<dim>> Normal_Vec_Dir =
-             cell.face_quad_fe_vals->get_normal_vectors();
-            if (cell.half_range_flag[i_face] == 0)
-              the_face_basis.Project_to_Basis(Neumann_BC_func,
-                                              FaceQ_Points_Loc,
-                                              face_supp_points_loc,
-                                              Normal_Vec_Dir,
-                                              face_normals_at_support,
-                                              Face_Q_Weights,
-                                              gN_vec_face);
-            gN_vec.block(i_face * n_polyfaces, 0, n_polyfaces, 1) = gN_vec_face;
-          }
+          i_face_basis.Project_to_Basis(Dirichlet_BC_func,
+                                        FaceQ_Points_Loc,
+                                        face_supp_points_loc,
+                                        Face_Q_Weights,
+                                        gD_vec);
         }
+        else
+          std::cout << "There is something wrong dude!\n";
+        uhat_vec.block(face_start, 0, n_polyfaces, 1) = gD_vec;
+      }
+      if ((signature & Has_Neumann_Face) && cell.BCs[i_face] == Cell_Class<dim>::Neumann)
+      {
+        cell.reinit_Face_FEValues(i_face);
+        Eigen::MatrixXd gN_vec_face;
+        std::vector<dealii::Point<dim>> FaceQ_Points_Loc =
+         cell.face_quad_fe_vals->get_quadrature_points();
+        std::vector<dealii::Point<dim>> face_supp_points_loc =
+         cell.face_supp_fe_vals->get_quadrature_points();
+        std::vector<dealii::Point<dim>> face_normals_at_support =
+         cell.face_supp_fe_vals->get_normal_vectors();
+        std::vector<dealii::Point<dim>> Normal_Vec_Dir =
+         cell.face_quad_fe_vals->get_normal_vectors();
+        if (cell.half_range_flag[i_face] == 0)
+          i_face_basis.Project_to_Basis(Neumann_BC_func,
+                                        FaceQ_Points_Loc,
+                                        face_supp_points_loc,
+                                        Normal_Vec_Dir,
+                                        face_normals_at_support,
+                                        Face_Q_Weights,
+                                        gN_vec_face);
+        gN_vec.block(face_start, 0, n_polyfaces, 1) = gN_vec_face;
+      }
+    }
 
-        std::vector<dealii::Point<dim>> elem_supp_points_loc =
-         cell.cell_supp_fe_vals->get_quadrature_points();
-        the_elem_basis.Project_to_Basis(
-         f_func, Q_Points_Loc, elem_supp_points_loc, Q_Weights, f_vec);
-        std::vector<double> rhs_col;
-        Eigen::MatrixXd u_vec, q_vec;
-        u_from_uhat_f(
-         LDLT_of_BT_Ainv_B_plus_D, BT_Ainv, C, E, M, uhat_vec, uhat_vec, f_vec, u_vec);
-        q_from_u_uhat(LDLT_of_A, B, C, uhat_vec, u_vec, q_vec);
-        uhat_u_q_to_jth_col(C, E, H, H2, uhat_vec, u_vec, q_vec, gN_vec, 1, rhs_col);
+    std::vector<dealii::Point<dim>> elem_supp_points_loc =
+     cell.cell_supp_fe_vals->get_quadrature_points();
+    elem_basis(cell.poly_order)
+     .Project_to_Basis(f_func, Q_Points_Loc, elem_supp_points_loc, Q_Weights, f_vec);
+    std::vector<double> rhs_col;
+    Eigen::MatrixXd u_vec, q_vec;
+    u_from_uhat_f(
+     LDLT_of_BT_Ainv_B_plus_D, BT_Ainv, C, E, M, uhat_vec, uhat_vec, f_vec, u_vec);
+    q_from_u_uhat(LDLT_of_A, B, C, uhat_vec, u_vec, q_vec);
+    uhat_u_q_to_jth_col(C, E, H, H2, uhat_vec, u_vec, q_vec, gN_vec, 1, rhs_col);
 #ifdef _OPENMP
 #pragma omp critical
 #endif
-        {
-          VecSetValues(RHS_vec, row_nums.size(), row_nums.data(), rhs_col.data(), ADD_VALUES);
-        }
-      }
+    {
+      VecSetValues(RHS_vec, row_nums.size(), row_nums.data(), rhs_col.data(), ADD_VALUES);
+      if (comm_ledger.enabled)
+        Count_Stashed_Rows(ownership_ranges, row_nums, sizeof(PetscScalar) + sizeof(PetscInt));
+    }
+  }
 
-      {
-        std::vector<double> exact_uhat_vec;
-        Eigen::MatrixXd face_exact_uhat_vec;
-        for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
-        {
-          cell.reinit_Face_FEValues(i_face);
-          std::vector<dealii::Point<dim>> Face_Q_Points_Loc =
-           cell.face_quad_fe_vals->get_quadrature_points();
-          std::vector<dealii::Point<dim>> face_supp_points_loc =
-           cell.face_supp_fe_vals->get_quadrature_points();
-          the_face_basis.Project_to_Basis(u_func,
-                                          Face_Q_Points_Loc,
-                                          face_supp_points_loc,
-                                          face_integration_capsul.get_weights(),
-                                          face_exact_uhat_vec);
-          exact_uhat_vec.insert(exact_uhat_vec.end(),
-                                face_exact_uhat_vec.data(),
-                                face_exact_uhat_vec.data() +
-                                 face_exact_uhat_vec.rows());
+  {
+    std::vector<double> exact_uhat_vec;
+    Eigen::MatrixXd face_exact_uhat_vec;
+    for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+    {
+      cell.reinit_Face_FEValues(i_face);
+      std::vector<dealii::Point<dim>> Face_Q_Points_Loc =
+       cell.face_quad_fe_vals->get_quadrature_points();
+      std::vector<dealii::Point<dim>> face_supp_points_loc =
+       cell.face_supp_fe_vals->get_quadrature_points();
+      face_basis(cell.face_poly_order[i_face])
+       .Project_to_Basis(u_func,
+                         Face_Q_Points_Loc,
+                         face_supp_points_loc,
+                         Face_Q_Weights,
+                         face_exact_uhat_vec);
+      exact_uhat_vec.insert(exact_uhat_vec.end(),
+                            face_exact_uhat_vec.data(),
+                            face_exact_uhat_vec.data() +
+                             face_exact_uhat_vec.rows());
+    }
+    /* The values are inserted once all faces are projected, since
+     * row_nums contains the DOFs of all faces. */
 #ifdef _OPENMP
 #pragma omp critical
 #endif
-          {
-            VecSetValues(exact_solution,
-                         row_nums.size(),
-                         row_nums.data(),
-                         exact_uhat_vec.data(),
-                         INSERT_VALUES);
-          }
+    {
+      VecSetValues(exact_solution,
+                   row_nums.size(),
+                   row_nums.data(),
+                   exact_uhat_vec.data(),
+                   INSERT_VALUES);
+      if (comm_ledger.enabled)
+        Count_Stashed_Rows(ownership_ranges, row_nums, sizeof(PetscScalar) + sizeof(PetscInt));
+    }
+  }
+  cell.detach_FEValues(fe_vals.quad_elem, fe_vals.quad_face, fe_vals.supp_elem, fe_vals.supp_face);
+}
+
+template <int dim>
+void Diffusion<dim>::Assemble_Globals()
+{
+  const PetscInt *ownership_ranges = NULL;
+  if (comm_ledger.enabled)
+    MatGetOwnershipRanges(global_mat, &ownership_ranges);
+  typedef void (Diffusion<dim>::*Assembly_Kernel)(Cell_Class<dim> &,
+                                                  std::map<unsigned, Cell_FEValues> &,
+                                                  Perf_Thread_Counters &,
+                                                  const unsigned &,
+                                                  const PetscInt *);
+  const Assembly_Kernel assembly_kernels[n_cell_signatures] = {
+    &Diffusion<dim>::template Assemble_Cell<0>, &Diffusion<dim>::template Assemble_Cell<1>,
+    &Diffusion<dim>::template Assemble_Cell<2>, &Diffusion<dim>::template Assemble_Cell<3>,
+    &Diffusion<dim>::template Assemble_Cell<4>, &Diffusion<dim>::template Assemble_Cell<5>,
+    &Diffusion<dim>::template Assemble_Cell<6>, &Diffusion<dim>::template Assemble_Cell<7>
+  };
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads)
+  {
+    unsigned thread_id = omp_get_thread_num();
+    unsigned n_team = omp_get_num_threads();
+#else
+  unsigned thread_id = 0;
+  unsigned n_team = 1;
+  {
+#endif
+    if (numa_pinning)
+      Pin_Thread_to_Core(thread_id);
+    std::map<unsigned, Cell_FEValues> fe_vals_of_order;
+    Perf_Thread_Counters thread_counters;
+    if (perf_recorder.enabled)
+      thread_counters.open(perf_recorder.fp_raw_event);
+    double batch_begin = tracer.now();
+    unsigned n_cells_in_batch = 0;
+
+    /* The buckets are visited one after the other, and each one with the
+     * kernel of its signature. */
+    for (unsigned signature = 0; signature < n_cell_signatures; ++signature)
+    {
+      Assembly_Kernel kernel = assembly_kernels[signature];
+      for (const unsigned &i_cell : Cells_of_Thread(thread_id, n_team, signature))
+      {
+        Cell_Class<dim> &cell = All_Owned_Cells[i_cell];
+        if (n_cells_in_batch == trace_batch_size)
+        {
+          tracer.record(thread_id, "assembly batch", batch_begin);
+          batch_begin = tracer.now();
+          n_cells_in_batch = 0;
         }
+        ++n_cells_in_batch;
+        (this->*kernel)(cell, fe_vals_of_order, thread_counters, thread_id, ownership_ranges);
       }
-      cell.detach_FEValues(fe_val_quad_elem, fe_val_quad_face, fe_val_supp_elem, fe_val_supp_face);
     }
+    if (n_cells_in_batch > 0)
+      tracer.record(thread_id, "assembly batch", batch_begin);
   }
 }
 
@@ -529,49 +1241,92 @@ void Diffusion<dim>::uhat_u_q_to_jth_col(const T &C,
   jth_col.assign(jth_col_vec.data(), jth_col_vec.data() + jth_col_vec.rows());
 }
 
-/**
- * In this function we initiate the FE Values objects for faces and elements.
- * We have two of each, because we want to use them for either nodal or modal
- * elements.
+/*!
+ * \brief Solves the local equations of one cell for the given trace: the
+ * trace of the cell is gathered from local_uhat_vec (or projected from the
+ * Dirichlet data), and u and q are found from it. The FEValues of the
+ * cell's own rule (cell.quad_order) are attached to the cell on return.
  */
 template <int dim>
-void Diffusion<dim>::initiate_internal_calc_fe_vals(
- std::unique_ptr<dealii::FEValues<dim>> &fe_vals_cell_1,
- std::unique_ptr<dealii::FEFaceValues<dim>> &fe_vals_face_1,
- std::unique_ptr<dealii::FEValues<dim>> &fe_vals_cell_2,
- std::unique_ptr<dealii::FEFaceValues<dim>> &fe_vals_face_2)
+void Diffusion<dim>::Local_Solve(Cell_Class<dim> &cell,
+                                 std::map<unsigned, Cell_FEValues> &fe_vals_of_order,
+                                 double *const &local_uhat_vec,
+                                 Eigen::MatrixXd &solved_uhat_vec,
+                                 Eigen::MatrixXd &solved_u_vec,
+                                 Eigen::MatrixXd &solved_q_vec)
 {
-  dealii::QGaussLobatto<dim> LGL_elem_support_points(poly_order + 1);
-  dealii::QGaussLobatto<dim - 1> LGL_face_support_points(poly_order + 1);
-
-  std::unique_ptr<dealii::FEValues<dim>> p1(new dealii::FEValues<dim>(
-   Elem_Mapping,
-   DG_Elem,
-   elem_integration_capsul,
-   dealii::update_values | dealii::update_gradients |
-    dealii::update_JxW_values | dealii::update_quadrature_points |
-    dealii::update_inverse_jacobians | dealii::update_jacobians));
-  fe_vals_cell_1 = std::move(p1);
+  Cell_FEValues &fe_vals = FEValues_of_Order(fe_vals_of_order, cell.quad_order);
+  const std::vector<double> &Q_Weights =
+   the_elem_basis.quadrature_table(cell.quad_order).quadrature.get_weights();
+  const std::vector<double> &Face_Q_Weights =
+   the_face_basis.quadrature_table(cell.quad_order).quadrature.get_weights();
+  cell.attach_FEValues(fe_vals.quad_elem, fe_vals.quad_face, fe_vals.supp_elem, fe_vals.supp_face);
+  cell.reinit_Cell_FEValues();
+
+  std::vector<dealii::Point<dim>> elem_supp_points_loc =
+   cell.cell_supp_fe_vals->get_quadrature_points();
+
+  Eigen::MatrixXd A, B, C, D, E, H, H2, M;
+  CalculateMatrices(cell);
+  cell.get_matrices(A, B, C, D, E, H, H2, M);
+
+  Eigen::LDLT<Eigen::MatrixXd, Eigen::Lower> LDLT_of_A = A.ldlt();
+  Eigen::MatrixXd BT_Ainv = LDLT_of_A.solve(B).transpose();
+  Eigen::LDLT<Eigen::MatrixXd, Eigen::Lower> LDLT_of_BT_Ainv_B_plus_D =
+   (BT_Ainv * B + D).ldlt();
 
-  std::unique_ptr<dealii::FEFaceValues<dim>> p2(new dealii::FEFaceValues<dim>(
-   Elem_Mapping,
-   DG_Elem,
-   face_integration_capsul,
-   dealii::update_values | dealii::update_gradients |
-    dealii::update_JxW_values | dealii::update_quadrature_points |
-    dealii::update_face_normal_vectors | dealii::update_inverse_jacobians));
-  fe_vals_face_1 = std::move(p2);
+  std::vector<dealii::Point<dim>> Q_Points_Loc =
+   cell.cell_quad_fe_vals->get_quadrature_points();
+  Eigen::MatrixXd exact_f_vec;
+  elem_basis(cell.poly_order)
+   .Project_to_Basis(f_func, Q_Points_Loc, elem_supp_points_loc, Q_Weights, exact_f_vec);
 
-  std::unique_ptr<dealii::FEValues<dim>> p3(new dealii::FEValues<dim>(
-   Elem_Mapping, DG_Elem, LGL_elem_support_points, dealii::update_quadrature_points));
-  fe_vals_cell_2 = std::move(p3);
+  solved_uhat_vec = Eigen::MatrixXd::Zero(cell.n_trace_DOFs(), 1);
+  Eigen::MatrixXd solved_lambda_vec = Eigen::MatrixXd::Zero(cell.n_trace_DOFs(), 1);
+  for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+  {
+    const unsigned n_polyfaces = cell.n_face_DOFs(i_face);
+    const unsigned face_start = cell.face_DOF_start(i_face);
+    int global_face_number = cell.Face_ID_in_this_rank[i_face];
+    if (global_face_number < 0)
+    {
+      Eigen::MatrixXd face_uhat_vec;
+      cell.reinit_Face_FEValues(i_face);
+      std::vector<dealii::Point<dim>> Face_Q_Points_Loc =
+       cell.face_quad_fe_vals->get_quadrature_points();
+      std::vector<dealii::Point<dim>> face_supp_points_loc =
+       cell.face_supp_fe_vals->get_quadrature_points();
+      face_basis(cell.face_poly_order[i_face])
+       .Project_to_Basis(Dirichlet_BC_func,
+                         Face_Q_Points_Loc,
+                         face_supp_points_loc,
+                         Face_Q_Weights,
+                         face_uhat_vec);
+      solved_uhat_vec.block(face_start, 0, n_polyfaces, 1) = face_uhat_vec;
+      solved_lambda_vec.block(face_start, 0, n_polyfaces, 1) = face_uhat_vec;
+    }
+    else
+    {
+      for (unsigned i_polyface = 0; i_polyface < n_polyfaces; ++i_polyface)
+      {
+        int local_dof_number = face_DOF_in_this_rank[global_face_number] + i_polyface;
+        solved_uhat_vec(face_start + i_polyface, 0) = local_uhat_vec[local_dof_number];
+      }
+    }
+  }
 
-  std::unique_ptr<dealii::FEFaceValues<dim>> p4(new dealii::FEFaceValues<dim>(
-   Elem_Mapping, DG_Elem, LGL_face_support_points, dealii::update_quadrature_points));
-  fe_vals_face_2 = std::move(p4);
+  u_from_uhat_f(LDLT_of_BT_Ainv_B_plus_D,
+                BT_Ainv,
+                C,
+                E,
+                M,
+                solved_uhat_vec,
+                solved_uhat_vec,
+                exact_f_vec,
+                solved_u_vec);
+  q_from_u_uhat(LDLT_of_A, B, C, solved_uhat_vec, solved_u_vec, solved_q_vec);
 }
 
-
 template <int dim>
 void Diffusion<dim>::Calculate_Internal_Unknowns(double *const &local_uhat_vec)
 {
@@ -591,147 +1346,184 @@ void Diffusion<dim>::Calculate_Internal_Unknowns(double *const &local_uhat_vec)
   refn_solu.reinit(refn_owned_indices, refn_ghost_indices, comm);
   elem_solu.reinit(elem_owned_indices, elem_ghost_indices, comm);
 
-  unsigned n_polys = pow(poly_order + 1, dim);
-  unsigned n_polyfaces = pow(poly_order + 1, dim - 1);
-  poly_space_basis<elem_basis_type, dim> the_elem_basis(
-   elem_integration_capsul.get_points(), support_points_1D, Domain::From_0_to_1);
-
   double Error_u = 0;
   double Error_q = 0;
   double Error_ustar = 0;
   double Error_div_q = 0;
   double Error_div_qstar = 0;
 
-  std::vector<double> Q_Weights = elem_integration_capsul.get_weights();
-  std::vector<double> Face_Q_Weights = face_integration_capsul.get_weights();
-
-  dealii::QGaussLobatto<1> postproc_support_points(poly_order + 2);
-  poly_space_basis<elem_basis_type, dim> the_postproc_elem_basis(
-   elem_integration_capsul.get_points(),
-   postproc_support_points.get_points(),
-   Domain::From_0_to_1);
-  Eigen::MatrixXd PostProcess_Mode_to_QPoint_Matrix = the_postproc_elem_basis.the_bases;
-
-  Eigen::MatrixXd Mode_to_QPoint_Matrix = the_elem_basis.the_bases;
-
-  dealii::FE_DGQ<1> DG_Elem_1D(poly_order);
-  poly_space_basis<elem_basis_type, dim> the_elem_qual_dist_basis(
-   DG_Elem.get_unit_support_points(), LGL_quad_1D.get_points(), Domain::From_0_to_1);
-  Eigen::MatrixXd Mode_to_Node_Matrix = the_elem_qual_dist_basis.the_bases;
+  /* For each order p, the postprocessing basis of order p+1 on the error rule
+   * of order p, and the matrix which gives the values of the modes of order p
+   * at the support points of DG_Elem. So, the cells of all orders are written
+   * on the nodes of poly_order. In the nodal collocation mode, this matrix is
+   * the identity, since the bases are the Lagrange polynomials on the same
+   * nodes. */
+  std::map<unsigned, poly_space_basis<elem_basis_type, dim>> postproc_bases_of_order;
+  std::map<unsigned, Eigen::MatrixXd> mode_to_node_of_order;
+  for (unsigned p = poly_order; p <= max_poly_order; ++p)
+  {
+    dealii::Quadrature<dim> elem_rule = Cell_Quadrature<dim>(Error_Quadrature_Order(p));
+    dealii::QGaussLobatto<1> postproc_support_points(p + 2);
+    dealii::QGaussLobatto<1> support_points(p + 1);
+    postproc_bases_of_order.emplace(std::piecewise_construct,
+                                    std::forward_as_tuple(p),
+                                    std::forward_as_tuple(elem_rule.get_points(),
+                                                          postproc_support_points.get_points(),
+                                                          Domain::From_0_to_1));
+    poly_space_basis<elem_basis_type, dim> the_elem_qual_dist_basis(
+     DG_Elem.get_unit_support_points(), support_points.get_points(), Domain::From_0_to_1);
+    mode_to_node_of_order[p] = the_elem_qual_dist_basis.the_bases;
+  }
+  if (hp_adaptive())
+    cell_smoothness.reinit(Grid1.n_active_cells());
+
+  /* For the Lagrange output, the matrix which gives the values of the modes
+   * of order p at the output nodes, and the place of each cell's values. */
+  std::map<unsigned, Eigen::MatrixXd> mode_to_lagrange_of_order;
+  const bool keep_lagrange_values = vtk_lagrange && full_output_this_cycle;
+  if (keep_lagrange_values)
+  {
+    for (unsigned p = poly_order; p <= max_poly_order; ++p)
+    {
+      dealii::QGaussLobatto<1> support_points(p + 1);
+      poly_space_basis<elem_basis_type, dim> the_lagrange_basis(
+       Lagrange_Output_Nodes(p), support_points.get_points(), Domain::From_0_to_1);
+      mode_to_lagrange_of_order[p] = the_lagrange_basis.the_bases;
+    }
+    lagrange_value_start.assign(All_Owned_Cells.size() + 1, 0);
+    for (unsigned i_cell = 0; i_cell < All_Owned_Cells.size(); ++i_cell)
+      lagrange_value_start[i_cell + 1] =
+       lagrange_value_start[i_cell] +
+       (dim + 1) * pow(Lagrange_Output_Order(All_Owned_Cells[i_cell].poly_order) + 1, dim);
+    /* The values are not initialized here, so that each thread places the
+     * pages of its cells when it writes them below. */
+    lagrange_values = First_Touch_Vector<double>(lagrange_value_start.back());
+  }
+  if (in_situ.enabled)
+    in_situ.begin(n_threads, All_Owned_Cells.size());
+  /* For the point queries, the modes of the head and the flow of each cell,
+   * from cell_mode_start[i_cell]. */
+  if (keep_cell_modes)
+  {
+    cell_mode_start.assign(All_Owned_Cells.size() + 1, 0);
+    for (unsigned i_cell = 0; i_cell < All_Owned_Cells.size(); ++i_cell)
+      cell_mode_start[i_cell + 1] =
+       cell_mode_start[i_cell] + (dim + 1) * pow(All_Owned_Cells[i_cell].poly_order + 1, dim);
+    cell_modes = First_Touch_Vector<double>(cell_mode_start.back());
+  }
 
 #ifdef _OPENMP
-#pragma omp parallel
+#pragma omp parallel num_threads(n_threads)
   {
     unsigned thread_id = omp_get_thread_num();
+    unsigned n_team = omp_get_num_threads();
 #else
   unsigned thread_id = 0;
+  unsigned n_team = 1;
   {
 #endif
-    std::unique_ptr<dealii::FEValues<dim>> fe_val_quad_elem, fe_val_supp_elem;
-    std::unique_ptr<dealii::FEFaceValues<dim>> fe_val_quad_face, fe_val_supp_face;
-    initiate_internal_calc_fe_vals(
-     fe_val_quad_elem, fe_val_quad_face, fe_val_supp_elem, fe_val_supp_face);
-
-    for (unsigned i_cell = thread_id; i_cell < All_Owned_Cells.size();
-         i_cell = i_cell + n_threads)
+    if (numa_pinning)
+      Pin_Thread_to_Core(thread_id);
+    std::map<unsigned, Cell_FEValues> fe_vals_of_order;
+    Perf_Thread_Counters thread_counters;
+    if (perf_recorder.enabled)
+      thread_counters.open(perf_recorder.fp_raw_event);
+    double batch_begin = tracer.now();
+    unsigned n_cells_in_batch = 0;
+
+    for (const unsigned &i_cell : Cells_of_Thread(thread_id, n_team))
     {
+      Perf_Scope recovery_scope(perf_recorder, thread_counters, Perf_Local_Recovery, thread_id);
       Cell_Class<dim> &cell = All_Owned_Cells[i_cell];
-      cell.attach_FEValues(fe_val_quad_elem, fe_val_quad_face, fe_val_supp_elem, fe_val_supp_face);
-      cell.reinit_Cell_FEValues();
-
-      std::vector<dealii::Point<dim>> elem_supp_points_loc =
-       cell.cell_supp_fe_vals->get_quadrature_points();
-
-      char buffer[100];
-      std::snprintf(buffer,
-                    100,
-                    "I am thread num. %d on element: %d from %zu",
-                    thread_id,
-                    i_cell,
-                    All_Owned_Cells.size());
-
-      Eigen::MatrixXd A, B, C, D, E, H, H2, M;
-      CalculateMatrices(cell);
-      cell.get_matrices(A, B, C, D, E, H, H2, M);
-
-      Eigen::MatrixXd BT_Ainv = B.transpose() * A.inverse();
-      Eigen::LDLT<Eigen::MatrixXd, Eigen::Lower> LDLT_of_A = A.ldlt();
-      Eigen::LDLT<Eigen::MatrixXd, Eigen::Lower> LDLT_of_BT_Ainv_B_plus_D =
-       (BT_Ainv * B + D).ldlt();
-
-      std::vector<dealii::Point<dim>> Q_Points_Loc =
-       cell.cell_quad_fe_vals->get_quadrature_points();
-      Eigen::MatrixXd exact_f_vec;
-      the_elem_basis.Project_to_Basis(
-       f_func, Q_Points_Loc, elem_supp_points_loc, Q_Weights, exact_f_vec);
-
-      Eigen::MatrixXd solved_uhat_vec =
-       Eigen::MatrixXd::Zero(n_polyfaces * n_faces_per_cell, 1);
-      Eigen::MatrixXd solved_lambda_vec =
-       Eigen::MatrixXd::Zero(n_polyfaces * n_faces_per_cell, 1);
-      for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+      if (n_cells_in_batch == trace_batch_size)
       {
-        int global_face_number = cell.Face_ID_in_this_rank[i_face];
-        if (global_face_number < 0)
-        {
-          Eigen::MatrixXd face_uhat_vec;
-          cell.reinit_Face_FEValues(i_face);
-          std::vector<dealii::Point<dim>> Face_Q_Points_Loc =
-           cell.face_quad_fe_vals->get_quadrature_points();
-          std::vector<dealii::Point<dim>> face_supp_points_loc =
-           cell.face_supp_fe_vals->get_quadrature_points();
-          the_face_basis.Project_to_Basis(Dirichlet_BC_func,
-                                          Face_Q_Points_Loc,
-                                          face_supp_points_loc,
-                                          Face_Q_Weights,
-                                          face_uhat_vec);
-          solved_uhat_vec.block(i_face * n_polyfaces, 0, n_polyfaces, 1) = face_uhat_vec;
-          solved_lambda_vec.block(i_face * n_polyfaces, 0, n_polyfaces, 1) =
-           face_uhat_vec;
-        }
-        else
-        {
-          for (unsigned i_polyface = 0; i_polyface < n_polyfaces; ++i_polyface)
-          {
-            int global_dof_number = global_face_number * n_polyfaces + i_polyface;
-            solved_uhat_vec(i_face * n_polyfaces + i_polyface, 0) =
-             local_uhat_vec[global_dof_number];
-          }
-        }
+        tracer.record(thread_id, "recovery batch", batch_begin);
+        batch_begin = tracer.now();
+        n_cells_in_batch = 0;
+      }
+      ++n_cells_in_batch;
+      const unsigned n_polys = pow(cell.poly_order + 1, dim);
+      const unsigned error_order = Error_Quadrature_Order(cell.poly_order);
+      /* The local matrices and the right hand side are integrated with the
+       * rule of this cell, the same as in the assembly. The errors and the
+       * postprocessing use the fixed rule of the cell's order. */
+      Eigen::MatrixXd solved_uhat_vec, solved_u_vec, solved_q_vec;
+      Local_Solve(
+       cell, fe_vals_of_order, local_uhat_vec, solved_uhat_vec, solved_u_vec, solved_q_vec);
+      Cell_FEValues &fe_vals = fe_vals_of_order[cell.quad_order];
+
+      if (error_order != cell.quad_order)
+      {
+        cell.detach_FEValues(
+         fe_vals.quad_elem, fe_vals.quad_face, fe_vals.supp_elem, fe_vals.supp_face);
+        Cell_FEValues &error_fe_vals = FEValues_of_Order(fe_vals_of_order, error_order);
+        cell.attach_FEValues(error_fe_vals.quad_elem,
+                             error_fe_vals.quad_face,
+                             error_fe_vals.supp_elem,
+                             error_fe_vals.supp_face);
+        cell.reinit_Cell_FEValues();
       }
+      const Quadrature_Table<dim> &error_table =
+       elem_basis(cell.poly_order).quadrature_table(error_order);
 
-      Eigen::MatrixXd solved_q_vec, solved_u_vec;
-      u_from_uhat_f(LDLT_of_BT_Ainv_B_plus_D,
-                    BT_Ainv,
-                    C,
-                    E,
-                    M,
-                    solved_uhat_vec,
-                    solved_uhat_vec,
-                    exact_f_vec,
-                    solved_u_vec);
-      q_from_u_uhat(LDLT_of_A, B, C, solved_uhat_vec, solved_u_vec, solved_q_vec);
 
       Internal_Vars_Errors(
-       cell, solved_u_vec, solved_q_vec, Mode_to_QPoint_Matrix, Error_u, Error_q, Error_div_q);
+       cell, error_table, solved_u_vec, solved_q_vec, Error_u, Error_q, Error_div_q);
 
       Eigen::MatrixXd ustar;
+      const poly_space_basis<elem_basis_type, dim> &postproc_basis =
+       postproc_bases_of_order.at(cell.poly_order);
       PostProcess(cell,
-                  the_postproc_elem_basis,
+                  error_table,
+                  postproc_basis,
                   solved_u_vec,
                   solved_q_vec,
                   ustar,
-                  PostProcess_Mode_to_QPoint_Matrix,
+                  postproc_basis.the_bases,
                   Error_ustar);
 
+      if (hp_adaptive())
+        cell_smoothness(cell.dealii_Cell->active_cell_index()) =
+         Legendre_Decay_Rate(solved_u_vec, cell.poly_order);
+
+      if (in_situ.enabled)
+        In_Situ_Cell(cell,
+                     i_cell,
+                     error_order,
+                     solved_uhat_vec,
+                     solved_u_vec,
+                     solved_q_vec,
+                     in_situ.thread_sums[thread_id]);
+
+      if (keep_cell_modes)
+      {
+        Eigen::Map<Eigen::VectorXd> modes(&cell_modes[cell_mode_start[i_cell]],
+                                          (dim + 1) * n_polys);
+        modes.segment(0, n_polys) = solved_u_vec.col(0);
+        modes.segment(n_polys, dim * n_polys) = solved_q_vec.col(0);
+      }
+
+      if (keep_lagrange_values)
+      {
+        const Eigen::MatrixXd &Mode_to_Lagrange = mode_to_lagrange_of_order.at(cell.poly_order);
+        const unsigned n_nodes = Mode_to_Lagrange.rows();
+        Eigen::Map<Eigen::VectorXd> cell_values(&lagrange_values[lagrange_value_start[i_cell]],
+                                                (dim + 1) * n_nodes);
+        cell_values.segment(0, n_nodes) = Mode_to_Lagrange * solved_u_vec;
+        for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+          cell_values.segment((i_dim + 1) * n_nodes, n_nodes) =
+           Mode_to_Lagrange * solved_q_vec.block(i_dim * n_polys, 0, n_polys, 1);
+      }
+
+      const Eigen::MatrixXd &Mode_to_Node_Matrix = mode_to_node_of_order.at(cell.poly_order);
       Eigen::MatrixXd solved_u_at_nodes = Mode_to_Node_Matrix * solved_u_vec;
-      Eigen::MatrixXd solved_q_at_nodes(dim * n_polys, 1);
+      unsigned n_local_unknown = solved_u_at_nodes.rows();
+      Eigen::MatrixXd solved_q_at_nodes(dim * n_local_unknown, 1);
       for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
       {
-        solved_q_at_nodes.block(i_dim * n_polys, 0, n_polys, 1) =
+        solved_q_at_nodes.block(i_dim * n_local_unknown, 0, n_local_unknown, 1) =
          Mode_to_Node_Matrix * solved_q_vec.block(i_dim * n_polys, 0, n_polys, 1);
       }
-      unsigned n_local_unknown = solved_u_at_nodes.rows();
 
       for (unsigned i_local_unknown = 0; i_local_unknown < n_local_unknown; ++i_local_unknown)
       {
@@ -741,23 +1533,34 @@ void Diffusion<dim>::Calculate_Internal_Unknowns(double *const &local_uhat_vec)
           temp_val +=
            std::pow(solved_q_at_nodes(i_dim * n_local_unknown + i_local_unknown, 0), 2);
         }
-        refn_owned_values[i_cell * n_local_unknown + i_local_unknown] = sqrt(temp_val);
+        refn_owned_values[cell.id_num * n_local_unknown + i_local_unknown] =
+         sqrt(temp_val);
       }
 
+      /* We use id_num instead of i_cell, because the cells might have been
+       * renumbered, while the deal.II DOFs are in the original order. */
       for (unsigned i_local_unknown = 0; i_local_unknown < n_local_unknown; ++i_local_unknown)
       {
-        elem_owned_values[(i_cell * n_local_unknown) * (dim + 1) + i_local_unknown] =
+        elem_owned_values[(cell.id_num * n_local_unknown) * (dim + 1) + i_local_unknown] =
          solved_u_at_nodes(i_local_unknown, 0);
         for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
         {
-          elem_owned_values[(i_cell * n_local_unknown) * (dim + 1) +
+          elem_owned_values[(cell.id_num * n_local_unknown) * (dim + 1) +
                             (i_dim + 1) * n_local_unknown + i_local_unknown] =
            solved_q_at_nodes(i_dim * n_local_unknown + i_local_unknown, 0);
         }
       }
-      cell.detach_FEValues(fe_val_quad_elem, fe_val_quad_face, fe_val_supp_elem, fe_val_supp_face);
+      Cell_FEValues &attached_fe_vals = fe_vals_of_order[error_order];
+      cell.detach_FEValues(attached_fe_vals.quad_elem,
+                           attached_fe_vals.quad_face,
+                           attached_fe_vals.supp_elem,
+                           attached_fe_vals.supp_face);
     }
+    if (n_cells_in_batch > 0)
+      tracer.record(thread_id, "recovery batch", batch_begin);
   }
+  if (numa_report)
+    Report_NUMA_Placement();
 
   refn_sol_temp.set(refn_owned_indices_vec, refn_owned_values);
   refn_sol_temp.compress(dealii::VectorOperation::insert);
@@ -765,6 +1568,10 @@ void Diffusion<dim>::Calculate_Internal_Unknowns(double *const &local_uhat_vec)
   elem_sol_temp.compress(dealii::VectorOperation::insert);
   refn_solu = refn_sol_temp;
   elem_solu = elem_sol_temp;
+  if (in_situ.enabled)
+    Finish_In_Situ();
+  if (!query_points.empty())
+    Run_Point_Queries();
 
   double global_Error_u, global_Error_q, global_Error_ustar;
   MPI_Reduce(&Error_u, &global_Error_u, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
@@ -808,16 +1615,17 @@ void Diffusion<dim>::Calculate_Internal_Unknowns(double *const &local_uhat_vec)
 }
 
 template <int dim>
-template <typename T1, typename T2>
+template <typename T1>
 void Diffusion<dim>::Internal_Vars_Errors(const Cell_Class<dim> &cell,
+                                          const Quadrature_Table<dim> &elem_table,
                                           const T1 &solved_u_vec,
                                           const T1 &solved_q_vec,
-                                          const T2 &Mode_to_Qpoints_Matrix,
                                           double &Error_u,
                                           double &Error_q,
                                           double &Error_div_q)
 {
-  unsigned n_polys = pow(poly_order + 1, dim);
+  unsigned n_polys = pow(cell.poly_order + 1, dim);
+  const Eigen::MatrixXd &Mode_to_Qpoints_Matrix = elem_table.the_bases;
   std::vector<dealii::DerivativeForm<1, dim, dim>> D_Forms =
    cell.cell_quad_fe_vals->get_inverse_jacobians();
 
@@ -842,8 +1650,7 @@ void Diffusion<dim>::Internal_Vars_Errors(const Cell_Class<dim> &cell,
     double divq_at_i_Qpoint = 0;
     for (unsigned i_poly = 0; i_poly < n_polys; ++i_poly)
     {
-      dealii::Tensor<1, dim> grad_X =
-       the_elem_basis.bases_grads[i_Qpoint][i_poly] * d_form;
+      dealii::Tensor<1, dim> grad_X = elem_table.bases_grads[i_Qpoint][i_poly] * d_form;
       for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
       {
         divq_at_i_Qpoint += grad_X[i_dim] * solved_q_vec(i_dim * n_polys + i_poly, 0);
@@ -878,12 +1685,13 @@ template <int dim>
 template <typename T>
 void Diffusion<dim>::Calculate_Postprocess_Matrices(
  Cell_Class<dim> &cell,
+ const Quadrature_Table<dim> &elem_table,
  const poly_space_basis<elem_basis_type, dim> &PostProcess_Elem_Basis,
  T &DM_star,
  T &DB2)
 {
-  const unsigned n_polys = pow(poly_order + 1, dim);
-  const unsigned n_polys_plus1 = pow(poly_order + 2, dim);
+  const unsigned n_polys = pow(cell.poly_order + 1, dim);
+  const unsigned n_polys_plus1 = pow(cell.poly_order + 2, dim);
 
   std::vector<dealii::DerivativeForm<1, dim, dim>> D_Forms =
    cell.cell_quad_fe_vals->get_inverse_jacobians();
@@ -895,7 +1703,7 @@ void Diffusion<dim>::Calculate_Postprocess_Matrices(
   DB2 = T::Zero(n_polys_plus1, dim * n_polys);
 
   Eigen::MatrixXd grad_Ni, Ni_vec;
-  for (unsigned i_point = 0; i_point < elem_integration_capsul.size(); ++i_point)
+  for (unsigned i_point = 0; i_point < elem_table.quadrature.size(); ++i_point)
   {
     dealii::Tensor<2, dim> d_form = D_Forms[i_point];
     grad_Ni = Eigen::MatrixXd::Zero(n_polys_plus1, dim);
@@ -912,11 +1720,10 @@ void Diffusion<dim>::Calculate_Postprocess_Matrices(
     for (unsigned i_poly = 0; i_poly < n_polys; ++i_poly)
     {
       for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
-        Ni_vec(i_dim * n_polys + i_poly, i_dim) =
-         the_elem_basis.bases[i_point][i_poly];
+        Ni_vec(i_dim * n_polys + i_poly, i_dim) = elem_table.bases[i_point][i_poly];
     }
     DM_star += cell_JxW[i_point] * grad_Ni * grad_Ni.transpose();
-    Eigen::MatrixXd kappa_inv_ =
+    const Eigen::Matrix<double, dim, dim> kappa_inv_ =
      kappa_inv.value(QPoints_Locs[i_point], QPoints_Locs[i_point]);
     DB2 += cell_JxW[i_point] * grad_Ni * kappa_inv_ * Ni_vec.transpose();
   }
@@ -925,6 +1732,7 @@ void Diffusion<dim>::Calculate_Postprocess_Matrices(
 template <int dim>
 template <typename T1>
 void Diffusion<dim>::PostProcess(Cell_Class<dim> &cell,
+                                 const Quadrature_Table<dim> &elem_table,
                                  const poly_space_basis<elem_basis_type, dim> &PostProcess_Elem_Basis,
                                  const T1 &u,
                                  const T1 &q,
@@ -938,7 +1746,7 @@ void Diffusion<dim>::PostProcess(Cell_Class<dim> &cell,
    cell.cell_quad_fe_vals->get_quadrature_points();
   std::vector<double> Q_JxWs = cell.cell_quad_fe_vals->get_JxW_values();
 
-  Calculate_Postprocess_Matrices(cell, PostProcess_Elem_Basis, LHS_mat_of_ustar, DB2);
+  Calculate_Postprocess_Matrices(cell, elem_table, PostProcess_Elem_Basis, LHS_mat_of_ustar, DB2);
   Eigen::MatrixXd RHS_vec_of_ustar = -DB2 * q;
   LHS_mat_of_ustar(0, 0) = 1;
   RHS_vec_of_ustar(0, 0) = u(0);
@@ -948,9 +1756,114 @@ void Diffusion<dim>::PostProcess(Cell_Class<dim> &cell,
   error_ustar += error_ustar_at_cell;
 }
 
+/*!
+ * \brief The order of the Lagrange cells of the output; VTK has no cells of
+ * order zero, so those are written as linear cells.
+ */
+template <int dim>
+unsigned Diffusion<dim>::Lagrange_Output_Order(const unsigned &p) const
+{
+  return std::max(p, 1u);
+}
+
+/*!
+ * \brief The equidistant nodes of the Lagrange cell of order
+ * Lagrange_Output_Order(p) on the unit cell, in the VTK order.
+ */
+template <int dim>
+std::vector<dealii::Point<dim>> Diffusion<dim>::Lagrange_Output_Nodes(const unsigned &p) const
+{
+  const unsigned p_out = Lagrange_Output_Order(p);
+  const std::vector<unsigned> vtk_index_of_node = VTK_Lagrange_Order(dim, p_out);
+  std::vector<dealii::Point<dim>> nodes(vtk_index_of_node.size());
+  for (unsigned i_node = 0; i_node < nodes.size(); ++i_node)
+  {
+    unsigned lexicographic_index = i_node;
+    for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+    {
+      nodes[vtk_index_of_node[i_node]][i_dim] = (double)(lexicographic_index % (p_out + 1)) / p_out;
+      lexicographic_index /= (p_out + 1);
+    }
+  }
+  return nodes;
+}
+
+/*!
+ * \brief Writes the values which are kept by Calculate_Internal_Unknowns with
+ * the Lagrange cells of VTK. The nodes are mapped by the d-linear map of the
+ * cell, which is the same as Elem_Mapping.
+ * \return the bytes of the appended data.
+ */
+template <int dim>
+uint64_t Diffusion<dim>::Write_Lagrange_VTU(const std::string &file_name)
+{
+  VTK_Lagrange_Writer writer(dim, vtk_compress);
+  const unsigned head_array = writer.add_array("head", 1, true);
+  const unsigned flow_array = writer.add_array("flow", 3, true);
+  const unsigned subdomain_array = writer.add_array("subdomain", 1, false);
+  const unsigned order_array = writer.add_array("order", 1, false);
+  std::map<unsigned, std::vector<dealii::Point<dim>>> nodes_of_order;
+  for (unsigned i_cell = 0; i_cell < All_Owned_Cells.size(); ++i_cell)
+  {
+    const Cell_Class<dim> &cell = All_Owned_Cells[i_cell];
+    if (nodes_of_order.find(cell.poly_order) == nodes_of_order.end())
+      nodes_of_order[cell.poly_order] = Lagrange_Output_Nodes(cell.poly_order);
+    const std::vector<dealii::Point<dim>> &unit_nodes = nodes_of_order[cell.poly_order];
+    const unsigned n_nodes = unit_nodes.size();
+    std::vector<double> node_coords(3 * n_nodes, 0);
+    for (unsigned i_node = 0; i_node < n_nodes; ++i_node)
+      for (unsigned i_vertex = 0; i_vertex < dealii::GeometryInfo<dim>::vertices_per_cell;
+           ++i_vertex)
+      {
+        double shape_value =
+         dealii::GeometryInfo<dim>::d_linear_shape_function(unit_nodes[i_node], i_vertex);
+        for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+          node_coords[3 * i_node + i_dim] +=
+           shape_value * cell.dealii_Cell->vertex(i_vertex)[i_dim];
+      }
+    writer.add_cell(node_coords);
+
+    const double *cell_values = &lagrange_values[lagrange_value_start[i_cell]];
+    std::vector<double> &heads = writer.point_data[head_array].values;
+    std::vector<double> &flows = writer.point_data[flow_array].values;
+    heads.insert(heads.end(), cell_values, cell_values + n_nodes);
+    for (unsigned i_node = 0; i_node < n_nodes; ++i_node)
+      for (unsigned i_dim = 0; i_dim < 3; ++i_dim)
+        flows.push_back(i_dim < dim ? cell_values[(i_dim + 1) * n_nodes + i_node] : 0);
+    writer.cell_data[subdomain_array].values.push_back(comm_rank);
+    writer.cell_data[order_array].values.push_back(cell.poly_order);
+  }
+  uint64_t n_bytes = writer.write(file_name + ".vtu");
+
+  if (comm_rank == 0)
+  {
+    std::vector<std::string> piece_names;
+    for (unsigned i_rank = 0; i_rank < comm_size; ++i_rank)
+      piece_names.push_back("solution-" + dealii::Utilities::int_to_string(refn_cycle, 2) + "." +
+                            dealii::Utilities::int_to_string(i_rank, 4) + ".vtu");
+    writer.Write_PVTU(file_name + ".pvtu", piece_names);
+  }
+  return n_bytes;
+}
+
 template <int dim>
 void Diffusion<dim>::vtk_visualizer()
 {
+  Trace_Scope output_scope(tracer, 0, "output");
+  memory_ledger.begin_phase();
+  double t1 = MPI_Wtime();
+  const std::string filename =
+   ("solution-" + dealii::Utilities::int_to_string(refn_cycle, 2) + "." +
+    dealii::Utilities::int_to_string(comm_rank, 4));
+  if (vtk_lagrange)
+  {
+    double n_bytes = Write_Lagrange_VTU(filename);
+    memory_ledger.count("Lagrange output values", Vector_Bytes(lagrange_values));
+    memory_ledger.end_phase("output");
+    Report_Output(MPI_Wtime() - t1, n_bytes);
+    return;
+  }
+
   dealii::DataOut<dim> data_out;
   data_out.attach_dof_handler(DoF_H_System);
 
@@ -973,13 +1886,22 @@ void Diffusion<dim>::vtk_visualizer()
     subdomain(i) = comm_rank;
   data_out.add_data_vector(subdomain, "subdomain");
 
+  dealii::Vector<float> cell_order(Grid1.n_active_cells());
+  if (hp_adaptive())
+  {
+    for (Cell_Type &&cell : Grid1.active_cell_iterators())
+      if (cell->is_locally_owned())
+        cell_order(cell->active_cell_index()) = Order_of_Cell(cell);
+    data_out.add_data_vector(cell_order, "order");
+  }
+
   data_out.build_patches();
+  memory_ledger.count("DataOut patches", data_out.memory_consumption());
 
-  const std::string filename =
-   ("solution-" + dealii::Utilities::int_to_string(refn_cycle, 2) + "." +
-    dealii::Utilities::int_to_string(comm_rank, 4));
   std::ofstream output((filename + ".vtu").c_str());
   data_out.write_vtu(output);
+  double n_bytes = output.tellp();
+  memory_ledger.end_phase("output");
 
   if (comm_rank == 0)
   {
@@ -991,4 +1913,29 @@ void Diffusion<dim>::vtk_visualizer()
     std::ofstream master_output((filename + ".pvtu").c_str());
     data_out.write_pvtu_record(master_output, filenames);
   }
+  Report_Output(MPI_Wtime() - t1, n_bytes);
+}
+
+/*!
+ * \brief Writes the time (max over the ranks) and the bytes (sum over the
+ * ranks) of the output of this cycle, to compare the two output modes.
+ */
+template <int dim>
+void Diffusion<dim>::Report_Output(const double &output_time, const double &n_bytes)
+{
+  double max_time, all_bytes;
+  MPI_Reduce(&output_time, &max_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+  MPI_Reduce(&n_bytes, &all_bytes, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+  if (comm_rank == 0)
+  {
+    char buffer[200];
+    std::snprintf(buffer,
+                  200,
+                  "Output of cycle %d (%s) : %12.4e s, %12.4e bytes",
+                  refn_cycle,
+                  vtk_lagrange ? "Lagrange cells" : "DataOut patches",
+                  max_time,
+                  all_bytes);
+    Execution_Time << buffer << std::endl;
+  }
 }
@@ -0,0 +1,41 @@
+#include <string>
+#include <petscksp.h>
+
+#ifndef DIRECT_SOLVER_HPP
+#define DIRECT_SOLVER_HPP
+
+/*!
+ * \defgroup direct_solver Direct solver
+ * \brief
+ * The sparse direct solve of the global trace system, as an alternative to
+ * CG with GAMG. A parallel package (MUMPS, or SuperLU_DIST with LU) is used
+ * when PETSc is built with it; on one rank, the Cholesky factorization of
+ * PETSc with nested dissection ordering is used. The mesh changes in every
+ * cycle and the system is solved once per cycle, so the factors are made for
+ * each solve and freed right after it.
+ */
+
+/*!
+ * \ingroup direct_solver
+ * \brief The options of the direct solver.
+ */
+struct Direct_Solver_Options
+{
+  Direct_Solver_Options()
+    : enabled(false), use_LU(false), max_bytes(4096.0 * 1048576.0), fill(10.0)
+  {
+  }
+
+  bool enabled;
+  /* The package of MatGetFactor; empty if there is no package which can
+   * factor the distributed matrix. */
+  std::string package;
+  bool use_LU;
+  /* Above this estimate of the bytes of the factors of one rank, CG and
+   * GAMG are used instead. The estimate is fill times the bytes of the
+   * local rows of the matrix. */
+  double max_bytes;
+  double fill;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#ifndef EVENT_TRACER_HPP
+#define EVENT_TRACER_HPP
+
+/*!
+ * \defgroup tracer Event tracer
+ * \brief
+ * A small tracer which records the begin and end times of the spans of work
+ * in each thread, and writes them in the trace event format of Chrome (which
+ * is also read by Perfetto). Each rank writes its own file, where the rank
+ * is the process and the OpenMP thread is the thread of the timeline.
+ */
+
+/*!
+ * \ingroup tracer
+ * \brief One span; \c name should be a string literal, since only the
+ * pointer is kept.
+ */
+struct Trace_Event
+{
+  const char *name;
+  double begin;
+  double end;
+};
+
+/*!
+ * \ingroup tracer
+ * \brief The events of one thread. When the buffer is full, the oldest events
+ * are overwritten. Only the owner thread writes into it, so no lock is
+ * needed; it is aligned to a cache line, so that the counters of different
+ * threads do not share a line.
+ */
+struct alignas(64) Trace_Ring
+{
+  Trace_Ring() : n_recorded(0)
+  {
+  }
+
+  void record(const char *name, const double &begin, const double &end)
+  {
+    if (events.size() == 0)
+      return;
+    Trace_Event &the_event = events[n_recorded % events.size()];
+    the_event.name = name;
+    the_event.begin = begin;
+    the_event.end = end;
+    ++n_recorded;
+  }
+
+  std::vector<Trace_Event> events;
+  uint64_t n_recorded;
+};
+
+/*!
+ * \ingroup tracer
+ * \brief Keeps one Trace_Ring for each thread. The times are in microseconds
+ * from the call to start(), which should be called by all ranks right after
+ * a barrier, so that the timelines of the ranks are aligned.
+ */
+struct Event_Tracer
+{
+  Event_Tracer() : enabled(false)
+  {
+  }
+
+  void setup(const bool &enabled_, const unsigned &n_threads, const unsigned &capacity)
+  {
+    enabled = enabled_;
+    rings.assign(enabled ? n_threads : 0, Trace_Ring());
+    for (Trace_Ring &ring : rings)
+      ring.events.resize(capacity);
+  }
+
+  void start()
+  {
+    zero_time = std::chrono::steady_clock::now();
+  }
+
+  double now() const
+  {
+    std::chrono::duration<double, std::micro> elapsed =
+     std::chrono::steady_clock::now() - zero_time;
+    return elapsed.count();
+  }
+
+  void record(const unsigned &thread_id, const char *name, const double &begin)
+  {
+    if (enabled)
+      rings[thread_id % rings.size()].record(name, begin, now());
+  }
+
+  /*!
+   * \details Writes the events of this rank as a JSON array (without the
+   * brackets), which can be concatenated with the events of the other ranks.
+   * \return the number of events which were lost, because the ring was full.
+   */
+  uint64_t Write_Events(std::ostream &out, const unsigned &rank) const
+  {
+    uint64_t n_lost = 0;
+    char buffer[300];
+    std::snprintf(buffer,
+                  300,
+                  "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":0,"
+                  "\"args\":{\"name\":\"rank %u\"}}",
+                  rank,
+                  rank);
+    out << buffer;
+    for (unsigned i_thread = 0; i_thread < rings.size(); ++i_thread)
+    {
+      const Trace_Ring &ring = rings[i_thread];
+      std::snprintf(buffer,
+                    300,
+                    ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,"
+                    "\"args\":{\"name\":\"thread %u\"}}",
+                    rank,
+                    i_thread,
+                    i_thread);
+      out << buffer;
+      uint64_t n_kept = std::min<uint64_t>(ring.n_recorded, ring.events.size());
+      n_lost += ring.n_recorded - n_kept;
+      for (uint64_t i_event = ring.n_recorded - n_kept; i_event < ring.n_recorded; ++i_event)
+      {
+        const Trace_Event &the_event = ring.events[i_event % ring.events.size()];
+        std::snprintf(buffer,
+                      300,
+                      ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,"
+                      "\"ts\":%.3f,\"dur\":%.3f}",
+                      the_event.name,
+                      rank,
+                      i_thread,
+                      the_event.begin,
+                      the_event.end - the_event.begin);
+        out << buffer;
+      }
+    }
+    return n_lost;
+  }
+
+  bool enabled;
+  std::vector<Trace_Ring> rings;
+  std::chrono::steady_clock::time_point zero_time;
+};
+
+/*!
+ * \ingroup tracer
+ * \brief Records a span from its construction to its destruction (or to
+ * stop()).
+ */
+struct Trace_Scope
+{
+  Trace_Scope(Event_Tracer &tracer_, const unsigned &thread_id_, const char *name_)
+    : tracer(tracer_), thread_id(thread_id_), name(name_), stopped(!tracer_.enabled)
+  {
+    if (!stopped)
+      begin = tracer.now();
+  }
+
+  ~Trace_Scope()
+  {
+    stop();
+  }
+
+  void stop()
+  {
+    if (stopped)
+      return;
+    stopped = true;
+    tracer.record(thread_id, name, begin);
+  }
+
+  Event_Tracer &tracer;
+  unsigned thread_id;
+  const char *name;
+  bool stopped;
+  double begin;
+};
+
+#endif
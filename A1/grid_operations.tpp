@@ -17,7 +17,13 @@ void Diffusion<dim>::Set_Boundary_Indicator()
    *
    * The following boundary condition loop should be applied on every active
    * face, either ghost or locally owned.
+   *
+   * For the imported meshes, the boundary ids are the tags of the file,
+   * which the children inherit, and Map_Boundary_Tags gives the boundary
+   * condition of each tag.
    */
+  if (mesh_imported)
+    return;
   for (Cell_Type &&cell : Grid1.active_cell_iterators())
   {
     for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
@@ -37,6 +43,260 @@ void Diffusion<dim>::Set_Boundary_Indicator()
   }
 }
 
+/*!
+ * \brief Creates the coarse mesh from a file. The Gmsh files are read by
+ * every rank from the file system, and the binary files are read by
+ * Read_Coarse_Mesh, where each rank reads one part of the file by MPI-IO.
+ * In both cases, nothing is sent from rank zero. The tags of the boundary
+ * faces are kept as their boundary ids. In the binary format, the tags of the
+ * interior faces are kept as their manifold ids, because deal.II allows
+ * boundary ids only on the boundary; no manifold is attached to these ids,
+ * so the faces stay straight.
+ * \return false if the file cannot be read; then, the grid is not touched.
+ */
+template <int dim>
+bool Diffusion<dim>::Import_Coarse_Mesh(const std::string &file_name)
+{
+  double t1 = MPI_Wtime();
+  if (file_name.size() > 4 && file_name.substr(file_name.size() - 4) == ".msh")
+  {
+    std::ifstream msh_file(file_name);
+    int local_fail = !msh_file.good(), any_fail;
+    MPI_Allreduce(&local_fail, &any_fail, 1, MPI_INT, MPI_MAX, comm);
+    if (any_fail)
+    {
+      OutLogger(std::cout,
+                " HEY! : Cannot read the mesh file " + file_name +
+                 "; we use the unit hypercube instead. \n");
+      return false;
+    }
+    dealii::GridIn<dim> grid_in;
+    grid_in.attach_triangulation(Grid1);
+    grid_in.read_msh(msh_file);
+  }
+  else
+  {
+    Coarse_Mesh the_mesh;
+    std::string read_error = Read_Coarse_Mesh(file_name, comm, the_mesh);
+    if (read_error.empty() && the_mesh.dim != dim)
+      read_error = file_name + " has a mesh of another dimension";
+    if (!read_error.empty())
+    {
+      OutLogger(std::cout,
+                " HEY! : " + read_error + "; we use the unit hypercube instead. \n");
+      return false;
+    }
+
+    std::vector<dealii::Point<dim>> vertices(the_mesh.n_vertices());
+    for (unsigned i_vertex = 0; i_vertex < vertices.size(); ++i_vertex)
+      for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+        vertices[i_vertex][i_dim] = the_mesh.vertices[i_vertex * dim + i_dim];
+
+    /* The faces are found by their sorted vertices; a face of two cells is
+     * interior. */
+    const unsigned n_face_vertices = dealii::GeometryInfo<dim>::vertices_per_face;
+    auto face_key = [&](const unsigned *cell_vertices, const unsigned &i_face)
+    {
+      std::vector<unsigned> key(n_face_vertices);
+      for (unsigned i_vertex = 0; i_vertex < n_face_vertices; ++i_vertex)
+        key[i_vertex] =
+         cell_vertices[dealii::GeometryInfo<dim>::face_to_cell_vertices(i_face, i_vertex)];
+      std::sort(key.begin(), key.end());
+      return key;
+    };
+    std::vector<dealii::CellData<dim>> cells(the_mesh.n_cells());
+    std::map<std::vector<unsigned>, unsigned> n_cells_of_face;
+    for (unsigned i_cell = 0; i_cell < cells.size(); ++i_cell)
+    {
+      for (unsigned i_vertex = 0; i_vertex < the_mesh.n_vertices_per_cell(); ++i_vertex)
+        cells[i_cell].vertices[i_vertex] = the_mesh.vertex_of_cell(i_cell, i_vertex);
+      cells[i_cell].material_id = 0;
+      for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+        ++n_cells_of_face[face_key(cells[i_cell].vertices, i_face)];
+    }
+
+    /* The tags of the boundary faces go into the SubCellData; deal.II gives
+     * them to the boundary faces with the same vertices. */
+    dealii::SubCellData boundary_data;
+    std::map<std::vector<unsigned>, unsigned> interior_face_tags;
+    unsigned n_wrong_tags = 0;
+    for (unsigned i_cell = 0; i_cell < cells.size(); ++i_cell)
+    {
+      for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+      {
+        int64_t tag = the_mesh.face_tag(i_cell, i_face);
+        if (tag < 0)
+          continue;
+        if (tag >= dealii::numbers::internal_face_boundary_id)
+        {
+          ++n_wrong_tags;
+          continue;
+        }
+        std::vector<unsigned> key = face_key(cells[i_cell].vertices, i_face);
+        if (n_cells_of_face[key] > 1)
+        {
+          interior_face_tags[key] = tag;
+          continue;
+        }
+        unsigned face_vertices[4];
+        for (unsigned i_vertex = 0; i_vertex < n_face_vertices; ++i_vertex)
+        {
+          unsigned i_cell_vertex =
+           dealii::GeometryInfo<dim>::face_to_cell_vertices(i_face, i_vertex);
+          face_vertices[i_vertex] = cells[i_cell].vertices[i_cell_vertex];
+        }
+        if (dim == 2)
+        {
+          dealii::CellData<1> boundary_line;
+          boundary_line.vertices[0] = face_vertices[0];
+          boundary_line.vertices[1] = face_vertices[1];
+          boundary_line.boundary_id = tag;
+          boundary_data.boundary_lines.push_back(boundary_line);
+        }
+        else
+        {
+          dealii::CellData<2> boundary_quad;
+          for (unsigned i_vertex = 0; i_vertex < 4; ++i_vertex)
+            boundary_quad.vertices[i_vertex] = face_vertices[i_vertex];
+          boundary_quad.boundary_id = tag;
+          boundary_data.boundary_quads.push_back(boundary_quad);
+        }
+      }
+    }
+    if (n_wrong_tags > 0)
+      OutLogger(std::cout,
+                " HEY! : " + std::to_string(n_wrong_tags) +
+                 " face tags of the mesh are too large for a boundary id; they "
+                 "are ignored. \n");
+    Grid1.create_triangulation(vertices, cells, boundary_data);
+    for (auto cell = Grid1.begin(0); cell != Grid1.end(0); ++cell)
+      for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+      {
+        if (cell->face(i_face)->at_boundary())
+          continue;
+        unsigned cell_vertices[dealii::GeometryInfo<dim>::vertices_per_cell];
+        for (unsigned i_vertex = 0; i_vertex < the_mesh.n_vertices_per_cell(); ++i_vertex)
+          cell_vertices[i_vertex] = cell->vertex_index(i_vertex);
+        auto tag_it = interior_face_tags.find(face_key(cell_vertices, i_face));
+        if (tag_it != interior_face_tags.end())
+          cell->face(i_face)->set_manifold_id(tag_it->second);
+      }
+  }
+
+  char buffer[300];
+  std::snprintf(buffer,
+                300,
+                "Imported the coarse mesh %s : %d cells, %d vertices, in %12.4e s",
+                file_name.c_str(),
+                Grid1.n_cells(0),
+                Grid1.n_vertices(),
+                MPI_Wtime() - t1);
+  OutLogger(Execution_Time, buffer);
+  return true;
+}
+
+/*!
+ * \brief Writes the coarse mesh of Grid1 in the binary format of
+ * mesh_import.hpp, with the boundary ids of the boundary faces and the
+ * manifold ids of the interior faces as the tags. This should be called
+ * before the first refinement.
+ */
+template <int dim>
+void Diffusion<dim>::Write_Coarse_Mesh_Of_Grid(const std::string &file_name)
+{
+  if (comm_rank != 0)
+    return;
+  Coarse_Mesh the_mesh;
+  the_mesh.dim = dim;
+  for (const dealii::Point<dim> &vertex : Grid1.get_vertices())
+    for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+      the_mesh.vertices.push_back(vertex[i_dim]);
+  for (auto cell = Grid1.begin(0); cell != Grid1.end(0); ++cell)
+  {
+    for (unsigned i_vertex = 0; i_vertex < the_mesh.n_vertices_per_cell(); ++i_vertex)
+      the_mesh.cell_records.push_back(cell->vertex_index(i_vertex));
+    for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+    {
+      auto &&face = cell->face(i_face);
+      if (face->at_boundary())
+        the_mesh.cell_records.push_back(face->boundary_id());
+      else if (face->manifold_id() != dealii::numbers::invalid_manifold_id)
+        the_mesh.cell_records.push_back(face->manifold_id());
+      else
+        the_mesh.cell_records.push_back(-1);
+    }
+  }
+  if (!Write_Coarse_Mesh(file_name, the_mesh))
+    OutLogger(std::cout, " HEY! : Cannot write the mesh file " + file_name + ". \n");
+}
+
+/*!
+ * \brief Maps the boundary tags of an imported coarse mesh to
+ * Dirichlet_BC_Index and Neumann_BC_Index in BC_of_tag. The faces keep
+ * their tags, so that -qoi_boundaries can select each tag. The tags are
+ * given by -mesh_dirichlet and -mesh_neumann (comma separated lists). By
+ * default, the tag 1 is Dirichlet and all others are Neumann, which is the
+ * numbering of the built-in mesh. The tags which are in neither list (when
+ * -mesh_neumann is given) become Neumann, with a warning.
+ */
+template <int dim>
+void Diffusion<dim>::Map_Boundary_Tags()
+{
+  const unsigned max_tags = 100;
+  PetscInt dirichlet_tags[max_tags], neumann_tags[max_tags];
+  PetscInt n_dirichlet_tags = max_tags, n_neumann_tags = max_tags;
+  PetscBool dirichlet_flag, neumann_flag;
+  PetscOptionsGetIntArray(
+   NULL, "-mesh_dirichlet", dirichlet_tags, &n_dirichlet_tags, &dirichlet_flag);
+  PetscOptionsGetIntArray(NULL, "-mesh_neumann", neumann_tags, &n_neumann_tags, &neumann_flag);
+  if (dirichlet_flag != PETSC_TRUE)
+  {
+    dirichlet_tags[0] = Dirichlet_BC_Index;
+    n_dirichlet_tags = 1;
+  }
+  if (neumann_flag != PETSC_TRUE)
+    n_neumann_tags = 0;
+
+  /* All ranks have the whole coarse mesh, so they all find the same tags. */
+  BC_of_tag.clear();
+  std::set<unsigned> unmapped_tags;
+  for (auto cell = Grid1.begin(0); cell != Grid1.end(0); ++cell)
+    for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+    {
+      auto &&face = cell->face(i_face);
+      if (!face->at_boundary())
+        continue;
+      PetscInt tag = face->boundary_id();
+      if (std::find(dirichlet_tags, dirichlet_tags + n_dirichlet_tags, tag) !=
+          dirichlet_tags + n_dirichlet_tags)
+        BC_of_tag[tag] = Dirichlet_BC_Index;
+      else
+      {
+        if (neumann_flag == PETSC_TRUE &&
+            std::find(neumann_tags, neumann_tags + n_neumann_tags, tag) ==
+             neumann_tags + n_neumann_tags)
+          unmapped_tags.insert(tag);
+        BC_of_tag[tag] = Neumann_BC_Index;
+      }
+    }
+  for (const unsigned &tag : unmapped_tags)
+    OutLogger(std::cout,
+              " HEY! : The boundary tag " + std::to_string(tag) +
+               " is not in -mesh_dirichlet or -mesh_neumann; we use Neumann. \n");
+}
+
+/*!
+ * \brief The boundary condition (Dirichlet_BC_Index or Neumann_BC_Index) of
+ * the boundary faces with the given boundary id. The ids of the built-in
+ * mesh are the indices themselves.
+ */
+template <int dim>
+int Diffusion<dim>::BC_Index_of_Tag(const unsigned &tag) const
+{
+  auto bc_it = BC_of_tag.find(tag);
+  return (bc_it == BC_of_tag.end()) ? (int)tag : bc_it->second;
+}
+
 template <int dim>
 void Diffusion<dim>::Refine_Grid(int n)
 {
@@ -61,13 +321,24 @@ void Diffusion<dim>::Refine_Grid(int n)
 
     dealii::parallel::distributed::GridRefinement::refine_and_coarsen_fixed_number(
      Grid1, estimated_error_per_cell, 0.3, 0.03);
-    Grid1.execute_coarsening_and_refinement();
+    if (hp_adaptive())
+    {
+      Apply_hp_Decisions();
+      Grid1.prepare_coarsening_and_refinement();
+      dealii::parallel::distributed::SolutionTransfer<dim, LA::MPI::Vector> order_transfer(
+       DoF_H_Order);
+      order_transfer.prepare_for_coarsening_and_refinement(cell_orders);
+      Grid1.execute_coarsening_and_refinement();
+      Transfer_Cell_Orders(order_transfer);
+    }
+    else
+      Grid1.execute_coarsening_and_refinement();
     ++refn_cycle;
   }
 
-  double penalty1 = 8.5;
-  taus.assign(n_faces_per_cell, penalty1);
+  taus.assign(n_faces_per_cell, tau_penalty);
   Set_Boundary_Indicator();
+  cell_tree.clear();
 
   FreeUpContainers();
   Init_Mesh_Containers();
@@ -86,6 +357,24 @@ void Diffusion<dim>::Init_Mesh_Containers()
   DoF_H_System.distribute_dofs(DG_System);
   DoF_H_Refine.distribute_dofs(DG_Elem);
 
+  /* In the first cycle (and after the global refinements), all cells get
+   * poly_order. After the adaptive refinements, cell_orders is already
+   * transferred to the new mesh in Transfer_Cell_Orders. */
+  if (hp_adaptive())
+  {
+    DoF_H_Order.distribute_dofs(DG_Order_Elem);
+    if (cell_orders.size() != DoF_H_Order.n_dofs())
+    {
+      dealii::IndexSet order_ghost_indices;
+      dealii::IndexSet order_owned_indices = DoF_H_Order.locally_owned_dofs();
+      dealii::DoFTools::extract_locally_relevant_dofs(DoF_H_Order, order_ghost_indices);
+      LA::MPI::Vector order_temp(order_owned_indices, comm);
+      order_temp = (PetscScalar)poly_order;
+      cell_orders.reinit(order_owned_indices, order_ghost_indices, comm);
+      cell_orders = order_temp;
+    }
+  }
+
   All_Owned_Cells.reserve(Grid1.n_locally_owned_active_cells());
   unsigned n_cell = 0;
   n_ghost_cell = 0;
@@ -95,6 +384,7 @@ void Diffusion<dim>::Init_Mesh_Containers()
     if (cell->is_locally_owned())
     {
       All_Owned_Cells.push_back(std::move(Cell_Class<dim>(cell, n_active_cell)));
+      All_Owned_Cells.back().poly_order = Order_of_Cell(cell);
       cell_ID_to_num[All_Owned_Cells.back().cell_id] = n_active_cell;
       ++n_active_cell;
     }
@@ -102,13 +392,311 @@ void Diffusion<dim>::Init_Mesh_Containers()
       ++n_ghost_cell;
     ++n_cell;
   }
+
+  /* When a renumbering is requested, we start by visiting the owned cells
+   * along the Morton curve of their centers. The faces are numbered in the
+   * order that we visit the cells in Count_Globals, so this also gives a
+   * first improvement in the numbering of faces. The cells of all levels
+   * are sorted together; Count_Globals does not need them from coarse to
+   * fine. */
+  if (renumbering != No_Renumbering)
+  {
+    std::vector<dealii::Point<dim>> cell_centers;
+    cell_centers.reserve(All_Owned_Cells.size());
+    for (const Cell_Class<dim> &cell : All_Owned_Cells)
+      cell_centers.push_back(cell.dealii_Cell->center());
+    Reorder_Owned_Cells(SFC_Permutation(cell_centers));
+  }
+}
+
+/*!
+ * The number of the DOF of cell_orders, which belongs to the given cell. The
+ * cell can come from any DoFHandler on Grid1.
+ */
+template <int dim>
+unsigned Diffusion<dim>::Order_DOF_of_Cell(const Cell_Type &cell) const
+{
+  typename dealii::DoFHandler<dim>::active_cell_iterator order_cell(
+   &Grid1, cell->level(), cell->index(), &DoF_H_Order);
+  std::vector<dealii::types::global_dof_index> order_DOF(1);
+  order_cell->get_dof_indices(order_DOF);
+  return order_DOF[0];
+}
+
+/*!
+ * The polynomial order of an owned or ghost cell. We do not know the order of
+ * artificial cells, so we return the largest possible order for them. This
+ * is only used for the ghost faces, where an upper bound is enough.
+ */
+template <int dim>
+unsigned Diffusion<dim>::Order_of_Cell(const Cell_Type &cell) const
+{
+  if (!hp_adaptive())
+    return poly_order;
+  if (cell->is_artificial())
+    return max_poly_order;
+  return std::lround(cell_orders(Order_DOF_of_Cell(cell)));
+}
+
+/*!
+ * Sets the order of the cell, and the order of the trace space on each of its
+ * faces. The order of a face is the maximum (or minimum, according to
+ * face_order_rule) of the orders of all cells which share the face, so both
+ * sides of the face, on every rank, get the same order.
+ */
+template <int dim>
+void Diffusion<dim>::Set_Face_Orders(Cell_Class<dim> &cell) const
+{
+  cell.poly_order = Order_of_Cell(cell.dealii_Cell);
+  if (!hp_adaptive())
+  {
+    cell.face_poly_order.assign(n_faces_per_cell, poly_order);
+    return;
+  }
+  for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+  {
+    std::vector<unsigned> side_orders(1, cell.poly_order);
+    const auto &face_i1 = cell.dealii_Cell->face(i_face);
+    if (!face_i1->at_boundary())
+    {
+      if (cell.dealii_Cell->neighbor_is_coarser(i_face))
+      {
+        Cell_Type &&nb_i1 = cell.dealii_Cell->neighbor(i_face);
+        int face_nb_num = cell.dealii_Cell->neighbor_face_no(i_face);
+        side_orders.push_back(Order_of_Cell(nb_i1));
+        for (unsigned i_nb_subface = 0; i_nb_subface < nb_i1->face(face_nb_num)->n_children();
+             ++i_nb_subface)
+          side_orders.push_back(
+           Order_of_Cell(nb_i1->neighbor_child_on_subface(face_nb_num, i_nb_subface)));
+      }
+      else if (face_i1->has_children())
+      {
+        for (unsigned i_subface = 0; i_subface < face_i1->n_children(); ++i_subface)
+          side_orders.push_back(
+           Order_of_Cell(cell.dealii_Cell->neighbor_child_on_subface(i_face, i_subface)));
+      }
+      else
+        side_orders.push_back(Order_of_Cell(cell.dealii_Cell->neighbor(i_face)));
+    }
+    if (face_order_rule == Max_Face_Order)
+      cell.face_poly_order[i_face] = *std::max_element(side_orders.begin(), side_orders.end());
+    else
+      cell.face_poly_order[i_face] = *std::min_element(side_orders.begin(), side_orders.end());
+  }
+}
+
+/*!
+ * This is called after the cells are flagged by the error estimator. If a
+ * cell is flagged for refinement and its solution is smooth (the Legendre
+ * decay rate is above hp_smoothness_limit), we increase its order instead of
+ * splitting it. If a cell is flagged for coarsening and its order is above
+ * poly_order, we decrease its order instead.
+ */
+template <int dim>
+void Diffusion<dim>::Apply_hp_Decisions()
+{
+  dealii::IndexSet order_owned_indices = DoF_H_Order.locally_owned_dofs();
+  LA::MPI::Vector order_temp(order_owned_indices, comm);
+  std::vector<unsigned> order_indices;
+  std::vector<PetscScalar> order_values;
+  unsigned n_p_changes[2] = { 0, 0 };
+  for (Cell_Type &&cell : Grid1.active_cell_iterators())
+  {
+    if (!cell->is_locally_owned())
+      continue;
+    unsigned p = Order_of_Cell(cell);
+    if (cell->refine_flag_set() && p < max_poly_order &&
+        cell_smoothness(cell->active_cell_index()) > hp_smoothness_limit)
+    {
+      cell->clear_refine_flag();
+      ++p;
+      ++n_p_changes[0];
+    }
+    else if (cell->coarsen_flag_set() && p > poly_order)
+    {
+      cell->clear_coarsen_flag();
+      --p;
+      ++n_p_changes[1];
+    }
+    order_indices.push_back(Order_DOF_of_Cell(cell));
+    order_values.push_back(p);
+  }
+  order_temp.set(order_indices, order_values);
+  order_temp.compress(dealii::VectorOperation::insert);
+  cell_orders = order_temp;
+
+  unsigned global_n_p_changes[2];
+  MPI_Reduce(n_p_changes, global_n_p_changes, 2, MPI_UNSIGNED, MPI_SUM, 0, comm);
+  char buffer[200];
+  std::snprintf(buffer,
+                200,
+                "hp-adaptivity: %u cells are p-refined instead of h-refined, and "
+                "%u cells are p-coarsened instead of h-coarsened",
+                global_n_p_changes[0],
+                global_n_p_changes[1]);
+  OutLogger(Execution_Time, buffer, true);
+}
+
+/*!
+ * Gets the orders of the cells on the new mesh. The children of a refined
+ * cell take the order of their parent, and a coarsened cell takes the mean
+ * order of its children, which we round.
+ */
+template <int dim>
+void Diffusion<dim>::Transfer_Cell_Orders(
+ dealii::parallel::distributed::SolutionTransfer<dim, LA::MPI::Vector> &order_transfer)
+{
+  DoF_H_Order.distribute_dofs(DG_Order_Elem);
+  dealii::IndexSet order_ghost_indices;
+  dealii::IndexSet order_owned_indices = DoF_H_Order.locally_owned_dofs();
+  dealii::DoFTools::extract_locally_relevant_dofs(DoF_H_Order, order_ghost_indices);
+  LA::MPI::Vector order_temp(order_owned_indices, comm);
+  order_transfer.interpolate(order_temp);
+
+  std::vector<unsigned> order_indices;
+  order_owned_indices.fill_index_vector(order_indices);
+  std::vector<PetscScalar> order_values(order_indices.size());
+  for (unsigned i_index = 0; i_index < order_indices.size(); ++i_index)
+  {
+    double p = std::round(order_temp(order_indices[i_index]));
+    order_values[i_index] =
+     std::min(std::max(p, (double)poly_order), (double)max_poly_order);
+  }
+  order_temp.set(order_indices, order_values);
+  order_temp.compress(dealii::VectorOperation::insert);
+  cell_orders.reinit(order_owned_indices, order_ghost_indices, comm);
+  cell_orders = order_temp;
+}
+
+/*!
+ * Reorders All_Owned_Cells, such that the cell in the ith position goes to
+ * the position new_position[i]. Since the Cell_Class has no assignment, we
+ * move the cells into a new vector. The cell_ID_to_num is updated
+ * accordingly, but the Cell_Class::id_num of each cell is kept, because it
+ * gives the location of the cell's DOFs in the deal.II vectors.
+ */
+template <int dim>
+void Diffusion<dim>::Reorder_Owned_Cells(const std::vector<unsigned> &new_position)
+{
+  assert(new_position.size() == All_Owned_Cells.size());
+  std::vector<unsigned> old_position(new_position.size());
+  for (unsigned i_cell = 0; i_cell < new_position.size(); ++i_cell)
+    old_position[new_position[i_cell]] = i_cell;
+
+  typename Cell_Class<dim>::vector_type reordered_cells;
+  reordered_cells.reserve(All_Owned_Cells.size());
+  for (const unsigned &i_old : old_position)
+    reordered_cells.push_back(std::move(All_Owned_Cells[i_old]));
+  All_Owned_Cells.swap(reordered_cells);
+
+  for (unsigned i_cell = 0; i_cell < All_Owned_Cells.size(); ++i_cell)
+    cell_ID_to_num[All_Owned_Cells[i_cell].cell_id] = i_cell;
+}
+
+/*!
+ * This function is called in the middle of Count_Globals, when the faces
+ * owned by this rank have their numbers (in [0, n_owned_faces)), but these
+ * numbers are neither shifted by face_count_before_rank, nor sent to other
+ * ranks. So, we can change them to get a better bandwidth. Two faces are
+ * connected if they belong to the same cell (owned or ghost), which is
+ * exactly the sparsity pattern of the rows of this rank in the global matrix.
+ * With SFC_Renumbering we sort the faces along the Morton curve of their
+ * centers, and with RCM_Renumbering we use the reverse Cuthill-McKee on the
+ * face graph.
+ */
+template <int dim>
+void Diffusion<dim>::Renumber_Owned_Faces(typename Cell_Class<dim>::vector_type &All_Ghost_Cells,
+                                          const unsigned &n_owned_faces)
+{
+  std::vector<std::vector<unsigned>> face_graph(n_owned_faces);
+  auto connect_faces_of = [&](const Cell_Class<dim> &cell)
+  {
+    std::vector<unsigned> owned_faces;
+    for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+      if (cell.face_owner_rank[i_face] == comm_rank && cell.Face_ID_in_all_ranks[i_face] >= 0)
+        owned_faces.push_back(cell.Face_ID_in_all_ranks[i_face]);
+    for (const unsigned &face_1 : owned_faces)
+      for (const unsigned &face_2 : owned_faces)
+        if (face_1 != face_2)
+          face_graph[face_1].push_back(face_2);
+  };
+  for (const Cell_Class<dim> &cell : All_Owned_Cells)
+    connect_faces_of(cell);
+  for (const Cell_Class<dim> &ghost_cell : All_Ghost_Cells)
+    connect_faces_of(ghost_cell);
+  for (std::vector<unsigned> &face_nbs : face_graph)
+  {
+    std::sort(face_nbs.begin(), face_nbs.end());
+    face_nbs.erase(std::unique(face_nbs.begin(), face_nbs.end()), face_nbs.end());
+  }
+
+  std::vector<unsigned> new_face_number;
+  if (renumbering == SFC_Renumbering)
+  {
+    std::vector<dealii::Point<dim>> face_centers(n_owned_faces);
+    for (const Cell_Class<dim> &cell : All_Owned_Cells)
+      for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+        if (cell.Face_ID_in_all_ranks[i_face] >= 0 && cell.half_range_flag[i_face] == 0)
+          face_centers[cell.Face_ID_in_all_ranks[i_face]] =
+           cell.dealii_Cell->face(i_face)->center();
+    new_face_number = SFC_Permutation(face_centers);
+  }
+  else
+    new_face_number = RCM_Permutation(face_graph);
+
+  std::vector<unsigned> old_face_number(n_owned_faces);
+  for (unsigned i_face = 0; i_face < n_owned_faces; ++i_face)
+    old_face_number[i_face] = i_face;
+  unsigned bandwidths[2] = { Graph_Bandwidth(face_graph, old_face_number),
+                             Graph_Bandwidth(face_graph, new_face_number) };
+  unsigned max_bandwidths[2];
+  MPI_Reduce(bandwidths, max_bandwidths, 2, MPI_UNSIGNED, MPI_MAX, 0, comm);
+  char buffer[200];
+  std::snprintf(buffer,
+                200,
+                "Face graph bandwidth (max over ranks) before renumbering: %u, "
+                "after renumbering: %u",
+                max_bandwidths[0],
+                max_bandwidths[1]);
+  OutLogger(Execution_Time, buffer);
+
+  for (Cell_Class<dim> &cell : All_Owned_Cells)
+    for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+      if (cell.Face_ID_in_all_ranks[i_face] >= 0)
+        cell.Face_ID_in_all_ranks[i_face] =
+         new_face_number[cell.Face_ID_in_all_ranks[i_face]];
+
+  for (Cell_Class<dim> &ghost_cell : All_Ghost_Cells)
+    for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+      if (ghost_cell.Face_ID_in_all_ranks[i_face] >= 0)
+        ghost_cell.Face_ID_in_all_ranks[i_face] =
+         new_face_number[ghost_cell.Face_ID_in_all_ranks[i_face]];
+
+  /* The messages to the other ranks are already written, so we replace the
+   * face number at the end of each message. */
+  for (auto &&rank_msgs : face_to_rank_sender)
+  {
+    for (std::string &msg : rank_msgs.second)
+    {
+      std::vector<std::string> tokens;
+      Tokenize(msg, tokens, "#");
+      assert(tokens.size() == 4);
+      std::snprintf(buffer,
+                    200,
+                    "%s#%s#%s#%d",
+                    tokens[0].c_str(),
+                    tokens[1].c_str(),
+                    tokens[2].c_str(),
+                    new_face_number[std::stoi(tokens[3])]);
+      msg = buffer;
+    }
+  }
 }
 
 template <int dim>
 void Diffusion<dim>::Count_Globals()
 {
-  unsigned n_polyface = pow(poly_order + 1, dim - 1);
-  std::vector<Cell_Class<dim>> All_Ghost_Cells;
+  typename Cell_Class<dim>::vector_type All_Ghost_Cells;
   All_Ghost_Cells.reserve(n_ghost_cell);
   std::map<std::string, int> Ghost_ID_to_num;
   unsigned ghost_cell_counter = 0;
@@ -132,6 +720,11 @@ void Diffusion<dim>::Count_Globals()
     }
   }
 
+  for (Cell_Class<dim> &cell : All_Owned_Cells)
+    Set_Face_Orders(cell);
+  for (Cell_Class<dim> &ghost_cell : All_Ghost_Cells)
+    Set_Face_Orders(ghost_cell);
+
   unsigned local_face_id_on_this_rank = 0;
   unsigned global_face_id_on_this_rank = 0;
   int homogenous_dirichlet = -1;
@@ -153,6 +746,74 @@ void Diffusion<dim>::Count_Globals()
    *         belongs to the subdomain with smaller rank.
    */
 
+  /* The faces with children (the coarse sides of hanging faces) are
+   * numbered first, together with the subfaces of their fine neighbors. So,
+   * when the next loop meets a fine cell whose coarser neighbor is owned, its
+   * face is already numbered. This way, the numbering does not depend on the
+   * order of the owned cells, which can follow a space filling curve across
+   * the levels of refinement. */
+  for (Cell_Class<dim> &cell : All_Owned_Cells)
+  {
+    for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+    {
+      const auto &face_i1 = cell.dealii_Cell->face(i_face);
+      if (!face_i1->has_children())
+        continue;
+      cell.Face_ID_in_this_rank[i_face] = local_face_id_on_this_rank;
+      cell.half_range_flag[i_face] = 0;
+      cell.Face_ID_in_all_ranks[i_face] = global_face_id_on_this_rank;
+      cell.face_owner_rank[i_face] = comm_rank;
+      for (unsigned i_subface = 0; i_subface < face_i1->number_of_children(); ++i_subface)
+      {
+        Cell_Type &&nb_i1 = cell.dealii_Cell->neighbor_child_on_subface(i_face, i_subface);
+        int face_nb_i1 = cell.dealii_Cell->neighbor_face_no(i_face);
+        std::stringstream nb_ss_id;
+        nb_ss_id << nb_i1->id();
+        std::string nb_str_id = nb_ss_id.str();
+        if (nb_i1->subdomain_id() == comm_rank)
+        {
+          assert(cell_ID_to_num.find(nb_str_id) != cell_ID_to_num.end());
+          int nb_i1_num = cell_ID_to_num[nb_str_id];
+          All_Owned_Cells[nb_i1_num].Face_ID_in_this_rank[face_nb_i1] = local_face_id_on_this_rank;
+          All_Owned_Cells[nb_i1_num].half_range_flag[face_nb_i1] = i_subface + 1;
+          All_Owned_Cells[nb_i1_num].Face_ID_in_all_ranks[face_nb_i1] =
+           global_face_id_on_this_rank;
+          All_Owned_Cells[nb_i1_num].face_owner_rank[face_nb_i1] = comm_rank;
+        }
+        else
+        {
+          /* Here, we are sure that the face is not owned by this rank.
+           * Hence, we do not bother to know if the beighbor subdomain is
+           * greater or smaller than the current rank.
+           */
+          assert(nb_i1->subdomain_id() != comm_rank);
+          assert(nb_i1->is_ghost());
+          assert(Ghost_ID_to_num.find(nb_str_id) != Ghost_ID_to_num.end());
+          unsigned nb_i1_num = Ghost_ID_to_num[nb_str_id];
+          All_Ghost_Cells[nb_i1_num].Face_ID_in_this_rank[face_nb_i1] = local_face_id_on_this_rank;
+          All_Ghost_Cells[nb_i1_num].half_range_flag[face_nb_i1] = i_subface + 1;
+          All_Ghost_Cells[nb_i1_num].Face_ID_in_all_ranks[face_nb_i1] =
+           global_face_id_on_this_rank;
+          All_Ghost_Cells[nb_i1_num].face_owner_rank[face_nb_i1] = comm_rank;
+          /* Now we send id, face id, subface id, and neighbor face number
+           * to the corresponding rank. */
+          char buffer[300];
+          std::snprintf(buffer,
+                        300,
+                        "%s#%d#%d#%d",
+                        nb_str_id.c_str(),
+                        face_nb_i1,
+                        i_subface + 1,
+                        global_face_id_on_this_rank);
+          face_to_rank_sender[nb_i1->subdomain_id()].push_back(buffer);
+          ++mpi_request_counter;
+        }
+      }
+      ++local_face_id_on_this_rank;
+      ++global_face_id_on_this_rank;
+    }
+  }
+
   for (Cell_Class<dim> &cell : All_Owned_Cells)
   {
     for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
@@ -165,13 +826,15 @@ void Diffusion<dim>::Count_Globals()
          * and we do not bother to know what is going on, on the other
          * side of this face. Because (in the current version), that is
          * the way things are working ! */
-        if (face_i1->at_boundary() && face_i1->boundary_id() == Dirichlet_BC_Index)
+        if (face_i1->at_boundary() &&
+            BC_Index_of_Tag(face_i1->boundary_id()) == Dirichlet_BC_Index)
         {
           cell.Face_ID_in_this_rank[i_face] = homogenous_dirichlet;
           cell.Face_ID_in_all_ranks[i_face] = homogenous_dirichlet;
           cell.BCs[i_face] = Cell_Class<dim>::Dirichlet;
         }
-        else if (face_i1->at_boundary() && face_i1->boundary_id() == Neumann_BC_Index)
+        else if (face_i1->at_boundary() &&
+                 BC_Index_of_Tag(face_i1->boundary_id()) == Neumann_BC_Index)
         {
           cell.Face_ID_in_this_rank[i_face] = local_face_id_on_this_rank;
           cell.Face_ID_in_all_ranks[i_face] = global_face_id_on_this_rank;
@@ -182,8 +845,9 @@ void Diffusion<dim>::Count_Globals()
         }
         else
         {
-          /* At this point, we are sure that the cell has a neighbor. We will
-           * have three cases:
+          /* At this point, we are sure that the cell has a neighbor, and that
+           * the face has no children (those faces are numbered above). We
+           * will have two cases:
            *
            * 1- The neighbor is coarser than the cell. This can only happen if
            *    the neighbor is a ghost cell, otherwise there is something
@@ -191,15 +855,7 @@ void Diffusion<dim>::Count_Globals()
            *    own the face. Hence, we have to take the face number from the
            *    corresponding neighboer.
            *
-           * 2- The neighbor is finer. In this case the face is owned by this
-           *    subdomain, but we will have two subcases:
-           *   2a- If the neighbor is in this subdomain, we act as if the domain
-           *       was not decomposed.
-           *   2b- If the neighbor is in some other subdomain, we have to also
-           *       send the face number to all those finer neighbors, along with
-           *       the corresponding subface id.
-           *
-           * 3- The face has neighbors of same refinement. This case is somehow
+           * 2- The face has neighbors of same refinement. This case is somehow
            *    trichier than what is looks. Because, you have to decide where
            *    face belongs to. As we said before, the face belongs to the
            *    domain which has smaller rank. So, we have to send the face
@@ -208,8 +864,8 @@ void Diffusion<dim>::Count_Globals()
           if (cell.dealii_Cell->neighbor_is_coarser(i_face))
           {
             /*
-             * The neighbor should be a ghost, because in each subdomain, the
-             * elements are ordered from coarse to fine.
+             * The neighbor should be a ghost, because the faces of the owned
+             * coarser neighbors are numbered above.
              */
             Cell_Type &&nb_i1 = cell.dealii_Cell->neighbor(i_face);
             assert(nb_i1->is_ghost());
@@ -242,67 +898,6 @@ void Diffusion<dim>::Count_Globals()
             }
             ++local_face_id_on_this_rank;
           }
-          else if (face_i1->has_children())
-          {
-            cell.Face_ID_in_this_rank[i_face] = local_face_id_on_this_rank;
-            cell.half_range_flag[i_face] = 0;
-            cell.Face_ID_in_all_ranks[i_face] = global_face_id_on_this_rank;
-            cell.face_owner_rank[i_face] = comm_rank;
-            for (unsigned i_subface = 0; i_subface < face_i1->number_of_children();
-                 ++i_subface)
-            {
-              Cell_Type &&nb_i1 =
-               cell.dealii_Cell->neighbor_child_on_subface(i_face, i_subface);
-              int face_nb_i1 = cell.dealii_Cell->neighbor_face_no(i_face);
-              std::stringstream nb_ss_id;
-              nb_ss_id << nb_i1->id();
-              std::string nb_str_id = nb_ss_id.str();
-              if (nb_i1->subdomain_id() == comm_rank)
-              {
-                assert(cell_ID_to_num.find(nb_str_id) != cell_ID_to_num.end());
-                int nb_i1_num = cell_ID_to_num[nb_str_id];
-                All_Owned_Cells[nb_i1_num].Face_ID_in_this_rank[face_nb_i1] =
-                 local_face_id_on_this_rank;
-                All_Owned_Cells[nb_i1_num].half_range_flag[face_nb_i1] =
-                 i_subface + 1;
-                All_Owned_Cells[nb_i1_num].Face_ID_in_all_ranks[face_nb_i1] =
-                 global_face_id_on_this_rank;
-                All_Owned_Cells[nb_i1_num].face_owner_rank[face_nb_i1] = comm_rank;
-              }
-              else
-              {
-                /* Here, we are sure that the face is not owned by this rank.
-                 * Hence, we do not bother to know if the beighbor subdomain is
-                 * greater or smaller than the current rank.
-                 */
-                assert(nb_i1->subdomain_id() != comm_rank);
-                assert(nb_i1->is_ghost());
-                assert(Ghost_ID_to_num.find(nb_str_id) != Ghost_ID_to_num.end());
-                unsigned nb_i1_num = Ghost_ID_to_num[nb_str_id];
-                All_Ghost_Cells[nb_i1_num].Face_ID_in_this_rank[face_nb_i1] =
-                 local_face_id_on_this_rank;
-                All_Ghost_Cells[nb_i1_num].half_range_flag[face_nb_i1] =
-                 i_subface + 1;
-                All_Ghost_Cells[nb_i1_num].Face_ID_in_all_ranks[face_nb_i1] =
-                 global_face_id_on_this_rank;
-                All_Ghost_Cells[nb_i1_num].face_owner_rank[face_nb_i1] = comm_rank;
-                /* Now we send id, face id, subface id, and neighbor face number
-                 * to the corresponding rank. */
-                char buffer[300];
-                std::snprintf(buffer,
-                              300,
-                              "%s#%d#%d#%d",
-                              nb_str_id.c_str(),
-                              face_nb_i1,
-                              i_subface + 1,
-                              global_face_id_on_this_rank);
-                face_to_rank_sender[nb_i1->subdomain_id()].push_back(buffer);
-                ++mpi_request_counter;
-              }
-            }
-            ++local_face_id_on_this_rank;
-            ++global_face_id_on_this_rank;
-          }
           else
           {
             cell.Face_ID_in_this_rank[i_face] = local_face_id_on_this_rank;
@@ -386,13 +981,15 @@ void Diffusion<dim>::Count_Globals()
          * and we do not bother to know what is going on, on the other
          * side of this face. Because (in the current version), that is
          * the way things are working ! */
-        if (face_i1->at_boundary() && face_i1->boundary_id() == Dirichlet_BC_Index)
+        if (face_i1->at_boundary() &&
+            BC_Index_of_Tag(face_i1->boundary_id()) == Dirichlet_BC_Index)
         {
           ghost_cell.Face_ID_in_this_rank[i_face] = homogenous_dirichlet;
           ghost_cell.Face_ID_in_all_ranks[i_face] = homogenous_dirichlet;
           ghost_cell.BCs[i_face] = Cell_Class<dim>::Dirichlet;
         }
-        else if (face_i1->at_boundary() && face_i1->boundary_id() == Neumann_BC_Index)
+        else if (face_i1->at_boundary() &&
+                 BC_Index_of_Tag(face_i1->boundary_id()) == Neumann_BC_Index)
         {
           ghost_cell.Face_ID_in_this_rank[i_face] = ghost_face_counter;
           ghost_cell.Face_ID_in_all_ranks[i_face] = ghost_face_counter;
@@ -466,16 +1063,76 @@ void Diffusion<dim>::Count_Globals()
     }
   }
 
+  if (renumbering != No_Renumbering)
+    Renumber_Owned_Faces(All_Ghost_Cells, global_face_id_on_this_rank);
+
+  /* The faces can have different orders, so the first trace DOF of a face is
+   * the sum of the DOF counts of the faces before it. We compute it for the
+   * owned faces (in the global numbering) and for the local faces (in the
+   * local vector of uhat). */
+  std::vector<unsigned> owned_face_n_DOFs(global_face_id_on_this_rank, 0);
+  std::vector<unsigned> local_face_n_DOFs(local_face_id_on_this_rank, 0);
+  for (const Cell_Class<dim> &cell : All_Owned_Cells)
+  {
+    for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+    {
+      if (cell.face_owner_rank[i_face] == comm_rank && cell.Face_ID_in_all_ranks[i_face] >= 0)
+        owned_face_n_DOFs[cell.Face_ID_in_all_ranks[i_face]] = cell.n_face_DOFs(i_face);
+      if (cell.Face_ID_in_this_rank[i_face] >= 0)
+        local_face_n_DOFs[cell.Face_ID_in_this_rank[i_face]] = cell.n_face_DOFs(i_face);
+    }
+  }
+  std::vector<unsigned> owned_face_DOF_start(global_face_id_on_this_rank + 1, 0);
+  for (unsigned i_face = 0; i_face < global_face_id_on_this_rank; ++i_face)
+    owned_face_DOF_start[i_face + 1] = owned_face_DOF_start[i_face] + owned_face_n_DOFs[i_face];
+  face_DOF_in_this_rank.assign(local_face_id_on_this_rank + 1, 0);
+  for (unsigned i_face = 0; i_face < local_face_id_on_this_rank; ++i_face)
+    face_DOF_in_this_rank[i_face + 1] = face_DOF_in_this_rank[i_face] + local_face_n_DOFs[i_face];
+
+  /* The counts of each rank fit in 32 bits, but their sums might not. */
+  std::vector<Global_Index> DOF_count_up_to_rank(comm_size, 0);
+  std::vector<Global_Index> DOF_count_before_rank(comm_size, 0);
+  Global_Index number_of_DOFs_on_this_rank = owned_face_DOF_start.back();
+  double comm_t1 = MPI_Wtime();
+  MPI_Allgather(&number_of_DOFs_on_this_rank,
+                1,
+                MPIU_INT,
+                DOF_count_up_to_rank.data(),
+                1,
+                MPIU_INT,
+                comm);
+  comm_ledger.wait(Comm_Count_Globals, MPI_Wtime() - comm_t1);
+  comm_ledger.collective(Comm_Count_Globals, comm_size * sizeof(Global_Index));
+  for (unsigned i_num = 0; i_num < comm_size; ++i_num)
+    for (unsigned j_num = 0; j_num < i_num; ++j_num)
+      DOF_count_before_rank[i_num] += DOF_count_up_to_rank[j_num];
+
+  /* The receivers also need the first DOF of the face, so we add it to the
+   * end of each message. */
+  for (auto &&rank_msgs : face_to_rank_sender)
+  {
+    for (std::string &msg : rank_msgs.second)
+    {
+      std::vector<std::string> tokens;
+      Tokenize(msg, tokens, "#");
+      assert(tokens.size() == 4);
+      msg += "#" + std::to_string(owned_face_DOF_start[std::stoi(tokens[3])]);
+    }
+  }
+
   face_count_up_to_rank.resize(comm_size, 0);
   face_count_before_rank.resize(comm_size, 0);
-  unsigned number_of_faces_on_this_rank = global_face_id_on_this_rank;
+  Global_Index number_of_faces_on_this_rank = global_face_id_on_this_rank;
+  comm_t1 = MPI_Wtime();
   MPI_Allgather(&number_of_faces_on_this_rank,
                 1,
-                MPI_UNSIGNED,
+                MPIU_INT,
                 face_count_up_to_rank.data(),
                 1,
-                MPI_UNSIGNED,
+                MPIU_INT,
                 comm);
+  comm_ledger.wait(Comm_Count_Globals, MPI_Wtime() - comm_t1);
+  comm_ledger.collective(Comm_Count_Globals, comm_size * sizeof(Global_Index));
 
   for (unsigned i_num = 0; i_num < comm_size; ++i_num)
     for (unsigned j_num = 0; j_num < i_num; ++j_num)
@@ -486,7 +1143,12 @@ void Diffusion<dim>::Count_Globals()
     for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
     {
       if (cell.Face_ID_in_all_ranks[i_face] >= 0)
+      {
+        cell.Face_DOF_in_all_ranks[i_face] =
+         owned_face_DOF_start[cell.Face_ID_in_all_ranks[i_face]] +
+         DOF_count_before_rank[comm_rank];
         cell.Face_ID_in_all_ranks[i_face] += face_count_before_rank[comm_rank];
+      }
     }
   }
 
@@ -523,9 +1185,12 @@ void Diffusion<dim>::Count_Globals()
                   refn_cycle,
                   comm,
                   &all_mpi_reqs_of_rank[jth_rank_on_i_send]);
+        comm_ledger.send(Comm_Count_Globals, i_send->first, msg_it.size() + 1);
         ++jth_rank_on_i_send;
       }
+      double wait_t1 = MPI_Wtime();
       MPI_Waitall(num_sends, all_mpi_reqs_of_rank.data(), MPI_STATUSES_IGNORE);
+      comm_ledger.wait(Comm_Count_Globals, MPI_Wtime() - wait_t1);
     }
   }
 
@@ -537,19 +1202,24 @@ void Diffusion<dim>::Count_Globals()
   {
     auto i_recv = is_there_a_msg_from_rank.begin();
     no_msg_left = true;
+    double probe_t1 = MPI_Wtime();
     for (; i_recv != is_there_a_msg_from_rank.end(); ++i_recv)
     {
       if (i_recv->second && comm_rank > i_recv->first)
         no_msg_left = false;
       int flag = 0;
       if (comm_rank > i_recv->first)
+      {
         MPI_Iprobe(i_recv->first, refn_cycle, comm, &flag, MPI_STATUS_IGNORE);
+        comm_ledger.probe(Comm_Count_Globals);
+      }
       if (flag)
       {
         assert(i_recv->second);
         break;
       }
     }
+    comm_ledger.wait(Comm_Count_Globals, MPI_Wtime() - probe_t1);
     if (i_recv != is_there_a_msg_from_rank.end())
     {
       /*
@@ -568,16 +1238,21 @@ void Diffusion<dim>::Count_Globals()
                  refn_cycle,
                  comm,
                  &all_mpi_stats_of_rank[recv_counter]);
+        int n_recv_chars = 0;
+        MPI_Get_count(&all_mpi_stats_of_rank[recv_counter], MPI_CHAR, &n_recv_chars);
+        comm_ledger.recv(Comm_Count_Globals, i_recv->first, n_recv_chars);
         std::vector<std::string> tokens;
         Tokenize(buffer, tokens, "#");
-        assert(tokens.size() == 4);
+        assert(tokens.size() == 5);
         std::string cell_unique_id = tokens[0];
         assert(cell_ID_to_num.find(cell_unique_id) != cell_ID_to_num.end());
         int cell_number = cell_ID_to_num[cell_unique_id];
         unsigned face_num = std::stoi(tokens[1]);
         assert(All_Owned_Cells[cell_number].Face_ID_in_all_ranks[face_num] == -2);
         All_Owned_Cells[cell_number].Face_ID_in_all_ranks[face_num] =
-         std::stoi(tokens[3]) + face_count_before_rank[i_recv->first];
+         std::stoll(tokens[3]) + face_count_before_rank[i_recv->first];
+        All_Owned_Cells[cell_number].Face_DOF_in_all_ranks[face_num] =
+         std::stoll(tokens[4]) + DOF_count_before_rank[i_recv->first];
         ++recv_counter;
       }
       i_recv->second = false;
@@ -608,9 +1283,12 @@ void Diffusion<dim>::Count_Globals()
                   refn_cycle,
                   comm,
                   &all_mpi_reqs_of_rank[jth_rank_on_i_send]);
+        comm_ledger.send(Comm_Count_Globals, i_send->first, msg_it.size() + 1);
         ++jth_rank_on_i_send;
       }
+      double wait_t1 = MPI_Wtime();
       MPI_Waitall(num_sends, all_mpi_reqs_of_rank.data(), MPI_STATUSES_IGNORE);
+      comm_ledger.wait(Comm_Count_Globals, MPI_Wtime() - wait_t1);
     }
   }
 
@@ -619,19 +1297,24 @@ void Diffusion<dim>::Count_Globals()
   {
     auto i_recv = is_there_a_msg_from_rank.begin();
     no_msg_left = true;
+    double probe_t1 = MPI_Wtime();
     for (; i_recv != is_there_a_msg_from_rank.end(); ++i_recv)
     {
       if (i_recv->second && comm_rank < i_recv->first)
         no_msg_left = false;
       int flag = 0;
       if (comm_rank < i_recv->first)
+      {
         MPI_Iprobe(i_recv->first, refn_cycle, comm, &flag, MPI_STATUS_IGNORE);
+        comm_ledger.probe(Comm_Count_Globals);
+      }
       if (flag)
       {
         assert(i_recv->second);
         break;
       }
     }
+    comm_ledger.wait(Comm_Count_Globals, MPI_Wtime() - probe_t1);
     if (i_recv != is_there_a_msg_from_rank.end())
     {
       /*
@@ -650,16 +1333,21 @@ void Diffusion<dim>::Count_Globals()
                  refn_cycle,
                  comm,
                  &all_mpi_stats_of_rank[recv_counter]);
+        int n_recv_chars = 0;
+        MPI_Get_count(&all_mpi_stats_of_rank[recv_counter], MPI_CHAR, &n_recv_chars);
+        comm_ledger.recv(Comm_Count_Globals, i_recv->first, n_recv_chars);
         std::vector<std::string> tokens;
         Tokenize(buffer, tokens, "#");
-        assert(tokens.size() == 4);
+        assert(tokens.size() == 5);
         std::string cell_unique_id = tokens[0];
         assert(cell_ID_to_num.find(cell_unique_id) != cell_ID_to_num.end());
         int cell_number = cell_ID_to_num[cell_unique_id];
         unsigned face_num = std::stoi(tokens[1]);
         assert(All_Owned_Cells[cell_number].Face_ID_in_all_ranks[face_num] == -2);
         All_Owned_Cells[cell_number].Face_ID_in_all_ranks[face_num] =
-         std::stoi(tokens[3]) + face_count_before_rank[i_recv->first];
+         std::stoll(tokens[3]) + face_count_before_rank[i_recv->first];
+        All_Owned_Cells[cell_number].Face_DOF_in_all_ranks[face_num] =
+         std::stoll(tokens[4]) + DOF_count_before_rank[i_recv->first];
         ++recv_counter;
       }
       i_recv->second = false;
@@ -716,17 +1404,20 @@ void Diffusion<dim>::Count_Globals()
   /* Now we count the number of global dofs in the rank, and also fill
    */
   num_global_DOFs_on_this_rank = 0;
-  for (Face_Class<dim> &face : All_Faces)
+  for (unsigned i_face = 0; i_face < All_Faces.size(); ++i_face)
   {
-    face.n_local_connected_faces++;
-    face.num_global_DOFs = n_polyface;
-    num_global_DOFs_on_this_rank += face.num_global_DOFs;
+    All_Faces[i_face].n_local_connected_faces++;
+    All_Faces[i_face].num_global_DOFs = owned_face_n_DOFs[i_face];
+    num_global_DOFs_on_this_rank += All_Faces[i_face].num_global_DOFs;
   }
 
+  /* The maps below give the number of DOFs of each connected face. The faces
+   * of the ghost cells which are not connected to the owned cells might have
+   * neighbors that we do not know; for them n_face_DOFs is an upper bound. */
   for (Face_Class<dim> &face : All_Faces)
   {
-    std::map<int, unsigned> local_face_num_map;
-    std::map<int, unsigned> nonlocal_face_num_map;
+    std::map<Global_Index, unsigned> local_face_num_map;
+    std::map<Global_Index, unsigned> nonlocal_face_num_map;
     for (unsigned i_parent_cell = 0; i_parent_cell < face.Parent_Cells.size();
          ++i_parent_cell)
     {
@@ -735,9 +1426,11 @@ void Diffusion<dim>::Count_Globals()
         if (face_j_of_cell != face.connected_face_of_parent_cell[i_parent_cell])
         {
           if (parent_cell->face_owner_rank[face_j_of_cell] == comm_rank)
-            local_face_num_map[parent_cell->Face_ID_in_all_ranks[face_j_of_cell]]++;
+            local_face_num_map[parent_cell->Face_ID_in_all_ranks[face_j_of_cell]] =
+             parent_cell->n_face_DOFs(face_j_of_cell);
           else if (parent_cell->Face_ID_in_all_ranks[face_j_of_cell] >= 0)
-            nonlocal_face_num_map[parent_cell->Face_ID_in_all_ranks[face_j_of_cell]]++;
+            nonlocal_face_num_map[parent_cell->Face_ID_in_all_ranks[face_j_of_cell]] =
+             parent_cell->n_face_DOFs(face_j_of_cell);
         }
     }
     for (unsigned i_parent_ghost = 0; i_parent_ghost < face.Parent_Ghosts.size();
@@ -749,27 +1442,28 @@ void Diffusion<dim>::Count_Globals()
         if (face_j_of_ghost != face.connected_face_of_parent_ghost[i_parent_ghost])
         {
           if (parent_ghost->face_owner_rank[face_j_of_ghost] == comm_rank)
-            local_face_num_map[parent_ghost->Face_ID_in_all_ranks[face_j_of_ghost]]++;
+            local_face_num_map[parent_ghost->Face_ID_in_all_ranks[face_j_of_ghost]] =
+             parent_ghost->n_face_DOFs(face_j_of_ghost);
           else if (parent_ghost->Face_ID_in_all_ranks[face_j_of_ghost] <= -10)
-            nonlocal_face_num_map[parent_ghost->Face_ID_in_all_ranks[face_j_of_ghost]]++;
+            nonlocal_face_num_map[parent_ghost->Face_ID_in_all_ranks[face_j_of_ghost]] =
+             parent_ghost->n_face_DOFs(face_j_of_ghost);
         }
     }
     face.n_local_connected_faces += local_face_num_map.size();
     face.n_nonlocal_connected_faces += nonlocal_face_num_map.size();
+    face.n_local_connected_DOFs = face.num_global_DOFs;
+    face.n_nonlocal_connected_DOFs = 0;
+    for (const auto &face_and_n_DOFs : local_face_num_map)
+      face.n_local_connected_DOFs += face_and_n_DOFs.second;
+    for (const auto &face_and_n_DOFs : nonlocal_face_num_map)
+      face.n_nonlocal_connected_DOFs += face_and_n_DOFs.second;
   }
 
-  for (Face_Class<dim> &face : All_Faces)
-  {
-    face.n_local_connected_DOFs = face.n_local_connected_faces * n_polyface;
-    face.n_nonlocal_connected_DOFs = face.n_nonlocal_connected_faces * n_polyface;
-  }
-
-  MPI_Allreduce(&num_global_DOFs_on_this_rank,
-                &num_global_DOFs_on_all_ranks,
-                1,
-                MPI_UNSIGNED,
-                MPI_SUM,
-                comm);
+  comm_t1 = MPI_Wtime();
+  Global_Index n_DOFs_on_this_rank = num_global_DOFs_on_this_rank;
+  MPI_Allreduce(&n_DOFs_on_this_rank, &num_global_DOFs_on_all_ranks, 1, MPIU_INT, MPI_SUM, comm);
+  comm_ledger.wait(Comm_Count_Globals, MPI_Wtime() - comm_t1);
+  comm_ledger.collective(Comm_Count_Globals, sizeof(Global_Index));
 
   unsigned DOF_Counter1 = 0;
   n_local_DOFs_connected_to_DOF.resize(num_global_DOFs_on_this_rank);
@@ -786,29 +1480,32 @@ void Diffusion<dim>::Count_Globals()
     DOF_Counter1 += face.num_global_DOFs;
   }
 
-  std::map<unsigned, unsigned> map_from_global_to_local;
+  /* The key is the first global DOF of each local face, and the value is the
+   * first local DOF of the face and its number of DOFs. */
+  std::map<Global_Index, std::pair<unsigned, unsigned>> map_from_global_to_local;
   for (Cell_Class<dim> &cell : All_Owned_Cells)
   {
     for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
     {
       int index1 = cell.Face_ID_in_this_rank[i_face];
-      int index2 = cell.Face_ID_in_all_ranks[i_face];
+      Global_Index index2 = cell.Face_DOF_in_all_ranks[i_face];
       if (index1 != -1)
       {
-        map_from_global_to_local[index2] = index1;
+        map_from_global_to_local[index2] =
+         std::make_pair(face_DOF_in_this_rank[index1], cell.n_face_DOFs(i_face));
       }
     }
   }
 
-  num_local_DOFs_on_this_rank = local_face_id_on_this_rank * n_polyface;
+  num_local_DOFs_on_this_rank = face_DOF_in_this_rank.back();
   scatter_from.reserve(num_local_DOFs_on_this_rank);
   scatter_to.reserve(num_local_DOFs_on_this_rank);
   for (const auto &map_it : map_from_global_to_local)
   {
-    for (unsigned i_polyface = 0; i_polyface < n_polyface; ++i_polyface)
+    for (unsigned i_polyface = 0; i_polyface < map_it.second.second; ++i_polyface)
     {
-      scatter_from.push_back(map_it.first * n_polyface + i_polyface);
-      scatter_to.push_back(map_it.second * n_polyface + i_polyface);
+      scatter_from.push_back(map_it.first + i_polyface);
+      scatter_to.push_back(map_it.second.first + i_polyface);
     }
   }
 
@@ -830,17 +1527,354 @@ void Diffusion<dim>::Count_Globals()
   }
   */
 
+  /* With RCM, the faces are not numbered in the order of the cells anymore.
+   * So, we visit the cells in the order of their smallest owned face, to
+   * keep the traversal of All_Owned_Cells consistent with the numbering of
+   * trace DOFs. All_Faces is not used after this point, hence we can move
+   * the cells. */
+  if (renumbering == RCM_Renumbering)
+  {
+    std::vector<Global_Index> first_owned_face(All_Owned_Cells.size(),
+                                               std::numeric_limits<Global_Index>::max());
+    for (unsigned i_cell = 0; i_cell < All_Owned_Cells.size(); ++i_cell)
+    {
+      const Cell_Class<dim> &cell = All_Owned_Cells[i_cell];
+      for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+        if (cell.face_owner_rank[i_face] == comm_rank && cell.Face_ID_in_all_ranks[i_face] >= 0)
+          first_owned_face[i_cell] =
+           std::min(first_owned_face[i_cell], cell.Face_ID_in_all_ranks[i_face]);
+    }
+    std::vector<unsigned> old_position(All_Owned_Cells.size());
+    for (unsigned i_cell = 0; i_cell < old_position.size(); ++i_cell)
+      old_position[i_cell] = i_cell;
+    std::stable_sort(old_position.begin(),
+                     old_position.end(),
+                     [&first_owned_face](const unsigned &i1, const unsigned &i2)
+                     {
+      return first_owned_face[i1] < first_owned_face[i2];
+    });
+    std::vector<unsigned> new_position(old_position.size());
+    for (unsigned i_cell = 0; i_cell < old_position.size(); ++i_cell)
+      new_position[old_position[i_cell]] = i_cell;
+    Reorder_Owned_Cells(new_position);
+  }
+
+  Distribute_Cells_To_Threads();
+  Select_Quadrature_Orders();
+
   char buffer[100];
   std::snprintf(buffer,
                 100,
                 "Number of DOFs in this rank is: %d and number of dofs in all "
-                "ranks is : %d",
+                "ranks is : %lld",
                 num_global_DOFs_on_this_rank,
-                num_global_DOFs_on_all_ranks);
+                (long long)num_global_DOFs_on_all_ranks);
   OutLogger(Execution_Time, buffer, true);
   //  std::cout << buffer << std::endl;
 }
 
+/*!
+ * Counts the nonzeros in each row of the local matrix of MATIS, which has
+ * the local DOFs of the rank as its rows, and only the contributions of the
+ * owned cells. A local face is connected to the faces of the owned cells on
+ * its sides, including itself.
+ */
+template <int dim>
+void Diffusion<dim>::Count_Local_Connections(
+ std::vector<PetscInt> &n_DOFs_connected_to_local_DOF) const
+{
+  const unsigned n_local_faces = face_DOF_in_this_rank.size() - 1;
+  std::vector<std::vector<int>> connected_faces(n_local_faces);
+  for (const Cell_Class<dim> &cell : All_Owned_Cells)
+    for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+      if (cell.Face_ID_in_this_rank[i_face] >= 0)
+        for (unsigned j_face = 0; j_face < n_faces_per_cell; ++j_face)
+          if (cell.Face_ID_in_this_rank[j_face] >= 0)
+            connected_faces[cell.Face_ID_in_this_rank[i_face]].push_back(
+             cell.Face_ID_in_this_rank[j_face]);
+
+  n_DOFs_connected_to_local_DOF.assign(num_local_DOFs_on_this_rank, 0);
+  for (unsigned i_face = 0; i_face < n_local_faces; ++i_face)
+  {
+    std::vector<int> &face_nbs = connected_faces[i_face];
+    std::sort(face_nbs.begin(), face_nbs.end());
+    face_nbs.erase(std::unique(face_nbs.begin(), face_nbs.end()), face_nbs.end());
+    PetscInt n_connected_DOFs = 0;
+    for (const int &j_face : face_nbs)
+      n_connected_DOFs += face_DOF_in_this_rank[j_face + 1] - face_DOF_in_this_rank[j_face];
+    for (unsigned i_DOF = face_DOF_in_this_rank[i_face]; i_DOF < face_DOF_in_this_rank[i_face + 1];
+         ++i_DOF)
+      n_DOFs_connected_to_local_DOF[i_DOF] = n_connected_DOFs;
+  }
+}
+
+/*!
+ * Divides All_Owned_Cells into n_threads contiguous blocks, and lets each
+ * thread first touch the data of its own block. The cells are moved into new
+ * storage, whose pages the threads touch block by block when it is
+ * allocated (see First_Touch_Allocator); then each thread copies the
+ * containers of its cells. This should be called after the final ordering of
+ * All_Owned_Cells is known (i.e. at the end of Count_Globals), because
+ * moving the cells reallocates them. The Eigen matrices of the cells are
+ * allocated and freed in the loops over cells, by the thread owning the
+ * cell, and the value arrays of the recovery are first touched there (see
+ * Calculate_Internal_Unknowns).
+ */
+template <int dim>
+void Diffusion<dim>::Distribute_Cells_To_Threads()
+{
+  unsigned long n_cells = All_Owned_Cells.size();
+  thread_cell_bounds.resize(n_threads + 1);
+  for (unsigned i_thread = 0; i_thread <= n_threads; ++i_thread)
+    thread_cell_bounds[i_thread] = n_cells * i_thread / n_threads;
+
+  typename Cell_Class<dim>::vector_type placed_cells(
+   First_Touch_Allocator<Cell_Class<dim>>(n_threads, numa_pinning));
+  placed_cells.reserve(n_cells);
+  for (Cell_Class<dim> &cell : All_Owned_Cells)
+    placed_cells.push_back(std::move(cell));
+  All_Owned_Cells.swap(placed_cells);
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads)
+  {
+    unsigned thread_id = omp_get_thread_num();
+    unsigned n_team = omp_get_num_threads();
+#else
+  unsigned thread_id = 0;
+  unsigned n_team = 1;
+  {
+#endif
+    if (numa_pinning)
+      Pin_Thread_to_Core(thread_id);
+    for (const unsigned &i_cell : Cells_of_Thread(thread_id, n_team))
+      All_Owned_Cells[i_cell].relocate_containers();
+  }
+}
+
+/*!
+ * Gives the cells which should be processed by a given thread. If OpenMP
+ * gives us fewer threads than n_threads, each thread takes more than one
+ * block, but the blocks are never split.
+ */
+template <int dim>
+std::vector<unsigned> Diffusion<dim>::Cells_of_Thread(const unsigned &thread_id,
+                                                      const unsigned &n_team) const
+{
+  std::vector<unsigned> cells_of_thread;
+  for (unsigned i_block = thread_id; i_block < n_threads; i_block += n_team)
+    for (unsigned i_cell = thread_cell_bounds[i_block];
+         i_cell < thread_cell_bounds[i_block + 1];
+         ++i_cell)
+      cells_of_thread.push_back(i_cell);
+  return cells_of_thread;
+}
+
+template <int dim>
+unsigned Diffusion<dim>::Signature_of_Cell(const Cell_Class<dim> &cell) const
+{
+  unsigned signature = Interior_Cell;
+  for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+  {
+    if (cell.BCs[i_face] == Cell_Class<dim>::Dirichlet)
+      signature |= Has_Dirichlet_Face;
+    if (cell.BCs[i_face] == Cell_Class<dim>::Neumann)
+      signature |= Has_Neumann_Face;
+    if (cell.half_range_flag[i_face] != 0)
+      signature |= Has_Hanging_Face;
+  }
+  return signature;
+}
+
+/*!
+ * Puts the cells of each thread block in the buckets of their signatures,
+ * keeping their order in the block, and writes the number of cells in each
+ * bucket (summed over ranks). This is called after Count_Globals, which sets
+ * the boundary conditions and the half ranges of the faces.
+ */
+template <int dim>
+void Diffusion<dim>::Classify_Cells()
+{
+  cell_work_lists.assign(n_threads * n_cell_signatures, std::vector<unsigned>());
+  std::vector<int> cells_of_signature(n_cell_signatures, 0);
+  for (unsigned i_block = 0; i_block < n_threads; ++i_block)
+    for (unsigned i_cell = thread_cell_bounds[i_block]; i_cell < thread_cell_bounds[i_block + 1];
+         ++i_cell)
+    {
+      unsigned signature = Signature_of_Cell(All_Owned_Cells[i_cell]);
+      cell_work_lists[i_block * n_cell_signatures + signature].push_back(i_cell);
+      ++cells_of_signature[signature];
+    }
+
+  std::vector<int> global_cells_of_signature(n_cell_signatures);
+  MPI_Reduce(cells_of_signature.data(),
+             global_cells_of_signature.data(),
+             n_cell_signatures,
+             MPI_INT,
+             MPI_SUM,
+             0,
+             comm);
+  char buffer[300];
+  std::snprintf(buffer,
+                300,
+                "Cell buckets of cycle %d : interior : %d, Dirichlet : %d, Neumann : %d, "
+                "Dirichlet and Neumann : %d, with hanging faces : %d",
+                refn_cycle,
+                global_cells_of_signature[Interior_Cell],
+                global_cells_of_signature[Has_Dirichlet_Face],
+                global_cells_of_signature[Has_Neumann_Face],
+                global_cells_of_signature[Has_Dirichlet_Face | Has_Neumann_Face],
+                std::accumulate(global_cells_of_signature.begin() + Has_Hanging_Face,
+                                global_cells_of_signature.end(),
+                                0));
+  OutLogger(Execution_Time, buffer);
+}
+
+/*!
+ * The cells of one thread with the given signature, in the same order as
+ * in Cells_of_Thread(thread_id, n_team).
+ */
+template <int dim>
+std::vector<unsigned> Diffusion<dim>::Cells_of_Thread(const unsigned &thread_id,
+                                                      const unsigned &n_team,
+                                                      const unsigned &signature) const
+{
+  std::vector<unsigned> cells_of_thread;
+  for (unsigned i_block = thread_id; i_block < n_threads; i_block += n_team)
+  {
+    const std::vector<unsigned> &work_list =
+     cell_work_lists[i_block * n_cell_signatures + signature];
+    cells_of_thread.insert(cells_of_thread.end(), work_list.begin(), work_list.end());
+  }
+  return cells_of_thread;
+}
+
+/*!
+ * Adds the bytes of the cells and of the maps and vectors of the faces, which
+ * are filled by Count_Globals, to the memory_ledger. The nodes of the maps
+ * are counted with the usual overhead of a red-black tree node (four
+ * pointers).
+ */
+template <int dim>
+void Diffusion<dim>::Count_Mesh_Memory()
+{
+  if (!memory_ledger.enabled)
+    return;
+  double cell_bytes = Vector_Bytes(All_Owned_Cells);
+  for (const Cell_Class<dim> &cell : All_Owned_Cells)
+    cell_bytes += cell.memory_bytes() - sizeof(Cell_Class<dim>);
+  memory_ledger.count("owned cells", cell_bytes);
+
+  const double node_overhead = 4 * sizeof(void *);
+  double face_bytes = 0;
+  for (auto &&id_and_num : cell_ID_to_num)
+    face_bytes += node_overhead + sizeof(id_and_num) + id_and_num.first.capacity();
+  for (auto &&face_and_senders : face_to_rank_sender)
+  {
+    face_bytes += node_overhead + sizeof(face_and_senders) +
+                  Vector_Bytes(face_and_senders.second);
+    for (const std::string &message : face_and_senders.second)
+      face_bytes += message.capacity();
+  }
+  face_bytes += face_to_rank_recver.size() *
+                (node_overhead + sizeof(std::pair<const unsigned, unsigned>));
+  face_bytes += Vector_Bytes(face_count_before_rank) + Vector_Bytes(face_count_up_to_rank) +
+                Vector_Bytes(face_DOF_in_this_rank) +
+                Vector_Bytes(n_local_DOFs_connected_to_DOF) +
+                Vector_Bytes(n_nonlocal_DOFs_connected_to_DOF) +
+                Vector_Bytes(scatter_from) + Vector_Bytes(scatter_to);
+  memory_ledger.count("face maps and vectors", face_bytes);
+}
+
+/*!
+ * Each thread checks the NUMA node of the memory pages which it touches when
+ * it visits its own cells, and compares it with the node that the thread is
+ * running on. The pages of the cell objects (in All_Owned_Cells and their
+ * face vectors) and of the value arrays of the recovery (cell_modes and
+ * lagrange_values, when they are kept) are counted separately. Every visited
+ * page is counted once per cell, so the ratio of remote pages is an estimate
+ * of the ratio of remote memory accesses in the loops over cells. This is
+ * called after the recovery, and we report the minimum and maximum ratio
+ * over ranks.
+ */
+template <int dim>
+void Diffusion<dim>::Report_NUMA_Placement()
+{
+  const bool count_lagrange_values = vtk_lagrange && full_output_this_cycle;
+  unsigned long cell_local_pages = 0, cell_remote_pages = 0;
+  unsigned long value_local_pages = 0, value_remote_pages = 0, unknown_pages = 0;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads) reduction(+ : cell_local_pages, cell_remote_pages, \
+                                                      value_local_pages, value_remote_pages, \
+                                                      unknown_pages)
+  {
+    unsigned thread_id = omp_get_thread_num();
+    unsigned n_team = omp_get_num_threads();
+#else
+  unsigned thread_id = 0;
+  unsigned n_team = 1;
+  {
+#endif
+    if (numa_pinning)
+      Pin_Thread_to_Core(thread_id);
+    int thread_node = Current_NUMA_Node();
+    NUMA_Page_Counter counter, value_counter;
+    for (const unsigned &i_cell : Cells_of_Thread(thread_id, n_team))
+    {
+      const Cell_Class<dim> &cell = All_Owned_Cells[i_cell];
+      if (keep_cell_modes)
+        value_counter.count(&cell_modes[cell_mode_start[i_cell]],
+                            (cell_mode_start[i_cell + 1] - cell_mode_start[i_cell]) *
+                             sizeof(double),
+                            thread_node);
+      if (count_lagrange_values)
+        value_counter.count(&lagrange_values[lagrange_value_start[i_cell]],
+                            (lagrange_value_start[i_cell + 1] - lagrange_value_start[i_cell]) *
+                             sizeof(double),
+                            thread_node);
+      counter.count(&cell, sizeof(Cell_Class<dim>), thread_node);
+      counter.count(cell.half_range_flag.data(), n_faces_per_cell * sizeof(unsigned), thread_node);
+      counter.count(cell.face_owner_rank.data(), n_faces_per_cell * sizeof(unsigned), thread_node);
+      counter.count(cell.Face_ID_in_this_rank.data(), n_faces_per_cell * sizeof(int), thread_node);
+      counter.count(cell.Face_ID_in_all_ranks.data(),
+                    n_faces_per_cell * sizeof(Global_Index),
+                    thread_node);
+      counter.count(cell.BCs.data(),
+                    n_faces_per_cell * sizeof(typename Cell_Class<dim>::BC),
+                    thread_node);
+    }
+    cell_local_pages += counter.local_pages;
+    cell_remote_pages += counter.remote_pages;
+    value_local_pages += value_counter.local_pages;
+    value_remote_pages += value_counter.remote_pages;
+    unknown_pages += counter.unknown_pages + value_counter.unknown_pages;
+  }
+
+  /* The ratios of the cell objects and of the value arrays; their negatives
+   * give the maximum by MPI_MIN. */
+  double remote_ratios[4] = { 0, 0, 0, 0 }, min_remote_ratios[4];
+  if (cell_local_pages + cell_remote_pages > 0)
+    remote_ratios[0] = (double)cell_remote_pages / (cell_local_pages + cell_remote_pages);
+  if (value_local_pages + value_remote_pages > 0)
+    remote_ratios[1] = (double)value_remote_pages / (value_local_pages + value_remote_pages);
+  remote_ratios[2] = -remote_ratios[0];
+  remote_ratios[3] = -remote_ratios[1];
+  unsigned long all_unknown_pages;
+  MPI_Reduce(remote_ratios, min_remote_ratios, 4, MPI_DOUBLE, MPI_MIN, 0, comm);
+  MPI_Reduce(&unknown_pages, &all_unknown_pages, 1, MPI_UNSIGNED_LONG, MPI_SUM, 0, comm);
+  char buffer[300];
+  std::snprintf(buffer,
+                300,
+                "Ratio of remote NUMA pages, min and max over ranks : cell objects : %8.4f "
+                "%8.4f, value arrays : %8.4f %8.4f, unknown pages : %lu",
+                min_remote_ratios[0],
+                -min_remote_ratios[2],
+                min_remote_ratios[1],
+                -min_remote_ratios[3],
+                all_unknown_pages);
+  OutLogger(Execution_Time, buffer);
+}
+
 template <int dim>
 void Diffusion<dim>::Write_Grid_Out()
 {
@@ -895,4 +1929,5 @@ void Diffusion<dim>::FreeUpContainers()
   Wreck_it_Ralph(face_to_rank_recver);
   Wreck_it_Ralph(face_count_before_rank);
   Wreck_it_Ralph(face_count_up_to_rank);
+  Wreck_it_Ralph(face_DOF_in_this_rank);
 }
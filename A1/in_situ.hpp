@@ -0,0 +1,133 @@
+#include <vector>
+#include <string>
+#include <map>
+#include <limits>
+#include <algorithm>
+
+#ifndef IN_SITU_HPP
+#define IN_SITU_HPP
+
+/*!
+ * \defgroup in_situ In-situ analysis
+ * \brief
+ * The reductions, histograms, probes and downsampled fields which are
+ * computed from the local solutions, while they are recovered in
+ * Calculate_Internal_Unknowns. So, the cycles which do not need the full
+ * fields write only these summaries.
+ */
+
+/*!
+ * \ingroup in_situ
+ * \brief The sums, minima and maxima of one thread (or one rank, after they
+ * are merged). The flow is reduced by its magnitude.
+ */
+struct In_Situ_Sums
+{
+  In_Situ_Sums()
+    : volume(0),
+      head_integral(0),
+      flow_integral(0),
+      head_min(std::numeric_limits<double>::max()),
+      head_max(std::numeric_limits<double>::lowest()),
+      flow_min(std::numeric_limits<double>::max()),
+      flow_max(std::numeric_limits<double>::lowest())
+  {
+  }
+
+  void add_point(const double &JxW, const double &head, const double &flow)
+  {
+    volume += JxW;
+    head_integral += JxW * head;
+    flow_integral += JxW * flow;
+    head_min = std::min(head_min, head);
+    head_max = std::max(head_max, head);
+    flow_min = std::min(flow_min, flow);
+    flow_max = std::max(flow_max, flow);
+  }
+
+  void merge(const In_Situ_Sums &other)
+  {
+    volume += other.volume;
+    head_integral += other.head_integral;
+    flow_integral += other.flow_integral;
+    head_min = std::min(head_min, other.head_min);
+    head_max = std::max(head_max, other.head_max);
+    flow_min = std::min(flow_min, other.flow_min);
+    flow_max = std::max(flow_max, other.flow_max);
+    for (auto &&id_and_flux : other.boundary_flux)
+      boundary_flux[id_and_flux.first] += id_and_flux.second;
+  }
+
+  double volume;
+  double head_integral;
+  double flow_integral;
+  double head_min, head_max;
+  double flow_min, flow_max;
+  /* The outward flux of the flow through the boundary, for each boundary
+   * id. */
+  std::map<unsigned, double> boundary_flux;
+};
+
+/*!
+ * \ingroup in_situ
+ * \brief The counts of \c values in \c n_bins equal bins of [lo, hi]; the
+ * values out of the range go to the first or the last bin.
+ */
+inline std::vector<double> Bin_Counts(const std::vector<double> &values,
+                                      const double &lo,
+                                      const double &hi,
+                                      const unsigned &n_bins)
+{
+  std::vector<double> counts(n_bins, 0);
+  double bin_width = (hi - lo) / n_bins;
+  for (const double &value : values)
+  {
+    int i_bin = (bin_width > 0) ? (int)((value - lo) / bin_width) : 0;
+    counts[std::max(0, std::min(i_bin, (int)n_bins - 1))] += 1;
+  }
+  return counts;
+}
+
+/*!
+ * \ingroup in_situ
+ * \brief The options and the data of the in-situ analysis of one cycle.
+ * The threads write into their own In_Situ_Sums, and into the entries of
+ * their own cells, so no locking is needed.
+ */
+struct In_Situ_Analysis
+{
+  In_Situ_Analysis()
+    : enabled(false), n_bins(20), downsample_level(-1), output_every(1), n_cycles(0)
+  {
+  }
+
+  void begin(const unsigned &n_threads, const unsigned &n_cells)
+  {
+    thread_sums.assign(n_threads, In_Situ_Sums());
+    cell_volume.assign(n_cells, 0);
+    cell_head.assign(n_cells, 0);
+    cell_flow.assign(3 * n_cells, 0);
+  }
+
+  bool enabled;
+  unsigned n_bins;
+  /* The level of the downsampled field; -1 means no downsampled field. */
+  int downsample_level;
+  /* The full fields are written every output_every cycles (never, if it is
+   * zero), or when the file output_trigger exists. */
+  unsigned output_every;
+  std::string output_trigger;
+  unsigned n_cycles;
+  /* The coordinates of the probes, dim for each probe; they are evaluated
+   * by Evaluate_Points. */
+  std::vector<double> probe_points;
+
+  std::vector<In_Situ_Sums> thread_sums;
+  /* The volume, the mean head and the mean flow vector of each owned cell,
+   * in the order of All_Owned_Cells. */
+  std::vector<double> cell_volume;
+  std::vector<double> cell_head;
+  std::vector<double> cell_flow;
+};
+
+#endif
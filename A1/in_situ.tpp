@@ -0,0 +1,697 @@
+#include "diffusion.hpp"
+
+/*!
+ * \brief Reads the options of the in-situ analysis and of the full output.
+ *   - -insitu : turns on the analysis of each cycle.
+ *   - -insitu_bins <n> : the bins of the histograms of the cell means.
+ *   - -insitu_probes x0,y0[,z0],x1,y1[,z1],... : the probe points.
+ *   - -insitu_level <L> : writes the means over the ancestors of level L.
+ *   - -output_every <N> : writes the full fields every N cycles (0: never).
+ *   - -output_trigger <file> : writes the full fields when this file
+ *     exists, and removes it.
+ *   - -query_points <file> : evaluates the solution at the points of this
+ *     file (see Read_Query_Points) after each solve.
+ *   - -qoi_boundaries id0,id1,... : computes the numerical flux through
+ *     the faces with these tags after each solve; see Compute_Flux_QoI.
+ */
+template <int dim>
+void Diffusion<dim>::Setup_In_Situ()
+{
+  PetscBool in_situ_flag = PETSC_FALSE;
+  PetscOptionsGetBool(NULL, "-insitu", &in_situ_flag, NULL);
+  in_situ.enabled = (in_situ_flag == PETSC_TRUE);
+  PetscInt n_bins = 20, downsample_level = -1, output_every = 1;
+  PetscOptionsGetInt(NULL, "-insitu_bins", &n_bins, NULL);
+  PetscOptionsGetInt(NULL, "-insitu_level", &downsample_level, NULL);
+  PetscOptionsGetInt(NULL, "-output_every", &output_every, NULL);
+  in_situ.n_bins = std::max((int)n_bins, 1);
+  in_situ.downsample_level = downsample_level;
+  in_situ.output_every = std::max((int)output_every, 0);
+
+  const unsigned max_probes = 100;
+  PetscReal probe_coords[dim * max_probes];
+  PetscInt n_probe_coords = dim * max_probes;
+  PetscBool probes_flag;
+  PetscOptionsGetRealArray(NULL, "-insitu_probes", probe_coords, &n_probe_coords, &probes_flag);
+  if (probes_flag == PETSC_TRUE)
+  {
+    if (n_probe_coords % dim != 0)
+      OutLogger(std::cout,
+                " HEY! : -insitu_probes needs " + std::to_string(dim) +
+                 " coordinates for each probe; the last probe is ignored. \n");
+    in_situ.probe_points.assign(probe_coords, probe_coords + n_probe_coords - n_probe_coords % dim);
+  }
+
+  char query_file_name[1000];
+  PetscBool query_flag;
+  PetscOptionsGetString(NULL, "-query_points", query_file_name, 1000, &query_flag);
+  if (query_flag == PETSC_TRUE && !Read_Query_Points(query_file_name, dim, query_points))
+  {
+    OutLogger(std::cout,
+              " HEY! : the query points cannot be read from " + std::string(query_file_name) +
+               ". \n");
+    query_points.clear();
+  }
+  keep_cell_modes = !query_points.empty() || (in_situ.enabled && !in_situ.probe_points.empty());
+
+  PetscInt qoi_ids[100];
+  PetscInt n_qoi_ids = 100;
+  PetscBool qoi_flag;
+  PetscOptionsGetIntArray(NULL, "-qoi_boundaries", qoi_ids, &n_qoi_ids, &qoi_flag);
+  if (qoi_flag == PETSC_TRUE)
+    qoi_boundary_ids.assign(qoi_ids, qoi_ids + n_qoi_ids);
+
+  char trigger_file_name[1000];
+  PetscBool trigger_flag;
+  PetscOptionsGetString(NULL, "-output_trigger", trigger_file_name, 1000, &trigger_flag);
+  if (trigger_flag == PETSC_TRUE)
+    in_situ.output_trigger = trigger_file_name;
+  full_output_this_cycle = true;
+}
+
+/*!
+ * \brief Decides if the full fields of this cycle are written; this is
+ * called once in each cycle, before the solve, so that the recovery only
+ * keeps the output values when they are needed.
+ */
+template <int dim>
+void Diffusion<dim>::Decide_Full_Output()
+{
+  ++in_situ.n_cycles;
+  int output_due =
+   (in_situ.output_every > 0 && in_situ.n_cycles % in_situ.output_every == 0) ? 1 : 0;
+  if (!in_situ.output_trigger.empty())
+  {
+    int triggered = 0;
+    if (comm_rank == 0 && std::ifstream(in_situ.output_trigger).good())
+    {
+      triggered = 1;
+      std::remove(in_situ.output_trigger.c_str());
+    }
+    MPI_Bcast(&triggered, 1, MPI_INT, 0, comm);
+    output_due = output_due || triggered;
+  }
+  full_output_this_cycle = output_due;
+}
+
+/*!
+ * \brief Adds one recovered cell to the in-situ analysis: the integrals and
+ * the extrema of the head and the flow at the quadrature points of the
+ * error rule (which should be attached to the cell), and the outward
+ * numerical flux through the boundary faces.
+ */
+template <int dim>
+void Diffusion<dim>::In_Situ_Cell(Cell_Class<dim> &cell,
+                                  const unsigned &i_cell,
+                                  const unsigned &error_order,
+                                  const Eigen::MatrixXd &solved_uhat_vec,
+                                  const Eigen::MatrixXd &solved_u_vec,
+                                  const Eigen::MatrixXd &solved_q_vec,
+                                  In_Situ_Sums &sums)
+{
+  const unsigned n_polys = pow(cell.poly_order + 1, dim);
+  poly_space_basis<elem_basis_type, dim> &cell_basis = elem_basis(cell.poly_order);
+  const Eigen::MatrixXd &mode_to_Qpoint = cell_basis.quadrature_table(error_order).the_bases;
+  std::vector<double> Q_JxWs = cell.cell_quad_fe_vals->get_JxW_values();
+  Eigen::MatrixXd u_at_Qpoints = mode_to_Qpoint * solved_u_vec;
+  Eigen::MatrixXd q_at_Qpoints(Q_JxWs.size(), dim);
+  for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+    q_at_Qpoints.col(i_dim) = mode_to_Qpoint * solved_q_vec.block(i_dim * n_polys, 0, n_polys, 1);
+
+  double cell_volume = 0, head_integral = 0;
+  Eigen::VectorXd flow_integral = Eigen::VectorXd::Zero(dim);
+  for (unsigned i_Q = 0; i_Q < Q_JxWs.size(); ++i_Q)
+  {
+    sums.add_point(Q_JxWs[i_Q], u_at_Qpoints(i_Q, 0), q_at_Qpoints.row(i_Q).norm());
+    cell_volume += Q_JxWs[i_Q];
+    head_integral += Q_JxWs[i_Q] * u_at_Qpoints(i_Q, 0);
+    flow_integral += Q_JxWs[i_Q] * q_at_Qpoints.row(i_Q).transpose();
+  }
+  in_situ.cell_volume[i_cell] = cell_volume;
+  in_situ.cell_head[i_cell] = head_integral / cell_volume;
+  for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+    in_situ.cell_flow[3 * i_cell + i_dim] = flow_integral(i_dim) / cell_volume;
+
+  for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+    if (cell.dealii_Cell->face(i_face)->at_boundary())
+      sums.boundary_flux[BC_Index_of_Tag(cell.dealii_Cell->face(i_face)->boundary_id())] +=
+       Face_Numerical_Flux(cell, i_face, error_order, solved_uhat_vec, solved_u_vec, solved_q_vec);
+}
+
+/*!
+ * \brief Reduces the in-situ data of all threads and ranks, and writes them
+ * (rank zero): one row of InSitu_p<order>.csv, the histograms of the cell
+ * means in InSitu_p<order>_c<cycle>_hist.txt, and the probes in
+ * Probes_p<order>.csv.
+ */
+template <int dim>
+void Diffusion<dim>::Finish_In_Situ()
+{
+  double t1 = MPI_Wtime();
+  In_Situ_Sums local_sums;
+  for (const In_Situ_Sums &thread_sums : in_situ.thread_sums)
+    local_sums.merge(thread_sums);
+
+  double local_values[5] = { local_sums.volume,
+                             local_sums.head_integral,
+                             local_sums.flow_integral,
+                             local_sums.boundary_flux[Dirichlet_BC_Index],
+                             local_sums.boundary_flux[Neumann_BC_Index] };
+  double local_mins[4] = {
+    local_sums.head_min, local_sums.flow_min, -local_sums.head_max, -local_sums.flow_max
+  };
+  double global_values[5], global_mins[4];
+  MPI_Reduce(local_values, global_values, 5, MPI_DOUBLE, MPI_SUM, 0, comm);
+  MPI_Allreduce(local_mins, global_mins, 4, MPI_DOUBLE, MPI_MIN, comm);
+
+  /* The histograms of the cell means span their global range. */
+  std::vector<double> cell_flow_norms(All_Owned_Cells.size());
+  for (unsigned i_cell = 0; i_cell < All_Owned_Cells.size(); ++i_cell)
+    cell_flow_norms[i_cell] = std::sqrt(std::pow(in_situ.cell_flow[3 * i_cell], 2) +
+                                        std::pow(in_situ.cell_flow[3 * i_cell + 1], 2) +
+                                        std::pow(in_situ.cell_flow[3 * i_cell + 2], 2));
+  std::vector<double> local_counts =
+   Bin_Counts(in_situ.cell_head, global_mins[0], -global_mins[2], in_situ.n_bins);
+  std::vector<double> flow_counts =
+   Bin_Counts(cell_flow_norms, global_mins[1], -global_mins[3], in_situ.n_bins);
+  local_counts.insert(local_counts.end(), flow_counts.begin(), flow_counts.end());
+  std::vector<double> global_counts(local_counts.size());
+  MPI_Reduce(
+   local_counts.data(), global_counts.data(), local_counts.size(), MPI_DOUBLE, MPI_SUM, 0, comm);
+
+  std::vector<double> probe_values;
+  if (!in_situ.probe_points.empty())
+    probe_values = Evaluate_Points(in_situ.probe_points);
+
+  if (in_situ.downsample_level >= 0)
+    Write_Downsampled_Field();
+
+  if (comm_rank != 0)
+    return;
+  char file_name[100], buffer[400];
+  std::snprintf(file_name, 100, "InSitu_p%d.csv", poly_order);
+  std::ofstream csv_file(file_name, std::ofstream::app);
+  if (csv_file.tellp() == 0)
+    csv_file << "cycle,n_cells,volume,head_min,head_max,head_mean,flow_min,flow_max,"
+                "flow_mean,dirichlet_flux,neumann_flux"
+             << std::endl;
+  std::snprintf(buffer,
+                400,
+                "%d,%d,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e",
+                refn_cycle,
+                Grid1.n_global_active_cells(),
+                global_values[0],
+                global_mins[0],
+                -global_mins[2],
+                global_values[1] / global_values[0],
+                global_mins[1],
+                -global_mins[3],
+                global_values[2] / global_values[0],
+                global_values[3],
+                global_values[4]);
+  csv_file << buffer << std::endl;
+
+  std::snprintf(file_name, 100, "InSitu_p%d_c%02d_hist.txt", poly_order, refn_cycle);
+  std::ofstream hist_file(file_name);
+  hist_file << "# bin_lo bin_hi cells ; for the cell means of the head, then the flow"
+            << std::endl;
+  for (unsigned i_field = 0; i_field < 2; ++i_field)
+  {
+    double lo = global_mins[i_field], hi = -global_mins[i_field + 2];
+    for (unsigned i_bin = 0; i_bin < in_situ.n_bins; ++i_bin)
+    {
+      std::snprintf(buffer,
+                    400,
+                    "%14.6e %14.6e %10.0f",
+                    lo + (hi - lo) * i_bin / in_situ.n_bins,
+                    lo + (hi - lo) * (i_bin + 1) / in_situ.n_bins,
+                    global_counts[i_field * in_situ.n_bins + i_bin]);
+      hist_file << buffer << std::endl;
+    }
+    hist_file << std::endl;
+  }
+
+  if (!in_situ.probe_points.empty())
+  {
+    std::snprintf(file_name, 100, "Probes_p%d.csv", poly_order);
+    std::ofstream probes_file(file_name, std::ofstream::app);
+    Write_Point_Values(probes_file, in_situ.probe_points, probe_values);
+  }
+  std::snprintf(
+   buffer, 400, "In-situ analysis of cycle %d : %12.4e s", refn_cycle, MPI_Wtime() - t1);
+  Execution_Time << buffer << std::endl;
+}
+
+/*!
+ * \brief Writes the means of the head and the flow over the ancestors of
+ * the owned cells on level -insitu_level (or over the cells themselves, if
+ * they are coarser), as linear cells, to insitu-<cycle>.<rank>.vtu. The
+ * children of one ancestor may be owned by two ranks; then, each rank
+ * writes the mean of its own children.
+ */
+template <int dim>
+void Diffusion<dim>::Write_Downsampled_Field()
+{
+  typedef dealii::TriaIterator<dealii::CellAccessor<dim>> Ancestor_Type;
+  struct Ancestor_Means
+  {
+    Ancestor_Type ancestor;
+    double volume;
+    double head;
+    double flow[3];
+  };
+  std::map<std::pair<int, int>, Ancestor_Means> means_of_ancestor;
+  for (unsigned i_cell = 0; i_cell < All_Owned_Cells.size(); ++i_cell)
+  {
+    Ancestor_Type ancestor = All_Owned_Cells[i_cell].dealii_Cell;
+    while (ancestor->level() > in_situ.downsample_level)
+      ancestor = ancestor->parent();
+    std::pair<int, int> key(ancestor->level(), ancestor->index());
+    if (means_of_ancestor.find(key) == means_of_ancestor.end())
+      means_of_ancestor[key] = { ancestor, 0, 0, { 0, 0, 0 } };
+    Ancestor_Means &means = means_of_ancestor[key];
+    double cell_volume = in_situ.cell_volume[i_cell];
+    means.volume += cell_volume;
+    means.head += cell_volume * in_situ.cell_head[i_cell];
+    for (unsigned i_dim = 0; i_dim < 3; ++i_dim)
+      means.flow[i_dim] += cell_volume * in_situ.cell_flow[3 * i_cell + i_dim];
+  }
+
+  VTK_Lagrange_Writer writer(dim, vtk_compress);
+  const unsigned head_array = writer.add_array("head", 1, false);
+  const unsigned flow_array = writer.add_array("flow", 3, false);
+  const unsigned volume_array = writer.add_array("volume", 1, false);
+  const std::vector<dealii::Point<dim>> unit_nodes = Lagrange_Output_Nodes(1);
+  for (auto &&key_and_means : means_of_ancestor)
+  {
+    const Ancestor_Means &means = key_and_means.second;
+    std::vector<double> node_coords(3 * unit_nodes.size(), 0);
+    for (unsigned i_node = 0; i_node < unit_nodes.size(); ++i_node)
+      for (unsigned i_vertex = 0; i_vertex < dealii::GeometryInfo<dim>::vertices_per_cell;
+           ++i_vertex)
+      {
+        double shape_value =
+         dealii::GeometryInfo<dim>::d_linear_shape_function(unit_nodes[i_node], i_vertex);
+        for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+          node_coords[3 * i_node + i_dim] +=
+           shape_value * means.ancestor->vertex(i_vertex)[i_dim];
+      }
+    writer.add_cell(node_coords);
+    writer.cell_data[head_array].values.push_back(means.head / means.volume);
+    for (unsigned i_dim = 0; i_dim < 3; ++i_dim)
+      writer.cell_data[flow_array].values.push_back(means.flow[i_dim] / means.volume);
+    writer.cell_data[volume_array].values.push_back(means.volume);
+  }
+  const std::string file_name = "insitu-" + dealii::Utilities::int_to_string(refn_cycle, 2);
+  writer.write(file_name + "." + dealii::Utilities::int_to_string(comm_rank, 4) + ".vtu");
+  if (comm_rank == 0)
+  {
+    std::vector<std::string> piece_names;
+    for (unsigned i_rank = 0; i_rank < comm_size; ++i_rank)
+      piece_names.push_back(file_name + "." + dealii::Utilities::int_to_string(i_rank, 4) +
+                            ".vtu");
+    writer.Write_PVTU(file_name + ".pvtu", piece_names);
+  }
+}
+
+/*!
+ * \brief Builds the tree of the bounding boxes of the owned cells. Since the
+ * cells are d-linear, each of them is inside the box of its vertices. The
+ * tree is cleared by Refine_Grid, and is built again by the first query on
+ * the new mesh.
+ */
+template <int dim>
+void Diffusion<dim>::Build_Cell_Tree()
+{
+  std::vector<BBox> cell_boxes(All_Owned_Cells.size());
+  BBox rank_box;
+  for (unsigned i_cell = 0; i_cell < All_Owned_Cells.size(); ++i_cell)
+  {
+    for (unsigned i_vertex = 0; i_vertex < dealii::GeometryInfo<dim>::vertices_per_cell;
+         ++i_vertex)
+    {
+      double vertex[3] = { 0, 0, 0 };
+      for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+        vertex[i_dim] = All_Owned_Cells[i_cell].dealii_Cell->vertex(i_vertex)[i_dim];
+      cell_boxes[i_cell].extend(vertex);
+    }
+    rank_box.extend(cell_boxes[i_cell]);
+  }
+  cell_tree.build(cell_boxes);
+  query_tolerance = 0;
+  for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+    query_tolerance = std::max(query_tolerance, 1.e-10 * (rank_box.hi[i_dim] - rank_box.lo[i_dim]));
+}
+
+/*!
+ * \brief Evaluates the head and the flow at a batch of points (dim
+ * coordinates for each point), which should be the same in all ranks. Each
+ * rank finds the candidate cells of a point by cell_tree, and takes the
+ * first one whose unit cell contains the point. The modes of the cells are
+ * kept by the last Calculate_Internal_Unknowns. A point on the boundary of
+ * two ranks is found by both, and gets the mean of their values.
+ * \return in rank zero, dim + 1 values (the head and the flow) for each
+ * point; NaN for the points out of the mesh.
+ */
+template <int dim>
+std::vector<double> Diffusion<dim>::Evaluate_Points(const std::vector<double> &points)
+{
+  if (cell_tree.empty())
+    Build_Cell_Tree();
+  const unsigned n_points = points.size() / dim;
+  /* The values of each point, and the number of ranks which found it. */
+  std::vector<double> local_values((dim + 2) * n_points, 0);
+  std::vector<unsigned> candidates;
+  for (unsigned i_point = 0; i_point < n_points; ++i_point)
+  {
+    double point_3d[3] = { 0, 0, 0 };
+    dealii::Point<dim> point;
+    for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+      point_3d[i_dim] = point[i_dim] = points[i_point * dim + i_dim];
+    cell_tree.find(point_3d, query_tolerance, candidates);
+    for (const unsigned &i_cell : candidates)
+    {
+      const Cell_Class<dim> &cell = All_Owned_Cells[i_cell];
+      dealii::Point<dim> unit_point;
+      try
+      {
+        unit_point = Elem_Mapping.transform_real_to_unit_cell(cell.dealii_Cell, point);
+      }
+      catch (...)
+      {
+        continue;
+      }
+      if (!dealii::GeometryInfo<dim>::is_inside_unit_cell(unit_point, 1.e-10))
+        continue;
+      unit_point = dealii::GeometryInfo<dim>::project_to_unit_cell(unit_point);
+      std::vector<double> N_valus = elem_basis(cell.poly_order).value(unit_point);
+      const double *modes = &cell_modes[cell_mode_start[i_cell]];
+      double *values = &local_values[(dim + 2) * i_point];
+      for (unsigned i_component = 0; i_component < dim + 1; ++i_component)
+        for (unsigned i_poly = 0; i_poly < N_valus.size(); ++i_poly)
+          values[i_component] += N_valus[i_poly] * modes[i_component * N_valus.size() + i_poly];
+      values[dim + 1] = 1;
+      break;
+    }
+  }
+
+  std::vector<double> global_values(local_values.size());
+  MPI_Reduce(local_values.data(),
+             global_values.data(),
+             local_values.size(),
+             MPI_DOUBLE,
+             MPI_SUM,
+             0,
+             comm);
+  std::vector<double> point_values;
+  if (comm_rank != 0)
+    return point_values;
+  point_values.assign((dim + 1) * n_points, std::numeric_limits<double>::quiet_NaN());
+  for (unsigned i_point = 0; i_point < n_points; ++i_point)
+  {
+    const double hits = global_values[(dim + 2) * i_point + dim + 1];
+    if (hits > 0)
+      for (unsigned i_component = 0; i_component < dim + 1; ++i_component)
+        point_values[(dim + 1) * i_point + i_component] =
+         global_values[(dim + 2) * i_point + i_component] / hits;
+  }
+  return point_values;
+}
+
+/*!
+ * \brief Writes the rows of the points of one cycle, with a header if the
+ * file is empty.
+ */
+template <int dim>
+void Diffusion<dim>::Write_Point_Values(std::ofstream &out_file,
+                                        const std::vector<double> &points,
+                                        const std::vector<double> &point_values)
+{
+  if (out_file.tellp() == 0)
+    out_file << "cycle,point,x,y,z,head,flow_x,flow_y,flow_z" << std::endl;
+  char buffer[400];
+  for (unsigned i_point = 0; i_point < points.size() / dim; ++i_point)
+  {
+    double coords[3] = { 0, 0, 0 }, values[4] = { 0, 0, 0, 0 };
+    for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+      coords[i_dim] = points[i_point * dim + i_dim];
+    for (unsigned i_component = 0; i_component < dim + 1; ++i_component)
+      values[i_component] = point_values[(dim + 1) * i_point + i_component];
+    std::snprintf(buffer,
+                  400,
+                  "%d,%d,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e",
+                  refn_cycle,
+                  i_point,
+                  coords[0],
+                  coords[1],
+                  coords[2],
+                  values[0],
+                  values[1],
+                  values[2],
+                  values[3]);
+    out_file << buffer << std::endl;
+  }
+}
+
+/*!
+ * \brief Evaluates the points of -query_points, and writes them to
+ * Queries_p<order>_c<cycle>.csv.
+ */
+template <int dim>
+void Diffusion<dim>::Run_Point_Queries()
+{
+  double t1 = MPI_Wtime();
+  bool tree_was_built = !cell_tree.empty();
+  std::vector<double> point_values = Evaluate_Points(query_points);
+  if (comm_rank != 0)
+    return;
+  char file_name[100], buffer[300];
+  std::snprintf(file_name, 100, "Queries_p%d_c%02d.csv", poly_order, refn_cycle);
+  std::ofstream queries_file(file_name);
+  Write_Point_Values(queries_file, query_points, point_values);
+  std::snprintf(buffer,
+                300,
+                "Point queries of cycle %d : %d points, %12.4e s (%s)",
+                refn_cycle,
+                (int)(query_points.size() / dim),
+                MPI_Wtime() - t1,
+                tree_was_built ? "cached tree" : "new tree");
+  Execution_Time << buffer << std::endl;
+}
+
+/*!
+ * \brief The outward numerical flux of the HDG method through one face,
+ * \f$\int_F \hat{q}\cdot n = \int_F q\cdot n + \tau (u - \hat{u})\f$, from
+ * the local solution of the cell. The FEValues of the rule with
+ * \c n_points_1D points should be attached to the cell. Since this is the
+ * flux which the global system conserves, the fluxes of the two sides of
+ * an interior face cancel.
+ */
+template <int dim>
+double Diffusion<dim>::Face_Numerical_Flux(Cell_Class<dim> &cell,
+                                           const unsigned &i_face,
+                                           const unsigned &n_points_1D,
+                                           const Eigen::MatrixXd &solved_uhat_vec,
+                                           const Eigen::MatrixXd &solved_u_vec,
+                                           const Eigen::MatrixXd &solved_q_vec)
+{
+  const unsigned n_polys = pow(cell.poly_order + 1, dim);
+  poly_space_basis<elem_basis_type, dim> &cell_basis = elem_basis(cell.poly_order);
+  const Quadrature_Table<dim - 1> &face_table = the_face_basis.quadrature_table(n_points_1D);
+  const Eigen::MatrixXd &face_bases = face_basis(cell.face_poly_order[i_face])
+                                       .half_range_table(cell.half_range_flag[i_face], n_points_1D);
+  Eigen::MatrixXd uhat_at_Qpoints =
+   face_bases *
+   solved_uhat_vec.block(cell.face_DOF_start(i_face), 0, cell.n_face_DOFs(i_face), 1);
+
+  cell.reinit_Face_FEValues(i_face);
+  std::vector<dealii::Point<dim>> Projected_Face_Q_Points(face_table.quadrature.size());
+  dealii::QProjector<dim>::project_to_face(face_table.quadrature, i_face, Projected_Face_Q_Points);
+  std::vector<dealii::Point<dim>> Normals = cell.face_quad_fe_vals->get_normal_vectors();
+  std::vector<double> Face_JxW = cell.face_quad_fe_vals->get_JxW_values();
+  double face_flux = 0;
+  for (unsigned i_Q_face = 0; i_Q_face < Face_JxW.size(); ++i_Q_face)
+  {
+    std::vector<double> N_valus = cell_basis.value(Projected_Face_Q_Points[i_Q_face]);
+    double u_at_Qpoint = 0, qn_at_Qpoint = 0;
+    for (unsigned i_poly = 0; i_poly < n_polys; ++i_poly)
+    {
+      u_at_Qpoint += N_valus[i_poly] * solved_u_vec(i_poly, 0);
+      for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+        qn_at_Qpoint +=
+         N_valus[i_poly] * solved_q_vec(i_dim * n_polys + i_poly, 0) * Normals[i_Q_face](i_dim);
+    }
+    face_flux += Face_JxW[i_Q_face] *
+                 (qn_at_Qpoint + taus[i_face] * (u_at_Qpoint - uhat_at_Qpoints(i_Q_face, 0)));
+  }
+  return face_flux;
+}
+
+/*!
+ * \brief True if the fields of the cells have to be recovered in this cycle.
+ * Otherwise, when only the flux quantities of interest are requested, the
+ * local solves are done only in the cells at the requested boundaries.
+ */
+template <int dim>
+bool Diffusion<dim>::Recovery_Needed() const
+{
+  return qoi_boundary_ids.empty() || full_output_this_cycle || in_situ.enabled ||
+         !query_points.empty() || Adaptive_ON;
+}
+
+/*!
+ * \brief Computes the numerical flux and the area of the faces of each tag
+ * of -qoi_boundaries (see Face_Tag). The flux through the boundary faces is
+ * outward. The interior faces of a tag (an interface of an imported mesh)
+ * are integrated once, and their flux is oriented by Interior_QoI_Sign.
+ * Only the cells which have a face with these tags are solved. The sums are
+ * written by rank zero to QoI_p<order>.csv.
+ */
+template <int dim>
+void Diffusion<dim>::Compute_Flux_QoI(double *const &local_uhat_vec)
+{
+  double t1 = MPI_Wtime();
+  std::vector<unsigned> qoi_cells;
+  for (unsigned i_cell = 0; i_cell < All_Owned_Cells.size(); ++i_cell)
+    for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+      if (Is_QoI_Face(All_Owned_Cells[i_cell], i_face))
+      {
+        qoi_cells.push_back(i_cell);
+        break;
+      }
+
+  /* The flux and the area of each boundary, for each thread. */
+  const unsigned n_ids = qoi_boundary_ids.size();
+  std::vector<double> thread_sums(2 * n_ids * n_threads, 0);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads)
+  {
+    unsigned thread_id = omp_get_thread_num();
+    unsigned n_team = omp_get_num_threads();
+#else
+  unsigned thread_id = 0;
+  unsigned n_team = 1;
+  {
+#endif
+    std::map<unsigned, Cell_FEValues> fe_vals_of_order;
+    double *sums = &thread_sums[2 * n_ids * thread_id];
+    for (unsigned i_qoi_cell = thread_id; i_qoi_cell < qoi_cells.size(); i_qoi_cell += n_team)
+    {
+      Cell_Class<dim> &cell = All_Owned_Cells[qoi_cells[i_qoi_cell]];
+      Eigen::MatrixXd solved_uhat_vec, solved_u_vec, solved_q_vec;
+      Local_Solve(
+       cell, fe_vals_of_order, local_uhat_vec, solved_uhat_vec, solved_u_vec, solved_q_vec);
+      for (unsigned i_face = 0; i_face < n_faces_per_cell; ++i_face)
+      {
+        if (!Is_QoI_Face(cell, i_face))
+          continue;
+        unsigned i_id =
+         std::find(qoi_boundary_ids.begin(), qoi_boundary_ids.end(), Face_Tag(cell, i_face)) -
+         qoi_boundary_ids.begin();
+        double face_flux = Face_Numerical_Flux(
+         cell, i_face, cell.quad_order, solved_uhat_vec, solved_u_vec, solved_q_vec);
+        if (!cell.dealii_Cell->face(i_face)->at_boundary())
+          face_flux *= Interior_QoI_Sign(cell, i_face);
+        sums[2 * i_id] += face_flux;
+        for (const double &JxW : cell.face_quad_fe_vals->get_JxW_values())
+          sums[2 * i_id + 1] += JxW;
+      }
+      Cell_FEValues &fe_vals = fe_vals_of_order[cell.quad_order];
+      cell.detach_FEValues(
+       fe_vals.quad_elem, fe_vals.quad_face, fe_vals.supp_elem, fe_vals.supp_face);
+    }
+  }
+
+  std::vector<double> local_sums(2 * n_ids + 1, 0), global_sums(2 * n_ids + 1);
+  for (unsigned i_thread = 0; i_thread < n_threads; ++i_thread)
+    for (unsigned i_sum = 0; i_sum < 2 * n_ids; ++i_sum)
+      local_sums[i_sum] += thread_sums[2 * n_ids * i_thread + i_sum];
+  local_sums[2 * n_ids] = qoi_cells.size();
+  MPI_Reduce(
+   local_sums.data(), global_sums.data(), 2 * n_ids + 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+  if (comm_rank != 0)
+    return;
+
+  char file_name[100], buffer[300];
+  std::snprintf(file_name, 100, "QoI_p%d.csv", poly_order);
+  std::ofstream qoi_file(file_name, std::ofstream::app);
+  if (qoi_file.tellp() == 0)
+    qoi_file << "cycle,boundary_id,flux,area,solved_cells,n_cells" << std::endl;
+  for (unsigned i_id = 0; i_id < n_ids; ++i_id)
+  {
+    std::snprintf(buffer,
+                  300,
+                  "%d,%d,%.10e,%.10e,%d,%d",
+                  refn_cycle,
+                  qoi_boundary_ids[i_id],
+                  global_sums[2 * i_id],
+                  global_sums[2 * i_id + 1],
+                  (int)global_sums[2 * n_ids],
+                  Grid1.n_global_active_cells());
+    qoi_file << buffer << std::endl;
+  }
+  std::snprintf(buffer,
+                300,
+                "Flux QoI of cycle %d : %d of %d cells solved, %12.4e s",
+                refn_cycle,
+                (int)global_sums[2 * n_ids],
+                Grid1.n_global_active_cells(),
+                MPI_Wtime() - t1);
+  Execution_Time << buffer << std::endl;
+}
+
+/*!
+ * \brief The tag of a face: the boundary id of a boundary face, and the
+ * manifold id of an interior face, which keeps the tag of the imported mesh
+ * (see Import_Coarse_Mesh). The children of a face inherit both.
+ */
+template <int dim>
+unsigned Diffusion<dim>::Face_Tag(const Cell_Class<dim> &cell, const unsigned &i_face) const
+{
+  const auto &face = cell.dealii_Cell->face(i_face);
+  return face->at_boundary() ? (unsigned)face->boundary_id() : (unsigned)face->manifold_id();
+}
+
+/*!
+ * \brief True if the face has a tag of -qoi_boundaries, and this cell
+ * integrates it. An interior face is integrated by one of its sides only:
+ * by the coarse side of a hanging face, and otherwise by the cell with the
+ * smaller CellId. Since the global system conserves the numerical flux,
+ * both sides give the same flux, with opposite signs.
+ */
+template <int dim>
+bool Diffusion<dim>::Is_QoI_Face(const Cell_Class<dim> &cell, const unsigned &i_face) const
+{
+  if (std::find(qoi_boundary_ids.begin(), qoi_boundary_ids.end(), Face_Tag(cell, i_face)) ==
+      qoi_boundary_ids.end())
+    return false;
+  const auto &face = cell.dealii_Cell->face(i_face);
+  if (face->at_boundary() || face->has_children())
+    return true;
+  if (cell.dealii_Cell->neighbor_is_coarser(i_face))
+    return false;
+  return cell.dealii_Cell->id() < cell.dealii_Cell->neighbor(i_face)->id();
+}
+
+/*!
+ * \brief The sign of the outward flux of the cell through an interior face
+ * in the QoI. The flux goes from the cells with the smaller material id into
+ * the larger one. Between cells of the same material, it goes in the
+ * direction of the normal whose first nonzero component is positive; this
+ * is consistent along a straight interface only. The FEFaceValues of the
+ * face should be initialized (Face_Numerical_Flux does this).
+ */
+template <int dim>
+double Diffusion<dim>::Interior_QoI_Sign(const Cell_Class<dim> &cell,
+                                         const unsigned &i_face) const
+{
+  unsigned material = cell.dealii_Cell->material_id();
+  unsigned nb_material = cell.dealii_Cell->neighbor(i_face)->material_id();
+  if (material != nb_material)
+    return (material < nb_material) ? 1.0 : -1.0;
+  const dealii::Point<dim> normal(cell.face_quad_fe_vals->normal_vector(0));
+  for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+    if (std::abs(normal[i_dim]) > 1.0E-12)
+      return (normal[i_dim] > 0) ? 1.0 : -1.0;
+  return 1.0;
+}
@@ -24,8 +24,14 @@ struct kappa_inv_class : public Function<dim, T>
   virtual T value(const dealii::Point<dim> &x, const dealii::Point<dim> &n) const
   {
     n *n;
-    Eigen::Matrix2d kappa_inv_;
-    kappa_inv_ << 1.0 / exp(x[0] + x[1]), 0.0, 0.0, 1.0 / exp(x[0] - x[1]);
+    /* T is a fixed size dim x dim matrix, so this is not allocated on the
+     * heap at every quadrature point. In 3D, the third diagonal entry varies
+     * with x and z, in the same way as the first two. */
+    T kappa_inv_ = T::Zero();
+    kappa_inv_(0, 0) = 1.0 / exp(x[0] + x[1]);
+    kappa_inv_(1, 1) = 1.0 / exp(x[0] - x[1]);
+    if (dim == 3)
+      kappa_inv_(dim - 1, dim - 1) = 1.0 / exp(x[0] + x[dim - 1]);
 
     //   Result set 1.
     /*
@@ -146,9 +152,12 @@ struct q_func_class : public Function<dim, T>
     }
     if (dim == 3)
     {
-      q_func[0] = -M_PI * cos(M_PI * x[0]) * cos(M_PI * x[1]) * sin(M_PI * x[2]);
-      q_func[1] = M_PI * sin(M_PI * x[0]) * sin(M_PI * x[1]) * sin(M_PI * x[2]);
-      q_func[2] = -M_PI * sin(M_PI * x[0]) * cos(M_PI * x[1]) * cos(M_PI * x[2]);
+      q_func[0] =
+       -exp(x[0] + x[1]) * M_PI * cos(M_PI * x[0]) * cos(M_PI * x[1]) * sin(M_PI * x[2]);
+      q_func[1] =
+       exp(x[0] - x[1]) * M_PI * sin(M_PI * x[0]) * sin(M_PI * x[1]) * sin(M_PI * x[2]);
+      q_func[2] =
+       -exp(x[0] + x[2]) * M_PI * sin(M_PI * x[0]) * cos(M_PI * x[1]) * cos(M_PI * x[2]);
     }
 
     return q_func;
@@ -204,8 +213,11 @@ struct f_func_class : public Function<dim, T>
                M_PI * exp(x[0] + x[1]) * cos(M_PI * x[0]) * cos(M_PI * x[1]) -
                M_PI * exp(x[0] - x[1]) * sin(M_PI * x[0]) * sin(M_PI * x[1]);
     if (dim == 3)
-      f_func =
-       3 * M_PI * M_PI * sin(M_PI * x[0]) * cos(M_PI * x[1]) * sin(M_PI * x[2]);
+      f_func = M_PI * M_PI * sin(M_PI * x[0]) * cos(M_PI * x[1]) * sin(M_PI * x[2]) *
+                (exp(x[0] + x[1]) + exp(x[0] - x[1]) + exp(x[0] + x[2])) -
+               M_PI * exp(x[0] + x[1]) * cos(M_PI * x[0]) * cos(M_PI * x[1]) * sin(M_PI * x[2]) -
+               M_PI * exp(x[0] - x[1]) * sin(M_PI * x[0]) * sin(M_PI * x[1]) * sin(M_PI * x[2]) -
+               M_PI * exp(x[0] + x[2]) * sin(M_PI * x[0]) * cos(M_PI * x[1]) * cos(M_PI * x[2]);
 
     //    f_func = 0;
 
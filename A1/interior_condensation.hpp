@@ -0,0 +1,91 @@
+#include <vector>
+#include <petscvec.h>
+#include <petscmat.h>
+
+#ifndef INTERIOR_CONDENSATION_HPP
+#define INTERIOR_CONDENSATION_HPP
+
+/*!
+ * \defgroup interior_condensation Condensation of rank-interior faces
+ * \brief
+ * The second level of the static condensation. After the cells are
+ * condensed to their faces, most of the trace DOFs of a rank are on faces
+ * which no other rank has. Each rank eliminates these interior DOFs with a
+ * sparse Cholesky factorization of its local matrix, so the Krylov solver
+ * only sees the DOFs on the interfaces of the ranks. The local matrix is the
+ * matrix of the MATIS assembly (see Assembly_Type), and the Schur complement
+ * of each rank is again the local matrix of a MATIS, numbered by the
+ * interface DOFs. The interior DOFs are recovered from the interface DOFs
+ * before Calculate_Internal_Unknowns.
+ */
+
+/*!
+ * \ingroup interior_condensation
+ * \brief The data of the condensation of one solve. In the local numbering
+ * of the rank, interior_DOFs and interface_DOFs split the local DOFs;
+ * interface_number is the number of each interface DOF in the interface
+ * system. The blocks of the local matrix are K_II (interior rows and
+ * columns), K_GI (interface rows, interior columns) and K_GG.
+ */
+struct Interior_Condensation
+{
+  Interior_Condensation()
+    : enabled(false),
+      column_block(64),
+      n_all_interface_DOFs(0),
+      K_II(NULL),
+      K_GI(NULL),
+      K_GG(NULL),
+      interior_factor(NULL),
+      interface_mat(NULL),
+      interface_rhs(NULL),
+      interface_solution(NULL),
+      f_interior(NULL),
+      local_vec(NULL),
+      local_scatter(NULL)
+  {
+  }
+
+  /*!
+   * \details Destroys the PETSc objects; the options are kept.
+   */
+  void clear()
+  {
+    MatDestroy(&K_II);
+    MatDestroy(&K_GI);
+    MatDestroy(&K_GG);
+    MatDestroy(&interior_factor);
+    MatDestroy(&interface_mat);
+    VecDestroy(&interface_rhs);
+    VecDestroy(&interface_solution);
+    VecDestroy(&f_interior);
+    VecDestroy(&local_vec);
+    VecScatterDestroy(&local_scatter);
+    interior_DOFs.clear();
+    interface_DOFs.clear();
+    interface_number.clear();
+    local_to_global.clear();
+  }
+
+  bool enabled;
+  /* The number of columns of the Schur complement which are computed by
+   * one MatMatSolve. */
+  unsigned column_block;
+  PetscInt n_all_interface_DOFs;
+  std::vector<PetscInt> interior_DOFs, interface_DOFs;
+  std::vector<PetscInt> interface_number;
+  /* The global DOF of each local DOF. */
+  std::vector<PetscInt> local_to_global;
+  Mat K_II, K_GI, K_GG;
+  Mat interior_factor;
+  Mat interface_mat;
+  Vec interface_rhs, interface_solution;
+  /* The right hand side of the interior DOFs. */
+  Vec f_interior;
+  /* A vector of the local DOFs, and the scatter from the global vectors to
+   * it. */
+  Vec local_vec;
+  VecScatter local_scatter;
+};
+
+#endif
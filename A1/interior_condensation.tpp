@@ -0,0 +1,348 @@
+#include "diffusion.hpp"
+
+/*!
+ * \brief Eliminates the rank-interior DOFs from the assembled MATIS
+ * global_mat and RHS_vec, and forms the interface system in
+ * condensation.interface_mat and condensation.interface_rhs.
+ * \details A local DOF is on the interface if another rank has it as a
+ * local DOF too; this is found by adding one from every rank into a global
+ * vector. The interface DOFs are numbered by the ranks which own them in
+ * RHS_vec. The Schur complement \f$K_{GG} - K_{GI} K_{II}^{-1} K_{IG}\f$ of
+ * the rank is computed column_block columns at a time, and is added to the
+ * local matrix of the interface MATIS. The Schur complement of a rank is
+ * dense, so the local matrix is a MATSEQDENSE; when it takes more memory
+ * than the uncondensed local matrix, this is reported.
+ */
+template <int dim>
+void Diffusion<dim>::Condense_Interior_Faces()
+{
+  Interior_Condensation &cond = condensation;
+  cond.clear();
+  double t1 = MPI_Wtime();
+  Trace_Scope condense_trace(tracer, 0, "interior condensation");
+
+  const unsigned n_local_DOFs = num_local_DOFs_on_this_rank;
+  cond.local_to_global.assign(n_local_DOFs, -1);
+  for (unsigned i_DOF = 0; i_DOF < scatter_to.size(); ++i_DOF)
+    cond.local_to_global[scatter_to[i_DOF]] = scatter_from[i_DOF];
+  VecCreateSeq(PETSC_COMM_SELF, n_local_DOFs, &cond.local_vec);
+  IS from, to;
+  ISCreateGeneral(PETSC_COMM_SELF, n_local_DOFs, scatter_from.data(), PETSC_COPY_VALUES, &from);
+  ISCreateGeneral(PETSC_COMM_SELF, n_local_DOFs, scatter_to.data(), PETSC_COPY_VALUES, &to);
+  VecScatterCreate(RHS_vec, from, cond.local_vec, to, &cond.local_scatter);
+  ISDestroy(&from);
+  ISDestroy(&to);
+
+  /* Every rank adds one to its local DOFs; then the owned DOFs with more
+   * than one are numbered in the interface system, and the numbers are
+   * scattered back (as doubles, which are exact up to 2^53). */
+  PetscInt rows_owned_lo, rows_owned_hi;
+  VecGetOwnershipRange(RHS_vec, &rows_owned_lo, &rows_owned_hi);
+  Vec global_marks;
+  VecDuplicate(RHS_vec, &global_marks);
+  VecSet(global_marks, 0);
+  VecSet(cond.local_vec, 1);
+  VecScatterBegin(cond.local_scatter, cond.local_vec, global_marks, ADD_VALUES, SCATTER_REVERSE);
+  VecScatterEnd(cond.local_scatter, cond.local_vec, global_marks, ADD_VALUES, SCATTER_REVERSE);
+  double *marks;
+  VecGetArray(global_marks, &marks);
+  PetscInt n_owned_interface_DOFs = 0;
+  for (PetscInt i_row = 0; i_row < rows_owned_hi - rows_owned_lo; ++i_row)
+    if (marks[i_row] > 1.5)
+      ++n_owned_interface_DOFs;
+  PetscInt first_interface_number = 0;
+  MPI_Exscan(&n_owned_interface_DOFs, &first_interface_number, 1, MPIU_INT, MPI_SUM, comm);
+  if (comm_rank == 0)
+    first_interface_number = 0;
+  MPI_Allreduce(
+   &n_owned_interface_DOFs, &cond.n_all_interface_DOFs, 1, MPIU_INT, MPI_SUM, comm);
+  PetscInt next_interface_number = first_interface_number;
+  for (PetscInt i_row = 0; i_row < rows_owned_hi - rows_owned_lo; ++i_row)
+    marks[i_row] = (marks[i_row] > 1.5) ? next_interface_number++ : -1;
+  VecRestoreArray(global_marks, &marks);
+  VecScatterBegin(cond.local_scatter, global_marks, cond.local_vec, INSERT_VALUES, SCATTER_FORWARD);
+  VecScatterEnd(cond.local_scatter, global_marks, cond.local_vec, INSERT_VALUES, SCATTER_FORWARD);
+  VecDestroy(&global_marks);
+  const double *local_numbers;
+  VecGetArrayRead(cond.local_vec, &local_numbers);
+  for (unsigned i_DOF = 0; i_DOF < n_local_DOFs; ++i_DOF)
+  {
+    if (local_numbers[i_DOF] < -0.5)
+      cond.interior_DOFs.push_back(i_DOF);
+    else
+    {
+      cond.interface_DOFs.push_back(i_DOF);
+      cond.interface_number.push_back((PetscInt)(local_numbers[i_DOF] + 0.5));
+    }
+  }
+  VecRestoreArrayRead(cond.local_vec, &local_numbers);
+  const PetscInt n_interior = cond.interior_DOFs.size();
+  const PetscInt n_interface = cond.interface_DOFs.size();
+
+  /* The blocks of the local matrix, and the factorization of K_II. */
+  Mat local_mat;
+  MatISGetLocalMat(global_mat, &local_mat);
+  IS interior_IS, interface_IS;
+  ISCreateGeneral(
+   PETSC_COMM_SELF, n_interior, cond.interior_DOFs.data(), PETSC_COPY_VALUES, &interior_IS);
+  ISCreateGeneral(
+   PETSC_COMM_SELF, n_interface, cond.interface_DOFs.data(), PETSC_COPY_VALUES, &interface_IS);
+  MatGetSubMatrix(local_mat, interior_IS, interior_IS, MAT_INITIAL_MATRIX, &cond.K_II);
+  MatGetSubMatrix(local_mat, interface_IS, interior_IS, MAT_INITIAL_MATRIX, &cond.K_GI);
+  MatGetSubMatrix(local_mat, interface_IS, interface_IS, MAT_INITIAL_MATRIX, &cond.K_GG);
+  ISDestroy(&interior_IS);
+  ISDestroy(&interface_IS);
+  if (n_interior > 0)
+  {
+    MatSetOption(cond.K_II, MAT_SYMMETRIC, PETSC_TRUE);
+    MatGetFactor(cond.K_II, MATSOLVERPETSC, MAT_FACTOR_CHOLESKY, &cond.interior_factor);
+    IS row_perm, col_perm;
+    MatGetOrdering(cond.K_II, MATORDERINGND, &row_perm, &col_perm);
+    MatFactorInfo factor_info;
+    MatFactorInfoInitialize(&factor_info);
+    MatCholeskyFactorSymbolic(cond.interior_factor, cond.K_II, row_perm, &factor_info);
+    MatCholeskyFactorNumeric(cond.interior_factor, cond.K_II, &factor_info);
+    ISDestroy(&row_perm);
+    ISDestroy(&col_perm);
+  }
+
+  MatCreate(comm, &cond.interface_mat);
+  MatSetSizes(cond.interface_mat,
+              n_owned_interface_DOFs,
+              n_owned_interface_DOFs,
+              cond.n_all_interface_DOFs,
+              cond.n_all_interface_DOFs);
+  ISLocalToGlobalMapping interface_map;
+  ISLocalToGlobalMappingCreate(PETSC_COMM_SELF,
+                               1,
+                               n_interface,
+                               cond.interface_number.data(),
+                               PETSC_COPY_VALUES,
+                               &interface_map);
+  MatSetType(cond.interface_mat, MATIS);
+  MatSetLocalToGlobalMapping(cond.interface_mat, interface_map, interface_map);
+  ISLocalToGlobalMappingDestroy(&interface_map);
+  /* The MATIS keeps a reference to schur_mat, which is used below. */
+  Mat schur_mat;
+  MatCreateSeqDense(PETSC_COMM_SELF, n_interface, n_interface, NULL, &schur_mat);
+  MatZeroEntries(schur_mat);
+  MatSetOption(schur_mat, MAT_ROW_ORIENTED, PETSC_FALSE);
+  MatISSetLocalMat(cond.interface_mat, schur_mat);
+  MatDestroy(&schur_mat);
+  MatISGetLocalMat(cond.interface_mat, &schur_mat);
+  MatSetOption(cond.interface_mat, MAT_SPD, PETSC_TRUE);
+
+  for (PetscInt i_row = 0; i_row < n_interface; ++i_row)
+  {
+    PetscInt n_cols;
+    const PetscInt *cols;
+    const PetscScalar *vals;
+    MatGetRow(cond.K_GG, i_row, &n_cols, &cols, &vals);
+    MatSetValuesLocal(cond.interface_mat, 1, &i_row, n_cols, cols, vals, ADD_VALUES);
+    MatRestoreRow(cond.K_GG, i_row, &n_cols, &cols, &vals);
+  }
+
+  /* The columns of K_IG are the rows of K_GI, since the local matrix is
+   * symmetric. */
+  std::vector<PetscInt> all_interface_rows(n_interface);
+  for (PetscInt i_row = 0; i_row < n_interface; ++i_row)
+    all_interface_rows[i_row] = i_row;
+  for (PetscInt col_begin = 0; n_interior > 0 && col_begin < n_interface;
+       col_begin += cond.column_block)
+  {
+    const PetscInt n_block_cols = std::min((PetscInt)cond.column_block, n_interface - col_begin);
+    Mat K_IG_block, X_block, KX_block;
+    MatCreateSeqDense(PETSC_COMM_SELF, n_interior, n_block_cols, NULL, &K_IG_block);
+    MatCreateSeqDense(PETSC_COMM_SELF, n_interior, n_block_cols, NULL, &X_block);
+    MatZeroEntries(K_IG_block);
+    PetscScalar *block_vals;
+    MatDenseGetArray(K_IG_block, &block_vals);
+    for (PetscInt i_col = 0; i_col < n_block_cols; ++i_col)
+    {
+      PetscInt n_cols;
+      const PetscInt *cols;
+      const PetscScalar *vals;
+      PetscInt i_row = col_begin + i_col;
+      MatGetRow(cond.K_GI, i_row, &n_cols, &cols, &vals);
+      for (PetscInt i_nz = 0; i_nz < n_cols; ++i_nz)
+        block_vals[i_col * n_interior + cols[i_nz]] = vals[i_nz];
+      MatRestoreRow(cond.K_GI, i_row, &n_cols, &cols, &vals);
+    }
+    MatDenseRestoreArray(K_IG_block, &block_vals);
+    MatAssemblyBegin(K_IG_block, MAT_FINAL_ASSEMBLY);
+    MatAssemblyEnd(K_IG_block, MAT_FINAL_ASSEMBLY);
+    MatMatSolve(cond.interior_factor, K_IG_block, X_block);
+    MatMatMult(cond.K_GI, X_block, MAT_INITIAL_MATRIX, PETSC_DEFAULT, &KX_block);
+    MatScale(KX_block, -1.0);
+    MatDenseGetArray(KX_block, &block_vals);
+    MatSetValuesLocal(cond.interface_mat,
+                      n_interface,
+                      all_interface_rows.data(),
+                      n_block_cols,
+                      all_interface_rows.data() + col_begin,
+                      block_vals,
+                      ADD_VALUES);
+    MatDenseRestoreArray(KX_block, &block_vals);
+    MatDestroy(&K_IG_block);
+    MatDestroy(&X_block);
+    MatDestroy(&KX_block);
+  }
+  MatAssemblyBegin(cond.interface_mat, MAT_FINAL_ASSEMBLY);
+  MatAssemblyEnd(cond.interface_mat, MAT_FINAL_ASSEMBLY);
+
+  /* The interface right hand side is f_G - K_GI K_II^-1 f_I; f_G is added
+   * by the owner of each DOF only, since RHS_vec is already summed. */
+  VecScatterBegin(cond.local_scatter, RHS_vec, cond.local_vec, INSERT_VALUES, SCATTER_FORWARD);
+  VecScatterEnd(cond.local_scatter, RHS_vec, cond.local_vec, INSERT_VALUES, SCATTER_FORWARD);
+  const double *f_local;
+  VecGetArrayRead(cond.local_vec, &f_local);
+  VecCreateSeq(PETSC_COMM_SELF, n_interior, &cond.f_interior);
+  for (PetscInt i_DOF = 0; i_DOF < n_interior; ++i_DOF)
+    VecSetValue(cond.f_interior, i_DOF, f_local[cond.interior_DOFs[i_DOF]], INSERT_VALUES);
+  VecAssemblyBegin(cond.f_interior);
+  VecAssemblyEnd(cond.f_interior);
+  Vec Kinv_f, K_Kinv_f;
+  VecDuplicate(cond.f_interior, &Kinv_f);
+  VecCreateSeq(PETSC_COMM_SELF, n_interface, &K_Kinv_f);
+  VecSet(K_Kinv_f, 0);
+  if (n_interior > 0)
+  {
+    MatSolve(cond.interior_factor, cond.f_interior, Kinv_f);
+    MatMult(cond.K_GI, Kinv_f, K_Kinv_f);
+  }
+  VecCreateMPI(comm, n_owned_interface_DOFs, cond.n_all_interface_DOFs, &cond.interface_rhs);
+  VecSet(cond.interface_rhs, 0);
+  const double *correction;
+  VecGetArrayRead(K_Kinv_f, &correction);
+  for (PetscInt i_DOF = 0; i_DOF < n_interface; ++i_DOF)
+  {
+    PetscInt global_DOF = cond.local_to_global[cond.interface_DOFs[i_DOF]];
+    double rhs_value = -correction[i_DOF];
+    if (global_DOF >= rows_owned_lo && global_DOF < rows_owned_hi)
+      rhs_value += f_local[cond.interface_DOFs[i_DOF]];
+    VecSetValue(cond.interface_rhs, cond.interface_number[i_DOF], rhs_value, ADD_VALUES);
+  }
+  VecRestoreArrayRead(K_Kinv_f, &correction);
+  VecRestoreArrayRead(cond.local_vec, &f_local);
+  VecAssemblyBegin(cond.interface_rhs);
+  VecAssemblyEnd(cond.interface_rhs);
+  VecDuplicate(cond.interface_rhs, &cond.interface_solution);
+  VecDestroy(&Kinv_f);
+  VecDestroy(&K_Kinv_f);
+  condense_trace.stop();
+
+  MatInfo local_mat_info;
+  MatGetInfo(local_mat, MAT_LOCAL, &local_mat_info);
+  const double local_mat_bytes = local_mat_info.memory;
+  const double schur_bytes = (double)n_interface * n_interface * sizeof(PetscScalar);
+
+  /* Report_Memory reduces the owners of all ranks entry by entry, so every
+   * rank counts both owners, with zero bytes if it has no interior DOFs. */
+  if (memory_ledger.enabled)
+  {
+    double factor_bytes = 0;
+    if (n_interior > 0)
+    {
+      MatInfo factor_info;
+      MatGetInfo(cond.interior_factor, MAT_LOCAL, &factor_info);
+      factor_bytes = factor_info.memory;
+    }
+    memory_ledger.count("interior factor", factor_bytes);
+    memory_ledger.count("interface Schur complement", schur_bytes);
+  }
+
+  double local_counts[3] = { (double)n_interior,
+                             (double)n_interface,
+                             (schur_bytes > local_mat_bytes) ? 1.0 : 0.0 },
+         all_counts[3];
+  MPI_Reduce(local_counts, all_counts, 3, MPI_DOUBLE, MPI_SUM, 0, comm);
+  double condense_time = MPI_Wtime() - t1, max_condense_time;
+  MPI_Reduce(&condense_time, &max_condense_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+  if (comm_rank == 0)
+  {
+    char buffer[300];
+    std::snprintf(buffer,
+                  300,
+                  "Interior condensation of cycle %d : interior DOFs : %.0f, local interface "
+                  "DOFs : %.0f, interface system : %lld, time : %12.4e s",
+                  refn_cycle,
+                  all_counts[0],
+                  all_counts[1],
+                  (long long)cond.n_all_interface_DOFs,
+                  max_condense_time);
+    Execution_Time << buffer << std::endl;
+    if (all_counts[2] > 0.5)
+    {
+      std::snprintf(buffer,
+                    300,
+                    " HEY! : On %.0f ranks, the dense Schur complement is larger than the "
+                    "uncondensed local matrix. \n",
+                    all_counts[2]);
+      OutLogger(std::cout, buffer);
+    }
+  }
+}
+
+/*!
+ * \brief Recovers the interior DOFs from the solution of the interface
+ * system, \f$u_I = K_{II}^{-1}(f_I - K_{IG} u_G)\f$, and writes all of the
+ * owned DOFs into solution_vec.
+ */
+template <int dim>
+void Diffusion<dim>::Recover_Interior_Faces()
+{
+  Interior_Condensation &cond = condensation;
+  Trace_Scope recover_trace(tracer, 0, "interior recovery");
+  const PetscInt n_interior = cond.interior_DOFs.size();
+  const PetscInt n_interface = cond.interface_DOFs.size();
+
+  Vec u_interface, u_interior;
+  VecCreateSeq(PETSC_COMM_SELF, n_interface, &u_interface);
+  VecDuplicate(cond.f_interior, &u_interior);
+  IS from, to;
+  ISCreateGeneral(
+   PETSC_COMM_SELF, n_interface, cond.interface_number.data(), PETSC_COPY_VALUES, &from);
+  ISCreateStride(PETSC_COMM_SELF, n_interface, 0, 1, &to);
+  VecScatter interface_scatter;
+  VecScatterCreate(cond.interface_solution, from, u_interface, to, &interface_scatter);
+  VecScatterBegin(
+   interface_scatter, cond.interface_solution, u_interface, INSERT_VALUES, SCATTER_FORWARD);
+  VecScatterEnd(
+   interface_scatter, cond.interface_solution, u_interface, INSERT_VALUES, SCATTER_FORWARD);
+  VecScatterDestroy(&interface_scatter);
+  ISDestroy(&from);
+  ISDestroy(&to);
+
+  if (n_interior > 0)
+  {
+    Vec rhs_interior;
+    VecDuplicate(cond.f_interior, &rhs_interior);
+    MatMultTranspose(cond.K_GI, u_interface, rhs_interior);
+    VecAYPX(rhs_interior, -1.0, cond.f_interior);
+    MatSolve(cond.interior_factor, rhs_interior, u_interior);
+    VecDestroy(&rhs_interior);
+  }
+
+  PetscInt rows_owned_lo, rows_owned_hi;
+  VecGetOwnershipRange(solution_vec, &rows_owned_lo, &rows_owned_hi);
+  const double *interface_values, *interior_values;
+  VecGetArrayRead(u_interface, &interface_values);
+  VecGetArrayRead(u_interior, &interior_values);
+  for (PetscInt i_DOF = 0; i_DOF < n_interface; ++i_DOF)
+  {
+    PetscInt global_DOF = cond.local_to_global[cond.interface_DOFs[i_DOF]];
+    if (global_DOF >= rows_owned_lo && global_DOF < rows_owned_hi)
+      VecSetValue(solution_vec, global_DOF, interface_values[i_DOF], INSERT_VALUES);
+  }
+  for (PetscInt i_DOF = 0; i_DOF < n_interior; ++i_DOF)
+    VecSetValue(solution_vec,
+                cond.local_to_global[cond.interior_DOFs[i_DOF]],
+                interior_values[i_DOF],
+                INSERT_VALUES);
+  VecRestoreArrayRead(u_interface, &interface_values);
+  VecRestoreArrayRead(u_interior, &interior_values);
+  VecAssemblyBegin(solution_vec);
+  VecAssemblyEnd(solution_vec);
+  VecDestroy(&u_interface);
+  VecDestroy(&u_interior);
+}
@@ -84,27 +84,178 @@ void Tokenize(const std::string &str_in,
 }
 
 
+/*!
+ * \brief The context of Trace_KSP_Iteration: the tracer, and the time of its
+ * previous call.
+ */
+struct Trace_KSP_Context
+{
+  Event_Tracer *tracer;
+  double last_time;
+};
+
+/*!
+ * \brief A KSP monitor which records each iteration of the solver as a span
+ * in the trace. It is called once before the first iteration, and once after
+ * each iteration.
+ */
+PetscErrorCode Trace_KSP_Iteration(KSP, PetscInt iteration, PetscReal, void *context)
+{
+  Trace_KSP_Context *the_context = (Trace_KSP_Context *)context;
+  if (iteration > 0)
+    the_context->tracer->record(0, "KSP iteration", the_context->last_time);
+  the_context->last_time = the_context->tracer->now();
+  return 0;
+}
+
+/*!
+ * \brief The levels of a multigrid preconditioner (PCMG or PCGAMG) and the
+ * complexities of its hierarchy: the operator complexity is the sum of the
+ * nonzeros of the operators of all levels over the nonzeros of the finest
+ * one, and the grid complexity is the same ratio for the rows. For the other
+ * preconditioners, all of them are zero. It should be called after the setup.
+ */
+void Multigrid_Complexities(PC the_pc,
+                            int &n_levels,
+                            double &operator_complexity,
+                            double &grid_complexity)
+{
+  n_levels = 0;
+  operator_complexity = grid_complexity = 0;
+  PetscBool is_gamg, is_mg;
+  PetscObjectTypeCompare((PetscObject)the_pc, PCGAMG, &is_gamg);
+  PetscObjectTypeCompare((PetscObject)the_pc, PCMG, &is_mg);
+  if (!is_gamg && !is_mg)
+    return;
+  PetscInt n_mg_levels;
+  PCMGGetLevels(the_pc, &n_mg_levels);
+  double fine_nonzeros = 0, fine_rows = 0, all_nonzeros = 0, all_rows = 0;
+  for (PetscInt i_level = 0; i_level < n_mg_levels; ++i_level)
+  {
+    KSP level_smoother;
+    Mat level_mat;
+    PCMGGetSmoother(the_pc, i_level, &level_smoother);
+    KSPGetOperators(level_smoother, &level_mat, NULL);
+    MatInfo level_info;
+    MatGetInfo(level_mat, MAT_GLOBAL_SUM, &level_info);
+    PetscInt n_rows, n_cols;
+    MatGetSize(level_mat, &n_rows, &n_cols);
+    all_nonzeros += level_info.nz_used;
+    all_rows += n_rows;
+    /* Level zero is the coarsest one. */
+    if (i_level == n_mg_levels - 1)
+    {
+      fine_nonzeros = level_info.nz_used;
+      fine_rows = n_rows;
+    }
+  }
+  n_levels = n_mg_levels;
+  if (fine_nonzeros > 0)
+    operator_complexity = all_nonzeros / fine_nonzeros;
+  if (fine_rows > 0)
+    grid_complexity = all_rows / fine_rows;
+}
+
 /*
  * This is the main class in this program. I will elaborate, later !
  */
 
+/*!
+ * \brief Decides if \c the_mat is solved by the direct solver: if
+ * -direct_solve is given, and the estimated factors of every rank fit in
+ * -direct_max_mb. Otherwise, CG is used.
+ */
+template <int dim>
+bool Diffusion<dim>::Use_Direct_Solver(Mat the_mat)
+{
+  if (!direct_solver.enabled)
+    return false;
+  MatInfo mat_info;
+  MatGetInfo(the_mat, MAT_LOCAL, &mat_info);
+  double factor_bytes =
+   direct_solver.fill * mat_info.nz_used * (sizeof(PetscScalar) + sizeof(PetscInt));
+  double max_factor_bytes;
+  MPI_Allreduce(&factor_bytes, &max_factor_bytes, 1, MPI_DOUBLE, MPI_MAX, comm);
+  if (max_factor_bytes <= direct_solver.max_bytes)
+    return true;
+  if (comm_rank == 0)
+  {
+    char buffer[300];
+    std::snprintf(buffer,
+                  300,
+                  "The direct solve of cycle %d is skipped : the factors of a rank would "
+                  "need %10.1f MB, more than -direct_max_mb %10.1f MB.",
+                  refn_cycle,
+                  max_factor_bytes / 1048576.0,
+                  direct_solver.max_bytes / 1048576.0);
+    OutLogger(Execution_Time, buffer, true);
+  }
+  return false;
+}
+
+/*!
+ * \brief A new KSP of the direct solver for \c the_mat. The caller
+ * destroys it, which frees the factors.
+ */
+template <int dim>
+KSP Diffusion<dim>::Direct_Solver_KSP(Mat the_mat)
+{
+  KSP the_ksp;
+  KSPCreate(comm, &the_ksp);
+  KSPSetOperators(the_ksp, the_mat, the_mat);
+  KSPSetType(the_ksp, KSPPREONLY);
+  PC the_pc;
+  KSPGetPC(the_ksp, &the_pc);
+  PCSetType(the_pc, direct_solver.use_LU ? PCLU : PCCHOLESKY);
+  PCFactorSetMatSolverPackage(the_pc, direct_solver.package.c_str());
+  PCFactorSetMatOrderingType(the_pc, MATORDERINGND);
+  return the_ksp;
+}
+
 template <int dim>
 PetscErrorCode Diffusion<dim>::Solve_Linear_Systam()
 {
-  int rows_owned_lo, rows_owned_hi;
+  PetscInt rows_owned_lo, rows_owned_hi;
   MatCreate(comm, &global_mat);
-  MatSetType(global_mat, MATMPIAIJ);
   MatSetSizes(global_mat,
               num_global_DOFs_on_this_rank,
               num_global_DOFs_on_this_rank,
               num_global_DOFs_on_all_ranks,
               num_global_DOFs_on_all_ranks);
 
-  MatMPIAIJSetPreallocation(global_mat,
-                            0,
-                            n_local_DOFs_connected_to_DOF.data(),
-                            0,
-                            n_nonlocal_DOFs_connected_to_DOF.data());
+  if (assembly_type == IS_Assembly)
+  {
+    /* The local DOF scatter_to[i] is the global DOF scatter_from[i]. */
+    std::vector<PetscInt> local_to_global(num_local_DOFs_on_this_rank);
+    for (unsigned i_DOF = 0; i_DOF < scatter_to.size(); ++i_DOF)
+      local_to_global[scatter_to[i_DOF]] = scatter_from[i_DOF];
+    ISLocalToGlobalMapping local_to_global_map;
+    ISLocalToGlobalMappingCreate(PETSC_COMM_SELF,
+                                 1,
+                                 num_local_DOFs_on_this_rank,
+                                 local_to_global.data(),
+                                 PETSC_COPY_VALUES,
+                                 &local_to_global_map);
+    MatSetType(global_mat, MATIS);
+    MatSetLocalToGlobalMapping(global_mat, local_to_global_map, local_to_global_map);
+    ISLocalToGlobalMappingDestroy(&local_to_global_map);
+
+    std::vector<PetscInt> n_DOFs_connected_to_local_DOF;
+    Count_Local_Connections(n_DOFs_connected_to_local_DOF);
+    Mat local_mat;
+    MatISGetLocalMat(global_mat, &local_mat);
+    MatSeqAIJSetPreallocation(local_mat, 0, n_DOFs_connected_to_local_DOF.data());
+    MatSetOption(local_mat, MAT_ROW_ORIENTED, PETSC_FALSE);
+  }
+  else
+  {
+    MatSetType(global_mat, MATMPIAIJ);
+    MatMPIAIJSetPreallocation(global_mat,
+                              0,
+                              n_local_DOFs_connected_to_DOF.data(),
+                              0,
+                              n_nonlocal_DOFs_connected_to_DOF.data());
+  }
 
   /*
   std::cout << "rank ID : " << comm_rank << "   " << current_refinement_level
@@ -121,6 +272,9 @@ PetscErrorCode Diffusion<dim>::Solve_Linear_Systam()
   VecDuplicate(RHS_vec, &exact_solution);
 
   double t11, t12, t13, t21, t22, t23;
+  perf_recorder.clear();
+  thread_matrix_bytes.assign(n_threads, 0);
+  memory_ledger.begin_phase();
   if (comm_rank == 0)
     Execution_Time << "Entering assembly : " << currentDateTime() << std::endl;
   t11 = MPI_Wtime();
@@ -133,37 +287,181 @@ PetscErrorCode Diffusion<dim>::Solve_Linear_Systam()
     Execution_Time << "Entering solver : " << currentDateTime() << std::endl;
 
   t12 = MPI_Wtime();
+  Trace_Scope assembly_trace(tracer, 0, "PETSc assembly");
+  Perf_Scope assembly_scope(
+   perf_recorder, perf_recorder.master_counters, Perf_Global_Assembly, 0);
+  double comm_t1 = MPI_Wtime();
   PetscErrorCode assem_error = MatAssemblyBegin(global_mat, MAT_FINAL_ASSEMBLY);
   CHKERRQ(assem_error);
+  if (comm_ledger.enabled)
+  {
+    PetscInt n_stash, n_reallocs, n_block_stash, n_block_reallocs;
+    MatStashGetInfo(global_mat, &n_stash, &n_reallocs, &n_block_stash, &n_block_reallocs);
+    comm_ledger.phases[Comm_PETSc_Assembly].stash_entries += n_stash + n_block_stash;
+    comm_ledger.phases[Comm_PETSc_Assembly].stash_reallocs += n_reallocs + n_block_reallocs;
+  }
   assem_error = MatAssemblyEnd(global_mat, MAT_FINAL_ASSEMBLY);
   CHKERRQ(assem_error);
 
   VecAssemblyBegin(RHS_vec);
+  if (comm_ledger.enabled)
+  {
+    PetscInt n_stash, n_reallocs, n_block_stash, n_block_reallocs;
+    VecStashGetInfo(RHS_vec, &n_stash, &n_reallocs, &n_block_stash, &n_block_reallocs);
+    comm_ledger.phases[Comm_PETSc_Assembly].stash_entries += n_stash + n_block_stash;
+    comm_ledger.phases[Comm_PETSc_Assembly].stash_reallocs += n_reallocs + n_block_reallocs;
+  }
   VecAssemblyEnd(RHS_vec);
   double rhs_norm;
   VecNorm(RHS_vec, NORM_2, &rhs_norm);
 
   VecAssemblyBegin(exact_solution);
   VecAssemblyEnd(exact_solution);
+  comm_ledger.wait(Comm_PETSc_Assembly, MPI_Wtime() - comm_t1);
+  comm_ledger.finish_aggregates(Comm_PETSc_Assembly);
+  assembly_scope.stop();
+  assembly_trace.stop();
+  memory_ledger.end_phase("assembly");
+  double all_thread_matrix_bytes = 0;
+  for (const double &matrix_bytes : thread_matrix_bytes)
+    all_thread_matrix_bytes += matrix_bytes;
+  memory_ledger.count("local matrices (all threads)", all_thread_matrix_bytes);
+
+  if (report_matrix_locality)
+    Report_Matrix_Locality();
+
+  /* A few MatMult's alone, to compare their counters with the whole solve. */
+  if (perf_recorder.enabled)
+  {
+    Vec x, y;
+    VecDuplicate(RHS_vec, &x);
+    VecDuplicate(RHS_vec, &y);
+    VecSet(x, 1.0);
+    {
+      Perf_Scope spmv_scope(perf_recorder, perf_recorder.master_counters, Perf_SpMV, 0);
+      for (unsigned i_spmv = 0; i_spmv < 10; ++i_spmv)
+        MatMult(global_mat, x, y);
+    }
+    VecDestroy(&x);
+    VecDestroy(&y);
+  }
+
+  /* With the condensation of the interior faces, the Krylov solver only
+   * sees the interface system. */
+  Mat solver_mat = global_mat;
+  Vec solver_rhs = RHS_vec, solver_solution = solution_vec;
+  if (condensation.enabled)
+  {
+    Condense_Interior_Faces();
+    solver_mat = condensation.interface_mat;
+    solver_rhs = condensation.interface_rhs;
+    solver_solution = condensation.interface_solution;
+  }
 
   KSP TheSolver;
   KSPConvergedReason How_KSP_Stopped;
-  KSPCreate(comm, &TheSolver);
-  KSPSetTolerances(TheSolver, 1E-8, PETSC_DEFAULT, PETSC_DEFAULT, PETSC_DEFAULT);
-  KSPSetOperators(TheSolver, global_mat, global_mat);
-  KSPSetType(TheSolver, KSPCG);
-  KSPSetFromOptions(TheSolver);
-
   PC ThePreCond;
-  KSPGetPC(TheSolver, &ThePreCond);
-  PCSetFromOptions(ThePreCond);
+  const bool direct_solve = Use_Direct_Solver(solver_mat);
+  if (direct_solve)
+  {
+    TheSolver = Direct_Solver_KSP(solver_mat);
+    KSPGetPC(TheSolver, &ThePreCond);
+  }
+  else
+  {
+    KSPCreate(comm, &TheSolver);
+    double cycle_rtol =
+     adaptive_tolerance.rtol((double)num_global_DOFs_on_all_ranks, poly_order, dim);
+    KSPSetTolerances(TheSolver, cycle_rtol, PETSC_DEFAULT, PETSC_DEFAULT, PETSC_DEFAULT);
+    KSPSetOperators(TheSolver, solver_mat, solver_mat);
+    KSPSetType(TheSolver, KSPCG);
+    KSPSetFromOptions(TheSolver);
+
+    KSPGetPC(TheSolver, &ThePreCond);
+    PCSetFromOptions(ThePreCond);
 
-  PCSetType(ThePreCond, PCGAMG);
-  PCGAMGSetType(ThePreCond, PCGAMGAGG);
-  PCGAMGSetNSmooths(ThePreCond, 1);
+    if (assembly_type == IS_Assembly)
+    {
+      PCSetType(ThePreCond, PCBDDC);
+      PCSetFromOptions(ThePreCond);
+    }
+    else
+    {
+      PCSetType(ThePreCond, PCGAMG);
+      PCGAMGSetType(ThePreCond, PCGAMGAGG);
+      PCGAMGSetNSmooths(ThePreCond, 1);
+    }
+  }
+
+  Trace_KSP_Context trace_ksp_context = { &tracer, 0 };
+  if (tracer.enabled)
+    KSPMonitorSet(TheSolver, Trace_KSP_Iteration, &trace_ksp_context, NULL);
+
+  /* The residual history is kept in our own array, which is large enough
+   * for the maximum number of iterations. */
+  std::vector<PetscReal> residual_history;
+  if (solver_report)
+  {
+    PetscReal rtol, abstol, dtol;
+    PetscInt max_its;
+    KSPGetTolerances(TheSolver, &rtol, &abstol, &dtol, &max_its);
+    residual_history.resize(max_its + 1);
+    KSPSetResidualHistory(TheSolver, residual_history.data(), max_its + 1, PETSC_TRUE);
+  }
+  /* The adaptive tolerance scales the next rtol by the condition estimate. */
+  if ((solver_report || adaptive_tolerance.enabled) && !direct_solve)
+    KSPSetComputeSingularValues(TheSolver, PETSC_TRUE);
 
   int num_iter;
-  KSPSolve(TheSolver, RHS_vec, solution_vec);
+  memory_ledger.begin_phase();
+  Trace_Scope solve_trace(tracer, 0, "KSP solve");
+  Perf_Scope solve_scope(perf_recorder, perf_recorder.master_counters, Perf_KSP_Solve, 0);
+  double setup_t1 = MPI_Wtime();
+  KSPSetUp(TheSolver);
+  double solve_t1 = MPI_Wtime();
+  KSPSolve(TheSolver, solver_rhs, solver_solution);
+  if (condensation.enabled)
+    Recover_Interior_Faces();
+  double solve_t2 = MPI_Wtime();
+  solve_scope.stop();
+  solve_trace.stop();
+  memory_ledger.end_phase("KSP solve");
+  if (memory_ledger.enabled)
+  {
+    /* For MATIS, the memory is in the local matrix of the rank. */
+    Mat info_mat = global_mat;
+    if (assembly_type == IS_Assembly)
+      MatISGetLocalMat(global_mat, &info_mat);
+    MatInfo mat_info;
+    MatGetInfo(info_mat, MAT_LOCAL, &mat_info);
+    memory_ledger.count("global_mat", mat_info.memory);
+    PetscLogDouble petsc_usage;
+    PetscMemoryGetCurrentUsage(&petsc_usage);
+    memory_ledger.count("RSS after solve (PETSc)", petsc_usage);
+  }
+  if (direct_solve)
+  {
+    Mat factor_mat;
+    PCFactorGetMatrix(ThePreCond, &factor_mat);
+    MatInfo factor_info;
+    MatGetInfo(factor_mat, MAT_LOCAL, &factor_info);
+    memory_ledger.count("direct factors", factor_info.memory);
+    double factor_bytes = factor_info.memory, max_factor_bytes;
+    MPI_Reduce(&factor_bytes, &max_factor_bytes, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    if (comm_rank == 0)
+    {
+      char buffer[300];
+      std::snprintf(buffer,
+                    300,
+                    "Direct solve with <%s> : factors (max over ranks) : %10.1f MB, setup : "
+                    "%12.4e s, solve : %12.4e s",
+                    direct_solver.package.c_str(),
+                    max_factor_bytes / 1048576.0,
+                    solve_t1 - setup_t1,
+                    solve_t2 - solve_t1);
+      Execution_Time << buffer << std::endl;
+    }
+  }
   KSPGetIterationNumber(TheSolver, &num_iter);
   KSPGetConvergedReason(TheSolver, &How_KSP_Stopped);
   if (comm_rank == 0)
@@ -179,6 +477,107 @@ PetscErrorCode Diffusion<dim>::Solve_Linear_Systam()
   double accuracy;
   VecAXPY(exact_solution, -1, solution_vec);
   VecNorm(exact_solution, NORM_2, &accuracy);
+  if (comm_rank == 0)
+  {
+    char buffer[300];
+    std::snprintf(buffer,
+                  300,
+                  "Norms of the solve : RHS : %12.4e, solution : %12.4e, error of the "
+                  "trace : %12.4e, KSP setup : %12.4e s, KSP solve : %12.4e s",
+                  rhs_norm,
+                  solution_norm,
+                  accuracy,
+                  solve_t1 - setup_t1,
+                  solve_t2 - solve_t1);
+    Execution_Time << buffer << std::endl;
+  }
+
+  /* The error and the condition estimate of this cycle give the tolerance
+   * of the next one. */
+  double condition_estimate = 0;
+  if (adaptive_tolerance.enabled && !direct_solve)
+  {
+    PetscReal used_rtol, abstol, dtol;
+    PetscInt max_its;
+    KSPGetTolerances(TheSolver, &used_rtol, &abstol, &dtol, &max_its);
+    PetscReal sigma_max = 0, sigma_min = 0;
+    if (num_iter > 0)
+      KSPComputeExtremeSingularValues(TheSolver, &sigma_max, &sigma_min);
+    if (sigma_min > 0)
+      condition_estimate = sigma_max / sigma_min;
+    unsigned n_full_iterations = adaptive_tolerance.iterations_at_min_rtol(used_rtol, num_iter);
+    adaptive_tolerance.n_iterations_saved += n_full_iterations - num_iter;
+    if (comm_rank == 0)
+    {
+      char buffer[400];
+      std::snprintf(buffer,
+                    400,
+                    "Adaptive tolerance of cycle %d : predicted error of the trace : %12.4e, "
+                    "condition of the last cycle : %12.4e, rtol (fraction * predicted "
+                    "error / condition) : %12.4e, condition of this cycle : %12.4e, "
+                    "iterations : %d, at rtol %8.1e : ~%d, saved in all cycles : %lu",
+                    refn_cycle,
+                    adaptive_tolerance.predicted_error,
+                    adaptive_tolerance.last_condition,
+                    used_rtol,
+                    condition_estimate,
+                    num_iter,
+                    adaptive_tolerance.min_rtol,
+                    n_full_iterations,
+                    adaptive_tolerance.n_iterations_saved);
+      Execution_Time << buffer << std::endl;
+    }
+  }
+  if (solution_norm > 0)
+    adaptive_tolerance.finish_cycle(accuracy / solution_norm,
+                                    (double)num_global_DOFs_on_all_ranks,
+                                    condition_estimate);
+
+  if (solver_report)
+  {
+    Solver_Record the_record;
+    KSPType ksp_type;
+    PCType pc_type;
+    KSPGetType(TheSolver, &ksp_type);
+    PCGetType(ThePreCond, &pc_type);
+    the_record.ksp_type = ksp_type;
+    the_record.pc_type = pc_type;
+    the_record.poly_order = poly_order;
+    the_record.cycle = refn_cycle;
+    the_record.n_DOFs = num_global_DOFs_on_all_ranks;
+    the_record.tau = taus.empty() ? 0 : taus[0];
+    the_record.n_iterations = num_iter;
+    the_record.converged_reason = How_KSP_Stopped;
+    /* The slowest rank defines the times. */
+    double local_times[2] = { solve_t1 - setup_t1, solve_t2 - solve_t1 }, max_times[2];
+    MPI_Allreduce(local_times, max_times, 2, MPI_DOUBLE, MPI_MAX, comm);
+    the_record.setup_time = max_times[0];
+    the_record.solve_time = max_times[1];
+    the_record.rhs_norm = rhs_norm;
+    the_record.solution_norm = solution_norm;
+    the_record.error_norm = accuracy;
+    PetscReal final_residual_norm;
+    KSPGetResidualNorm(TheSolver, &final_residual_norm);
+    the_record.final_residual_norm = final_residual_norm;
+    Multigrid_Complexities(ThePreCond,
+                           the_record.n_levels,
+                           the_record.operator_complexity,
+                           the_record.grid_complexity);
+    PetscReal sigma_max = 0, sigma_min = 0;
+    if (num_iter > 0 && !direct_solve)
+      KSPComputeExtremeSingularValues(TheSolver, &sigma_max, &sigma_min);
+    the_record.sigma_max = sigma_max;
+    the_record.sigma_min = sigma_min;
+    PetscInt n_residuals;
+    PetscReal *residuals;
+    KSPGetResidualHistory(TheSolver, &residuals, &n_residuals);
+    the_record.residual_history.assign(residuals, residuals + n_residuals);
+    if (comm_rank == 0)
+      Write_Solver_Record(the_record);
+  }
+  /* The factors are freed before the local recovery. */
+  if (direct_solve)
+    KSPDestroy(&TheSolver);
 
   IS from, to;
   Vec x;
@@ -195,9 +594,30 @@ PetscErrorCode Diffusion<dim>::Solve_Linear_Systam()
                   PETSC_COPY_VALUES,
                   &to);
   //  VecView(x, PETSC_VIEWER_STDOUT_SELF);
+  Trace_Scope scatter_trace(tracer, 0, "scatter");
+  comm_t1 = MPI_Wtime();
   VecScatterCreate(solution_vec, from, x, to, &scatter);
   VecScatterBegin(scatter, solution_vec, x, INSERT_VALUES, SCATTER_FORWARD);
   VecScatterEnd(scatter, solution_vec, x, INSERT_VALUES, SCATTER_FORWARD);
+  scatter_trace.stop();
+  comm_ledger.wait(Comm_Scatter, MPI_Wtime() - comm_t1);
+  if (comm_ledger.enabled)
+  {
+    /* The values of the ghost DOFs come from their owners. */
+    const PetscInt *ownership_ranges;
+    VecGetOwnershipRanges(solution_vec, &ownership_ranges);
+    for (const PetscInt &DOF : scatter_from)
+    {
+      if (DOF >= ownership_ranges[comm_rank] && DOF < ownership_ranges[comm_rank + 1])
+        continue;
+      unsigned owner =
+       std::upper_bound(ownership_ranges, ownership_ranges + comm_size + 1, DOF) -
+       ownership_ranges - 1;
+      comm_ledger.aggregate(Comm_Scatter, owner, sizeof(PetscScalar), false);
+    }
+    comm_ledger.finish_aggregates(Comm_Scatter);
+    Report_Communication();
+  }
 
   double *local_solution_vec_p;
   VecGetArray(x, &local_solution_vec_p);
@@ -212,15 +632,47 @@ PetscErrorCode Diffusion<dim>::Solve_Linear_Systam()
   if (comm_rank == 0)
     Execution_Time << "Entering local solver : " << currentDateTime() << std::endl;
   t13 = MPI_Wtime();
-  Calculate_Internal_Unknowns(local_solution_vec_p);
+  memory_ledger.begin_phase();
+  if (Recovery_Needed())
+    Calculate_Internal_Unknowns(local_solution_vec_p);
+  else if (comm_rank == 0)
+    Execution_Time << "The local recovery of this cycle is skipped." << std::endl;
+  if (!qoi_boundary_ids.empty())
+    Compute_Flux_QoI(local_solution_vec_p);
+  memory_ledger.end_phase("local recovery");
   t23 = MPI_Wtime();
   if (comm_rank == 0)
     Execution_Time << "Finished local solver : " << currentDateTime() << std::endl;
 
+  /* This line is parsed by the perf_check target; keep its format. */
+  double phase_times[5] = { refine_time, count_time, t21 - t11, t22 - t12, t23 - t13 };
+  double max_phase_times[5];
+  MPI_Reduce(phase_times, max_phase_times, 5, MPI_DOUBLE, MPI_MAX, 0, comm);
   if (comm_rank == 0)
-    std::cout << t21 - t11 << " " << t22 - t12 << " " << t23 - t13 << std::endl;
+  {
+    char buffer[300];
+    std::snprintf(buffer,
+                  300,
+                  "Phase times of p %d cycle %d (max over ranks) : refine : %12.4e s, "
+                  "count : %12.4e s, assemble : %12.4e s, solve : %12.4e s, "
+                  "recover : %12.4e s, iterations : %d, DOFs : %lld",
+                  poly_order,
+                  refn_cycle,
+                  max_phase_times[0],
+                  max_phase_times[1],
+                  max_phase_times[2],
+                  max_phase_times[3],
+                  max_phase_times[4],
+                  num_iter,
+                  (long long)num_global_DOFs_on_all_ranks);
+    Execution_Time << buffer << std::endl;
+    std::cout << buffer << std::endl;
+  }
+  if (perf_recorder.enabled)
+    Report_Perf_Counters();
 
   MatDestroy(&global_mat);
+  condensation.clear();
   VecDestroy(&RHS_vec);
   VecDestroy(&exact_solution);
   VecDestroy(&solution_vec);
@@ -229,6 +681,424 @@ PetscErrorCode Diffusion<dim>::Solve_Linear_Systam()
   return 0;
 }
 
+/*!
+ * \brief Measures the locality of the assembled global_mat. We compute the
+ * mean and maximum distance of the nonzero entries from the diagonal (only
+ * for the entries in the diagonal block of each rank, which are affected by
+ * the renumbering), and the time and the effective memory bandwidth of
+ * MatMult. This is used to compare the different Renumbering_Type's.
+ */
+template <int dim>
+void Diffusion<dim>::Report_Matrix_Locality()
+{
+  PetscInt rows_owned_lo, rows_owned_hi;
+  MatGetOwnershipRange(global_mat, &rows_owned_lo, &rows_owned_hi);
+  double local_sums[2] = { 0, 0 };
+  PetscInt local_max_distance = 0;
+  for (PetscInt i_row = rows_owned_lo; i_row < rows_owned_hi; ++i_row)
+  {
+    PetscInt n_cols;
+    const PetscInt *cols;
+    MatGetRow(global_mat, i_row, &n_cols, &cols, NULL);
+    for (PetscInt i_col = 0; i_col < n_cols; ++i_col)
+    {
+      if (cols[i_col] >= rows_owned_lo && cols[i_col] < rows_owned_hi)
+      {
+        PetscInt distance = std::abs(cols[i_col] - i_row);
+        local_max_distance = std::max(local_max_distance, distance);
+        local_sums[0] += distance;
+        local_sums[1] += 1;
+      }
+    }
+    MatRestoreRow(global_mat, i_row, &n_cols, &cols, NULL);
+  }
+
+  Vec x, y;
+  VecDuplicate(RHS_vec, &x);
+  VecDuplicate(RHS_vec, &y);
+  VecSet(x, 1.0);
+  MatMult(global_mat, x, y);
+  const unsigned n_spmv = 20;
+  MPI_Barrier(comm);
+  double t1 = MPI_Wtime();
+  for (unsigned i_spmv = 0; i_spmv < n_spmv; ++i_spmv)
+    MatMult(global_mat, x, y);
+  double spmv_time = (MPI_Wtime() - t1) / n_spmv;
+  VecDestroy(&x);
+  VecDestroy(&y);
+
+  MatInfo mat_info;
+  MatGetInfo(global_mat, MAT_GLOBAL_SUM, &mat_info);
+  double spmv_bytes =
+   mat_info.nz_used * (sizeof(PetscScalar) + sizeof(PetscInt)) +
+   num_global_DOFs_on_all_ranks * (2 * sizeof(PetscScalar) + sizeof(PetscInt));
+
+  double global_sums[2], max_spmv_time;
+  PetscInt global_max_distance;
+  MPI_Reduce(local_sums, global_sums, 2, MPI_DOUBLE, MPI_SUM, 0, comm);
+  MPI_Reduce(&local_max_distance, &global_max_distance, 1, MPIU_INT, MPI_MAX, 0, comm);
+  MPI_Reduce(&spmv_time, &max_spmv_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+  if (comm_rank == 0)
+  {
+    const char *renumbering_names[] = { "none", "sfc", "rcm" };
+    unsigned renumbering_id =
+     (renumbering == SFC_Renumbering) ? 1 : (renumbering == RCM_Renumbering ? 2 : 0);
+    char buffer[300];
+    std::snprintf(buffer,
+                  300,
+                  "Matrix locality with renumbering <%s>: mean |i-j| : %12.4e, "
+                  "max |i-j| : %d, MatMult time : %12.4e s, effective SpMV "
+                  "bandwidth : %10.3f GB/s",
+                  renumbering_names[renumbering_id],
+                  global_sums[0] / std::max(global_sums[1], 1.0),
+                  (int)global_max_distance,
+                  max_spmv_time,
+                  spmv_bytes / max_spmv_time / 1.0E9);
+    Execution_Time << buffer << std::endl;
+  }
+}
+
+/*!
+ * \brief Writes the hardware counters of the last solve. For each phase, the
+ * wall times and the events are summed over all ranks and threads. From
+ * these, we write the instructions per cycle, the cache misses per thousand
+ * instructions, the memory traffic (64 bytes per last level cache miss) and
+ * the FP operations per thread-second, and the FP operations per byte; which
+ * give the position of each phase relative to the roofline of one core. The
+ * threaded phases are also written per thread (summed over the ranks), to
+ * show the imbalance between the threads.
+ */
+template <int dim>
+void Diffusion<dim>::Report_Perf_Counters()
+{
+  const unsigned n_values = 2 + N_Perf_Events;
+  const unsigned n_records = perf_recorder.records.size();
+  std::vector<double> local_values(n_values * n_records), global_values(n_values * n_records);
+  for (unsigned i_record = 0; i_record < n_records; ++i_record)
+  {
+    const Perf_Phase_Record &the_record = perf_recorder.records[i_record];
+    local_values[n_values * i_record] = the_record.wall_time;
+    local_values[n_values * i_record + 1] = the_record.n_calls;
+    for (unsigned i_event = 0; i_event < N_Perf_Events; ++i_event)
+      local_values[n_values * i_record + 2 + i_event] = the_record.events[i_event];
+  }
+  MPI_Reduce(local_values.data(),
+             global_values.data(),
+             local_values.size(),
+             MPI_DOUBLE,
+             MPI_SUM,
+             0,
+             comm);
+  if (comm_rank != 0)
+    return;
+
+  const char *phase_names[] = { "local matrices", "local solves", "global assembly",
+                                "SpMV",           "KSP solve",    "local recovery" };
+  char buffer[300];
+  for (unsigned i_phase = 0; i_phase < N_Perf_Phases; ++i_phase)
+  {
+    std::vector<double> phase_values(n_values, 0);
+    for (unsigned i_thread = 0; i_thread < perf_recorder.n_threads; ++i_thread)
+      for (unsigned i_value = 0; i_value < n_values; ++i_value)
+        phase_values[i_value] +=
+         global_values[n_values * (i_thread * N_Perf_Phases + i_phase) + i_value];
+    if (phase_values[1] == 0)
+      continue;
+    double wall = std::max(phase_values[0], 1.E-12);
+    double cycles = std::max(phase_values[2 + Perf_Cycles], 1.0);
+    double instructions = std::max(phase_values[2 + Perf_Instructions], 1.0);
+    double bytes = 64.0 * phase_values[2 + Perf_Cache_Misses];
+    double fp_ops = phase_values[2 + Perf_FP_Ops];
+    std::snprintf(buffer,
+                  300,
+                  "Counters of %-16s: calls : %10.0f, time : %12.4e s, IPC : %6.3f, "
+                  "LLC misses/kinstr : %8.3f, GB/s : %8.3f, GFLOP/s : %8.3f, "
+                  "flop/byte : %8.3f",
+                  phase_names[i_phase],
+                  phase_values[1],
+                  wall,
+                  instructions / cycles,
+                  1000.0 * phase_values[2 + Perf_Cache_Misses] / instructions,
+                  bytes / wall / 1.0E9,
+                  fp_ops / wall / 1.0E9,
+                  fp_ops / std::max(bytes, 1.0));
+    Execution_Time << buffer << std::endl;
+
+    if (i_phase != Perf_Local_Matrices && i_phase != Perf_Local_Solves &&
+        i_phase != Perf_Local_Recovery)
+      continue;
+    for (unsigned i_thread = 0; i_thread < perf_recorder.n_threads; ++i_thread)
+    {
+      const double *thread_values =
+       &global_values[n_values * (i_thread * N_Perf_Phases + i_phase)];
+      std::snprintf(buffer,
+                    300,
+                    "    thread %4d : time : %12.4e s, IPC : %6.3f",
+                    i_thread,
+                    thread_values[0],
+                    thread_values[2 + Perf_Instructions] /
+                     std::max(thread_values[2 + Perf_Cycles], 1.0));
+      Execution_Time << buffer << std::endl;
+    }
+  }
+}
+
+/*!
+ * \brief Writes the spans which are recorded by the tracer. Each rank writes
+ * Trace_p<order>_r<rank>.json, and rank 0 merges them into
+ * Trace_p<order>.json, which can be opened in chrome://tracing or Perfetto.
+ * The files are rewritten after each cycle, so they contain all the cycles
+ * up to now (as long as the rings are not full).
+ */
+template <int dim>
+void Diffusion<dim>::Write_Trace()
+{
+  if (!tracer.enabled)
+    return;
+  char file_name[100];
+  std::snprintf(file_name, 100, "Trace_p%d_r%05d.json", poly_order, comm_rank);
+  std::ofstream rank_file(file_name);
+  rank_file << "{\"traceEvents\":[" << std::endl;
+  unsigned long long n_lost = tracer.Write_Events(rank_file, comm_rank);
+  rank_file << std::endl << "]}" << std::endl;
+  rank_file.close();
+
+  unsigned long long total_lost;
+  MPI_Reduce(&n_lost, &total_lost, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, comm);
+  MPI_Barrier(comm);
+  if (comm_rank != 0)
+    return;
+  /* The first and the last lines of each rank file are the brackets. */
+  std::snprintf(file_name, 100, "Trace_p%d.json", poly_order);
+  std::ofstream merged_file(file_name);
+  merged_file << "{\"traceEvents\":[" << std::endl;
+  for (unsigned i_rank = 0; i_rank < comm_size; ++i_rank)
+  {
+    std::snprintf(file_name, 100, "Trace_p%d_r%05d.json", poly_order, i_rank);
+    std::ifstream rank_in(file_name);
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(rank_in, line))
+      lines.push_back(line);
+    if (lines.size() < 3)
+      continue;
+    if (i_rank > 0)
+      merged_file << "," << std::endl;
+    for (unsigned i_line = 1; i_line + 1 < lines.size(); ++i_line)
+      merged_file << lines[i_line] << std::endl;
+  }
+  merged_file << "]}" << std::endl;
+  if (total_lost > 0)
+    OutLogger(std::cout,
+              " HEY! : " + std::to_string(total_lost) +
+               " trace events were overwritten; increase -trace_capacity. \n");
+}
+
+/*!
+ * \brief Writes the memory_ledger of this cycle: the peak RSS in each phase,
+ * and the bytes of the large containers, with their minimum, maximum and
+ * mean over the ranks. The bytes of the bases are counted here, since they
+ * do not change within a cycle.
+ */
+template <int dim>
+void Diffusion<dim>::Report_Memory()
+{
+  if (!memory_ledger.enabled)
+    return;
+  double basis_bytes = the_elem_basis.memory_bytes() + the_face_basis.memory_bytes();
+  for (auto &&order_and_basis : elem_bases_of_order)
+    basis_bytes += order_and_basis.second.memory_bytes();
+  for (auto &&order_and_basis : face_bases_of_order)
+    basis_bytes += order_and_basis.second.memory_bytes();
+  memory_ledger.count("basis tables", basis_bytes);
+
+  std::vector<double> local_values(memory_ledger.phase_peaks);
+  local_values.insert(
+   local_values.end(), memory_ledger.owner_bytes.begin(), memory_ledger.owner_bytes.end());
+  std::vector<double> min_values(local_values.size()), max_values(local_values.size()),
+   sum_values(local_values.size());
+  MPI_Reduce(
+   local_values.data(), min_values.data(), local_values.size(), MPI_DOUBLE, MPI_MIN, 0, comm);
+  MPI_Reduce(
+   local_values.data(), max_values.data(), local_values.size(), MPI_DOUBLE, MPI_MAX, 0, comm);
+  MPI_Reduce(
+   local_values.data(), sum_values.data(), local_values.size(), MPI_DOUBLE, MPI_SUM, 0, comm);
+  if (comm_rank != 0)
+    return;
+
+  const double MB = 1024.0 * 1024.0;
+  char buffer[300];
+  std::snprintf(buffer,
+                300,
+                "Memory of cycle %d in MB %s: %38s %10s %10s",
+                refn_cycle,
+                memory_ledger.peak_is_resettable ? "" : "(cumulative peaks) ",
+                "min",
+                "max",
+                "mean");
+  Execution_Time << buffer << std::endl;
+  unsigned n_phases = memory_ledger.phase_names.size();
+  for (unsigned i_value = 0; i_value < local_values.size(); ++i_value)
+  {
+    std::string name = (i_value < n_phases)
+                        ? "peak RSS in " + memory_ledger.phase_names[i_value]
+                        : memory_ledger.owner_names[i_value - n_phases];
+    std::snprintf(buffer,
+                  300,
+                  "  %-40s : %10.2f %10.2f %10.2f",
+                  name.c_str(),
+                  min_values[i_value] / MB,
+                  max_values[i_value] / MB,
+                  sum_values[i_value] / comm_size / MB);
+    Execution_Time << buffer << std::endl;
+  }
+}
+
+/*!
+ * \brief Writes the record of the last solve to Solver_p<order>_c<cycle>.json
+ * and appends it to Solver_p<order>.csv, which collects all of the cycles of
+ * this order. Only rank zero calls this.
+ */
+template <int dim>
+void Diffusion<dim>::Write_Solver_Record(const Solver_Record &the_record)
+{
+  char file_name[100];
+  std::snprintf(file_name, 100, "Solver_p%d_c%02d.json", poly_order, refn_cycle);
+  std::ofstream json_file(file_name);
+  the_record.Write_JSON(json_file);
+
+  std::snprintf(file_name, 100, "Solver_p%d.csv", poly_order);
+  std::ofstream csv_file(file_name, std::ofstream::app);
+  if (csv_file.tellp() == 0)
+    Solver_Record::Write_CSV_Header(csv_file);
+  the_record.Write_CSV_Row(csv_file);
+}
+
+/*!
+ * \brief Writes the communication of the last cycle. For each phase, we
+ * write the messages, the bytes and the partners (sum over the ranks, and
+ * the largest rank), the mean size of the messages, the probes and the
+ * collectives, and the time spent waiting. A small mean message with a long
+ * wait means that the phase is bound by the latency; large messages mean it
+ * is bound by the volume. Then, all of the point to point traffic is written
+ * to Comm_Neighbors_p<order>_c<cycle>.txt, one line for each pair of ranks
+ * in each phase.
+ */
+template <int dim>
+void Diffusion<dim>::Report_Communication()
+{
+  const unsigned n_values = 11;
+  std::vector<double> local_values(n_values * N_Comm_Phases);
+  /* The rows of the neighbor matrix: phase, source, destination, messages,
+   * bytes. For the scatter, we know the sources; for the others, the
+   * destinations. */
+  std::vector<double> neighbor_rows;
+  for (unsigned i_phase = 0; i_phase < N_Comm_Phases; ++i_phase)
+  {
+    const Comm_Phase_Stats &stats = comm_ledger.phases[i_phase];
+    std::set<unsigned> partners;
+    for (auto &&rank_and_msgs : stats.msgs_to_rank)
+      partners.insert(rank_and_msgs.first);
+    for (auto &&rank_and_msgs : stats.msgs_from_rank)
+      partners.insert(rank_and_msgs.first);
+    double phase_values[n_values] = { stats.n_sends,
+                                      stats.send_bytes,
+                                      stats.n_recvs,
+                                      stats.recv_bytes,
+                                      (double)partners.size(),
+                                      stats.n_probes,
+                                      stats.n_collectives,
+                                      stats.collective_bytes,
+                                      stats.wait_time,
+                                      stats.stash_entries,
+                                      stats.stash_reallocs };
+    std::copy(phase_values, phase_values + n_values, &local_values[n_values * i_phase]);
+
+    bool use_sources = (i_phase == Comm_Scatter);
+    const std::map<unsigned, double> &msgs =
+     use_sources ? stats.msgs_from_rank : stats.msgs_to_rank;
+    const std::map<unsigned, double> &bytes =
+     use_sources ? stats.bytes_from_rank : stats.bytes_to_rank;
+    for (auto &&rank_and_msgs : msgs)
+    {
+      double row[5] = { (double)i_phase,
+                        (double)(use_sources ? rank_and_msgs.first : comm_rank),
+                        (double)(use_sources ? comm_rank : rank_and_msgs.first),
+                        rank_and_msgs.second,
+                        bytes.at(rank_and_msgs.first) };
+      neighbor_rows.insert(neighbor_rows.end(), row, row + 5);
+    }
+  }
+
+  std::vector<double> sum_values(local_values.size()), max_values(local_values.size());
+  MPI_Reduce(
+   local_values.data(), sum_values.data(), local_values.size(), MPI_DOUBLE, MPI_SUM, 0, comm);
+  MPI_Reduce(
+   local_values.data(), max_values.data(), local_values.size(), MPI_DOUBLE, MPI_MAX, 0, comm);
+
+  int n_local_rows = neighbor_rows.size();
+  std::vector<int> n_rows_of_rank(comm_size), row_offsets(comm_size + 1, 0);
+  MPI_Gather(&n_local_rows, 1, MPI_INT, n_rows_of_rank.data(), 1, MPI_INT, 0, comm);
+  for (unsigned i_rank = 0; i_rank < comm_size; ++i_rank)
+    row_offsets[i_rank + 1] = row_offsets[i_rank] + n_rows_of_rank[i_rank];
+  std::vector<double> all_neighbor_rows(std::max(row_offsets.back(), 1));
+  MPI_Gatherv(neighbor_rows.data(),
+              n_local_rows,
+              MPI_DOUBLE,
+              all_neighbor_rows.data(),
+              n_rows_of_rank.data(),
+              row_offsets.data(),
+              MPI_DOUBLE,
+              0,
+              comm);
+  if (comm_rank != 0)
+    return;
+
+  const char *phase_names[] = { "count globals", "PETSc assembly", "scatter" };
+  char buffer[400];
+  for (unsigned i_phase = 0; i_phase < N_Comm_Phases; ++i_phase)
+  {
+    const double *sums = &sum_values[n_values * i_phase];
+    const double *maxs = &max_values[n_values * i_phase];
+    std::snprintf(buffer,
+                  400,
+                  "Communication of %-14s: msgs : %10.0f (max rank %8.0f), bytes : "
+                  "%12.4e (max rank %12.4e), mean msg : %10.1f B, max partners : %4.0f, "
+                  "probes : %10.0f, collectives : %4.0f, max wait : %12.4e s, stash "
+                  "entries : %10.0f, stash reallocs : %4.0f",
+                  phase_names[i_phase],
+                  sums[0],
+                  maxs[0],
+                  sums[1],
+                  maxs[1],
+                  sums[1] / std::max(sums[0], 1.0),
+                  maxs[4],
+                  sums[5],
+                  maxs[6],
+                  maxs[8],
+                  sums[9],
+                  sums[10]);
+    Execution_Time << buffer << std::endl;
+  }
+
+  std::snprintf(buffer, 400, "Comm_Neighbors_p%d_c%02d.txt", poly_order, refn_cycle);
+  std::ofstream neighbors_file(buffer);
+  neighbors_file << "# phase source destination messages bytes" << std::endl;
+  for (int i_row = 0; i_row < row_offsets.back(); i_row += 5)
+  {
+    const double *row = &all_neighbor_rows[i_row];
+    std::snprintf(buffer,
+                  400,
+                  "%-14s %8d %8d %10.0f %14.0f",
+                  phase_names[(int)row[0]],
+                  (int)row[1],
+                  (int)row[2],
+                  row[3],
+                  row[4]);
+    neighbors_file << buffer << std::endl;
+  }
+}
+
 template <int dim>
 void Diffusion<dim>::Setup_System(unsigned refinement)
 {
@@ -240,7 +1110,16 @@ void Diffusion<dim>::Setup_System(unsigned refinement)
                 refn_cycle);
   if (comm_rank == comm_size)
     std::cout << buffer << currentDateTime() << std::endl;
+  memory_ledger.clear();
+  comm_ledger.clear();
+  Decide_Full_Output();
+  memory_ledger.begin_phase();
+  double t1 = MPI_Wtime();
+  Trace_Scope refine_trace(tracer, 0, "refinement");
   Refine_Grid(refinement);
+  refine_trace.stop();
+  refine_time = MPI_Wtime() - t1;
+  memory_ledger.end_phase("refinement");
   std::snprintf(buffer,
                 300,
                 "Rank %5d is in cycle %5d and has exited  refinement: ",
@@ -259,7 +1138,15 @@ void Diffusion<dim>::Setup_System(unsigned refinement)
   if (comm_rank == 0)
     Execution_Time << buffer << currentDateTime() << std::endl;
 
+  memory_ledger.begin_phase();
+  double t2 = MPI_Wtime();
+  Trace_Scope count_trace(tracer, 0, "count globals");
   Count_Globals();
+  Classify_Cells();
+  count_trace.stop();
+  count_time = MPI_Wtime() - t2;
+  memory_ledger.end_phase("count globals");
+  Count_Mesh_Memory();
   std::snprintf(buffer,
                 300,
                 "Rank %5d is in cycle %5d and has exited  counter: ",
@@ -336,6 +1223,185 @@ void parse_my_options(const int &rank,
   }
 }
 
+/*!
+ * \brief Returns the MPI thread level which we ask from MPI_Init_thread,
+ * from the -mpi_thread_level option (single, funneled, serialized, or
+ * multiple). We read it from the command line directly, since PETSc options
+ * are not available before MPI is initialized. The default is funneled: all
+ * of our MPI calls are made by the master thread, out of the OpenMP regions,
+ * and the threads only call PETSc to set values, which does not communicate.
+ */
+int Requested_MPI_Thread_Level(const int &argc, char *args[])
+{
+  int level = MPI_THREAD_FUNNELED;
+  for (int i_arg = 1; i_arg < argc - 1; ++i_arg)
+  {
+    if (strcmp(args[i_arg], "-mpi_thread_level") != 0)
+      continue;
+    if (strcmp(args[i_arg + 1], "single") == 0)
+      level = MPI_THREAD_SINGLE;
+    else if (strcmp(args[i_arg + 1], "serialized") == 0)
+      level = MPI_THREAD_SERIALIZED;
+    else if (strcmp(args[i_arg + 1], "multiple") == 0)
+      level = MPI_THREAD_MULTIPLE;
+  }
+  return level;
+}
+
+/*!
+ * \brief Returns the number of OpenMP threads of each rank. It is
+ * OMP_NUM_THREADS if it is set, and 1 otherwise, so the pure MPI runs stay as
+ * before. The option -threads overrides it, and -threads 0 uses all of the
+ * cores which the rank is bound to (e.g. one socket). We fall back to one
+ * thread if the MPI library does not give us at least MPI_THREAD_FUNNELED.
+ */
+int Resolve_Thread_Count(const int &rank, const int &provided)
+{
+  int n_threads = 1;
+  const char *omp_env = std::getenv("OMP_NUM_THREADS");
+  if (omp_env != NULL && atoi(omp_env) > 0)
+    n_threads = atoi(omp_env);
+  PetscInt threads_option = n_threads;
+  PetscBool found_threads_option;
+  PetscOptionsGetInt(NULL, "-threads", &threads_option, &found_threads_option);
+  if (found_threads_option == PETSC_TRUE)
+    n_threads = (threads_option > 0) ? threads_option : N_Allowed_Cores();
+#ifndef _OPENMP
+  if (n_threads > 1 && rank == 0)
+    std::cout << " HEY! : The code is compiled without OpenMP; using 1 thread. \n"
+              << std::endl;
+  n_threads = 1;
+#endif
+  if (n_threads > 1 && provided < MPI_THREAD_FUNNELED)
+  {
+    if (rank == 0)
+      std::cout << " HEY! : MPI does not support MPI_THREAD_FUNNELED; using 1 "
+                   "thread per rank. \n" << std::endl;
+    n_threads = 1;
+  }
+  return n_threads;
+}
+
+/*!
+ * \brief Reports the resolved layout of ranks and threads on each node, and
+ * warns if a node is oversubscribed, or if the threads of a rank are more
+ * than the cores that the rank is bound to.
+ */
+void Report_Hybrid_Layout(const int &rank,
+                          const int &size,
+                          const int &n_threads,
+                          const int &provided)
+{
+  char host_name[MPI_MAX_PROCESSOR_NAME];
+  std::fill(host_name, host_name + MPI_MAX_PROCESSOR_NAME, 0);
+  int host_name_length;
+  MPI_Get_processor_name(host_name, &host_name_length);
+  int rank_info[3] = { n_threads, N_Allowed_Cores(), 1 };
+#ifdef __linux__
+  rank_info[2] = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+  std::vector<char> all_host_names(rank == 0 ? size * MPI_MAX_PROCESSOR_NAME : 1);
+  std::vector<int> all_rank_infos(rank == 0 ? 3 * size : 1);
+  MPI_Gather(host_name,
+             MPI_MAX_PROCESSOR_NAME,
+             MPI_CHAR,
+             all_host_names.data(),
+             MPI_MAX_PROCESSOR_NAME,
+             MPI_CHAR,
+             0,
+             PETSC_COMM_WORLD);
+  MPI_Gather(rank_info, 3, MPI_INT, all_rank_infos.data(), 3, MPI_INT, 0, PETSC_COMM_WORLD);
+  if (rank != 0)
+    return;
+
+  /* For each node: the number of ranks, their threads, and its cores. */
+  std::map<std::string, std::vector<int>> node_infos;
+  unsigned n_underbound_ranks = 0;
+  for (int i_rank = 0; i_rank < size; ++i_rank)
+  {
+    std::string node_name(&all_host_names[i_rank * MPI_MAX_PROCESSOR_NAME]);
+    std::vector<int> &node_info = node_infos[node_name];
+    if (node_info.size() == 0)
+      node_info.assign({ 0, 0, all_rank_infos[3 * i_rank + 2] });
+    node_info[0] += 1;
+    node_info[1] += all_rank_infos[3 * i_rank];
+    if (all_rank_infos[3 * i_rank] > all_rank_infos[3 * i_rank + 1])
+      ++n_underbound_ranks;
+  }
+
+  const char *level_names[] = { "single", "funneled", "serialized", "multiple" };
+  unsigned level_id = (provided == MPI_THREAD_MULTIPLE)
+                       ? 3
+                       : (provided == MPI_THREAD_SERIALIZED
+                           ? 2
+                           : (provided == MPI_THREAD_FUNNELED ? 1 : 0));
+  char buffer[300];
+  std::snprintf(buffer,
+                300,
+                "Hybrid layout: %d ranks x %d threads on %d nodes, MPI thread "
+                "level: %s",
+                size,
+                n_threads,
+                (int)node_infos.size(),
+                level_names[level_id]);
+  std::cout << buffer << std::endl;
+  for (auto &&node_info : node_infos)
+  {
+    std::snprintf(buffer,
+                  300,
+                  "  %-24s : %4d ranks, %5d threads, %5d cores",
+                  node_info.first.c_str(),
+                  node_info.second[0],
+                  node_info.second[1],
+                  node_info.second[2]);
+    std::cout << buffer << std::endl;
+    if (node_info.second[1] > node_info.second[2])
+      std::cout << " HEY! : Node " << node_info.first
+                << " is oversubscribed; reduce -threads or the ranks per node. \n"
+                << std::endl;
+  }
+  if (n_underbound_ranks > 0)
+    std::cout << " HEY! : " << n_underbound_ranks
+              << " ranks have more threads than the cores they are bound to; "
+                 "check the binding of mpiexec (e.g. bind to socket). \n"
+              << std::endl;
+}
+
+/* Both dimensions are instantiated, and the dimension is selected at
+ * runtime by -dim. */
+template struct Diffusion<2>;
+template struct Diffusion<3>;
+
+/*!
+ * \brief Runs the refinement cycles for all of the requested orders, in a
+ * given dimension.
+ */
+template <int dim>
+void Run_Diffusion(const unsigned &p_1,
+                   const unsigned &p_2,
+                   const unsigned &h_1,
+                   const unsigned &h_2,
+                   const int &Adaptive,
+                   const int &rank,
+                   const int &size,
+                   const int &number_of_threads)
+{
+  for (unsigned p1 = p_1; p1 < p_2; ++p1)
+  {
+    Diffusion<dim> diff0(p1, PETSC_COMM_WORLD, size, rank, number_of_threads, Adaptive);
+    for (unsigned h1 = h_1; h1 < h_2; ++h1)
+    {
+      diff0.Setup_System(h1);
+      diff0.Solve_Linear_Systam();
+      if (diff0.full_output_this_cycle)
+        diff0.vtk_visualizer();
+      diff0.Write_Trace();
+      diff0.Report_Memory();
+    }
+  }
+}
+
 /*!
  * \brief main
  * \param  argc
@@ -357,17 +1423,23 @@ int main(int argc, char *args[])
   std::cout << CC1 << std::endl;
   */
 
+  /* We initialize MPI ourselves, to negotiate the thread level; then PETSc
+   * does not finalize it, and we call MPI_Finalize at the end. */
+  int provided_thread_level = MPI_THREAD_SINGLE;
+  MPI_Init_thread(&argc, &args, Requested_MPI_Thread_Level(argc, args), &provided_thread_level);
   SlepcInitialize(&argc, &args, (char *)0, NULL);
   PetscMPIInt rank, size;
   MPI_Comm_rank(PETSC_COMM_WORLD, &rank);
   MPI_Comm_size(PETSC_COMM_WORLD, &size);
-  dealii::MultithreadInfo::set_thread_limit(1);
 
-  int number_of_threads = 1;
+  /* OpenMP and the TBB pool of deal.II get the same number of threads, so
+   * the threads of one do not compete with the other. */
+  int number_of_threads = Resolve_Thread_Count(rank, provided_thread_level);
 #ifdef _OPENMP
-  omp_set_num_threads(1);
-  number_of_threads = omp_get_max_threads();
+  omp_set_num_threads(number_of_threads);
 #endif
+  dealii::MultithreadInfo::set_thread_limit(number_of_threads);
+  Report_Hybrid_Layout(rank, size, number_of_threads, provided_thread_level);
 
   char buffer[100];
   std::snprintf(buffer, 100, "There are %d threads available.\n", number_of_threads);
@@ -378,7 +1450,8 @@ int main(int argc, char *args[])
     std::snprintf(help_line,
                   300,
                   "\n"
-                  "mpiexec -n 8 ./A1 -h_0 2 -h_n 12 -p_0 1 -p_n 2 -amr 1 "
+                  "mpiexec -n 8 ./A1 -dim 2 -h_0 2 -h_n 12 -p_0 1 -p_n 2 -amr 1 "
+                  "-threads 1 "
                   /*
                   "-pc_type hypre -pc_hypre_type boomeramg "
                   "-pc_hypre_boomeramg_strong_threshold 0.25 "
@@ -442,19 +1515,19 @@ int main(int argc, char *args[])
   h_2 = 8;
   Adaptive = 0;
   */
-  const int dim = 2;
-
-  for (unsigned p1 = (unsigned)p_1; p1 < (unsigned)p_2; ++p1)
+  int dim = 2;
+  PetscOptionsGetInt(NULL, "-dim", &dim, &found_option);
+  if (dim == 3)
+    Run_Diffusion<3>(p_1, p_2, h_1, h_2, Adaptive, rank, size, number_of_threads);
+  else
   {
-    Diffusion<dim> diff0(p1, PETSC_COMM_WORLD, size, rank, number_of_threads, Adaptive);
-    for (unsigned h1 = (unsigned)h_1; h1 < (unsigned)h_2; ++h1)
-    {
-      diff0.Setup_System(h1);
-      diff0.Solve_Linear_Systam();
-      diff0.vtk_visualizer();
-    }
+    if (dim != 2 && rank == 0)
+      std::cout << " HEY! : The dimension should either be 2 (default) or 3. \n"
+                << std::endl;
+    Run_Diffusion<2>(p_1, p_2, h_1, h_2, Adaptive, rank, size, number_of_threads);
   }
 
   SlepcFinalize();
+  MPI_Finalize();
   return 0;
 }
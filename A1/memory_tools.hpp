@@ -0,0 +1,157 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#ifndef MEMORY_TOOLS_HPP
+#define MEMORY_TOOLS_HPP
+
+/*!
+ * \defgroup memory Memory accounting
+ * \brief
+ * The resident set size (RSS) of the process, its high-water mark in each
+ * phase of the program, and explicit byte counts of the large containers.
+ * Like the NUMA tools, these read /proc and getrusage directly; on other
+ * systems they return zero.
+ */
+
+/*!
+ * \ingroup memory
+ * \brief The current resident set size of this process, in bytes.
+ */
+inline double Current_RSS_Bytes()
+{
+#ifdef __linux__
+  long total_pages = 0, resident_pages = 0;
+  FILE *statm = std::fopen("/proc/self/statm", "r");
+  if (statm == NULL)
+    return 0;
+  int n_read = std::fscanf(statm, "%ld %ld", &total_pages, &resident_pages);
+  std::fclose(statm);
+  if (n_read == 2)
+    return (double)resident_pages * sysconf(_SC_PAGESIZE);
+#endif
+  return 0;
+}
+
+/*!
+ * \ingroup memory
+ * \brief The high-water mark of the resident set size, in bytes. This is
+ * VmHWM from /proc/self/status, which can be reset by Reset_Peak_RSS(); if
+ * it is not available, we use the peak of getrusage, which is never reset.
+ */
+inline double Peak_RSS_Bytes()
+{
+#ifdef __linux__
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line))
+  {
+    long hwm_kB;
+    if (std::sscanf(line.c_str(), "VmHWM: %ld kB", &hwm_kB) == 1)
+      return 1024.0 * hwm_kB;
+  }
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    return 1024.0 * usage.ru_maxrss;
+#endif
+  return 0;
+}
+
+/*!
+ * \ingroup memory
+ * \brief Resets the high-water mark of the resident set size to its current
+ * value (Linux 4.0 and newer). So, the next Peak_RSS_Bytes() gives the peak
+ * of the phase which starts now.
+ * \return true if the kernel has accepted the reset.
+ */
+inline bool Reset_Peak_RSS()
+{
+#ifdef __linux__
+  FILE *clear_refs = std::fopen("/proc/self/clear_refs", "w");
+  if (clear_refs == NULL)
+    return false;
+  bool reset = (std::fputs("5", clear_refs) >= 0);
+  reset = (std::fclose(clear_refs) == 0) && reset;
+  return reset;
+#else
+  return false;
+#endif
+}
+
+/*!
+ * \ingroup memory
+ * \brief The bytes which are held by a vector.
+ */
+template <typename T, typename Allocator>
+double Vector_Bytes(const std::vector<T, Allocator> &vec)
+{
+  return (double)vec.capacity() * sizeof(T);
+}
+
+/*!
+ * \ingroup memory
+ * \brief Collects the peak RSS of the phases of one cycle, and the bytes of
+ * the large containers. All ranks should add the same phases and owners in
+ * the same order, since they are reduced entry by entry.
+ */
+struct Memory_Ledger
+{
+  Memory_Ledger() : enabled(false), peak_is_resettable(false)
+  {
+  }
+
+  void clear()
+  {
+    phase_names.clear();
+    phase_peaks.clear();
+    owner_names.clear();
+    owner_bytes.clear();
+  }
+
+  void begin_phase()
+  {
+    if (enabled)
+      peak_is_resettable = Reset_Peak_RSS();
+  }
+
+  void end_phase(const std::string &name)
+  {
+    if (!enabled)
+      return;
+    phase_names.push_back(name);
+    phase_peaks.push_back(Peak_RSS_Bytes());
+  }
+
+  /*!
+   * \details Adds \c bytes to the owner \c name; the owners which are
+   * counted more than once in a cycle are summed.
+   */
+  void count(const std::string &name, const double &bytes)
+  {
+    if (!enabled)
+      return;
+    for (unsigned i_owner = 0; i_owner < owner_names.size(); ++i_owner)
+      if (owner_names[i_owner] == name)
+      {
+        owner_bytes[i_owner] += bytes;
+        return;
+      }
+    owner_names.push_back(name);
+    owner_bytes.push_back(bytes);
+  }
+
+  bool enabled;
+  bool peak_is_resettable;
+  std::vector<std::string> phase_names;
+  std::vector<double> phase_peaks;
+  std::vector<std::string> owner_names;
+  std::vector<double> owner_bytes;
+};
+
+#endif
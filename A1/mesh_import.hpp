@@ -0,0 +1,210 @@
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <mpi.h>
+
+#ifndef MESH_IMPORT_HPP
+#define MESH_IMPORT_HPP
+
+/*!
+ * \defgroup mesh_import Coarse mesh import
+ * \brief
+ * A simple binary format for the coarse quad/hex meshes, which all ranks
+ * read together by MPI-IO. Every rank reads a contiguous part of the file,
+ * and then the parts are gathered, since the coarse mesh of a
+ * p::d::Triangulation must exist on every rank. So, no rank reads the whole
+ * file, and nothing is broadcast from rank zero.
+ *
+ * The file is (all in the native byte order):
+ *   - the 8 characters "AVNSMESH",
+ *   - int64 dim, int64 n_vertices, int64 n_cells,
+ *   - n_vertices * dim doubles: the coordinates of the vertices,
+ *   - n_cells records of (2^dim + 2 dim) int64's: the vertices of the cell
+ *     in the lexicographic order of deal.II, and the tag of each face of the
+ *     cell, in the face order of deal.II. The faces without a tag get -1.
+ *     A tagged interior face (an interface) has its tag in both of its
+ *     cells.
+ */
+
+/*!
+ * \ingroup mesh_import
+ * \brief The coarse mesh, as it is stored in the file.
+ */
+struct Coarse_Mesh
+{
+  Coarse_Mesh() : dim(0)
+  {
+  }
+
+  unsigned n_vertices_per_cell() const
+  {
+    return 1 << dim;
+  }
+
+  unsigned n_faces_per_cell() const
+  {
+    return 2 * dim;
+  }
+
+  unsigned record_size() const
+  {
+    return n_vertices_per_cell() + n_faces_per_cell();
+  }
+
+  int64_t n_vertices() const
+  {
+    return dim ? vertices.size() / dim : 0;
+  }
+
+  int64_t n_cells() const
+  {
+    return dim ? cell_records.size() / record_size() : 0;
+  }
+
+  int64_t vertex_of_cell(const int64_t &i_cell, const unsigned &i_vertex) const
+  {
+    return cell_records[i_cell * record_size() + i_vertex];
+  }
+
+  int64_t face_tag(const int64_t &i_cell, const unsigned &i_face) const
+  {
+    return cell_records[i_cell * record_size() + n_vertices_per_cell() + i_face];
+  }
+
+  int dim;
+  std::vector<double> vertices;
+  std::vector<int64_t> cell_records;
+};
+
+/*!
+ * \ingroup mesh_import
+ * \brief Reads a part of \c n_items items of \c item_type, starting at
+ * \c offset, in every rank, and gathers all of them in \c items of all ranks.
+ * A file which ends before the part of a rank is a read error (of all ranks),
+ * because MPI_File_read_at_all succeeds with fewer items at the end of file.
+ */
+template <typename T>
+int Read_And_Gather_Items(MPI_File &mesh_file,
+                          const MPI_Offset &offset,
+                          const int64_t &n_items,
+                          const unsigned &item_length,
+                          MPI_Datatype base_type,
+                          std::vector<T> &items,
+                          const MPI_Comm &comm)
+{
+  int comm_rank, comm_size;
+  MPI_Comm_rank(comm, &comm_rank);
+  MPI_Comm_size(comm, &comm_size);
+  MPI_Datatype item_type;
+  MPI_Type_contiguous(item_length, base_type, &item_type);
+  MPI_Type_commit(&item_type);
+
+  std::vector<int> n_items_of_rank(comm_size), first_item_of_rank(comm_size);
+  for (int i_rank = 0; i_rank < comm_size; ++i_rank)
+  {
+    first_item_of_rank[i_rank] = n_items * i_rank / comm_size;
+    n_items_of_rank[i_rank] = n_items * (i_rank + 1) / comm_size - first_item_of_rank[i_rank];
+  }
+  items.resize(n_items * item_length);
+  T *my_items = items.data() + (int64_t)first_item_of_rank[comm_rank] * item_length;
+  MPI_Status status;
+  int read_error = MPI_File_read_at_all(mesh_file,
+                                        offset + (MPI_Offset)first_item_of_rank[comm_rank] *
+                                                  item_length * sizeof(T),
+                                        my_items,
+                                        n_items_of_rank[comm_rank],
+                                        item_type,
+                                        &status);
+  if (read_error == MPI_SUCCESS)
+  {
+    int n_read_items;
+    MPI_Get_count(&status, item_type, &n_read_items);
+    if (n_read_items != n_items_of_rank[comm_rank])
+      read_error = MPI_ERR_TRUNCATE;
+  }
+  int read_errors;
+  MPI_Allreduce(&read_error, &read_errors, 1, MPI_INT, MPI_MAX, comm);
+  if (read_errors == MPI_SUCCESS)
+    MPI_Allgatherv(MPI_IN_PLACE,
+                   0,
+                   item_type,
+                   items.data(),
+                   n_items_of_rank.data(),
+                   first_item_of_rank.data(),
+                   item_type,
+                   comm);
+  MPI_Type_free(&item_type);
+  return read_errors;
+}
+
+/*!
+ * \ingroup mesh_import
+ * \brief Reads a coarse mesh in the binary format. All ranks of \c comm
+ * should call this.
+ * \return an empty string on success, otherwise the reason of the failure
+ * (the same on all ranks).
+ */
+inline std::string Read_Coarse_Mesh(const std::string &file_name,
+                                    const MPI_Comm &comm,
+                                    Coarse_Mesh &mesh)
+{
+  MPI_File mesh_file;
+  if (MPI_File_open(comm, file_name.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &mesh_file) !=
+      MPI_SUCCESS)
+    return "cannot open " + file_name;
+
+  /* The header is small; everyone reads it. A file shorter than the header
+   * keeps these zeros, and fails the checks below. */
+  char magic[8] = { 0 };
+  int64_t header[3] = { 0, 0, 0 };
+  MPI_Status status;
+  MPI_File_read_at_all(mesh_file, 0, magic, 8, MPI_CHAR, &status);
+  MPI_File_read_at_all(mesh_file, 8, header, 3, MPI_INT64_T, &status);
+  if (std::strncmp(magic, "AVNSMESH", 8) != 0 || (header[0] != 2 && header[0] != 3) ||
+      header[1] < 0 || header[2] < 0)
+  {
+    MPI_File_close(&mesh_file);
+    return file_name + " is not a coarse mesh file (or has another byte order)";
+  }
+  mesh.dim = header[0];
+  MPI_Offset offset = 8 + 3 * sizeof(int64_t);
+  int read_errors = Read_And_Gather_Items(
+   mesh_file, offset, header[1], mesh.dim, MPI_DOUBLE, mesh.vertices, comm);
+  offset += header[1] * mesh.dim * sizeof(double);
+  if (read_errors == MPI_SUCCESS)
+    read_errors = Read_And_Gather_Items(
+     mesh_file, offset, header[2], mesh.record_size(), MPI_INT64_T, mesh.cell_records, comm);
+  MPI_File_close(&mesh_file);
+  if (read_errors != MPI_SUCCESS)
+    return "cannot read the vertices and cells of " + file_name +
+           " (or it is shorter than its header says)";
+
+  for (int64_t i_cell = 0; i_cell < mesh.n_cells(); ++i_cell)
+    for (unsigned i_vertex = 0; i_vertex < mesh.n_vertices_per_cell(); ++i_vertex)
+      if (mesh.vertex_of_cell(i_cell, i_vertex) < 0 ||
+          mesh.vertex_of_cell(i_cell, i_vertex) >= mesh.n_vertices())
+        return file_name + " has a cell with a wrong vertex index";
+  return "";
+}
+
+/*!
+ * \ingroup mesh_import
+ * \brief Writes a coarse mesh in the binary format; this is called by one
+ * rank, e.g. to convert a Gmsh file once.
+ */
+inline bool Write_Coarse_Mesh(const std::string &file_name, const Coarse_Mesh &mesh)
+{
+  std::ofstream mesh_file(file_name, std::ofstream::binary);
+  int64_t header[3] = { mesh.dim, mesh.n_vertices(), mesh.n_cells() };
+  mesh_file.write("AVNSMESH", 8);
+  mesh_file.write((const char *)header, sizeof(header));
+  mesh_file.write((const char *)mesh.vertices.data(), mesh.vertices.size() * sizeof(double));
+  mesh_file.write((const char *)mesh.cell_records.data(),
+                  mesh.cell_records.size() * sizeof(int64_t));
+  return mesh_file.good();
+}
+
+#endif
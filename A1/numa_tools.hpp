@@ -0,0 +1,277 @@
+#include <vector>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#ifndef NUMA_TOOLS_HPP
+#define NUMA_TOOLS_HPP
+
+/*!
+ * \defgroup numa NUMA tools
+ * \brief
+ * Small wrappers around the Linux system calls which we use to pin the
+ * OpenMP threads to cores, and to find out on which NUMA node a given memory
+ * page is located. We call the kernel directly, to avoid depending on
+ * libnuma. On other systems these functions do nothing.
+ */
+
+/*!
+ * \ingroup numa
+ * \brief Returns the NUMA node of the core which the calling thread is
+ * running on, or -1 if it is not known.
+ */
+inline int Current_NUMA_Node()
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+  unsigned cpu = 0, node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+    return node;
+#endif
+  return -1;
+}
+
+/*!
+ * \ingroup numa
+ * \brief Returns the NUMA node where the page containing \c address is
+ * located. A negative value means that the page is not touched yet, or the
+ * kernel does not support the query.
+ */
+inline int NUMA_Node_of_Address(const void *address)
+{
+#if defined(__linux__) && defined(SYS_move_pages)
+  static const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  void *page = (void *)((uintptr_t)address & ~(page_size - 1));
+  int status = -1;
+  /* With nodes = NULL, move_pages does not move anything and only reports
+   * the current node of each page in status. */
+  if (syscall(SYS_move_pages, 0, 1, &page, NULL, &status, 0) == 0)
+    return status;
+#endif
+  (void)address;
+  return -1;
+}
+
+/*!
+ * \ingroup numa
+ * \brief Returns the number of cores which this process is allowed to run
+ * on (e.g. the cores of one socket, when mpiexec binds each rank to a
+ * socket). If this is not known, the number of online cores is returned.
+ */
+inline int N_Allowed_Cores()
+{
+#ifdef __linux__
+  cpu_set_t process_set;
+  CPU_ZERO(&process_set);
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &process_set) == 0)
+    return CPU_COUNT(&process_set);
+  return sysconf(_SC_NPROCESSORS_ONLN);
+#else
+  return 1;
+#endif
+}
+
+/*!
+ * \ingroup numa
+ * \brief Pins the calling thread to the \c thread_id -th core among the
+ * cores which are allowed for this process (e.g. by mpiexec binding). So,
+ * with one rank per socket, thread i always stays on core i of that socket.
+ * \return true if the pinning succeeded.
+ */
+inline bool Pin_Thread_to_Core(const unsigned &thread_id)
+{
+#ifdef __linux__
+  static std::vector<int> allowed_cores = []()
+  {
+    std::vector<int> cores;
+    cpu_set_t process_set;
+    CPU_ZERO(&process_set);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &process_set) == 0)
+      for (int i_core = 0; i_core < CPU_SETSIZE; ++i_core)
+        if (CPU_ISSET(i_core, &process_set))
+          cores.push_back(i_core);
+    return cores;
+  }();
+  if (allowed_cores.size() == 0)
+    return false;
+  cpu_set_t thread_set;
+  CPU_ZERO(&thread_set);
+  CPU_SET(allowed_cores[thread_id % allowed_cores.size()], &thread_set);
+  return (sched_setaffinity(0, sizeof(cpu_set_t), &thread_set) == 0);
+#else
+  (void)thread_id;
+  return false;
+#endif
+}
+
+/*!
+ * \ingroup numa
+ * \brief Counts the pages of some memory ranges which are on the same NUMA
+ * node as a given node, and those which are not.
+ */
+struct NUMA_Page_Counter
+{
+  NUMA_Page_Counter() : local_pages(0), remote_pages(0), unknown_pages(0)
+  {
+  }
+
+  /*!
+   * \details Adds all the pages in [data, data + n_bytes) to the counters,
+   * comparing their location with \c node.
+   */
+  void count(const void *data, const size_t &n_bytes, const int &node)
+  {
+    if (data == NULL || n_bytes == 0)
+      return;
+#ifdef __linux__
+    static const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+#else
+    static const uintptr_t page_size = 4096;
+#endif
+    uintptr_t first_page = (uintptr_t)data & ~(page_size - 1);
+    uintptr_t last_byte = (uintptr_t)data + n_bytes - 1;
+    for (uintptr_t page = first_page; page <= last_byte; page += page_size)
+    {
+      int page_node = NUMA_Node_of_Address((const void *)page);
+      if (page_node < 0 || node < 0)
+        ++unknown_pages;
+      else if (page_node == node)
+        ++local_pages;
+      else
+        ++remote_pages;
+    }
+  }
+
+  unsigned long local_pages;
+  unsigned long remote_pages;
+  unsigned long unknown_pages;
+};
+
+/*!
+ * \ingroup numa
+ * \brief Divides \c n_items items of \c item_size bytes at \c data into
+ * \c n_blocks contiguous blocks, in the same way as the cells are divided in
+ * Distribute_Cells_To_Threads, and lets each OpenMP thread write one byte in
+ * every page of its blocks. So, the pages which are not touched yet are
+ * placed on the NUMA node of the thread which later processes these items.
+ */
+inline void First_Touch_Blocks(char *data,
+                               const size_t &n_items,
+                               const size_t &item_size,
+                               const unsigned &n_blocks,
+                               const bool &pin_threads)
+{
+#ifdef __linux__
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+#else
+  static const size_t page_size = 4096;
+#endif
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_blocks)
+  {
+    unsigned thread_id = omp_get_thread_num();
+    unsigned n_team = omp_get_num_threads();
+#else
+  unsigned thread_id = 0;
+  unsigned n_team = 1;
+  {
+#endif
+    if (pin_threads)
+      Pin_Thread_to_Core(thread_id);
+    for (unsigned i_block = thread_id; i_block < n_blocks; i_block += n_team)
+    {
+      size_t first_byte = n_items * i_block / n_blocks * item_size;
+      size_t end_byte = n_items * (i_block + 1) / n_blocks * item_size;
+      for (size_t i_byte = first_byte; i_byte < end_byte; i_byte += page_size)
+        data[i_byte] = 0;
+    }
+  }
+}
+
+/*!
+ * \ingroup numa
+ * \brief The allocator of the arrays of cell data, which lets the threads
+ * place the memory pages by first touch, instead of the thread which
+ * allocates the array. With \c n_blocks > 0, the new storage is touched by
+ * First_Touch_Blocks. In any case, resize() leaves the values of trivial
+ * types uninitialized, so the thread which first writes the values of a
+ * cell places their pages. Only the fresh pages (such as the large blocks
+ * which malloc takes from mmap) are placed in this way.
+ */
+template <typename T>
+struct First_Touch_Allocator
+{
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  First_Touch_Allocator() : n_blocks(0), pin_threads(false)
+  {
+  }
+
+  First_Touch_Allocator(const unsigned &n_blocks_, const bool &pin_threads_)
+    : n_blocks(n_blocks_), pin_threads(pin_threads_)
+  {
+  }
+
+  template <typename U>
+  First_Touch_Allocator(const First_Touch_Allocator<U> &other)
+    : n_blocks(other.n_blocks), pin_threads(other.pin_threads)
+  {
+  }
+
+  T *allocate(const size_t &n)
+  {
+    T *data = static_cast<T *>(::operator new(n * sizeof(T)));
+    if (n_blocks > 0)
+      First_Touch_Blocks((char *)data, n, sizeof(T), n_blocks, pin_threads);
+    return data;
+  }
+
+  void deallocate(T *data, const size_t &)
+  {
+    ::operator delete(data);
+  }
+
+  template <typename U>
+  void construct(U *item)
+  {
+    ::new ((void *)item) U;
+  }
+
+  template <typename U, typename... Args>
+  void construct(U *item, Args &&... args)
+  {
+    ::new ((void *)item) U(std::forward<Args>(args)...);
+  }
+
+  unsigned n_blocks;
+  bool pin_threads;
+};
+
+/* All of the instances free the memory in the same way. */
+template <typename T, typename U>
+bool operator==(const First_Touch_Allocator<T> &, const First_Touch_Allocator<U> &)
+{
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const First_Touch_Allocator<T> &, const First_Touch_Allocator<U> &)
+{
+  return false;
+}
+
+template <typename T>
+using First_Touch_Vector = std::vector<T, First_Touch_Allocator<T>>;
+
+#endif // NUMA_TOOLS_HPP
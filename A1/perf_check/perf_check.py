@@ -0,0 +1,625 @@
+#!/usr/bin/env python3
+"""Runs a fixed set of small configurations of A1, and compares their phase
+times and solver iterations with the stored baselines, and the accuracy of
+each solver and discretization mode with the default AIJ/CG path.
+
+Each configuration is run in its own directory under --work-dir, and the
+"Phase times of p .. cycle .." lines of its Execution_Time.txt are parsed.
+A phase regresses if its time is more than (1 + time_tol) * baseline +
+time_floor; the iterations regress if they are more than baseline +
+max(1, iter_tol * baseline). A change in the number of DOFs means that the
+problem itself has changed, which is also reported as a failure. The
+configurations without a baseline are reported as NEW; they fail only with
+--strict. If no baseline is recorded at all, the check fails without running
+anything. Use --update to store the measured values as the new baselines.
+
+The accuracy does not depend on the machine, so it is not stored: a
+configuration with a "reference" must give the error norms of
+Convergence_Result.txt (and the fluxes of QoI_p<p>.csv, where both runs have
+them) of its reference configuration, in the same invocation, within
+--error-tol (relative; the fluxes relative to the largest one) plus
+--error-floor. A configuration with "converges"
+must reduce the L2 error of u in every refinement cycle of each order, until
+the error is below --error-floor. An accuracy failure also fails --update,
+so that the baselines are never taken from a wrong build. Some
+configurations also read back their output files, and compare them with the
+exact solution.
+"""
+
+import argparse
+import glob
+import json
+import math
+import os
+import re
+import struct
+import subprocess
+import sys
+import zlib
+
+PHASES = ["refine", "count", "assemble", "solve", "recover"]
+
+
+def write_square_mesh(run_dir):
+    """Writes [-1,1]^2 as 2x2 cells in the binary format of mesh_import.hpp.
+    The faces at x = -1, 1 get the tag 1 (Dirichlet), the faces at y = -1, 1
+    the tag 2, and the interface at x = 0 the tag 3."""
+    vertices = [(-1.0 + i, -1.0 + j) for j in range(3) for i in range(3)]
+    cells = []
+    for j in range(2):
+        for i in range(2):
+            corner = 3 * j + i
+            tags = [1 if i == 0 else 3, 1 if i == 1 else 3, 2 if j == 0 else -1,
+                    2 if j == 1 else -1]
+            cells.append([corner, corner + 1, corner + 3, corner + 4] + tags)
+    with open(os.path.join(run_dir, "square.mesh"), "wb") as mesh_file:
+        mesh_file.write(b"AVNSMESH")
+        mesh_file.write(struct.pack("=3q", 2, len(vertices), len(cells)))
+        for vertex in vertices:
+            mesh_file.write(struct.pack("=2d", *vertex))
+        for cell in cells:
+            mesh_file.write(struct.pack("=8q", *cell))
+
+
+def exact_u(x, y):
+    """The exact solution of the default 2D problem (input_data.hpp)."""
+    return math.sin(math.pi * x) * math.cos(math.pi * y)
+
+
+def exact_q(x, y):
+    """The exact flow of the default 2D problem (input_data.hpp)."""
+    return (-math.exp(x + y) * math.pi * math.cos(math.pi * x) * math.cos(math.pi * y),
+            math.exp(x - y) * math.pi * math.sin(math.pi * x) * math.sin(math.pi * y))
+
+
+# The exact outward flux of the default problem through the faces at
+# x = -1, 1 (tag 1) and y = -1, 1 (tag 2), and through x = 0 in the +x
+# direction (the interface tag 3 of write_square_mesh).
+EXACT_FLUX = {1: -math.pi * (math.e - 1 / math.e) ** 2 / (1 + math.pi ** 2), 2: 0.0,
+              3: math.pi * (math.e - 1 / math.e) / (1 + math.pi ** 2)}
+
+
+def check_exact_flux(args, config, run_dir, accuracy):
+    """Compares the fluxes of QoI_p<p>.csv with EXACT_FLUX: for each order
+    and tag, the error must decrease from the coarsest to the finest mesh,
+    and end below 1e-2 (relative to the flux, if it is larger than one)."""
+    failures = []
+    fluxes = {}
+    for key, flux in accuracy["qoi"].items():
+        order, n_cells, tag = [int(value) for value in re.findall(r"\d+", key)]
+        fluxes.setdefault((order, tag), {})[n_cells] = flux
+    for (order, tag), flux_of_mesh in sorted(fluxes.items()):
+        if tag not in EXACT_FLUX:
+            continue
+        first = abs(flux_of_mesh[min(flux_of_mesh)] - EXACT_FLUX[tag])
+        last = abs(flux_of_mesh[max(flux_of_mesh)] - EXACT_FLUX[tag])
+        if len(flux_of_mesh) > 1 and not (last < first or last < 1e-8):
+            failures.append("%s: p%d, tag %d: the error of the flux %.4e did not decrease "
+                            "from %.4e" % (config["name"], order, tag, last, first))
+        if not last <= 1e-2 * max(1.0, abs(EXACT_FLUX[tag])):
+            failures.append("%s: p%d, tag %d: the error of the flux is %.4e" %
+                            (config["name"], order, tag, last))
+    if not fluxes:
+        failures.append("%s: no QoI_p*.csv was written" % config["name"])
+    print("  fluxes: %d orders and tags: %s" % (len(fluxes), "FAILED" if failures else "ok"))
+    return failures
+
+
+QUERY_POINTS = [(0.1234, -0.4321), (0.7071, 0.3333), (-0.55, 0.61), (-0.9, -0.95),
+                (0.0, 0.0)]
+
+
+def write_query_points(run_dir):
+    with open(os.path.join(run_dir, "query_points.txt"), "w") as query_file:
+        query_file.write("# x y\n")
+        for point in QUERY_POINTS:
+            query_file.write("%g %g\n" % point)
+
+
+def check_queries(args, config, run_dir, accuracy):
+    """Compares the values of Queries_p<p>_c<c>.csv with the exact solution:
+    for each order, the errors of u and q at the points must decrease from
+    the first to the last cycle, and the error of u must end below 1e-2."""
+    failures = []
+    query_paths = {}
+    for query_path in glob.glob(os.path.join(run_dir, "Queries_p*_c*.csv")):
+        order = int(re.search(r"Queries_p(\d+)_c\d+\.csv", query_path).group(1))
+        query_paths.setdefault(order, []).append(query_path)
+    if not query_paths:
+        return ["%s: no Queries_p*_c*.csv was written" % config["name"]]
+    for order, paths in sorted(query_paths.items()):
+        point_errors = []
+        for query_path in (min(paths), max(paths)):
+            with open(query_path) as query_file:
+                rows = [line.split(",") for line in query_file.readlines()[1:]]
+            u_error, q_error = 0.0, 0.0
+            for row in rows:
+                x, y, head, flow_x, flow_y = [float(row[i]) for i in (2, 3, 5, 6, 7)]
+                q = exact_q(x, y)
+                u_error = max(u_error, abs(head - exact_u(x, y)))
+                q_error = max(q_error, abs(flow_x - q[0]), abs(flow_y - q[1]))
+            if len(rows) != len(QUERY_POINTS):
+                failures.append("%s: %s has %d points, not %d" %
+                                (config["name"], os.path.basename(query_path), len(rows),
+                                 len(QUERY_POINTS)))
+            point_errors.append((u_error, q_error))
+        first, last = point_errors
+        # The values are written with 7 digits.
+        if len(paths) > 1 and not (last[0] < first[0] or last[0] < 1e-6):
+            failures.append("%s: p%d: the error of u at the points %.4e did not decrease "
+                            "from %.4e" % (config["name"], order, last[0], first[0]))
+        if len(paths) > 1 and not (last[1] < first[1] or last[1] < 1e-5):
+            failures.append("%s: p%d: the error of q at the points %.4e did not decrease "
+                            "from %.4e" % (config["name"], order, last[1], first[1]))
+        if not last[0] <= 1e-2:
+            failures.append("%s: p%d: the error of u at the points is %.4e" %
+                            (config["name"], order, last[0]))
+    print("  queries: %d orders: %s" % (len(query_paths), "FAILED" if failures else "ok"))
+    return failures
+
+
+def option_value(config, name):
+    """The value of an option of the run; the last one wins, as in PETSc."""
+    options = COMMON_OPTIONS + config.get("options", [])
+    return options[len(options) - 1 - options[::-1].index(name) + 1]
+
+
+def check_global_DOFs(args, config, run_dir, accuracy):
+    """Checks the global number of trace DOFs of a uniform run on the
+    built-in mesh with its exact value: m^(dim-1) (m+1) dim faces with
+    (p+1)^(dim-1) DOFs, for m = 2^cycle cells in each direction (the cycle
+    is the number of global refinements). This sum goes through the 64-bit
+    global numbering, whatever the number of ranks."""
+    failures = []
+    dim = int(option_value(config, "-dim"))
+    n_lines = 0
+    with open(os.path.join(run_dir, "Execution_Time.txt")) as exec_time:
+        for line in exec_time:
+            match = PHASE_LINE.search(line)
+            if match is None:
+                continue
+            n_lines += 1
+            order, cycle, n_DOFs = [int(value) for value in match.group(1, 2, 9)]
+            m = 2 ** cycle
+            exact = dim * m ** (dim - 1) * (m + 1) * (order + 1) ** (dim - 1)
+            if n_DOFs != exact:
+                failures.append("%s: p%d_cycle%d has %d DOFs, not %d" %
+                                (config["name"], order, cycle, n_DOFs, exact))
+    print("  global DOFs: %d cycles: %s" % (n_lines, "FAILED" if failures else "ok"))
+    return failures
+
+
+VTU_TYPES = {"Float64": "d", "Int64": "q", "UInt8": "B"}
+
+VTU_ARRAY = re.compile(r'<DataArray type="(\w+)" Name="(\w+)" NumberOfComponents="\d+" '
+                       r'format="appended" offset="(\d+)"/>')
+
+
+def read_vtu(path):
+    """Reads the arrays of a .vtu file of vtk_lagrange.hpp, with the raw or
+    the zlib compressed appended data, and the number of cells."""
+    with open(path, "rb") as vtu_file:
+        header, _, appended = vtu_file.read().partition(b'<AppendedData encoding="raw">\n_')
+    header = header.decode()
+    vtu = {"n_cells": int(re.search(r'NumberOfCells="(\d+)"', header).group(1))}
+    for type_name, name, offset in VTU_ARRAY.findall(header):
+        offset = int(offset)
+        if "vtkZLibDataCompressor" in header:
+            n_blocks = struct.unpack_from("<Q", appended, offset)[0]
+            sizes = struct.unpack_from("<%dQ" % n_blocks, appended, offset + 24)
+            position = offset + 24 + 8 * n_blocks
+            data = b""
+            for size in sizes:
+                data += zlib.decompress(appended[position:position + size])
+                position += size
+        else:
+            n_bytes = struct.unpack_from("<Q", appended, offset)[0]
+            data = appended[offset + 8:offset + 8 + n_bytes]
+        code = VTU_TYPES[type_name]
+        vtu[name] = struct.unpack("<%d%s" % (len(data) // struct.calcsize(code), code), data)
+    return vtu
+
+
+def check_vtu(args, config, run_dir, accuracy):
+    """Reads the Lagrange cells of the first and the last cycle (of the
+    highest order, which overwrites the others), checks their structure,
+    and that their nodal error in u decreases to below 1e-2. The cells of
+    the last cycle must be those of the last line of Convergence_Result.txt."""
+    failures = []
+    pvtu_paths = sorted(glob.glob(os.path.join(run_dir, "solution-*.pvtu")))
+    if not pvtu_paths:
+        return ["%s: no solution-*.pvtu was written" % config["name"]]
+    node_errors = []
+    for pvtu_path in (pvtu_paths[0], pvtu_paths[-1]):
+        with open(pvtu_path) as pvtu_file:
+            pieces = re.findall(r'<Piece Source="([^"]+)"/>', pvtu_file.read())
+        n_cells, node_error = 0, 0.0
+        for piece in pieces:
+            vtu = read_vtu(os.path.join(run_dir, piece))
+            n_points = len(vtu["Points"]) // 3
+            offsets = vtu["offsets"]
+            if (any(cell_type != 70 for cell_type in vtu["types"]) or
+                    len(offsets) != vtu["n_cells"] or len(vtu["order"]) != vtu["n_cells"] or
+                    any(b <= a for a, b in zip((0,) + offsets, offsets)) or
+                    (offsets and offsets[-1] != n_points) or len(vtu["head"]) != n_points or
+                    len(vtu["flow"]) != 3 * n_points):
+                failures.append("%s: %s has inconsistent cells or arrays" %
+                                (config["name"], piece))
+                continue
+            n_cells += vtu["n_cells"]
+            for i_point, head in enumerate(vtu["head"]):
+                x, y = vtu["Points"][3 * i_point:3 * i_point + 2]
+                node_error = max(node_error, abs(head - exact_u(x, y)))
+        node_errors.append(node_error)
+    if accuracy["errors"] and n_cells != accuracy["errors"][-1][0]:
+        failures.append("%s: %s has %d cells, the last solve had %d" %
+                        (config["name"], os.path.basename(pvtu_paths[-1]), n_cells,
+                         accuracy["errors"][-1][0]))
+    if len(pvtu_paths) > 1 and not node_errors[1] < node_errors[0]:
+        failures.append("%s: the nodal error of u %.4e did not decrease from %.4e" %
+                        (config["name"], node_errors[1], node_errors[0]))
+    if not node_errors[1] <= 1e-2:
+        failures.append("%s: the nodal error of u is %.4e" % (config["name"], node_errors[1]))
+    print("  vtu: %d cycles, nodal error of u %.4e: %s" %
+          (len(pvtu_paths), node_errors[1], "FAILED" if failures else "ok"))
+    return failures
+
+
+# The runs which are compared for accuracy solve tightly, so that only the
+# discretization is compared, and they write the fluxes through the Dirichlet
+# (1) and Neumann (2) boundaries of the default mesh.
+ACCURACY_OPTIONS = ["-p_n", "3", "-ksp_rtol", "1e-12", "-qoi_boundaries", "1,2"]
+
+CONFIGURATIONS = [
+    # The default AIJ/CG path, which the modes below are compared with. The
+    # adaptive reference also covers the precomputed hanging-face operators.
+    {"name": "reference_np4", "ranks": 4, "amr": 0, "options": ACCURACY_OPTIONS,
+     "converges": True, "checks": [check_exact_flux]},
+    {"name": "reference_adaptive_np4", "ranks": 4, "amr": 1, "options": ACCURACY_OPTIONS,
+     "converges": True},
+    {"name": "uniform_np1", "ranks": 1, "amr": 0},
+    # The global DOF numbers are 64-bit (PetscInt) when PETSc is; the same
+    # counts must come out of both builds.
+    {"name": "uniform_np4", "ranks": 4, "amr": 0, "checks": [check_global_DOFs]},
+    {"name": "adaptive_np1", "ranks": 1, "amr": 1},
+    {"name": "adaptive_np4", "ranks": 4, "amr": 1},
+    # The renumberings visit the owned cells of all levels along one curve,
+    # which checks that the hanging faces are numbered in any cell order. Only
+    # the order of the unknowns changes, so the accuracy must not.
+    {"name": "adaptive_sfc_np4", "ranks": 4, "amr": 1,
+     "options": ACCURACY_OPTIONS + ["-renumber", "sfc"],
+     "reference": "reference_adaptive_np4"},
+    {"name": "adaptive_rcm_np4", "ranks": 4, "amr": 1,
+     "options": ACCURACY_OPTIONS + ["-renumber", "rcm"],
+     "reference": "reference_adaptive_np4"},
+    # The threaded recovery with first-touch placement and pinned threads.
+    {"name": "numa_np2", "ranks": 2, "amr": 0,
+     "options": ACCURACY_OPTIONS + ["-threads", "2", "-numa_pin", "-numa_report"],
+     "reference": "reference_np4"},
+    # The 3D manufactured solution has no 2D reference, so its L2 error must
+    # decrease with every refinement.
+    {"name": "dim3_np4", "ranks": 4, "amr": 0,
+     "options": ["-dim", "3", "-p_n", "3", "-h_0", "2", "-h_n", "5", "-ksp_rtol", "1e-12"],
+     "converges": True, "checks": [check_global_DOFs]},
+    # The precomputed hanging-face operators have no switch; on one rank all
+    # hanging faces are local, on four ranks some are on the partition
+    # boundaries, and both must give the same adaptive solution.
+    {"name": "hanging_np1", "ranks": 1, "amr": 1, "options": ACCURACY_OPTIONS,
+     "reference": "reference_adaptive_np4"},
+    # The adaptive quadrature may integrate the data more accurately than the
+    # fixed rule, which changes the error in its last digits.
+    {"name": "quad_adaptive_np4", "ranks": 4, "amr": 0,
+     "options": ACCURACY_OPTIONS + ["-quad_policy", "adaptive"],
+     "reference": "reference_np4", "error_tol": 0.05},
+    # With hp-adaptivity, the smooth cells are enriched up to order 4 instead
+    # of being split.
+    {"name": "hp_np4", "ranks": 4, "amr": 1,
+     "options": ["-p_n", "2", "-ksp_rtol", "1e-12", "-hp_max", "4"], "converges": True},
+    # The nodal collocation mode is a separate build (--nodal-exe). Its
+    # integration on the nodes is not exact, so only its convergence is
+    # checked.
+    {"name": "nodal_np4", "ranks": 4, "amr": 0, "exe": "nodal", "options": ACCURACY_OPTIONS,
+     "converges": True},
+    # The coarse mesh of 2x2 cells, refined once less, gives the cells of the
+    # default mesh, and the same boundary conditions. The flux through its
+    # interface is integrated from one side of the interior faces.
+    {"name": "mesh_np4", "ranks": 4, "amr": 0, "setup": write_square_mesh,
+     "options": ACCURACY_OPTIONS + ["-mesh", "square.mesh", "-h_0", "2", "-h_n", "5",
+                                    "-qoi_boundaries", "1,2,3"],
+     "reference": "reference_np4", "checks": [check_exact_flux]},
+    # The output must not change the solution, and its files are read back.
+    {"name": "vtk_np4", "ranks": 4, "amr": 0, "options": ACCURACY_OPTIONS + ["-vtk_lagrange"],
+     "reference": "reference_np4", "checks": [check_vtu]},
+    {"name": "query_np4", "ranks": 4, "amr": 0, "setup": write_query_points,
+     "options": ACCURACY_OPTIONS + ["-query_points", "query_points.txt"],
+     "reference": "reference_np4", "checks": [check_queries]},
+    # The unassembled MATIS with BDDC solves the same system.
+    {"name": "is_np4", "ranks": 4, "amr": 0, "options": ACCURACY_OPTIONS + ["-assembly", "is"],
+     "reference": "reference_np4"},
+    # The faces inside one rank are eliminated before the Krylov solve, and
+    # recovered after it.
+    {"name": "condense_np4", "ranks": 4, "amr": 0,
+     "options": ACCURACY_OPTIONS + ["-condense_interior"], "reference": "reference_np4"},
+    # On one rank, the factorization of PETSc itself is always available.
+    {"name": "direct_np1", "ranks": 1, "amr": 0, "options": ACCURACY_OPTIONS + ["-direct_solve"],
+     "reference": "reference_np4"},
+    # The adaptive tolerance stops the solve at a tenth of the predicted
+    # discretization error, so the errors may grow by about that much.
+    # -ksp_rtol would override it, so it is not given.
+    {"name": "adaptive_rtol_np4", "ranks": 4, "amr": 0,
+     "options": ["-p_n", "3", "-qoi_boundaries", "1,2", "-adaptive_rtol"],
+     "reference": "reference_np4", "error_tol": 0.15},
+]
+
+COMMON_OPTIONS = ["-dim", "2", "-p_0", "1", "-p_n", "5", "-h_0", "3", "-h_n", "6",
+                  "-threads", "1"]
+
+ERROR_LINE = re.compile(
+    r"NEl :\s*(\d+), \|\| uh - u \|\|_L2 :\s*(\S+); \|\| q - qh \|\|_L2 is:\s*(\S+);")
+
+PHASE_LINE = re.compile(
+    r"Phase times of p (\d+) cycle (\d+) \(max over ranks\) : "
+    r"refine :\s*(\S+) s, count :\s*(\S+) s, assemble :\s*(\S+) s, "
+    r"solve :\s*(\S+) s, recover :\s*(\S+) s, iterations :\s*(\d+), DOFs :\s*(\d+)")
+
+
+def read_accuracy(run_dir):
+    """Returns the error norms of Convergence_Result.txt, as a list of
+    (cells, error of u, error of q), and the fluxes of QoI_p<p>.csv, keyed by
+    "p<p>_cells<n>_tag<t>". The cycles are the numbers of global refinements,
+    which differ between coarse meshes, so the fluxes are keyed by the cells."""
+    accuracy = {"errors": [], "qoi": {}}
+    convergence_path = os.path.join(run_dir, "Convergence_Result.txt")
+    if os.path.exists(convergence_path):
+        with open(convergence_path) as convergence:
+            for line in convergence:
+                match = ERROR_LINE.search(line)
+                if match is not None:
+                    accuracy["errors"].append(
+                        (int(match.group(1)), float(match.group(2)), float(match.group(3))))
+    for qoi_path in glob.glob(os.path.join(run_dir, "QoI_p*.csv")):
+        order = re.search(r"QoI_p(\d+)\.csv", qoi_path).group(1)
+        with open(qoi_path) as qoi_file:
+            for line in qoi_file:
+                if line.startswith("cycle"):
+                    continue
+                row = line.split(",")
+                key = "p%s_cells%s_tag%s" % (order, row[5].strip(), row[1])
+                accuracy["qoi"][key] = float(row[2])
+    return accuracy
+
+
+def run_configuration(args, config):
+    """Runs one configuration and returns {"p<p>_cycle<c>": values}, and the
+    accuracy of the last run."""
+    run_dir = os.path.join(args.work_dir, config["name"])
+    os.makedirs(run_dir, exist_ok=True)
+    exe = args.nodal_exe if config.get("exe") == "nodal" else args.exe
+    command = [args.mpiexec, "-n", str(config["ranks"]), exe]
+    command += COMMON_OPTIONS + ["-amr", str(config["amr"])] + config.get("options", [])
+    if "setup" in config:
+        config["setup"](run_dir)
+    results = {}
+    exec_time_path = os.path.join(run_dir, "Execution_Time.txt")
+    for i_repeat in range(args.repeat):
+        # The QoI files are appended to by A1, and the checks should not see
+        # the output of an earlier run, so the old ones are removed.
+        old_paths = [exec_time_path]
+        for pattern in ("QoI_p*.csv", "Queries_p*.csv", "solution-*"):
+            old_paths += glob.glob(os.path.join(run_dir, pattern))
+        for old_path in old_paths:
+            if os.path.exists(old_path):
+                os.remove(old_path)
+        with open(os.path.join(run_dir, "stdout.txt"), "w") as stdout:
+            subprocess.run(command, cwd=run_dir, stdout=stdout,
+                           stderr=subprocess.STDOUT, check=True)
+        with open(exec_time_path) as exec_time:
+            for line in exec_time:
+                match = PHASE_LINE.search(line)
+                if match is None:
+                    continue
+                key = "p%s_cycle%s" % (match.group(1), match.group(2))
+                times = [float(value) for value in match.group(3, 4, 5, 6, 7)]
+                values = results.setdefault(
+                    key, {"iterations": int(match.group(8)),
+                          "DOFs": int(match.group(9))})
+                # With repeats, the fastest run is kept, to reduce the noise.
+                for phase, time in zip(PHASES, times):
+                    values[phase] = min(values.get(phase, time), time)
+    return results, read_accuracy(run_dir)
+
+
+def close_enough(args, tol, value, reference, scale=0.0):
+    """True if value is within tol of reference, relative to the larger of
+    reference and scale."""
+    return abs(value - reference) <= tol * max(abs(reference), scale) + args.error_floor
+
+
+def compare_accuracy(args, config, accuracy, reference):
+    """Returns the list of differences from the accuracy of the reference."""
+    name = config["name"]
+    tol = config.get("error_tol", args.error_tol)
+    failures = []
+    errors, ref_errors = accuracy["errors"], reference["errors"]
+    if len(errors) != len(ref_errors):
+        failures.append("%s: %d error lines, %s has %d" %
+                        (name, len(errors), config["reference"], len(ref_errors)))
+    for i_line, (line, ref_line) in enumerate(zip(errors, ref_errors)):
+        if line[0] != ref_line[0]:
+            failures.append("%s: line %d has %d cells, %s has %d" %
+                            (name, i_line + 1, line[0], config["reference"], ref_line[0]))
+            continue
+        for field, value, ref_value in (("u", line[1], ref_line[1]),
+                                        ("q", line[2], ref_line[2])):
+            if not close_enough(args, tol, value, ref_value):
+                failures.append("%s: line %d: error of %s %.4e, %s %.4e" %
+                                (name, i_line + 1, field, value, config["reference"],
+                                 ref_value))
+    # A flux may vanish (as through the Neumann faces of the default problem),
+    # so the fluxes are compared relative to the largest one.
+    flux_scale = max([abs(flux) for flux in reference["qoi"].values()] + [0.0])
+    n_qoi = 0
+    for key, flux in sorted(accuracy["qoi"].items()):
+        if key not in reference["qoi"]:
+            continue
+        n_qoi += 1
+        if not close_enough(args, tol, flux, reference["qoi"][key], flux_scale):
+            failures.append("%s/%s: flux %.10e, %s %.10e" %
+                            (name, key, flux, config["reference"], reference["qoi"][key]))
+    print("  accuracy: %d error lines and %d fluxes against %s (tol %g): %s" %
+          (len(errors), n_qoi, config["reference"], tol, "FAILED" if failures else "ok"))
+    return failures
+
+
+def check_convergence(args, config, accuracy, measured):
+    """Returns the cycles where the error of u did not decrease. A new order
+    starts where the order of the phase times changes, or, without them, when
+    the number of cells does not grow; with hp-adaptivity, a cycle may only
+    enrich cells."""
+    orders = [key.split("_")[0] for key in measured]
+    if len(orders) == len(accuracy["errors"]):
+        new_order = [i_line == 0 or order != orders[i_line - 1]
+                     for i_line, order in enumerate(orders)]
+    else:
+        new_order = [i_line == 0 or line[0] <= accuracy["errors"][i_line - 1][0]
+                     for i_line, line in enumerate(accuracy["errors"])]
+    failures = []
+    previous = None
+    for i_line, line in enumerate(accuracy["errors"]):
+        if (not new_order[i_line] and previous[1] > args.error_floor and
+                not line[1] < previous[1]):
+            failures.append("%s: line %d: error of u %.4e did not decrease from %.4e" %
+                            (config["name"], i_line + 1, line[1], previous[1]))
+        previous = line
+    print("  convergence: %d error lines: %s" %
+          (len(accuracy["errors"]), "FAILED" if failures else "ok"))
+    return failures
+
+
+def compare(args, name, measured, baseline):
+    """Returns the list of regressions of one configuration."""
+    failures = []
+    for key, values in sorted(measured.items()):
+        if key not in baseline:
+            print("  %-14s NEW" % key)
+            if args.strict:
+                failures.append("%s/%s has no baseline" % (name, key))
+            continue
+        base = baseline[key]
+        if values["DOFs"] != base["DOFs"]:
+            failures.append("%s/%s: DOFs %d, baseline %d" %
+                            (name, key, values["DOFs"], base["DOFs"]))
+        iter_limit = base["iterations"] + max(
+            1, int(math.ceil(args.iter_tol * base["iterations"])))
+        if values["iterations"] > iter_limit:
+            failures.append("%s/%s: iterations %d, baseline %d" %
+                            (name, key, values["iterations"], base["iterations"]))
+        for phase in PHASES:
+            limit = (1 + args.time_tol) * base[phase] + args.time_floor
+            status = "ok"
+            if values[phase] > limit:
+                status = "SLOWER"
+                failures.append("%s/%s: %s %.4e s, baseline %.4e s" %
+                                (name, key, phase, values[phase], base[phase]))
+            print("  %-14s %-9s %12.4e s  baseline %12.4e s  %s" %
+                  (key, phase, values[phase], base[phase], status))
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--exe", required=True, help="the A1 executable")
+    parser.add_argument("--nodal-exe", help="A1 built with -DNODAL_COLLOCATION=ON; the "
+                        "configurations of the nodal mode are skipped without it")
+    parser.add_argument("--mpiexec", default="mpiexec")
+    parser.add_argument("--baselines", default=os.path.join(
+        os.path.dirname(os.path.abspath(__file__)), "baselines.json"))
+    parser.add_argument("--work-dir", default="perf_check_runs")
+    parser.add_argument("--time-tol", type=float, default=0.25)
+    parser.add_argument("--time-floor", type=float, default=0.05,
+                        help="seconds added to each time limit, for tiny phases")
+    parser.add_argument("--iter-tol", type=float, default=0.10)
+    parser.add_argument("--error-tol", type=float, default=1e-3,
+                        help="relative tolerance of the accuracy comparisons; the "
+                        "errors are written with 5 digits")
+    parser.add_argument("--error-floor", type=float, default=1e-11,
+                        help="absolute tolerance of the accuracy comparisons")
+    parser.add_argument("--repeat", type=int, default=1)
+    parser.add_argument("--only", help="run only the configuration with this name (and "
+                        "its reference)")
+    parser.add_argument("--update", action="store_true",
+                        help="store the measured values as the baselines")
+    parser.add_argument("--strict", action="store_true",
+                        help="fail if a configuration has no baseline")
+    args = parser.parse_args()
+    args.exe = os.path.abspath(args.exe)
+    if args.nodal_exe:
+        args.nodal_exe = os.path.abspath(args.nodal_exe)
+    args.work_dir = os.path.abspath(args.work_dir)
+
+    with open(args.baselines) as baselines_file:
+        baselines = json.load(baselines_file)
+    stored = baselines.setdefault("configurations", {})
+
+    if not stored and not args.update:
+        print("perf_check FAILED: no baselines are recorded in %s, so nothing can be "
+              "compared. Record them on the reference machine first with:\n"
+              "  perf_check.py --exe <A1> --repeat 3 --update" % args.baselines)
+        return 1
+    selected = set(config["name"] for config in CONFIGURATIONS)
+    if args.only:
+        selected = {args.only}
+        for config in CONFIGURATIONS:
+            if config["name"] == args.only and "reference" in config:
+                selected.add(config["reference"])
+    failures, accuracy_failures = [], []
+    accuracy_of = {}
+    for config in CONFIGURATIONS:
+        if config["name"] not in selected:
+            continue
+        if config.get("exe") == "nodal" and not args.nodal_exe:
+            print("%s is skipped: no --nodal-exe" % config["name"])
+            continue
+        print("%s (%d ranks, amr %d)" % (config["name"], config["ranks"], config["amr"]))
+        measured, accuracy = run_configuration(args, config)
+        accuracy_of[config["name"]] = accuracy
+        if "reference" in config:
+            accuracy_failures += compare_accuracy(args, config, accuracy,
+                                                  accuracy_of[config["reference"]])
+        if config.get("converges"):
+            accuracy_failures += check_convergence(args, config, accuracy, measured)
+        for check in config.get("checks", []):
+            accuracy_failures += check(args, config, os.path.join(args.work_dir, config["name"]),
+                                       accuracy)
+        if not measured:
+            failures.append("%s: no phase times were found" % config["name"])
+            continue
+        if args.update:
+            stored[config["name"]] = measured
+        else:
+            failures += compare(args, config["name"], measured,
+                                stored.get(config["name"], {}))
+
+    if accuracy_failures:
+        print("\nperf_check FAILED (accuracy):")
+        for failure in accuracy_failures:
+            print("  " + failure)
+        return 1
+    if args.update:
+        with open(args.baselines, "w") as baselines_file:
+            json.dump(baselines, baselines_file, indent=2, sort_keys=True)
+            baselines_file.write("\n")
+        print("The baselines are updated in %s" % args.baselines)
+        return 0
+    if failures:
+        print("\nperf_check FAILED:")
+        for failure in failures:
+            print("  " + failure)
+        return 1
+    print("\nperf_check passed.")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,263 @@
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+/*!
+ * \defgroup perf Hardware performance counters
+ * \brief
+ * A thin layer over the Linux perf_event_open system call, which counts the
+ * cycles, instructions, last level cache misses and (if a raw event code is
+ * given) floating point operations of the calling thread, in a few phases of
+ * the program. Like the NUMA tools, we call the kernel directly; on other
+ * systems, or when the kernel does not allow the counters, the events are
+ * reported as zero and only the wall time is measured.
+ */
+
+/*!
+ * \ingroup perf
+ * \brief The events which we count.
+ */
+enum Perf_Event
+{
+  Perf_Cycles = 0,
+  Perf_Instructions = 1,
+  Perf_Cache_Misses = 2,
+  Perf_FP_Ops = 3,
+  N_Perf_Events = 4
+};
+
+/*!
+ * \ingroup perf
+ * \brief The phases which are measured. The first two and the last one are
+ * measured in every thread, the others only in the master thread.
+ */
+enum Perf_Phase
+{
+  Perf_Local_Matrices = 0,
+  Perf_Local_Solves = 1,
+  Perf_Global_Assembly = 2,
+  Perf_SpMV = 3,
+  Perf_KSP_Solve = 4,
+  Perf_Local_Recovery = 5,
+  N_Perf_Phases = 6
+};
+
+/*!
+ * \ingroup perf
+ * \brief The counters of the thread which has opened them. Each thread opens
+ * its own counters at the start of a parallel region, since the kernel
+ * counts the events of the thread which has called perf_event_open.
+ */
+struct Perf_Thread_Counters
+{
+  Perf_Thread_Counters()
+  {
+    for (unsigned i_event = 0; i_event < N_Perf_Events; ++i_event)
+      fds[i_event] = -1;
+  }
+
+  ~Perf_Thread_Counters()
+  {
+    close_all();
+  }
+
+  Perf_Thread_Counters(const Perf_Thread_Counters &) = delete;
+  Perf_Thread_Counters &operator=(const Perf_Thread_Counters &) = delete;
+
+  /*!
+   * \details Opens the counters for the calling thread. The FP counter is
+   * opened only if \c fp_raw_event is nonzero, since there is no generic
+   * event for it; e.g. on Intel cores, 0x01c7 counts the scalar double
+   * precision operations.
+   */
+  void open(const uint64_t &fp_raw_event)
+  {
+    close_all();
+#ifdef __linux__
+    const uint32_t types[N_Perf_Events] = {
+      PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_RAW
+    };
+    const uint64_t configs[N_Perf_Events] = { PERF_COUNT_HW_CPU_CYCLES,
+                                              PERF_COUNT_HW_INSTRUCTIONS,
+                                              PERF_COUNT_HW_CACHE_MISSES,
+                                              fp_raw_event };
+    for (unsigned i_event = 0; i_event < N_Perf_Events; ++i_event)
+    {
+      if (i_event == Perf_FP_Ops && fp_raw_event == 0)
+        continue;
+      struct perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = types[i_event];
+      attr.config = configs[i_event];
+      /* With exclude_kernel, a perf_event_paranoid of 2 is enough. */
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fds[i_event] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#else
+    (void)fp_raw_event;
+#endif
+  }
+
+  /*!
+   * \details Reads the current values of all events. The events which are
+   * not available are read as zero.
+   */
+  void read_all(uint64_t values[N_Perf_Events]) const
+  {
+    for (unsigned i_event = 0; i_event < N_Perf_Events; ++i_event)
+    {
+      values[i_event] = 0;
+#ifdef __linux__
+      if (fds[i_event] >= 0 &&
+          read(fds[i_event], &values[i_event], sizeof(uint64_t)) != sizeof(uint64_t))
+        values[i_event] = 0;
+#endif
+    }
+  }
+
+  bool available(const unsigned &i_event) const
+  {
+    return fds[i_event] >= 0;
+  }
+
+  void close_all()
+  {
+    for (unsigned i_event = 0; i_event < N_Perf_Events; ++i_event)
+    {
+#ifdef __linux__
+      if (fds[i_event] >= 0)
+        close(fds[i_event]);
+#endif
+      fds[i_event] = -1;
+    }
+  }
+
+  int fds[N_Perf_Events];
+};
+
+/*!
+ * \ingroup perf
+ * \brief The wall time, the number of calls, and the events of one phase in
+ * one thread.
+ */
+struct Perf_Phase_Record
+{
+  Perf_Phase_Record() : wall_time(0), n_calls(0)
+  {
+    for (unsigned i_event = 0; i_event < N_Perf_Events; ++i_event)
+      events[i_event] = 0;
+  }
+
+  double wall_time;
+  uint64_t n_calls;
+  uint64_t events[N_Perf_Events];
+};
+
+/*!
+ * \ingroup perf
+ * \brief Keeps a Perf_Phase_Record for each phase and each thread. Every
+ * thread writes only into its own records, so no locking is needed.
+ */
+struct Perf_Recorder
+{
+  Perf_Recorder() : enabled(false), fp_raw_event(0), n_threads(1)
+  {
+  }
+
+  void setup(const bool &enabled_, const uint64_t &fp_raw_event_, const unsigned &n_threads_)
+  {
+    enabled = enabled_;
+    fp_raw_event = fp_raw_event_;
+    n_threads = n_threads_;
+    clear();
+    if (enabled)
+      master_counters.open(fp_raw_event);
+  }
+
+  void clear()
+  {
+    records.assign(n_threads * N_Perf_Phases, Perf_Phase_Record());
+  }
+
+  Perf_Phase_Record &record(const unsigned &thread_id, const unsigned &phase)
+  {
+    return records[(thread_id % n_threads) * N_Perf_Phases + phase];
+  }
+
+  bool enabled;
+  uint64_t fp_raw_event;
+  unsigned n_threads;
+  std::vector<Perf_Phase_Record> records;
+  /* The counters of the master thread, for the phases out of the parallel
+   * regions. */
+  Perf_Thread_Counters master_counters;
+};
+
+/*!
+ * \ingroup perf
+ * \brief Adds the wall time and the events between its construction and its
+ * destruction to one phase of a thread. It does nothing if the recorder is
+ * not enabled. The scope can also be closed earlier by stop(). Each scope
+ * costs a few system calls, so it should wrap the work of a whole cell (or
+ * more), not the inner loops.
+ */
+struct Perf_Scope
+{
+  Perf_Scope(Perf_Recorder &recorder_,
+             const Perf_Thread_Counters &counters_,
+             const unsigned &phase_,
+             const unsigned &thread_id_)
+    : recorder(recorder_),
+      counters(counters_),
+      phase(phase_),
+      thread_id(thread_id_),
+      stopped(false)
+  {
+    if (!recorder.enabled)
+      return;
+    counters.read_all(start_events);
+    start_time = std::chrono::steady_clock::now();
+  }
+
+  ~Perf_Scope()
+  {
+    stop();
+  }
+
+  void stop()
+  {
+    if (!recorder.enabled || stopped)
+      return;
+    stopped = true;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+    uint64_t end_events[N_Perf_Events];
+    counters.read_all(end_events);
+    Perf_Phase_Record &the_record = recorder.record(thread_id, phase);
+    the_record.wall_time += elapsed.count();
+    the_record.n_calls += 1;
+    for (unsigned i_event = 0; i_event < N_Perf_Events; ++i_event)
+      the_record.events[i_event] += end_events[i_event] - start_events[i_event];
+  }
+
+  Perf_Recorder &recorder;
+  const Perf_Thread_Counters &counters;
+  unsigned phase;
+  unsigned thread_id;
+  bool stopped;
+  uint64_t start_events[N_Perf_Events];
+  std::chrono::steady_clock::time_point start_time;
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <limits>
+
+#ifndef POINT_QUERY_HPP
+#define POINT_QUERY_HPP
+
+/*!
+ * \defgroup point_query Point queries
+ * \brief
+ * The evaluation of the solution at given points (wells, sensors). Each rank
+ * keeps a tree of the bounding boxes of its owned cells, which is built once
+ * after each refinement, and finds the cells of a batch of points by it. The
+ * batches are the same on all ranks (e.g. they are read from one file by
+ * every rank), so no point has to be sent to its owner; every rank evaluates
+ * the points in its own cells, and one reduction to rank zero collects the
+ * values.
+ */
+
+/*!
+ * \ingroup point_query
+ * \brief An axis aligned box in 3D; the 2D boxes have zero thickness.
+ */
+struct BBox
+{
+  BBox()
+  {
+    for (unsigned i_dim = 0; i_dim < 3; ++i_dim)
+    {
+      lo[i_dim] = std::numeric_limits<double>::max();
+      hi[i_dim] = std::numeric_limits<double>::lowest();
+    }
+  }
+
+  void extend(const double *point)
+  {
+    for (unsigned i_dim = 0; i_dim < 3; ++i_dim)
+    {
+      lo[i_dim] = std::min(lo[i_dim], point[i_dim]);
+      hi[i_dim] = std::max(hi[i_dim], point[i_dim]);
+    }
+  }
+
+  void extend(const BBox &other)
+  {
+    extend(other.lo);
+    extend(other.hi);
+  }
+
+  bool contains(const double *point, const double &tolerance) const
+  {
+    for (unsigned i_dim = 0; i_dim < 3; ++i_dim)
+      if (point[i_dim] < lo[i_dim] - tolerance || point[i_dim] > hi[i_dim] + tolerance)
+        return false;
+    return true;
+  }
+
+  double center(const unsigned &i_dim) const
+  {
+    return 0.5 * (lo[i_dim] + hi[i_dim]);
+  }
+
+  double lo[3], hi[3];
+};
+
+/*!
+ * \ingroup point_query
+ * \brief A bounding volume hierarchy over a set of boxes. The boxes are
+ * split at the median of their centers, along the longest side of their
+ * bounding box, until a node has at most leaf_size boxes. The nodes are
+ * stored in one vector; the children of a node are next to each other.
+ */
+class BBox_Tree
+{
+ public:
+  BBox_Tree() : leaf_size(8)
+  {
+  }
+
+  void build(const std::vector<BBox> &boxes_)
+  {
+    boxes = boxes_;
+    box_ids.resize(boxes.size());
+    for (unsigned i_box = 0; i_box < boxes.size(); ++i_box)
+      box_ids[i_box] = i_box;
+    nodes.clear();
+    if (boxes.empty())
+      return;
+    nodes.push_back(Node());
+    Build_Node(0, 0, boxes.size());
+  }
+
+  void clear()
+  {
+    boxes.clear();
+    box_ids.clear();
+    nodes.clear();
+  }
+
+  bool empty() const
+  {
+    return nodes.empty();
+  }
+
+  /*!
+   * \details The boxes which contain \c point (3 coordinates), within
+   * \c tolerance, in \c candidates.
+   */
+  void find(const double *point, const double &tolerance, std::vector<unsigned> &candidates) const
+  {
+    candidates.clear();
+    if (nodes.empty())
+      return;
+    std::vector<unsigned> stack(1, 0);
+    while (!stack.empty())
+    {
+      const Node &node = nodes[stack.back()];
+      stack.pop_back();
+      if (!node.box.contains(point, tolerance))
+        continue;
+      if (node.first_child == 0)
+      {
+        for (unsigned i_id = node.begin; i_id < node.end; ++i_id)
+          if (boxes[box_ids[i_id]].contains(point, tolerance))
+            candidates.push_back(box_ids[i_id]);
+        continue;
+      }
+      stack.push_back(node.first_child);
+      stack.push_back(node.first_child + 1);
+    }
+    std::sort(candidates.begin(), candidates.end());
+  }
+
+  double memory_bytes() const
+  {
+    return boxes.capacity() * sizeof(BBox) + box_ids.capacity() * sizeof(unsigned) +
+           nodes.capacity() * sizeof(Node);
+  }
+
+  unsigned leaf_size;
+
+ private:
+  struct Node
+  {
+    Node() : begin(0), end(0), first_child(0)
+    {
+    }
+
+    BBox box;
+    /* The boxes of the node are box_ids[begin, end); first_child is zero
+     * for the leaves, since the root is never a child. */
+    unsigned begin, end;
+    unsigned first_child;
+  };
+
+  void Build_Node(const unsigned &i_node, const unsigned &begin, const unsigned &end)
+  {
+    BBox node_box;
+    for (unsigned i_id = begin; i_id < end; ++i_id)
+      node_box.extend(boxes[box_ids[i_id]]);
+    nodes[i_node].box = node_box;
+    nodes[i_node].begin = begin;
+    nodes[i_node].end = end;
+    if (end - begin <= leaf_size)
+      return;
+
+    unsigned split_dim = 0;
+    for (unsigned i_dim = 1; i_dim < 3; ++i_dim)
+      if (node_box.hi[i_dim] - node_box.lo[i_dim] >
+          node_box.hi[split_dim] - node_box.lo[split_dim])
+        split_dim = i_dim;
+    const unsigned middle = (begin + end) / 2;
+    std::nth_element(box_ids.begin() + begin,
+                     box_ids.begin() + middle,
+                     box_ids.begin() + end,
+                     [this, split_dim](const unsigned &id1, const unsigned &id2) {
+                       return boxes[id1].center(split_dim) < boxes[id2].center(split_dim);
+                     });
+    const unsigned first_child = nodes.size();
+    nodes[i_node].first_child = first_child;
+    nodes.resize(nodes.size() + 2);
+    Build_Node(first_child, begin, middle);
+    Build_Node(first_child + 1, middle, end);
+  }
+
+  std::vector<BBox> boxes;
+  std::vector<unsigned> box_ids;
+  std::vector<Node> nodes;
+};
+
+/*!
+ * \ingroup point_query
+ * \brief Reads the points of a query file: \c dim coordinates in each line;
+ * the empty lines and the lines which start with # are skipped.
+ * \return false if the file cannot be read, or has a wrong line.
+ */
+inline bool Read_Query_Points(const std::string &file_name,
+                              const unsigned &dim,
+                              std::vector<double> &points)
+{
+  std::ifstream query_file(file_name);
+  if (!query_file.good())
+    return false;
+  points.clear();
+  std::string line;
+  while (std::getline(query_file, line))
+  {
+    if (line.find_first_not_of(" \t\r") == std::string::npos || line[0] == '#')
+      continue;
+    std::istringstream line_stream(line);
+    for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+    {
+      double coord;
+      if (!(line_stream >> coord))
+        return false;
+      points.push_back(coord);
+    }
+  }
+  return true;
+}
+
+#endif
@@ -2,9 +2,13 @@
 #include <vector>
 #include <cmath>
 #include <memory>
+#include <map>
 #include <deal.II/base/tensor.h>
+#include <deal.II/base/quadrature_lib.h>
 #include <boost/numeric/mtl/mtl.hpp>
 
+#include "memory_tools.hpp"
+
 #ifndef POLY_BASIS
 #define POLY_BASIS
 
@@ -26,6 +30,43 @@ enum Domain
 #include "lagrange_polynomial_vandermonde.hpp"
 #include "support_classes.hpp"
 
+/*!
+ * \brief The integration rule of the cells and faces with \c n_points_1D
+ * points in each direction. This is the Gauss rule, unless the code is
+ * compiled with NODAL_COLLOCATION; then it is the Gauss-Lobatto rule, whose
+ * points are the nodes of Lagrange_Polys.
+ * \ingroup basis_funcs
+ */
+template <int dim>
+dealii::Quadrature<dim> Cell_Quadrature(const unsigned &n_points_1D)
+{
+#ifdef NODAL_COLLOCATION
+  return dealii::QGaussLobatto<dim>(n_points_1D);
+#else
+  return dealii::QGauss<dim>(n_points_1D);
+#endif
+}
+
+/*!
+ * \brief The values and gradients of a basis at the points of a
+ * Cell_Quadrature with a given number of points in each direction.
+ * \ingroup basis_funcs
+ */
+template <int dim>
+struct Quadrature_Table
+{
+  Quadrature_Table(const unsigned &n_points_1D)
+    : quadrature(Cell_Quadrature<dim>(n_points_1D))
+  {
+  }
+
+  dealii::Quadrature<dim> quadrature;
+  std::vector<std::vector<double>> bases;
+  std::vector<std::vector<dealii::Tensor<1, dim>>> bases_grads;
+  Eigen::MatrixXd the_bases;
+  std::vector<Eigen::MatrixXd> half_range_bases;
+};
+
 /*!
  * \brief The static base class for all other polynomial basis.
  *
@@ -48,6 +89,14 @@ class poly_space_basis
   std::vector<double>
    value(const dealii::Point<dim, double> &P0, const unsigned half_range);
   std::vector<dealii::Tensor<1, dim>> grad(const dealii::Point<dim, double> &P0);
+  void Compute_Half_Range_Bases(const std::vector<dealii::Point<dim>> &integration_points);
+  const Eigen::MatrixXd &half_range_table(const unsigned &half_range) const;
+  const Eigen::MatrixXd &half_range_table(const unsigned &half_range,
+                                          const unsigned &n_points_1D) const;
+  void Cache_Quadrature(const unsigned &n_points_1D);
+  const Quadrature_Table<dim> &quadrature_table(const unsigned &n_points_1D) const;
+  const std::vector<std::vector<double>> &bases_at(const unsigned &n_points) const;
+  double memory_bytes() const;
   ~poly_space_basis();
 
   unsigned n_polys;
@@ -55,6 +104,19 @@ class poly_space_basis
   std::vector<std::vector<dealii::Tensor<1, dim>>> bases_grads;
   Eigen::MatrixXd the_bases;
   mtl::dense2D<dealii::Tensor<1, dim>> the_bases_grads;
+  /*!
+   * \details half_range_projections[k-1] maps the modes of a basis function
+   * on the whole face to its modes on the subface with half_range = k, and
+   * half_range_bases[k-1] is the_bases multiplied by this matrix.
+   */
+  std::vector<Eigen::MatrixXd> half_range_projections;
+  std::vector<Eigen::MatrixXd> half_range_bases;
+  /*!
+   * \details The tables of other Gauss rules, which are used when the cells
+   * are integrated with different numbers of points. The key is the number of
+   * points in each direction.
+   */
+  std::map<unsigned, Quadrature_Table<dim>> quadrature_tables;
 
   template <int func_dim, typename T>
   void Project_to_Basis(const Function<func_dim, T> &func,
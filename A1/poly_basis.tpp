@@ -92,13 +92,14 @@ void poly_space_basis<Derived_Basis, dim>::Project_to_Basis(
 {
   if (std::is_same<Jacobi_Poly_Basis<dim>, Derived_Basis>::value)
   {
-    assert(bases.size() == integration_points_.size());
+    const std::vector<std::vector<double>> &bases_ = bases_at(weights.size());
+    assert(bases_.size() == integration_points_.size());
     assert(integration_points_.size() == weights.size());
     vec = Eigen::MatrixXd::Zero(n_polys, 1);
     for (unsigned i1 = 0; i1 < weights.size(); ++i1)
     {
       Eigen::MatrixXd Nj(n_polys, 1);
-      Nj = Eigen::VectorXd::Map(bases[i1].data(), n_polys);
+      Nj = Eigen::VectorXd::Map(bases_[i1].data(), n_polys);
       vec += weights[i1] *
              func.value(integration_points_[i1], integration_points_[i1]) * Nj;
     }
@@ -126,13 +127,14 @@ void poly_space_basis<Derived_Basis, dim>::Project_to_Basis(
 {
   if (std::is_same<Jacobi_Poly_Basis<dim>, Derived_Basis>::value)
   {
-    assert(bases.size() == integration_points_.size());
+    const std::vector<std::vector<double>> &bases_ = bases_at(weights_.size());
+    assert(bases_.size() == integration_points_.size());
     assert(integration_points_.size() == weights_.size());
     vec = Eigen::MatrixXd::Zero(n_polys, 1);
     for (unsigned i1 = 0; i1 < weights_.size(); ++i1)
     {
       Eigen::MatrixXd Nj(n_polys, 1);
-      Nj = Eigen::VectorXd::Map(bases[i1].data(), n_polys);
+      Nj = Eigen::VectorXd::Map(bases_[i1].data(), n_polys);
       vec += weights_[i1] *
              func.value(integration_points_[i1], normals_at_integration_[i1]) * Nj;
     }
@@ -187,6 +189,136 @@ std::vector<double>
   return poly_basis.value(P0, half_range);
 }
 
+/*!
+ * Since the bases are polynomials, restricting them to one of the
+ * \f$2^{dim}\f$ halves (quarters in 3D) of the face is a linear map from the
+ * modes on the whole face to the modes on that subface. We find this map
+ * once, by the least squares fit of the half-range values on the
+ * integration points, i.e. \f$B P_k = B_k\f$, where \f$B\f$ is
+ * the_bases. Then, on each hanging face we only read the precomputed table
+ * \f$B P_k\f$, instead of evaluating the basis at the remapped points. We
+ * need at least as many integration points as n_polys for this fit to be
+ * exact.
+ */
+template <typename Derived_Basis, int dim>
+void poly_space_basis<Derived_Basis, dim>::Compute_Half_Range_Bases(
+ const std::vector<dealii::Point<dim>> &integration_points_)
+{
+  assert(integration_points_.size() == (unsigned)the_bases.rows());
+  assert(integration_points_.size() >= n_polys);
+  const unsigned n_half_ranges = pow(2, dim);
+  half_range_projections.resize(n_half_ranges);
+  half_range_bases.resize(n_half_ranges);
+  Eigen::ColPivHouseholderQR<Eigen::MatrixXd> QR_of_bases(the_bases);
+  for (unsigned half_range = 1; half_range <= n_half_ranges; ++half_range)
+  {
+    Eigen::MatrixXd remapped_bases(integration_points_.size(), n_polys);
+    for (unsigned i1 = 0; i1 < integration_points_.size(); ++i1)
+    {
+      std::vector<double> Ni = value(integration_points_[i1], half_range);
+      for (unsigned i_poly = 0; i_poly < n_polys; ++i_poly)
+        remapped_bases(i1, i_poly) = Ni[i_poly];
+    }
+    half_range_projections[half_range - 1] = QR_of_bases.solve(remapped_bases);
+    half_range_bases[half_range - 1] =
+     the_bases * half_range_projections[half_range - 1];
+  }
+  for (auto &&n_points_and_table : quadrature_tables)
+  {
+    Quadrature_Table<dim> &table = n_points_and_table.second;
+    table.half_range_bases.clear();
+    for (const Eigen::MatrixXd &projection : half_range_projections)
+      table.half_range_bases.push_back(table.the_bases * projection);
+  }
+}
+
+/*!
+ * Returns the table of values of the bases at the integration points, on the
+ * subface with the given half_range. For half_range = 0, this is the_bases.
+ */
+template <typename Derived_Basis, int dim>
+const Eigen::MatrixXd &
+ poly_space_basis<Derived_Basis, dim>::half_range_table(const unsigned &half_range) const
+{
+  if (half_range == 0)
+    return the_bases;
+  assert(half_range <= half_range_bases.size());
+  return half_range_bases[half_range - 1];
+}
+
+/*!
+ * Similar to the above function, for the Gauss rule with \c n_points_1D
+ * points in each direction, which should be cached before.
+ */
+template <typename Derived_Basis, int dim>
+const Eigen::MatrixXd &
+ poly_space_basis<Derived_Basis, dim>::half_range_table(const unsigned &half_range,
+                                                        const unsigned &n_points_1D) const
+{
+  const Quadrature_Table<dim> &table = quadrature_table(n_points_1D);
+  if (half_range == 0)
+    return table.the_bases;
+  assert(half_range <= table.half_range_bases.size());
+  return table.half_range_bases[half_range - 1];
+}
+
+/*!
+ * Computes the values and gradients of the bases at the points of the Gauss
+ * rule with \c n_points_1D points in each direction, and keeps them in
+ * quadrature_tables. If the half-range projections are computed, the
+ * half-range tables of this rule are also formed. Calling this function for
+ * a rule which is already cached does nothing. Since this function changes
+ * quadrature_tables, it should not be called from several threads.
+ */
+template <typename Derived_Basis, int dim>
+void poly_space_basis<Derived_Basis, dim>::Cache_Quadrature(const unsigned &n_points_1D)
+{
+  if (quadrature_tables.find(n_points_1D) != quadrature_tables.end())
+    return;
+  Quadrature_Table<dim> table(n_points_1D);
+  const std::vector<dealii::Point<dim>> &points = table.quadrature.get_points();
+  table.the_bases.resize(points.size(), n_polys);
+  for (unsigned i1 = 0; i1 < points.size(); ++i1)
+  {
+    std::vector<double> Ni = value(points[i1]);
+    std::vector<dealii::Tensor<1, dim>> Ni_grad = grad(points[i1]);
+    for (unsigned i_poly = 0; i_poly < n_polys; ++i_poly)
+      table.the_bases(i1, i_poly) = Ni[i_poly];
+    table.bases.push_back(std::move(Ni));
+    table.bases_grads.push_back(std::move(Ni_grad));
+  }
+  for (const Eigen::MatrixXd &projection : half_range_projections)
+    table.half_range_bases.push_back(table.the_bases * projection);
+  quadrature_tables.insert(std::make_pair(n_points_1D, std::move(table)));
+}
+
+template <typename Derived_Basis, int dim>
+const Quadrature_Table<dim> &
+ poly_space_basis<Derived_Basis, dim>::quadrature_table(const unsigned &n_points_1D) const
+{
+  auto found_table = quadrature_tables.find(n_points_1D);
+  assert(found_table != quadrature_tables.end());
+  return found_table->second;
+}
+
+/*!
+ * Returns the values of the bases at a set of integration points, which is
+ * either the set given to the constructor or one of the cached Gauss rules.
+ * We find the correct table from the number of points.
+ */
+template <typename Derived_Basis, int dim>
+const std::vector<std::vector<double>> &
+ poly_space_basis<Derived_Basis, dim>::bases_at(const unsigned &n_points) const
+{
+  if (n_points == bases.size())
+    return bases;
+  for (auto &&n_points_and_table : quadrature_tables)
+    if (n_points_and_table.second.bases.size() == n_points)
+      return n_points_and_table.second.bases;
+  assert(false);
+  return bases;
+}
+
 template <typename Derived_Basis, int dim>
 std::vector<dealii::Tensor<1, dim>>
  poly_space_basis<Derived_Basis, dim>::grad(const dealii::Point<dim, double> &P0)
@@ -194,6 +326,40 @@ std::vector<dealii::Tensor<1, dim>>
   return poly_basis.grad(P0);
 }
 
+/*!
+ * The bytes of all tables of this basis, including the cached quadrature
+ * tables.
+ */
+template <typename Derived_Basis, int dim>
+double poly_space_basis<Derived_Basis, dim>::memory_bytes() const
+{
+  double bytes = Vector_Bytes(bases) + Vector_Bytes(bases_grads);
+  for (const std::vector<double> &bases_at_point : bases)
+    bytes += Vector_Bytes(bases_at_point);
+  for (const std::vector<dealii::Tensor<1, dim>> &grads_at_point : bases_grads)
+    bytes += Vector_Bytes(grads_at_point);
+  bytes += the_bases.size() * sizeof(double);
+  bytes += (double)mtl::num_rows(the_bases_grads) * mtl::num_cols(the_bases_grads) *
+           sizeof(dealii::Tensor<1, dim>);
+  for (const Eigen::MatrixXd &projection : half_range_projections)
+    bytes += projection.size() * sizeof(double);
+  for (const Eigen::MatrixXd &half_range_basis : half_range_bases)
+    bytes += half_range_basis.size() * sizeof(double);
+  for (auto &&n_points_and_table : quadrature_tables)
+  {
+    const Quadrature_Table<dim> &table = n_points_and_table.second;
+    bytes += table.quadrature.size() * (sizeof(dealii::Point<dim>) + sizeof(double));
+    for (const std::vector<double> &bases_at_point : table.bases)
+      bytes += Vector_Bytes(bases_at_point);
+    for (const std::vector<dealii::Tensor<1, dim>> &grads_at_point : table.bases_grads)
+      bytes += Vector_Bytes(grads_at_point);
+    bytes += table.the_bases.size() * sizeof(double);
+    for (const Eigen::MatrixXd &half_range_basis : table.half_range_bases)
+      bytes += half_range_basis.size() * sizeof(double);
+  }
+  return bytes;
+}
+
 template <typename Derived_Basis, int dim>
 poly_space_basis<Derived_Basis, dim>::~poly_space_basis()
 {
@@ -0,0 +1,207 @@
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <deal.II/base/point.h>
+
+#ifndef RENUMBERING_HPP
+#define RENUMBERING_HPP
+
+/*!
+ * \defgroup renumbering Renumbering
+ * \brief
+ * This module contains the tools which we use to reorder the owned cells and
+ * the trace DOFs of each rank, in order to get a global matrix with smaller
+ * bandwidth.
+ */
+
+/*!
+ * \ingroup renumbering
+ * \details The renumbering which is applied to the owned cells and faces of
+ * each rank. \c No_Renumbering keeps the order in which deal.II gives us the
+ * cells.
+ */
+enum Renumbering_Type
+{
+  No_Renumbering = 0,
+  SFC_Renumbering = 1,
+  RCM_Renumbering = 2
+};
+
+/*!
+ * \ingroup renumbering
+ * \brief Gives the Morton (Z-order) key of point \c p inside the box
+ * \f$[lo, hi]\f$. Each coordinate is quantized with \c 63/dim bits and the
+ * bits are interleaved, so that close points get close keys.
+ */
+template <int dim>
+uint64_t Morton_Key(const dealii::Point<dim> &p,
+                    const dealii::Point<dim> &lo,
+                    const dealii::Point<dim> &hi)
+{
+  const unsigned n_bits = 63 / dim;
+  const uint64_t n_cells_1D = (uint64_t(1) << n_bits) - 1;
+  uint64_t quantized[dim];
+  for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+  {
+    double length = hi[i_dim] - lo[i_dim];
+    double ratio = (length > 0) ? (p[i_dim] - lo[i_dim]) / length : 0.0;
+    ratio = std::min(std::max(ratio, 0.0), 1.0);
+    quantized[i_dim] = static_cast<uint64_t>(ratio * n_cells_1D);
+  }
+  uint64_t key = 0;
+  for (int i_bit = n_bits - 1; i_bit >= 0; --i_bit)
+    for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+      key = (key << 1) | ((quantized[i_dim] >> i_bit) & 1);
+  return key;
+}
+
+/*!
+ * \ingroup renumbering
+ * \brief Sorts the given points along the Morton curve of their bounding box.
+ * \return A vector \c new_number, where \c new_number[i] is the position of
+ * the ith point in the curve.
+ */
+template <int dim>
+std::vector<unsigned> SFC_Permutation(const std::vector<dealii::Point<dim>> &points)
+{
+  std::vector<unsigned> new_number(points.size());
+  if (points.size() == 0)
+    return new_number;
+  dealii::Point<dim> lo = points[0], hi = points[0];
+  for (const dealii::Point<dim> &point : points)
+    for (unsigned i_dim = 0; i_dim < dim; ++i_dim)
+    {
+      lo[i_dim] = std::min(lo[i_dim], point[i_dim]);
+      hi[i_dim] = std::max(hi[i_dim], point[i_dim]);
+    }
+  std::vector<uint64_t> keys(points.size());
+  for (unsigned i_point = 0; i_point < points.size(); ++i_point)
+    keys[i_point] = Morton_Key(points[i_point], lo, hi);
+  std::vector<unsigned> old_number(points.size());
+  std::iota(old_number.begin(), old_number.end(), 0);
+  std::stable_sort(old_number.begin(),
+                   old_number.end(),
+                   [&keys](const unsigned &i1, const unsigned &i2)
+                   {
+    return keys[i1] < keys[i2];
+  });
+  for (unsigned i_new = 0; i_new < old_number.size(); ++i_new)
+    new_number[old_number[i_new]] = i_new;
+  return new_number;
+}
+
+/*!
+ * \ingroup renumbering
+ * \brief The reverse Cuthill-McKee ordering of a graph. Each connected
+ * component is started from a pseudo-peripheral node, which we find by a few
+ * sweeps of breadth first search.
+ * \param graph contains the neighbors of each node. We assume that the graph
+ * is symmetric and has no self loops.
+ * \return A vector \c new_number, where \c new_number[i] is the new number of
+ * node i.
+ */
+inline std::vector<unsigned>
+ RCM_Permutation(const std::vector<std::vector<unsigned>> &graph)
+{
+  const unsigned n_nodes = graph.size();
+  std::vector<unsigned> cm_order;
+  cm_order.reserve(n_nodes);
+  std::vector<bool> numbered(n_nodes, false);
+  std::vector<int> level(n_nodes, -1);
+
+  /* Returns the last node of a breadth first search started from root, which
+   * is one of the farthest nodes from root, with the smallest degree. */
+  auto farthest_node = [&](const unsigned &root)
+  {
+    std::vector<unsigned> visited;
+    std::deque<unsigned> to_visit(1, root);
+    level[root] = 0;
+    unsigned last = root;
+    while (!to_visit.empty())
+    {
+      unsigned node = to_visit.front();
+      to_visit.pop_front();
+      visited.push_back(node);
+      if (level[node] > level[last] ||
+          (level[node] == level[last] && graph[node].size() < graph[last].size()))
+        last = node;
+      for (const unsigned &nb : graph[node])
+        if (level[nb] < 0)
+        {
+          level[nb] = level[node] + 1;
+          to_visit.push_back(nb);
+        }
+    }
+    int depth = level[last];
+    for (const unsigned &node : visited)
+      level[node] = -1;
+    return std::make_pair(last, depth);
+  };
+
+  for (unsigned i_node = 0; i_node < n_nodes; ++i_node)
+  {
+    if (numbered[i_node])
+      continue;
+    unsigned root = i_node;
+    auto next = farthest_node(root);
+    for (unsigned i_sweep = 0; i_sweep < 5; ++i_sweep)
+    {
+      auto candidate = farthest_node(next.first);
+      if (candidate.second <= next.second)
+        break;
+      root = next.first;
+      next = candidate;
+    }
+    root = next.first;
+
+    std::deque<unsigned> to_visit(1, root);
+    numbered[root] = true;
+    while (!to_visit.empty())
+    {
+      unsigned node = to_visit.front();
+      to_visit.pop_front();
+      cm_order.push_back(node);
+      std::vector<unsigned> nbs;
+      for (const unsigned &nb : graph[node])
+        if (!numbered[nb])
+        {
+          numbered[nb] = true;
+          nbs.push_back(nb);
+        }
+      std::sort(nbs.begin(),
+                nbs.end(),
+                [&graph](const unsigned &i1, const unsigned &i2)
+                {
+        return graph[i1].size() < graph[i2].size();
+      });
+      to_visit.insert(to_visit.end(), nbs.begin(), nbs.end());
+    }
+  }
+
+  std::vector<unsigned> new_number(n_nodes);
+  for (unsigned i_new = 0; i_new < n_nodes; ++i_new)
+    new_number[cm_order[n_nodes - 1 - i_new]] = i_new;
+  return new_number;
+}
+
+/*!
+ * \ingroup renumbering
+ * \brief The maximum of \f$|i-j|\f$ over the edges of the graph, when the
+ * nodes are numbered according to \c new_number.
+ */
+inline unsigned Graph_Bandwidth(const std::vector<std::vector<unsigned>> &graph,
+                                const std::vector<unsigned> &new_number)
+{
+  unsigned bandwidth = 0;
+  for (unsigned i_node = 0; i_node < graph.size(); ++i_node)
+    for (const unsigned &nb : graph[i_node])
+    {
+      unsigned i1 = new_number[i_node], i2 = new_number[nb];
+      bandwidth = std::max(bandwidth, i1 > i2 ? i1 - i2 : i2 - i1);
+    }
+  return bandwidth;
+}
+
+#endif // RENUMBERING_HPP
@@ -0,0 +1,255 @@
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <ostream>
+
+#ifndef SOLVER_TELEMETRY_HPP
+#define SOLVER_TELEMETRY_HPP
+
+/*!
+ * \defgroup solver_telemetry Solver telemetry
+ * \brief
+ * The record of one linear solve: the residual history, the time of the
+ * setup (mostly the construction of the preconditioner) and of the
+ * iterations, the complexity of the multigrid hierarchy, and the estimates
+ * of the extreme singular values of the preconditioned operator. The record
+ * is filled from PETSc in Solve_Linear_Systam and written as JSON (one file
+ * per cycle) and CSV (one row per cycle).
+ */
+
+/*!
+ * \ingroup solver_telemetry
+ * \brief The data of one solve, as seen by rank zero.
+ */
+struct Solver_Record
+{
+  Solver_Record()
+    : poly_order(0),
+      cycle(0),
+      n_DOFs(0),
+      tau(0),
+      n_iterations(0),
+      converged_reason(0),
+      setup_time(0),
+      solve_time(0),
+      rhs_norm(0),
+      solution_norm(0),
+      final_residual_norm(0),
+      error_norm(0),
+      n_levels(0),
+      operator_complexity(0),
+      grid_complexity(0),
+      sigma_max(0),
+      sigma_min(0)
+  {
+  }
+
+  double condition_estimate() const
+  {
+    return (sigma_min > 0) ? sigma_max / sigma_min : 0;
+  }
+
+  /*!
+   * \details Writes the record as one JSON object.
+   */
+  void Write_JSON(std::ostream &out) const
+  {
+    char buffer[300];
+    out << "{\n  \"ksp_type\": \"" << ksp_type << "\",\n  \"pc_type\": \"" << pc_type
+        << "\",\n";
+    std::snprintf(buffer,
+                  300,
+                  "  \"poly_order\": %u,\n  \"cycle\": %u,\n  \"n_DOFs\": %lld,\n"
+                  "  \"tau\": %.6e,\n  \"iterations\": %d,\n  \"converged_reason\": %d,\n",
+                  poly_order,
+                  cycle,
+                  n_DOFs,
+                  tau,
+                  n_iterations,
+                  converged_reason);
+    out << buffer;
+    std::snprintf(buffer,
+                  300,
+                  "  \"setup_time\": %.6e,\n  \"solve_time\": %.6e,\n"
+                  "  \"rhs_norm\": %.6e,\n  \"solution_norm\": %.6e,\n"
+                  "  \"final_residual_norm\": %.6e,\n  \"error_norm\": %.6e,\n",
+                  setup_time,
+                  solve_time,
+                  rhs_norm,
+                  solution_norm,
+                  final_residual_norm,
+                  error_norm);
+    out << buffer;
+    std::snprintf(buffer,
+                  300,
+                  "  \"mg_levels\": %d,\n  \"operator_complexity\": %.6e,\n"
+                  "  \"grid_complexity\": %.6e,\n  \"sigma_max\": %.6e,\n"
+                  "  \"sigma_min\": %.6e,\n  \"condition_estimate\": %.6e,\n",
+                  n_levels,
+                  operator_complexity,
+                  grid_complexity,
+                  sigma_max,
+                  sigma_min,
+                  condition_estimate());
+    out << buffer;
+    out << "  \"residual_history\": [";
+    for (unsigned i_res = 0; i_res < residual_history.size(); ++i_res)
+    {
+      std::snprintf(buffer, 300, "%s%.6e", (i_res == 0) ? "" : ", ", residual_history[i_res]);
+      out << buffer;
+    }
+    out << "]\n}\n";
+  }
+
+  static void Write_CSV_Header(std::ostream &out)
+  {
+    out << "poly_order,cycle,n_DOFs,tau,ksp_type,pc_type,iterations,converged_reason,"
+           "setup_time,solve_time,rhs_norm,solution_norm,final_residual_norm,"
+           "error_norm,mg_levels,operator_complexity,grid_complexity,sigma_max,"
+           "sigma_min,condition_estimate,mean_reduction_per_iteration\n";
+  }
+
+  /*!
+   * \details Writes the record as one CSV row; the residual history is
+   * summarized by the mean reduction factor of one iteration.
+   */
+  void Write_CSV_Row(std::ostream &out) const
+  {
+    double mean_reduction = 0;
+    if (residual_history.size() > 1 && residual_history.front() > 0)
+      mean_reduction = std::pow(residual_history.back() / residual_history.front(),
+                                1.0 / (residual_history.size() - 1));
+    char buffer[500];
+    std::snprintf(buffer,
+                  500,
+                  "%u,%u,%lld,%.6e,%s,%s,%d,%d,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e,%d,%.6e,"
+                  "%.6e,%.6e,%.6e,%.6e,%.6e\n",
+                  poly_order,
+                  cycle,
+                  n_DOFs,
+                  tau,
+                  ksp_type.c_str(),
+                  pc_type.c_str(),
+                  n_iterations,
+                  converged_reason,
+                  setup_time,
+                  solve_time,
+                  rhs_norm,
+                  solution_norm,
+                  final_residual_norm,
+                  error_norm,
+                  n_levels,
+                  operator_complexity,
+                  grid_complexity,
+                  sigma_max,
+                  sigma_min,
+                  condition_estimate(),
+                  mean_reduction);
+    out << buffer;
+  }
+
+  unsigned poly_order;
+  unsigned cycle;
+  long long n_DOFs;
+  double tau;
+  std::string ksp_type;
+  std::string pc_type;
+  int n_iterations;
+  int converged_reason;
+  double setup_time;
+  double solve_time;
+  double rhs_norm;
+  double solution_norm;
+  double final_residual_norm;
+  /* The norm of the difference from the interpolated exact trace. */
+  double error_norm;
+  /* The levels and the complexities of the multigrid hierarchy; zero if the
+   * preconditioner is not a multigrid. */
+  int n_levels;
+  double operator_complexity;
+  double grid_complexity;
+  /* The extreme singular values of the preconditioned operator, estimated by
+   * the Krylov method; zero if they are not computed. */
+  double sigma_max;
+  double sigma_min;
+  std::vector<double> residual_history;
+};
+
+/*!
+ * \ingroup solver_telemetry
+ * \brief The relative tolerance of the Krylov solve of each cycle, chosen
+ * from the discretization error. The relative error of the trace in the
+ * last cycle is scaled to the number of DOFs of this cycle by the rate
+ * \f$N^{-(p+1)/d}\f$ of the error of a smooth solution. This is a heuristic
+ * on the residual: the relative error of the solve can be up to
+ * \f$\kappa(PA)\f$ times its relative residual, so the tolerance is a
+ * fraction of the prediction divided by the condition estimate of the
+ * preconditioned operator in the last cycle (the extreme singular values of
+ * the Lanczos process of CG). The condition grows with the refinement, so
+ * the estimate of the last cycle is slightly optimistic. The first cycle
+ * uses min_rtol, which is also the tolerance without this option.
+ */
+struct Adaptive_Tolerance
+{
+  Adaptive_Tolerance()
+    : enabled(false),
+      fraction(0.1),
+      min_rtol(1E-8),
+      max_rtol(1E-2),
+      last_error(0),
+      last_n_DOFs(0),
+      predicted_error(0),
+      last_condition(1),
+      n_iterations_saved(0)
+  {
+  }
+
+  double rtol(const double &n_DOFs, const unsigned &p, const unsigned &dim)
+  {
+    predicted_error = 0;
+    if (!enabled || last_n_DOFs <= 0 || last_error <= 0)
+      return min_rtol;
+    predicted_error = last_error * std::pow(last_n_DOFs / n_DOFs, (p + 1.0) / dim);
+    return std::max(min_rtol,
+                    std::min(max_rtol, fraction * predicted_error / last_condition));
+  }
+
+  /*!
+   * \details The iterations that min_rtol would need, if the residual kept
+   * the mean rate of the \c n_iterations which reduced it by \c rtol.
+   */
+  unsigned iterations_at_min_rtol(const double &rtol, const unsigned &n_iterations) const
+  {
+    if (rtol <= min_rtol || rtol >= 1 || n_iterations == 0)
+      return n_iterations;
+    return std::ceil(n_iterations * std::log(min_rtol) / std::log(rtol));
+  }
+
+  /*!
+   * \details A \c condition below one means that it was not estimated in
+   * this cycle, and the last estimate is kept.
+   */
+  void finish_cycle(const double &error, const double &n_DOFs, const double &condition)
+  {
+    last_error = error;
+    last_n_DOFs = n_DOFs;
+    if (condition >= 1)
+      last_condition = condition;
+  }
+
+  bool enabled;
+  double fraction;
+  double min_rtol, max_rtol;
+  /* The relative error of the trace, and the number of DOFs, of the last
+   * cycle. */
+  double last_error;
+  double last_n_DOFs;
+  double predicted_error;
+  /* The estimate of kappa(PA) of the last cycle, which scales rtol. */
+  double last_condition;
+  unsigned long n_iterations_saved;
+};
+
+#endif
@@ -1,9 +1,12 @@
 #include <type_traits>
+#include <limits>
 #include <deal.II/base/point.h>
 #include <deal.II/base/function.h>
 #include <Eigen/Dense>
+#include <petscsys.h>
 
 #include "poly_basis.hpp"
+#include "numa_tools.hpp"
 
 #ifndef SUPPORT_CLASSES
 #define SUPPORT_CLASSES
@@ -11,6 +14,15 @@
 
 const std::string currentDateTime();
 
+/*!
+ * \brief The type of the global numbers of faces and trace DOFs, which are
+ * passed to PETSc. It is 64 bits when PETSc is configured with
+ * --with-64-bit-indices, so the number of trace DOFs in all ranks can pass
+ * 2^31. The numbers in one rank stay unsigned (or int, where -1 or -2 mark
+ * the faces which are not numbered).
+ */
+typedef PetscInt Global_Index;
+
 /*!
  * \defgroup Functions
  * \brief
@@ -46,6 +58,12 @@ struct Function
   Function();
   virtual ~Function();
   virtual T value(const dealii::Point<dim> &x, const dealii::Point<dim> &n) const = 0;
+  /*!
+   * \details The polynomial degree of the function in \c x, which is used to
+   * choose the quadrature rule. A negative value means that the function is
+   * not a polynomial.
+   */
+  virtual int polynomial_degree() const;
 };
 
 /*!
@@ -74,11 +92,17 @@ struct Cell_Class
    * We define this type to access the deal.II cell class easily.
    */
   typedef dealii::TriaActiveIterator<dealii::CellAccessor<dim, spacedim>> dealii_Cell_Type;
+  /*!
+   * \details
+   * The vector of the owned and ghost cells. Its allocator lets the threads
+   * place the cells on their NUMA nodes; see Distribute_Cells_To_Threads.
+   */
+  typedef std::vector<Cell_Class, First_Touch_Allocator<Cell_Class>> vector_type;
   /*!
    * \details
    * This typedef is also for easy access to vector iterator type.
    */
-  typedef typename std::vector<Cell_Class>::iterator vec_iterator_type;
+  typedef typename vector_type::iterator vec_iterator_type;
   /*!
    * \details
    * We remove the default constructor to avoid uninitialized creation of Cell
@@ -150,6 +174,33 @@ struct Cell_Class
    * \c i_face\f$\in\{1,2,3,4\}\f$
    */
   void reinit_Face_FEValues(unsigned i_face);
+  /*!
+   * \details Reallocates the containers of the cell from the calling thread.
+   * On a NUMA machine, the memory pages are placed on the node of the thread
+   * which touches them first. So, if each thread calls this function for
+   * the cells that it is going to work on, the data of these cells will be
+   * close to that thread.
+   */
+  void relocate_containers();
+  /*!
+   * \details The number of trace DOFs on the face \c i_face, according to
+   * Cell_Class::face_poly_order.
+   */
+  unsigned n_face_DOFs(const unsigned &i_face) const;
+  /*!
+   * \details The position of the first DOF of face \c i_face in the vector of
+   * all trace DOFs of the cell. The faces are stored one after another.
+   */
+  unsigned face_DOF_start(const unsigned &i_face) const;
+  /*!
+   * \details The total number of trace DOFs on the faces of the cell.
+   */
+  unsigned n_trace_DOFs() const;
+  /*!
+   * \details The bytes which are held by this cell, including the local
+   * matrices if they are stored.
+   */
+  double memory_bytes() const;
 
   template <typename T>
   void assign_matrices(T &&A_, T &&B_, T &&C_, T &&D_, T &&E_, T &&H_, T &&H2_, T &&M_);
@@ -160,12 +211,29 @@ struct Cell_Class
 
   const unsigned n_faces;
   unsigned id_num;
+  /*!
+   * \details The number of Gauss points in each direction, which is used to
+   * integrate the matrices of this cell.
+   */
+  unsigned quad_order;
+  /*!
+   * \details The polynomial order of the element basis in this cell, and the
+   * order of the trace basis on each of its faces.
+   */
+  unsigned poly_order;
+  std::vector<unsigned> face_poly_order;
   std::string cell_id;
   std::vector<unsigned> half_range_flag;
   std::vector<unsigned> face_owner_rank;
   dealii_Cell_Type dealii_Cell;
   std::vector<int> Face_ID_in_this_rank;
-  std::vector<int> Face_ID_in_all_ranks;
+  std::vector<Global_Index> Face_ID_in_all_ranks;
+  /*!
+   * \details The global number of the first trace DOF of each face. The DOFs
+   * of each face are numbered contiguously, but since the faces can have
+   * different orders, this is not a multiple of the face number.
+   */
+  std::vector<Global_Index> Face_DOF_in_all_ranks;
   std::vector<BC> BCs;
   std::unique_ptr<dealii::FEValues<dim>> cell_quad_fe_vals, cell_supp_fe_vals;
   std::unique_ptr<dealii::FEFaceValues<dim>> face_quad_fe_vals, face_supp_fe_vals;
@@ -10,15 +10,25 @@ Function<dim, T, spacedim>::~Function()
 {
 }
 
+template <int dim, typename T, int spacedim>
+int Function<dim, T, spacedim>::polynomial_degree() const
+{
+  return -1;
+}
+
 template <int dim, int spacedim>
 Cell_Class<dim, spacedim>::Cell_Class(const dealii_Cell_Type &inp_cell, unsigned id_num_)
   : n_faces(dealii::GeometryInfo<dim>::faces_per_cell),
     id_num(id_num_),
+    quad_order(0),
+    poly_order(0),
+    face_poly_order(n_faces, 0),
     half_range_flag(n_faces, 0),
     face_owner_rank(n_faces, -1),
     dealii_Cell(inp_cell),
     Face_ID_in_this_rank(n_faces, -2),
     Face_ID_in_all_ranks(n_faces, -2),
+    Face_DOF_in_all_ranks(n_faces, -2),
     BCs(n_faces)
 {
   //  cell_quad_fe_vals = nullptr;
@@ -33,12 +43,16 @@ Cell_Class<dim, spacedim>::Cell_Class(Cell_Class &&inp_cell) noexcept
  : matrices_calculated(false),
    n_faces(inp_cell.n_faces),
    id_num(inp_cell.id_num),
+   quad_order(inp_cell.quad_order),
+   poly_order(inp_cell.poly_order),
+   face_poly_order(inp_cell.face_poly_order),
    cell_id(inp_cell.cell_id),
    half_range_flag(inp_cell.half_range_flag),
    face_owner_rank(inp_cell.face_owner_rank),
    dealii_Cell(std::move(inp_cell.dealii_Cell)),
    Face_ID_in_this_rank(inp_cell.Face_ID_in_this_rank),
    Face_ID_in_all_ranks(inp_cell.Face_ID_in_all_ranks),
+   Face_DOF_in_all_ranks(inp_cell.Face_DOF_in_all_ranks),
    BCs(inp_cell.BCs)
 {
 }
@@ -90,6 +104,54 @@ void Cell_Class<dim, spacedim>::reinit_Face_FEValues(unsigned i_face)
   face_supp_fe_vals->reinit(dealii_Cell, i_face);
 }
 
+template <int dim, int spacedim>
+void Cell_Class<dim, spacedim>::relocate_containers()
+{
+  half_range_flag = std::vector<unsigned>(half_range_flag);
+  face_owner_rank = std::vector<unsigned>(face_owner_rank);
+  Face_ID_in_this_rank = std::vector<int>(Face_ID_in_this_rank);
+  Face_ID_in_all_ranks = std::vector<Global_Index>(Face_ID_in_all_ranks);
+  Face_DOF_in_all_ranks = std::vector<Global_Index>(Face_DOF_in_all_ranks);
+  face_poly_order = std::vector<unsigned>(face_poly_order);
+  BCs = std::vector<BC>(BCs);
+  cell_id = std::string(cell_id.begin(), cell_id.end());
+}
+
+template <int dim, int spacedim>
+unsigned Cell_Class<dim, spacedim>::n_face_DOFs(const unsigned &i_face) const
+{
+  return pow(face_poly_order[i_face] + 1, dim - 1);
+}
+
+template <int dim, int spacedim>
+unsigned Cell_Class<dim, spacedim>::face_DOF_start(const unsigned &i_face) const
+{
+  unsigned start = 0;
+  for (unsigned j_face = 0; j_face < i_face; ++j_face)
+    start += n_face_DOFs(j_face);
+  return start;
+}
+
+template <int dim, int spacedim>
+unsigned Cell_Class<dim, spacedim>::n_trace_DOFs() const
+{
+  return face_DOF_start(n_faces);
+}
+
+template <int dim, int spacedim>
+double Cell_Class<dim, spacedim>::memory_bytes() const
+{
+  double bytes = sizeof(Cell_Class);
+  bytes += (A.size() + B.size() + C.size() + D.size() + E.size() + H.size() + H2.size() +
+            M.size()) *
+           sizeof(double);
+  bytes += Vector_Bytes(face_poly_order) + Vector_Bytes(half_range_flag) +
+           Vector_Bytes(face_owner_rank) + Vector_Bytes(Face_ID_in_this_rank) +
+           Vector_Bytes(Face_ID_in_all_ranks) + Vector_Bytes(Face_DOF_in_all_ranks) +
+           Vector_Bytes(BCs) + cell_id.capacity();
+  return bytes;
+}
+
 template <int dim, int spacedim>
 template <typename T>
 void Cell_Class<dim, spacedim>::assign_matrices(
@@ -0,0 +1,279 @@
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#ifdef DEAL_II_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#ifndef VTK_LAGRANGE_HPP
+#define VTK_LAGRANGE_HPP
+
+/*!
+ * \defgroup vtk_lagrange High order VTK output
+ * \brief
+ * A writer of VTK unstructured grids with the Lagrange cells of VTK (the
+ * types 70 and 72), where every cell is written once, with the values at
+ * its own (p+1)^dim equidistant nodes. So, the size of the file grows like
+ * the number of unknowns, instead of the number of subdivided patches, and
+ * the cells of different orders can be in the same file. The arrays are
+ * written as raw binary appended data, compressed by zlib when deal.II has
+ * it (DEAL_II_WITH_ZLIB).
+ */
+
+/*!
+ * \ingroup vtk_lagrange
+ * \brief The position of the node (i,j,k) of a Lagrange cell of the given
+ * order in the VTK ordering: vertices, edges, faces, interior. This follows
+ * PointIndexFromIJK of vtkHigherOrderQuadrilateral and
+ * vtkHigherOrderHexahedron (VTK 9.1, file version 2.2).
+ */
+inline unsigned VTK_Lagrange_Index(const unsigned &dim,
+                                   const unsigned &i,
+                                   const unsigned &j,
+                                   const unsigned &k,
+                                   const unsigned &p)
+{
+  bool ibdy = (i == 0 || i == p);
+  bool jbdy = (j == 0 || j == p);
+  bool kbdy = (dim == 2 || k == 0 || k == p);
+  unsigned n_bdy = ibdy + jbdy + kbdy;
+  const unsigned q = p - 1;
+  if (dim == 2)
+  {
+    if (n_bdy == 3)
+      return i ? (j ? 2 : 1) : (j ? 3 : 0);
+    if (n_bdy == 2)
+    {
+      if (!ibdy)
+        return (i - 1) + (j ? 2 * q : 0) + 4;
+      return (j - 1) + (i ? q : 3 * q) + 4;
+    }
+    return 4 + 4 * q + (i - 1) + q * (j - 1);
+  }
+
+  if (n_bdy == 3)
+    return (i ? (j ? 2 : 1) : (j ? 3 : 0)) + (k ? 4 : 0);
+  unsigned offset = 8;
+  if (n_bdy == 2)
+  {
+    if (!ibdy)
+      return (i - 1) + (j ? 2 * q : 0) + (k ? 4 * q : 0) + offset;
+    if (!jbdy)
+      return (j - 1) + (i ? q : 3 * q) + (k ? 4 * q : 0) + offset;
+    offset += 8 * q;
+    return (k - 1) + q * (i ? (j ? 3 : 1) : (j ? 2 : 0)) + offset;
+  }
+  offset += 12 * q;
+  if (n_bdy == 1)
+  {
+    if (ibdy)
+      return (j - 1) + q * (k - 1) + (i ? q * q : 0) + offset;
+    offset += 2 * q * q;
+    if (jbdy)
+      return (i - 1) + q * (k - 1) + (j ? q * q : 0) + offset;
+    offset += 2 * q * q;
+    return (i - 1) + q * (j - 1) + (k ? q * q : 0) + offset;
+  }
+  offset += 6 * q * q;
+  return offset + (i - 1) + q * ((j - 1) + q * (k - 1));
+}
+
+/*!
+ * \ingroup vtk_lagrange
+ * \brief For each node of a cell of order p, in the lexicographic order (x
+ * runs fastest), its position in the VTK ordering.
+ */
+inline std::vector<unsigned> VTK_Lagrange_Order(const unsigned &dim, const unsigned &p)
+{
+  unsigned n_k = (dim == 3) ? p + 1 : 1;
+  std::vector<unsigned> vtk_index_of_node;
+  for (unsigned k = 0; k < n_k; ++k)
+    for (unsigned j = 0; j <= p; ++j)
+      for (unsigned i = 0; i <= p; ++i)
+        vtk_index_of_node.push_back(VTK_Lagrange_Index(dim, i, j, k, p));
+  return vtk_index_of_node;
+}
+
+/*!
+ * \ingroup vtk_lagrange
+ * \brief Collects the cells of one rank and writes them to one .vtu file.
+ * The cells are added with add_cell, and then the point data are filled in
+ * the same order; all of the nodes of a cell are its own, since the fields
+ * are discontinuous.
+ */
+struct VTK_Lagrange_Writer
+{
+  VTK_Lagrange_Writer(const unsigned &dim_, const bool &compress_)
+    : dim(dim_), compress(compress_)
+  {
+#ifndef DEAL_II_WITH_ZLIB
+    compress = false;
+#endif
+  }
+
+  /*!
+   * \details Adds a cell with \c n_nodes nodes, whose coordinates (3 for
+   * each node, in the VTK order) are in \c node_coords.
+   */
+  void add_cell(const std::vector<double> &node_coords)
+  {
+    points.insert(points.end(), node_coords.begin(), node_coords.end());
+    offsets.push_back(points.size() / 3);
+    types.push_back(dim == 2 ? 70 : 72);
+  }
+
+  /*!
+   * \details Adds a point (\c on_points) or cell data array with
+   * \c n_components components, and returns its index in point_data or
+   * cell_data.
+   */
+  unsigned add_array(const std::string &name, const unsigned &n_components, const bool &on_points)
+  {
+    std::vector<Data_Array> &arrays = on_points ? point_data : cell_data;
+    arrays.push_back(Data_Array());
+    arrays.back().name = name;
+    arrays.back().n_components = n_components;
+    return arrays.size() - 1;
+  }
+
+  /*!
+   * \details Writes the file; returns the number of bytes in the appended
+   * section.
+   */
+  uint64_t write(const std::string &file_name) const
+  {
+    std::string appended;
+    std::ostringstream header;
+    uint64_t n_points = points.size() / 3, n_cells = offsets.size();
+    header << "<?xml version=\"1.0\"?>\n<VTKFile type=\"UnstructuredGrid\" version=\"2.2\" "
+              "byte_order=\"LittleEndian\" header_type=\"UInt64\"";
+    if (compress)
+      header << " compressor=\"vtkZLibDataCompressor\"";
+    header << ">\n<UnstructuredGrid>\n<Piece NumberOfPoints=\"" << n_points
+           << "\" NumberOfCells=\"" << n_cells << "\">\n";
+
+    header << "<PointData>\n";
+    for (const Data_Array &the_array : point_data)
+      header << Append_Array(appended, the_array.name, "Float64", the_array.n_components,
+                             the_array.values.data(), the_array.values.size() * sizeof(double));
+    header << "</PointData>\n<CellData>\n";
+    for (const Data_Array &the_array : cell_data)
+      header << Append_Array(appended, the_array.name, "Float64", the_array.n_components,
+                             the_array.values.data(), the_array.values.size() * sizeof(double));
+    header << "</CellData>\n<Points>\n";
+    header << Append_Array(appended, "Points", "Float64", 3, points.data(),
+                           points.size() * sizeof(double));
+    header << "</Points>\n<Cells>\n";
+    std::vector<int64_t> connectivity(n_points);
+    for (uint64_t i_point = 0; i_point < n_points; ++i_point)
+      connectivity[i_point] = i_point;
+    header << Append_Array(appended, "connectivity", "Int64", 1, connectivity.data(),
+                           connectivity.size() * sizeof(int64_t));
+    header << Append_Array(appended, "offsets", "Int64", 1, offsets.data(),
+                           offsets.size() * sizeof(int64_t));
+    header << Append_Array(appended, "types", "UInt8", 1, types.data(), types.size());
+    header << "</Cells>\n</Piece>\n</UnstructuredGrid>\n<AppendedData encoding=\"raw\">\n_";
+
+    std::ofstream vtu_file(file_name, std::ofstream::binary);
+    vtu_file << header.str();
+    vtu_file.write(appended.data(), appended.size());
+    vtu_file << "\n</AppendedData>\n</VTKFile>\n";
+    return appended.size();
+  }
+
+  /*!
+   * \details Writes the .pvtu file, which collects the pieces of all ranks.
+   */
+  void Write_PVTU(const std::string &file_name, const std::vector<std::string> &piece_names) const
+  {
+    std::ofstream pvtu_file(file_name);
+    pvtu_file << "<?xml version=\"1.0\"?>\n<VTKFile type=\"PUnstructuredGrid\" version=\"2.2\" "
+                 "byte_order=\"LittleEndian\" header_type=\"UInt64\">\n"
+                 "<PUnstructuredGrid GhostLevel=\"0\">\n<PPointData>\n";
+    for (const Data_Array &the_array : point_data)
+      pvtu_file << "<PDataArray type=\"Float64\" Name=\"" << the_array.name
+                << "\" NumberOfComponents=\"" << the_array.n_components << "\"/>\n";
+    pvtu_file << "</PPointData>\n<PCellData>\n";
+    for (const Data_Array &the_array : cell_data)
+      pvtu_file << "<PDataArray type=\"Float64\" Name=\"" << the_array.name
+                << "\" NumberOfComponents=\"" << the_array.n_components << "\"/>\n";
+    pvtu_file << "</PCellData>\n<PPoints>\n<PDataArray type=\"Float64\" "
+                 "NumberOfComponents=\"3\"/>\n</PPoints>\n";
+    for (const std::string &piece_name : piece_names)
+      pvtu_file << "<Piece Source=\"" << piece_name << "\"/>\n";
+    pvtu_file << "</PUnstructuredGrid>\n</VTKFile>\n";
+  }
+
+  struct Data_Array
+  {
+    std::string name;
+    unsigned n_components;
+    std::vector<double> values;
+  };
+
+  unsigned dim;
+  bool compress;
+  std::vector<double> points;
+  std::vector<int64_t> offsets;
+  std::vector<uint8_t> types;
+  std::vector<Data_Array> point_data;
+  std::vector<Data_Array> cell_data;
+
+ private:
+  /*!
+   * \details Appends the data of one array to \c appended, with the header
+   * of the VTK format (the size, or the block table of the compressed data),
+   * and returns its DataArray tag.
+   */
+  std::string Append_Array(std::string &appended,
+                           const std::string &name,
+                           const std::string &type,
+                           const unsigned &n_components,
+                           const void *data,
+                           const uint64_t &n_bytes) const
+  {
+    std::ostringstream tag;
+    tag << "<DataArray type=\"" << type << "\" Name=\"" << name << "\" NumberOfComponents=\""
+        << n_components << "\" format=\"appended\" offset=\"" << appended.size() << "\"/>\n";
+    const char *bytes = (const char *)data;
+    if (!compress)
+    {
+      appended.append((const char *)&n_bytes, sizeof(uint64_t));
+      appended.append(bytes, n_bytes);
+      return tag.str();
+    }
+#ifdef DEAL_II_WITH_ZLIB
+    /* The data are split in blocks; the header is the number of blocks, the
+     * size of a block, the size of the last block, and the compressed size
+     * of each block. */
+    const uint64_t block_size = 1 << 20;
+    uint64_t n_blocks = (n_bytes + block_size - 1) / block_size;
+    std::vector<uint64_t> block_header(3 + n_blocks);
+    block_header[0] = n_blocks;
+    block_header[1] = block_size;
+    block_header[2] = (n_bytes % block_size == 0) ? block_size : n_bytes % block_size;
+    std::string compressed_blocks;
+    for (uint64_t i_block = 0; i_block < n_blocks; ++i_block)
+    {
+      uint64_t this_block_size = (i_block == n_blocks - 1) ? block_header[2] : block_size;
+      uLongf compressed_size = compressBound(this_block_size);
+      std::vector<Bytef> compressed(compressed_size);
+      compress2(compressed.data(),
+                &compressed_size,
+                (const Bytef *)bytes + i_block * block_size,
+                this_block_size,
+                Z_BEST_SPEED);
+      block_header[3 + i_block] = compressed_size;
+      compressed_blocks.append((const char *)compressed.data(), compressed_size);
+    }
+    appended.append((const char *)block_header.data(), block_header.size() * sizeof(uint64_t));
+    appended.append(compressed_blocks);
+#endif
+    return tag.str();
+  }
+};
+
+#endif